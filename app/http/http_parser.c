@@ -0,0 +1,434 @@
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "c_stdio.h"
+#include "http_parser.h"
+
+void http_request_init(http_request *r)
+{
+  c_memset(r, 0, sizeof(http_request));
+}
+
+void http_request_free(http_request *r)
+{
+  if(r->head)
+    c_free(r->head);
+  if(r->body)
+    c_free(r->body);
+  http_request_init(r);
+}
+
+// room for one more byte and the terminating 0 in a head buffer, it grows
+// by doubling up to max. 0 if there is, -1 if it is full, -2 out of memory.
+static int head_room(char **head, uint16_t *size, uint16_t len, uint16_t max)
+{
+  uint16_t n;
+  char *p;
+
+  if(len + 1 < *size)
+    return 0;
+  n = *size ? *size * 2 : HTTP_HEAD_MIN;
+  if(n > max)
+    n = max;
+  if(len + 1 >= n)
+    return -1;
+  p = (char *)c_malloc(n);
+  if(p == NULL)
+    return -2;
+  if(*head){
+    c_memcpy(p, *head, len);
+    c_free(*head);
+  }
+  *head = p;
+  *size = n;
+  return 0;
+}
+
+// "name: value" in place, the name in lower case. false if there is no name.
+static bool split_header(char *s, char **pvalue)
+{
+  char *value, *end;
+
+  value = c_strchr(s, ':');
+  if(value == NULL || value == s)
+    return false;
+  *value++ = 0;
+  while(*value == ' ' || *value == '\t')
+    value++;
+  end = value + c_strlen(value);
+  while(end > value && (end[-1] == ' ' || end[-1] == '\t'))
+    *--end = 0;
+  for(end = s; *end; end++){
+    if(*end >= 'A' && *end <= 'Z')
+      *end += 'a' - 'A';
+  }
+  *pvalue = value;
+  return true;
+}
+
+static const char *find_header(const char *head, const uint16_t header[][2], int n, const char *name)
+{
+  int i;
+  for(i = 0; i < n; i++){
+    if(c_strcmp(head + header[i][0], name) == 0)
+      return head + header[i][1];
+  }
+  return NULL;
+}
+
+static void http_request_fail(http_request *r, uint16_t status)
+{
+  r->state = HTTP_ERROR;
+  r->error = status;
+  r->keep_alive = 0;
+}
+
+static int hexval(char c)
+{
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// %xx escapes, in place, the string only gets shorter
+static void url_decode(char *s)
+{
+  char *d = s;
+  while(*s){
+    if(s[0] == '%' && hexval(s[1]) >= 0 && hexval(s[2]) >= 0){
+      *d++ = (char)(hexval(s[1]) << 4 | hexval(s[2]));
+      s += 3;
+    } else {
+      *d++ = *s++;
+    }
+  }
+  *d = 0;
+}
+
+// does the comma separated list hold the token, case insensitive
+bool http_has_token(const char *list, const char *token)
+{
+  size_t n = c_strlen(token);
+  while(*list){
+    size_t i;
+    while(*list == ' ' || *list == ',')
+      list++;
+    for(i = 0; i < n && list[i]; i++){
+      char c = list[i];
+      if(c >= 'A' && c <= 'Z')
+        c += 'a' - 'A';
+      if(c != token[i])
+        break;
+    }
+    if(i == n && (list[i] == 0 || list[i] == ',' || list[i] == ' ' || list[i] == ';'))
+      return true;
+    while(*list && *list != ',')
+      list++;
+  }
+  return false;
+}
+
+// METHOD SP target SP HTTP/1.x
+static void http_request_line(http_request *r, char *s)
+{
+  char *target, *version, *q;
+
+  target = c_strchr(s, ' ');
+  if(target == NULL){
+    http_request_fail(r, 400);
+    return;
+  }
+  *target++ = 0;
+  version = c_strchr(target, ' ');
+  if(version == NULL){
+    http_request_fail(r, 400);
+    return;
+  }
+  *version++ = 0;
+  if(c_strncmp(version, "HTTP/1.", 7) != 0 || *target != '/'){
+    http_request_fail(r, 400);
+    return;
+  }
+  // 1.1 keeps the connection unless told otherwise
+  r->keep_alive = version[7] == '1';
+  q = c_strchr(target, '?');
+  if(q){
+    *q++ = 0;
+  } else {
+    q = target + c_strlen(target);  // the empty string at its end
+  }
+  url_decode(target);
+  r->method = s - r->head;
+  r->path = target - r->head;
+  r->query = q - r->head;
+  r->state = HTTP_HEADERS;
+}
+
+// name: value, or the empty line that ends the headers
+static void http_request_header_line(http_request *r, char *s)
+{
+  const char *v;
+  char *value;
+
+  if(*s == 0){
+    if(http_request_header(r, "transfer-encoding")){
+      http_request_fail(r, 501);
+      return;
+    }
+    v = http_request_header(r, "connection");
+    if(v && http_has_token(v, "close"))
+      r->keep_alive = 0;
+    else if(v && http_has_token(v, "keep-alive"))
+      r->keep_alive = 1;
+    v = http_request_header(r, "accept-encoding");
+    r->gzip = v && http_has_token(v, "gzip");
+    v = http_request_header(r, "content-length");
+    r->content_length = v ? c_strtol(v, NULL, 10) : 0;
+    if(r->content_length > HTTP_BODY_MAX){
+      http_request_fail(r, 413);
+      return;
+    }
+    if(r->content_length == 0){
+      r->state = HTTP_DONE;
+      return;
+    }
+    r->body = (char *)c_malloc(r->content_length + 1);
+    if(r->body == NULL){
+      http_request_fail(r, 503);
+      return;
+    }
+    r->body[r->content_length] = 0;
+    r->state = HTTP_BODY;
+    return;
+  }
+  if(!split_header(s, &value)){
+    http_request_fail(r, 400);
+    return;
+  }
+  if(r->nheaders == HTTP_MAX_HEADERS)
+    return;   // keep the first ones
+  r->header[r->nheaders][0] = s - r->head;
+  r->header[r->nheaders][1] = value - r->head;
+  r->nheaders++;
+}
+
+int http_request_parse(http_request *r, const char *data, int len)
+{
+  int i = 0;
+
+  while(i < len && r->state < HTTP_DONE){
+    if(r->state == HTTP_BODY){
+      uint32_t n = r->content_length - r->body_len;
+      if(n > (uint32_t)(len - i))
+        n = len - i;
+      c_memcpy(r->body + r->body_len, data + i, n);
+      r->body_len += n;
+      i += n;
+      if(r->body_len == r->content_length)
+        r->state = HTTP_DONE;
+      continue;
+    }
+    char c = data[i++];
+    // the buffer grows, the offsets stay valid
+    int room = head_room(&r->head, &r->size, r->len, HTTP_HEAD_MAX);
+    if(room < 0){
+      http_request_fail(r, room == -2 ? 503 : r->state == HTTP_REQ_LINE ? 414 : 431);
+      break;
+    }
+    if(c != '\n'){
+      r->head[r->len++] = c;
+      continue;
+    }
+    // a line is complete, terminate it in place of the \r
+    if(r->len > r->line && r->head[r->len - 1] == '\r')
+      r->len--;
+    r->head[r->len++] = 0;
+    char *s = r->head + r->line;
+    r->line = r->len;
+    if(r->state == HTTP_REQ_LINE){
+      if(*s == 0){
+        r->len = r->line = 0;   // empty lines before the request are allowed
+        continue;
+      }
+      http_request_line(r, s);
+    } else {
+      http_request_header_line(r, s);
+    }
+  }
+  return i;
+}
+
+const char *http_request_header(const http_request *r, const char *name)
+{
+  return find_header(r->head, r->header, r->nheaders, name);
+}
+
+void http_response_init(http_response *r)
+{
+  c_memset(r, 0, sizeof(http_response));
+}
+
+void http_response_free(http_response *r)
+{
+  if(r->head)
+    c_free(r->head);
+  http_response_init(r);
+}
+
+static void http_response_fail(http_response *r)
+{
+  r->state = HTTP_ERROR;
+  r->keep_alive = 0;
+}
+
+// HTTP/1.x SP status SP reason
+static void http_status_line(http_response *r, char *s)
+{
+  if(c_strncmp(s, "HTTP/1.", 7) != 0 || s[8] != ' '){
+    http_response_fail(r);
+    return;
+  }
+  r->keep_alive = s[7] == '1';
+  r->status = c_strtol(s + 9, NULL, 10);
+  if(r->status < 100 || r->status > 999){
+    http_response_fail(r);
+    return;
+  }
+  r->state = HTTP_HEADERS;
+}
+
+// the empty line after the headers, how is the body framed
+static void http_response_head_done(http_response *r)
+{
+  const char *v;
+
+  v = http_response_header(r, "connection");
+  if(v && http_has_token(v, "close"))
+    r->keep_alive = 0;
+  else if(v && http_has_token(v, "keep-alive"))
+    r->keep_alive = 1;
+  if(r->no_body || r->status == 204 || r->status == 304){
+    r->state = HTTP_DONE;
+    return;
+  }
+  v = http_response_header(r, "transfer-encoding");
+  if(v && http_has_token(v, "chunked")){
+    r->chunk_len = 0;
+    r->state = HTTP_CHUNK_HEAD;
+    return;
+  }
+  v = http_response_header(r, "content-length");
+  if(v){
+    r->left = c_strtol(v, NULL, 10);
+    r->state = r->left ? HTTP_BODY : HTTP_DONE;
+    return;
+  }
+  // until the server closes
+  r->left = (uint32_t)-1;
+  r->keep_alive = 0;
+  r->state = HTTP_BODY;
+}
+
+// a line of the chunked framing, in r->chunk
+static void http_chunk_line(http_response *r)
+{
+  r->chunk[r->chunk_len] = 0;
+  if(r->state == HTTP_CHUNK_HEAD){
+    char *end;
+    r->left = c_strtol(r->chunk, &end, 16);
+    if(end == r->chunk){
+      http_response_fail(r);
+      return;
+    }
+    r->state = r->left ? HTTP_CHUNK_DATA : HTTP_TRAILER;
+  } else if(r->state == HTTP_CHUNK_TAIL){
+    r->state = HTTP_CHUNK_HEAD;
+  } else if(r->chunk_len == 0){
+    r->state = HTTP_DONE;   // the empty line after the trailer
+  }
+  r->chunk_len = 0;
+}
+
+int http_response_parse(http_response *r, const char *data, int len, http_body_cb cb, void *arg)
+{
+  int i = 0;
+
+  while(i < len && r->state < HTTP_DONE){
+    char c;
+    if(r->state == HTTP_BODY || r->state == HTTP_CHUNK_DATA){
+      uint32_t n = r->left;
+      if(n > (uint32_t)(len - i))
+        n = len - i;
+      cb(arg, data + i, n);
+      i += n;
+      if(r->left != (uint32_t)-1)
+        r->left -= n;
+      if(r->left == 0)
+        r->state = r->state == HTTP_BODY ? HTTP_DONE : HTTP_CHUNK_TAIL;
+      continue;
+    }
+    c = data[i++];
+    if(r->state >= HTTP_CHUNK_HEAD){
+      // framing lines are short, anything beyond is an extension
+      if(c == '\n')
+        http_chunk_line(r);
+      else if(c != '\r' && r->chunk_len < sizeof(r->chunk) - 1)
+        r->chunk[r->chunk_len++] = c == ';' ? 0 : c;
+      continue;
+    }
+    if(head_room(&r->head, &r->size, r->len, HTTP_RESP_HEAD_MAX) < 0){
+      http_response_fail(r);
+      break;
+    }
+    if(c != '\n'){
+      r->head[r->len++] = c;
+      continue;
+    }
+    if(r->len > r->line && r->head[r->len - 1] == '\r')
+      r->len--;
+    r->head[r->len++] = 0;
+    char *s = r->head + r->line;
+    r->line = r->len;
+    if(r->state == HTTP_REQ_LINE){
+      http_status_line(r, s);
+    } else if(*s == 0){
+      if(r->status < 200){
+        // 100 Continue and the like, the real response follows
+        r->len = r->line = 0;
+        r->nheaders = 0;
+        r->state = HTTP_REQ_LINE;
+        continue;
+      }
+      http_response_head_done(r);
+      break;    // let the caller see the headers first
+    } else {
+      char *value;
+      if(!split_header(s, &value)){
+        http_response_fail(r);
+        break;
+      }
+      if(r->nheaders < HTTP_MAX_HEADERS){
+        r->header[r->nheaders][0] = s - r->head;
+        r->header[r->nheaders][1] = value - r->head;
+        r->nheaders++;
+      }
+    }
+  }
+  return i;
+}
+
+void http_response_eof(http_response *r)
+{
+  if(r->state == HTTP_BODY && r->left == (uint32_t)-1)
+    r->state = HTTP_DONE;
+  else if(r->state < HTTP_DONE)
+    http_response_fail(r);
+}
+
+const char *http_response_header(const http_response *r, const char *name)
+{
+  return find_header(r->head, r->header, r->nheaders, name);
+}
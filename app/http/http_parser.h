@@ -0,0 +1,98 @@
+#ifndef _HTTP_PARSER_H
+#define _HTTP_PARSER_H 1
+#include "c_types.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// request line and headers are read into a buffer that grows up to
+// HTTP_HEAD_MAX, the strings point into it. it is only held while a request
+// is being read, an idle keep-alive connection costs just the struct.
+#define HTTP_HEAD_MIN     256
+#define HTTP_HEAD_MAX     1024
+#define HTTP_RESP_HEAD_MAX 2048     // servers send cookies and the like
+#define HTTP_MAX_HEADERS  16
+#define HTTP_BODY_MAX     4096
+
+typedef enum {
+  HTTP_REQ_LINE = 0,        // request line, or the status line of a response
+  HTTP_HEADERS,
+  HTTP_BODY,
+  HTTP_CHUNK_HEAD,          // Transfer-Encoding: chunked, size line
+  HTTP_CHUNK_DATA,
+  HTTP_CHUNK_TAIL,          // CRLF after the data
+  HTTP_TRAILER,
+  HTTP_DONE,
+  HTTP_ERROR
+} http_state;
+
+typedef struct http_request {
+  uint8_t state;
+  uint8_t keep_alive;
+  uint8_t gzip;             // client takes Content-Encoding: gzip
+  uint8_t nheaders;
+  uint16_t error;           // status to answer with in HTTP_ERROR
+  uint16_t size;            // of head
+  uint16_t len;             // bytes used in head
+  uint16_t line;            // start of the line being read
+  uint16_t method;          // offsets of the strings in head
+  uint16_t path;            // percent-decoded, without the query
+  uint16_t query;
+  uint16_t header[HTTP_MAX_HEADERS][2];   // name, lower case, and value
+  uint32_t content_length;
+  uint32_t body_len;
+  char *head;
+  char *body;
+} http_request;
+
+#define http_request_str(r, off) ((r)->head + (off))
+
+void http_request_init(http_request *r);
+// frees the buffers, ready for the next request
+void http_request_free(http_request *r);
+// reads up to len bytes, stops after a request is complete or on error.
+// returns the number of bytes taken.
+int http_request_parse(http_request *r, const char *data, int len);
+// value of a header, name in lower case. NULL if not there.
+const char *http_request_header(const http_request *r, const char *name);
+
+typedef struct http_response {
+  uint8_t state;
+  uint8_t keep_alive;
+  uint8_t no_body;          // set for HEAD requests, before parsing
+  uint8_t nheaders;
+  uint16_t status;
+  uint16_t size;            // of head
+  uint16_t len;             // bytes used in head
+  uint16_t line;            // start of the line being read
+  uint16_t header[HTTP_MAX_HEADERS][2];   // name, lower case, and value
+  uint32_t left;            // of the body or of the chunk, -1 until close
+  uint8_t chunk_len;
+  char chunk[12];           // chunk size line, extensions are dropped
+  char *head;
+} http_response;
+
+// gets the decoded body, as it comes
+typedef void (*http_body_cb)(void *arg, const char *data, uint32_t len);
+
+#define http_response_str(r, off) ((r)->head + (off))
+
+void http_response_init(http_response *r);
+void http_response_free(http_response *r);
+// reads up to len bytes, passing the body to cb. returns the number of bytes
+// taken. it returns as soon as the headers are complete, so they can be
+// looked at before the body, and stops at the end of the response or on an
+// error.
+int http_response_parse(http_response *r, const char *data, int len, http_body_cb cb, void *arg);
+// the connection closed, ends a body that runs until close
+void http_response_eof(http_response *r);
+const char *http_response_header(const http_response *r, const char *name);
+// does the comma separated list of a header value hold the token, which is
+// in lower case
+bool http_has_token(const char *list, const char *token);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef _HOST_C_STDIO_H_
+#define _HOST_C_STDIO_H_
+#include <stdio.h>
+#endif
@@ -0,0 +1,7 @@
+#ifndef _HOST_C_STDLIB_H_
+#define _HOST_C_STDLIB_H_
+#include <stdlib.h>
+#define c_malloc malloc
+#define c_free free
+#define c_strtol strtol
+#endif
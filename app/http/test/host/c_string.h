@@ -0,0 +1,11 @@
+#ifndef _HOST_C_STRING_H_
+#define _HOST_C_STRING_H_
+#include <string.h>
+#define c_memset memset
+#define c_memcpy memcpy
+#define c_memcmp memcmp
+#define c_strchr strchr
+#define c_strlen strlen
+#define c_strcmp strcmp
+#define c_strncmp strncmp
+#endif
@@ -0,0 +1,7 @@
+// host stand-ins for the firmware headers websocket.c and http_parser.c use
+#ifndef _HOST_C_TYPES_H_
+#define _HOST_C_TYPES_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#endif
@@ -0,0 +1,10 @@
+// the ROM SHA1 of the ESP8266, from openssl on the host
+#ifndef _HOST_ROM_H_
+#define _HOST_ROM_H_
+#include <openssl/sha.h>
+#define SHA1_DIGEST_LENGTH    SHA_DIGEST_LENGTH
+#define SHA1_CTX              SHA_CTX
+#define SHA1Init(c)           SHA1_Init(c)
+#define SHA1Update(c, d, l)   SHA1_Update(c, d, l)
+#define SHA1Final(d, c)       SHA1_Final(d, c)
+#endif
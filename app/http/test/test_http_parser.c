@@ -0,0 +1,292 @@
+/*
+ * test_http_parser.c
+ *
+ * host check of the request and response parsing in ../http_parser.c
+ *
+ *   gcc -std=gnu99 -Ihost -I.. test_http_parser.c ../http_parser.c -o test_http_parser
+ *   ./test_http_parser
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "http_parser.h"
+
+static int failed;
+
+#define CHECK(c) do { if(!(c)){ printf("%s:%d: %s\n", __FILE__, __LINE__, #c); failed++; } } while(0)
+
+// feeds a request in pieces of step bytes, returns the bytes taken
+static int feed_request(http_request *r, const char *data, int len, int step)
+{
+  int i = 0;
+  while(i < len && r->state < HTTP_DONE){
+    int n = len - i < step ? len - i : step;
+    i += http_request_parse(r, data + i, n);
+  }
+  return i;
+}
+
+static char body[HTTP_BODY_MAX];
+static uint32_t body_len;
+
+static void on_body(void *arg, const char *data, uint32_t len)
+{
+  if(body_len + len <= sizeof(body))
+    memcpy(body + body_len, data, len);
+  body_len += len;
+}
+
+// the parser stops after the headers, so it is called again like the client
+// does, with what is left of each piece
+static int feed_response(http_response *r, const char *data, int len, int step)
+{
+  int i = 0;
+  while(i < len && r->state < HTTP_DONE){
+    int n = len - i < step ? len - i : step;
+    i += http_response_parse(r, data + i, n, on_body, NULL);
+  }
+  return i;
+}
+
+static void test_request(void)
+{
+  static const char req[] =
+    "\r\nPOST /a%20b/c?x=1&y=2 HTTP/1.1\r\n"
+    "Host: example\r\n"
+    "Content-Type:  text/plain \r\n"
+    "Accept-Encoding: deflate, GZIP\r\n"
+    "Content-Length: 5\r\n"
+    "\r\n"
+    "hello"
+    "GET / HTTP/1.0\r\n\r\n";
+  int len = sizeof(req) - 1, step;
+  http_request r;
+
+  // whole, and split down to a byte at a time
+  for(step = 1; step <= len; step = step < 8 ? step + 1 : step * 2){
+    http_request_init(&r);
+    CHECK(feed_request(&r, req, len, step) == len - 18);   // the next request is left
+    CHECK(r.state == HTTP_DONE);
+    CHECK(strcmp(http_request_str(&r, r.method), "POST") == 0);
+    CHECK(strcmp(http_request_str(&r, r.path), "/a b/c") == 0);
+    CHECK(strcmp(http_request_str(&r, r.query), "x=1&y=2") == 0);
+    CHECK(http_request_header(&r, "content-type") && strcmp(http_request_header(&r, "content-type"), "text/plain") == 0);
+    CHECK(http_request_header(&r, "Host") == NULL);   // names are looked up in lower case
+    CHECK(r.keep_alive && r.gzip);
+    CHECK(r.content_length == 5 && r.body_len == 5 && strcmp(r.body, "hello") == 0);
+    http_request_free(&r);
+    CHECK(r.head == NULL && r.body == NULL && r.state == HTTP_REQ_LINE);
+  }
+
+  // the next request on the same connection
+  http_request_init(&r);
+  CHECK(feed_request(&r, req + len - 18, 18, 18) == 18);
+  CHECK(r.state == HTTP_DONE && !r.keep_alive && r.body == NULL);
+  CHECK(strcmp(http_request_str(&r, r.query), "") == 0);
+  http_request_free(&r);
+
+  http_request_init(&r);
+  feed_request(&r, "GET / HTTP/1.1\r\nConnection: close\r\n\r\n", 37, 37);
+  CHECK(r.state == HTTP_DONE && !r.keep_alive);
+  http_request_free(&r);
+}
+
+// the status a bad request is answered with
+static int request_error(const char *data, int len)
+{
+  http_request r;
+  int error;
+
+  http_request_init(&r);
+  feed_request(&r, data, len, 7);
+  error = r.state == HTTP_ERROR ? r.error : 0;
+  CHECK(r.state != HTTP_ERROR || !r.keep_alive);
+  http_request_free(&r);
+  return error;
+}
+
+static void test_request_errors(void)
+{
+  static char big[HTTP_HEAD_MAX + 64];
+  int n;
+
+  CHECK(request_error("GET\r\n", 5) == 400);
+  CHECK(request_error("GET / FTP/1.0\r\n", 15) == 400);
+  CHECK(request_error("GET x HTTP/1.1\r\n", 16) == 400);
+  CHECK(request_error("GET / HTTP/1.1\r\nno colon\r\n", 26) == 400);
+  CHECK(request_error("GET / HTTP/1.1\r\n: empty name\r\n", 30) == 400);
+  CHECK(request_error("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", 47) == 501);
+  CHECK(request_error("POST / HTTP/1.1\r\nContent-Length: 5000\r\n\r\n", 41) == 413);
+
+  // a request line or headers beyond HTTP_HEAD_MAX
+  n = sprintf(big, "GET /");
+  memset(big + n, 'a', sizeof(big) - n);
+  CHECK(request_error(big, sizeof(big)) == 414);
+  n = sprintf(big, "GET / HTTP/1.1\r\nX: ");
+  memset(big + n, 'a', sizeof(big) - n);
+  CHECK(request_error(big, sizeof(big)) == 431);
+
+  // headers beyond HTTP_MAX_HEADERS are dropped, the first ones kept
+  {
+    char many[HTTP_HEAD_MAX];
+    http_request r;
+    int i;
+
+    n = sprintf(many, "GET / HTTP/1.1\r\n");
+    for(i = 0; i < HTTP_MAX_HEADERS + 4; i++)
+      n += sprintf(many + n, "h%d: %d\r\n", i, i);
+    n += sprintf(many + n, "\r\n");
+    http_request_init(&r);
+    CHECK(feed_request(&r, many, n, n) == n);
+    CHECK(r.state == HTTP_DONE && r.nheaders == HTTP_MAX_HEADERS);
+    CHECK(http_request_header(&r, "h0") && strcmp(http_request_header(&r, "h0"), "0") == 0);
+    CHECK(http_request_header(&r, "h19") == NULL);
+    http_request_free(&r);
+  }
+}
+
+static void test_response(void)
+{
+  static const char resp[] =
+    "HTTP/1.1 100 Continue\r\n\r\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 11\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "hello world";
+  static const char close[] =
+    "HTTP/1.0 404 Not Found\r\n\r\n"
+    "gone";
+  int len = sizeof(resp) - 1, step;
+  http_response r;
+
+  for(step = 1; step <= len; step = step < 8 ? step + 1 : step * 2){
+    http_response_init(&r);
+    body_len = 0;
+    CHECK(feed_response(&r, resp, len, step) == len);
+    CHECK(r.state == HTTP_DONE && r.status == 200 && r.keep_alive);
+    CHECK(http_response_header(&r, "content-length") && strcmp(http_response_header(&r, "content-length"), "11") == 0);
+    CHECK(body_len == 11 && memcmp(body, "hello world", 11) == 0);
+    http_response_free(&r);
+  }
+
+  // the headers can be looked at before any of the body
+  http_response_init(&r);
+  body_len = 0;
+  CHECK(http_response_parse(&r, resp, len, on_body, NULL) == len - 11);
+  CHECK(r.state == HTTP_BODY && body_len == 0 && r.status == 200);
+  http_response_free(&r);
+
+  // a body that runs until the server closes
+  http_response_init(&r);
+  body_len = 0;
+  CHECK(feed_response(&r, close, sizeof(close) - 1, 5) == sizeof(close) - 1);
+  CHECK(r.state == HTTP_BODY && r.status == 404 && !r.keep_alive);
+  http_response_eof(&r);
+  CHECK(r.state == HTTP_DONE && body_len == 4 && memcmp(body, "gone", 4) == 0);
+  http_response_free(&r);
+
+  // no body for HEAD
+  http_response_init(&r);
+  r.no_body = 1;
+  feed_response(&r, resp + 25, len - 25 - 11, len);
+  CHECK(r.state == HTTP_DONE);
+  http_response_free(&r);
+}
+
+static void test_chunked(void)
+{
+  static const char resp[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: gzip, Chunked\r\n"
+    "\r\n"
+    "5;name=value\r\n"
+    "hello\r\n"
+    "00000006\r\n"
+    " world\r\n"
+    "1A\r\n"
+    "abcdefghijklmnopqrstuvwxyz\r\n"
+    "0\r\n"
+    "X-Checksum: 1234567890abcdef\r\n"
+    "X-Other: 1\r\n"
+    "\r\n";
+  int len = sizeof(resp) - 1, step, n;
+  http_response r;
+
+  for(step = 1; step <= len; step = step < 8 ? step + 1 : step * 2){
+    http_response_init(&r);
+    body_len = 0;
+    CHECK(feed_response(&r, resp, len, step) == len);
+    CHECK(r.state == HTTP_DONE && r.keep_alive);
+    CHECK(body_len == 37 && memcmp(body, "hello worldabcdefghijklmnopqrstuvwxyz", 37) == 0);
+    http_response_free(&r);
+  }
+
+  // without a trailer
+  http_response_init(&r);
+  body_len = 0;
+  n = strstr(resp, "1A\r\n") - resp;
+  CHECK(feed_response(&r, resp, n, 3) == n);
+  feed_response(&r, "0\r\n\r\n", 5, 1);
+  CHECK(r.state == HTTP_DONE && body_len == 11);
+  http_response_free(&r);
+}
+
+static void test_response_errors(void)
+{
+  static char big[HTTP_RESP_HEAD_MAX + 64];
+  static const char *bad[] = {
+    "HTTP/2 200 OK\r\n",
+    "HTTP/1.1200 OK\r\n",
+    "HTTP/1.1 42 Odd\r\n",
+    "HTTP/1.1 200 OK\r\nno colon\r\n",
+    "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+  };
+  http_response r;
+  int i, n;
+
+  for(i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++){
+    http_response_init(&r);
+    feed_response(&r, bad[i], strlen(bad[i]), 4);
+    CHECK(r.state == HTTP_ERROR && !r.keep_alive);
+    http_response_free(&r);
+  }
+
+  // headers beyond HTTP_RESP_HEAD_MAX
+  n = sprintf(big, "HTTP/1.1 200 OK\r\nSet-Cookie: ");
+  memset(big + n, 'a', sizeof(big) - n);
+  http_response_init(&r);
+  feed_response(&r, big, sizeof(big), 100);
+  CHECK(r.state == HTTP_ERROR);
+  http_response_free(&r);
+
+  // closed before the body is complete
+  http_response_init(&r);
+  body_len = 0;
+  feed_response(&r, "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nabc", 42, 42);
+  CHECK(r.state == HTTP_BODY && body_len == 3);
+  http_response_eof(&r);
+  CHECK(r.state == HTTP_ERROR);
+  http_response_free(&r);
+}
+
+static void test_has_token(void)
+{
+  CHECK(http_has_token("keep-alive, Upgrade", "upgrade"));
+  CHECK(http_has_token("gzip;q=1.0", "gzip"));
+  CHECK(!http_has_token("gzipped", "gzip"));
+  CHECK(!http_has_token("", "close"));
+}
+
+int main(int argc, char **args)
+{
+  test_request();
+  test_request_errors();
+  test_response();
+  test_chunked();
+  test_response_errors();
+  test_has_token();
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
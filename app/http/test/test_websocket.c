@@ -0,0 +1,161 @@
+/*
+ * test_websocket.c
+ *
+ * host check of the websocket framing and handshake in ../websocket.c
+ *
+ *   gcc -std=gnu99 -Ihost -I.. test_websocket.c ../websocket.c -lcrypto -o test_websocket
+ *   ./test_websocket
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "websocket.h"
+
+#define MSG_MAX 16
+
+static int failed;
+
+#define CHECK(c) do { if(!(c)){ printf("%s:%d: %s\n", __FILE__, __LINE__, #c); failed++; } } while(0)
+
+static struct {
+  int opcode;
+  uint32_t len;
+  char data[WS_MSG_MAX];
+} msg[MSG_MAX];
+static int msgs;
+
+static void on_message(void *arg, int opcode, char *data, uint32_t len)
+{
+  if(msgs == MSG_MAX)
+    return;
+  msg[msgs].opcode = opcode;
+  msg[msgs].len = len;
+  memcpy(msg[msgs].data, data, len);
+  msgs++;
+}
+
+// a masked frame as a client sends it
+static int frame(uint8_t *out, int opcode, int fin, const char *data, uint32_t len)
+{
+  static const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+  int n = ws_frame_head(out, opcode, len, mask);
+  if(!fin)
+    out[0] &= 0x7f;
+  ws_mask((char *)out + n, data, len, mask);
+  return n + len;
+}
+
+static void test_accept(void)
+{
+  // RFC 6455 section 1.3
+  char accept[WS_ACCEPT_LEN + 1];
+  ws_accept_key("dGhlIHNhbXBsZSBub25jZQ==", 24, accept);
+  CHECK(strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+}
+
+static void test_switching(void)
+{
+  static const char want[] =
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+    "\r\n";
+  char reply[WS_SWITCHING_LEN + 1];
+
+  CHECK(WS_SWITCHING_LEN == sizeof(want) - 1);
+  memset(reply, '#', sizeof(reply));
+  ws_switching(reply, "dGhlIHNhbXBsZSBub25jZQ==", 24);
+  CHECK(memcmp(reply, want, WS_SWITCHING_LEN) == 0);
+  CHECK(reply[WS_SWITCHING_LEN] == '#');
+}
+
+static void test_frame_head(void)
+{
+  uint8_t h[WS_HEAD_MAX];
+  static const uint8_t mask[4] = { 1, 2, 3, 4 };
+
+  CHECK(ws_frame_head(h, WS_OP_TEXT, 5, NULL) == 2);
+  CHECK(h[0] == 0x81 && h[1] == 5);
+  CHECK(ws_frame_head(h, WS_OP_BINARY, 300, NULL) == 4);
+  CHECK(h[0] == 0x82 && h[1] == 126 && h[2] == 1 && h[3] == 44);
+  CHECK(ws_frame_head(h, WS_OP_BINARY, 70000, NULL) == 10);
+  CHECK(h[1] == 127 && h[7] == 1 && h[8] == 0x11 && h[9] == 0x70);
+  CHECK(ws_frame_head(h, WS_OP_PING, 0, mask) == 6);
+  CHECK(h[1] == 0x80 && memcmp(h + 2, mask, 4) == 0);
+}
+
+// every way the stream could be split into reads gives the same messages
+static void test_parse(void)
+{
+  static uint8_t stream[32 * 1024], copy[sizeof(stream)];
+  static char big[10000];
+  int n = 0, step, i;
+
+  for(i = 0; i < (int)sizeof(big); i++)
+    big[i] = 'a' + i % 26;
+  n += frame(stream + n, WS_OP_TEXT, 1, "hello", 5);
+  n += frame(stream + n, WS_OP_TEXT, 0, "frag", 4);
+  n += frame(stream + n, WS_OP_PING, 1, "pi", 2);         // between fragments
+  n += frame(stream + n, WS_OP_CONT, 0, "men", 3);
+  n += frame(stream + n, WS_OP_CONT, 1, "ted", 3);
+  n += frame(stream + n, WS_OP_BINARY, 1, big, 300);
+  n += frame(stream + n, WS_OP_BINARY, 1, big, sizeof(big));
+  n += frame(stream + n, WS_OP_TEXT, 1, "", 0);
+  n += frame(stream + n, WS_OP_CLOSE, 1, "\x03\xe8", 2);
+
+  for(step = 1; step <= n; step = step < 4 ? step + 1 : step * 3){
+    ws_parser p;
+    int err = 0;
+
+    memcpy(copy, stream, n);      // unmasked in place
+    ws_parser_init(&p, true);
+    msgs = 0;
+    for(i = 0; i < n && err == 0; i += step)
+      err = ws_parse(&p, (char *)copy + i, n - i < step ? n - i : step, on_message, NULL);
+    CHECK(err == 0);
+    CHECK(msgs == 7);
+    CHECK(msg[0].opcode == WS_OP_TEXT && msg[0].len == 5 && memcmp(msg[0].data, "hello", 5) == 0);
+    CHECK(msg[1].opcode == WS_OP_PING && msg[1].len == 2 && memcmp(msg[1].data, "pi", 2) == 0);
+    CHECK(msg[2].opcode == WS_OP_TEXT && msg[2].len == 10 && memcmp(msg[2].data, "fragmented", 10) == 0);
+    CHECK(msg[3].opcode == WS_OP_BINARY && msg[3].len == 300 && memcmp(msg[3].data, big, 300) == 0);
+    CHECK(msg[4].opcode == WS_OP_BINARY && msg[4].len == sizeof(big) && memcmp(msg[4].data, big, sizeof(big)) == 0);
+    CHECK(msg[5].opcode == WS_OP_TEXT && msg[5].len == 0);
+    CHECK(msg[6].opcode == WS_OP_CLOSE && msg[6].len == 2);
+    ws_parser_free(&p);
+  }
+}
+
+static void test_errors(void)
+{
+  ws_parser p;
+  uint8_t unmasked[] = { 0x81, 0x02, 'h', 'i' };
+  uint8_t too_big[] = { 0x82, 0x7f, 0, 0, 0, 0, 0, 1, 0, 0 };
+  uint8_t stray_cont[] = { 0x80, 0x00 };
+  uint8_t long_ping[] = { 0x89, 0x7e, 0, 200 };
+
+  ws_parser_init(&p, true);
+  CHECK(ws_parse(&p, (char *)unmasked, sizeof(unmasked), on_message, NULL) == WS_CLOSE_PROTOCOL);
+  ws_parser_free(&p);
+  ws_parser_init(&p, false);
+  CHECK(ws_parse(&p, (char *)too_big, sizeof(too_big), on_message, NULL) == WS_CLOSE_TOO_BIG);
+  ws_parser_free(&p);
+  ws_parser_init(&p, false);
+  CHECK(ws_parse(&p, (char *)stray_cont, sizeof(stray_cont), on_message, NULL) == WS_CLOSE_PROTOCOL);
+  ws_parser_free(&p);
+  ws_parser_init(&p, false);
+  CHECK(ws_parse(&p, (char *)long_ping, sizeof(long_ping), on_message, NULL) == WS_CLOSE_PROTOCOL);
+  ws_parser_free(&p);
+}
+
+int main(int argc, char **args)
+{
+  test_accept();
+  test_switching();
+  test_frame_head();
+  test_parse();
+  test_errors();
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,289 @@
+#include "c_types.h"
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "c_stdio.h"
+#include "rom.h"
+#include "websocket.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+void ws_parser_init(ws_parser *p, bool need_mask)
+{
+  c_memset(p, 0, sizeof(ws_parser));
+  p->need_mask = need_mask;
+}
+
+void ws_parser_free(ws_parser *p)
+{
+  if(p->msg)
+    c_free(p->msg);
+  ws_parser_init(p, p->need_mask);
+}
+
+static void ws_fail(ws_parser *p, uint16_t code)
+{
+  if(p->error == 0)
+    p->error = code;
+}
+
+// bytes of the frame head, as far as the first two tell
+static int ws_head_len(const ws_parser *p)
+{
+  int n = 2;
+  if(p->hlen < 2)
+    return n;
+  if((p->head[1] & 0x7f) == 126)
+    n += 2;
+  else if((p->head[1] & 0x7f) == 127)
+    n += 8;
+  if(p->head[1] & 0x80)
+    n += 4;
+  return n;
+}
+
+// the head is in, check it and get ready for the payload
+static void ws_head_done(ws_parser *p)
+{
+  const uint8_t *h = p->head;
+  uint32_t len = h[1] & 0x7f;
+  int n = 2;
+
+  p->fin = h[0] >> 7;
+  p->opcode = h[0] & 0x0f;
+  p->masked = h[1] >> 7;
+  if(h[0] & 0x70){
+    ws_fail(p, WS_CLOSE_PROTOCOL);    // no extensions were agreed on
+    return;
+  }
+  if(len == 126){
+    len = h[2] << 8 | h[3];
+    n = 4;
+  } else if(len == 127){
+    if(h[2] | h[3] | h[4] | h[5]){
+      ws_fail(p, WS_CLOSE_TOO_BIG);
+      return;
+    }
+    len = (uint32_t)h[6] << 24 | (uint32_t)h[7] << 16 | h[8] << 8 | h[9];
+    n = 10;
+  }
+  if(p->masked)
+    c_memcpy(p->mask, h + n, 4);
+  else if(p->need_mask){
+    ws_fail(p, WS_CLOSE_PROTOCOL);
+    return;
+  }
+
+  switch(p->opcode){
+  case WS_OP_CLOSE:
+  case WS_OP_PING:
+  case WS_OP_PONG:
+    // control frames come whole, maybe in the middle of a message
+    if(!p->fin || len > 125){
+      ws_fail(p, WS_CLOSE_PROTOCOL);
+      return;
+    }
+    break;
+  case WS_OP_TEXT:
+  case WS_OP_BINARY:
+    if(p->msg_op){
+      ws_fail(p, WS_CLOSE_PROTOCOL);
+      return;
+    }
+    p->msg_op = p->opcode;
+    break;
+  case WS_OP_CONT:
+    if(p->msg_op == 0){
+      ws_fail(p, WS_CLOSE_PROTOCOL);
+      return;
+    }
+    break;
+  default:
+    ws_fail(p, WS_CLOSE_PROTOCOL);
+    return;
+  }
+  if(!(p->opcode & 0x8) && len > WS_MSG_MAX - p->msg_len){
+    ws_fail(p, WS_CLOSE_TOO_BIG);
+    return;
+  }
+  p->left = len;
+  p->pos = 0;
+  p->hlen = 0;
+  p->in_payload = 1;
+}
+
+// the frame is read, hand on what it completes
+static void ws_frame_end(ws_parser *p, ws_message_cb cb, void *arg)
+{
+  p->in_payload = 0;
+  if(p->opcode & 0x8){
+    char *data = p->msg ? p->msg + p->msg_size - 125 : (char *)p->head;
+    cb(arg, p->opcode, data, p->pos);
+    return;
+  }
+  if(!p->fin)
+    return;
+  cb(arg, p->msg_op, p->msg ? p->msg : (char *)p->head, p->msg_len);
+  if(p->msg){
+    c_free(p->msg);
+    p->msg = NULL;
+  }
+  p->msg_len = p->msg_size = 0;
+  p->msg_op = 0;
+}
+
+// make room for n more bytes of the message, and 125 for a control frame
+// at the end of the buffer
+static bool ws_grow(ws_parser *p, uint32_t n)
+{
+  uint32_t size = p->msg_len + n + 125;
+  char *m;
+
+  if(size <= p->msg_size)
+    return true;
+  m = (char *)c_malloc(size);
+  if(m == NULL)
+    return false;
+  if(p->msg){
+    c_memcpy(m, p->msg, p->msg_len);
+    c_free(p->msg);
+  }
+  p->msg = m;
+  p->msg_size = size;
+  return true;
+}
+
+static void ws_unmask(ws_parser *p, char *data, uint32_t n)
+{
+  uint32_t i;
+  if(!p->masked)
+    return;
+  for(i = 0; i < n; i++)
+    data[i] ^= p->mask[(p->pos + i) & 3];
+}
+
+int ws_parse(ws_parser *p, char *data, uint32_t len, ws_message_cb cb, void *arg)
+{
+  uint32_t i = 0;
+
+  while(i < len && p->error == 0){
+    if(!p->in_payload){
+      p->head[p->hlen++] = data[i++];
+      if(p->hlen < ws_head_len(p))
+        continue;
+      ws_head_done(p);
+      if(p->in_payload && p->left == 0)
+        ws_frame_end(p, cb, arg);
+      continue;
+    }
+
+    uint32_t n = p->left;
+    char *s = data + i;
+    if(n > len - i)
+      n = len - i;
+    ws_unmask(p, s, n);
+    i += n;
+    if(p->pos == 0 && n == p->left && (p->opcode & 0x8 || (p->fin && p->msg_len == 0))){
+      // the whole frame is here, no need to copy it
+      int op = p->opcode;
+      p->in_payload = 0;
+      if(!(op & 0x8)){
+        op = p->msg_op;
+        p->msg_op = 0;
+      }
+      cb(arg, op, s, n);
+      continue;
+    }
+    if(p->opcode & 0x8){
+      // control frames go behind the message, the room is always there
+      if(!ws_grow(p, 0)){
+        ws_fail(p, WS_CLOSE_TOO_BIG);
+        break;
+      }
+      c_memcpy(p->msg + p->msg_size - 125 + p->pos, s, n);
+    } else {
+      if(p->pos == 0 && !ws_grow(p, p->left)){
+        ws_fail(p, WS_CLOSE_TOO_BIG);
+        break;
+      }
+      c_memcpy(p->msg + p->msg_len, s, n);
+      p->msg_len += n;
+    }
+    p->pos += n;
+    p->left -= n;
+    if(p->left == 0)
+      ws_frame_end(p, cb, arg);
+  }
+  return p->error;
+}
+
+int ws_frame_head(uint8_t *head, int opcode, uint32_t len, const uint8_t *mask)
+{
+  int n = 2;
+
+  head[0] = 0x80 | opcode;
+  if(len < 126){
+    head[1] = len;
+  } else if(len < 0x10000){
+    head[1] = 126;
+    head[2] = len >> 8;
+    head[3] = len;
+    n = 4;
+  } else {
+    head[1] = 127;
+    head[2] = head[3] = head[4] = head[5] = 0;
+    head[6] = len >> 24;
+    head[7] = len >> 16;
+    head[8] = len >> 8;
+    head[9] = len;
+    n = 10;
+  }
+  if(mask){
+    head[1] |= 0x80;
+    c_memcpy(head + n, mask, 4);
+    n += 4;
+  }
+  return n;
+}
+
+void ws_mask(char *dst, const char *src, uint32_t len, const uint8_t *mask)
+{
+  uint32_t i;
+  for(i = 0; i < len; i++)
+    dst[i] = src[i] ^ mask[i & 3];
+}
+
+static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void ws_accept_key(const char *key, size_t len, char *accept)
+{
+  SHA1_CTX ctx;
+  uint8_t d[SHA1_DIGEST_LENGTH + 1];
+  int i;
+
+  SHA1Init(&ctx);
+  SHA1Update(&ctx, (const uint8_t *)key, len);
+  SHA1Update(&ctx, (const uint8_t *)WS_GUID, sizeof(WS_GUID) - 1);
+  SHA1Final(d, &ctx);
+  d[SHA1_DIGEST_LENGTH] = 0;
+  // 20 bytes are 6 groups of 3 and 2 left over, one '='
+  for(i = 0; i < 7; i++){
+    uint32_t v = d[3*i] << 16 | d[3*i + 1] << 8 | d[3*i + 2];
+    accept[4*i] = b64[v >> 18];
+    accept[4*i + 1] = b64[(v >> 12) & 0x3f];
+    accept[4*i + 2] = b64[(v >> 6) & 0x3f];
+    accept[4*i + 3] = b64[v & 0x3f];
+  }
+  accept[WS_ACCEPT_LEN - 1] = '=';
+  accept[WS_ACCEPT_LEN] = 0;
+}
+
+void ws_switching(char *reply, const char *key, size_t len)
+{
+  char accept[WS_ACCEPT_LEN + 1];
+
+  c_memcpy(reply, WS_SWITCHING, sizeof(WS_SWITCHING) - 1);
+  reply += sizeof(WS_SWITCHING) - 1;
+  ws_accept_key(key, len, accept);
+  c_memcpy(reply, accept, WS_ACCEPT_LEN);
+  c_memcpy(reply + WS_ACCEPT_LEN, "\r\n\r\n", 4);
+}
@@ -0,0 +1,72 @@
+#ifndef _WEBSOCKET_H
+#define _WEBSOCKET_H 1
+#include "c_types.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// RFC 6455 framing. a frame that came in whole is unmasked where it lies and
+// handed on as is, only fragmented or split messages are collected.
+#define WS_MSG_MAX        (16*1024)   // a longer message closes with 1009
+#define WS_HEAD_MAX       14          // 2, 16 or 64 bit length, mask
+#define WS_ACCEPT_LEN     28          // base64 of a SHA1
+
+#define WS_OP_CONT        0x0
+#define WS_OP_TEXT        0x1
+#define WS_OP_BINARY      0x2
+#define WS_OP_CLOSE       0x8
+#define WS_OP_PING        0x9
+#define WS_OP_PONG        0xA
+
+#define WS_CLOSE_NORMAL   1000
+#define WS_CLOSE_PROTOCOL 1002
+#define WS_CLOSE_TOO_BIG  1009
+
+typedef struct ws_parser {
+  uint8_t need_mask;        // a server takes masked frames only
+  uint8_t hlen;             // bytes of the frame head read
+  uint8_t head[WS_HEAD_MAX];
+  uint8_t in_payload;
+  uint8_t opcode;           // of the frame being read
+  uint8_t fin;
+  uint8_t masked;
+  uint8_t mask[4];
+  uint8_t msg_op;           // opcode of the message being collected, 0 if none
+  uint16_t error;           // close code once the stream is broken
+  uint32_t left;            // payload bytes of the frame still to come
+  uint32_t pos;             // payload bytes of the frame read, for the mask
+  char *msg;                // fragments, or a frame split across reads
+  uint32_t msg_len;
+  uint32_t msg_size;
+} ws_parser;
+
+// a complete message, or a control frame. data may be changed, it is gone
+// after the call.
+typedef void (*ws_message_cb)(void *arg, int opcode, char *data, uint32_t len);
+
+void ws_parser_init(ws_parser *p, bool need_mask);
+void ws_parser_free(ws_parser *p);
+// reads all of data, which is unmasked in place, calling cb for each
+// message. returns 0, or the close code once the stream is broken.
+int ws_parse(ws_parser *p, char *data, uint32_t len, ws_message_cb cb, void *arg);
+
+// writes the head of a frame of len bytes, masked if mask is not NULL.
+// returns its length.
+int ws_frame_head(uint8_t *head, int opcode, uint32_t len, const uint8_t *mask);
+// copies len bytes from src to dst, masking them
+void ws_mask(char *dst, const char *src, uint32_t len, const uint8_t *mask);
+// Sec-WebSocket-Accept for a Sec-WebSocket-Key, WS_ACCEPT_LEN characters and a 0
+void ws_accept_key(const char *key, size_t len, char *accept);
+
+// the 101 a server answers a handshake with, up to the empty line
+#define WS_SWITCHING      "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n" \
+                          "Connection: Upgrade\r\nSec-WebSocket-Accept: "
+#define WS_SWITCHING_LEN  (sizeof(WS_SWITCHING) - 1 + WS_ACCEPT_LEN + 4)
+// writes the WS_SWITCHING_LEN bytes of the 101 for a Sec-WebSocket-Key
+void ws_switching(char *reply, const char *key, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
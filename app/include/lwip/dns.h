@@ -103,12 +103,24 @@ struct local_hostlist_entry {
 */
 typedef void (*dns_found_callback)(const char *name, ip_addr_t *ipaddr, void *callback_arg);
 
+/** Counters of the resolver table, see dns_getstats() */
+struct dns_stats {
+  u32_t hits;       /* answered from the table */
+  u32_t misses;     /* sent to a server */
+  u32_t coalesced;  /* joined a query on its way */
+  u32_t negative;   /* failed again from the table */
+  u32_t failures;   /* queries that got no address */
+  u32_t full;       /* turned away, the table was busy asking */
+  u8_t  entries;    /* names in the table now */
+};
+
 void           dns_init(void);
 void           dns_tmr(void);
 void           dns_setserver(u8_t numdns, ip_addr_t *dnsserver);
 ip_addr_t      dns_getserver(u8_t numdns);
 err_t          dns_gethostbyname(const char *hostname, ip_addr_t *addr,
                                  dns_found_callback found, void *callback_arg);
+void           dns_getstats(struct dns_stats *stats);
 
 #if DNS_LOCAL_HOSTLIST && DNS_LOCAL_HOSTLIST_IS_DYNAMIC
 int            dns_local_removehost(const char *hostname, const ip_addr_t *addr);
@@ -79,13 +79,22 @@ typedef enum {
 extern const u16_t memp_sizes[MEMP_MAX];
 #endif /* MEMP_MEM_MALLOC || MEM_USE_POOLS */
 
+#if !MEMP_MEM_MALLOC || LWIP_COUNTERS
+extern const char *memp_desc[MEMP_MAX];
+#endif
+
 #if MEMP_MEM_MALLOC
 
 #include "mem.h"
 
 #define memp_init()
+#if LWIP_COUNTERS
+void *memp_malloc(memp_t type)ICACHE_FLASH_ATTR;
+void  memp_free(memp_t type, void *mem)ICACHE_FLASH_ATTR;
+#else /* LWIP_COUNTERS */
 #define memp_malloc(type)     mem_malloc(memp_sizes[type])
 #define memp_free(type, mem)  mem_free(mem)
+#endif /* LWIP_COUNTERS */
 
 #else /* MEMP_MEM_MALLOC */
 
@@ -978,6 +978,15 @@
 #define TCP_SNDQUEUELOWAT               ((TCP_SND_QUEUELEN)/2)
 #endif
 
+/**
+ * TCP_TIMEWAIT_MAX: Once this many pcbs are in TIME_WAIT, tcp_alloc() takes
+ * over the oldest of them instead of allocating another. 0 keeps them all
+ * for 2 * TCP_MSL.
+ */
+#ifndef TCP_TIMEWAIT_MAX
+#define TCP_TIMEWAIT_MAX                0
+#endif
+
 /**
  * TCP_LISTEN_BACKLOG: Enable the backlog option for tcp listen pcb.
  */
@@ -1560,6 +1569,15 @@
 
 #endif /* LWIP_STATS */
 
+/**
+ * LWIP_COUNTERS==1: Keep a few cheap counters in lwip_counters whatever
+ * LWIP_STATS says: pool use, tcp retransmits, out of sequence segments
+ * dropped, zero windows and failed pbuf allocations.
+ */
+#ifndef LWIP_COUNTERS
+#define LWIP_COUNTERS                   0
+#endif
+
 /*
    ---------------------------------
    ---------- PPP options ----------
@@ -285,6 +285,31 @@ void stats_display_sys(struct stats_sys *sys)ICACHE_FLASH_ATTR;
 #define stats_display_sys(sys)
 #endif /* LWIP_STATS_DISPLAY */
 
+#if LWIP_COUNTERS
+/* pools come from the heap (MEMP_MEM_MALLOC), so this is all that tells
+   which of them ran out */
+struct counters_memp {
+  u16_t used;
+  u16_t max;
+  u16_t err;                     /* allocations that failed */
+};
+
+struct counters_ {
+  struct counters_memp memp[MEMP_MAX];
+  u32_t tcp_rexmit;              /* retransmissions, by timeout or fast */
+  u32_t tcp_ooseq_drop;          /* segments dropped for being out of sequence */
+  u32_t tcp_zero_wnd;            /* times the peer's window closed on us */
+  u32_t pbuf_err;                /* pbuf_alloc() failures */
+  u32_t tcp_tw_recycled;         /* TIME_WAIT pcbs cut short for new ones */
+};
+
+extern struct counters_ lwip_counters;
+
+#define COUNTER_INC(x) ++lwip_counters.x
+#else /* LWIP_COUNTERS */
+#define COUNTER_INC(x)
+#endif /* LWIP_COUNTERS */
+
 #ifdef __cplusplus
 }
 #endif
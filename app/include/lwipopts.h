@@ -787,12 +787,17 @@
 
 /** DNS maximum number of entries to maintain locally. */
 #ifndef DNS_TABLE_SIZE
-#define DNS_TABLE_SIZE                  4
+#define DNS_TABLE_SIZE                  8
 #endif
 
 /** DNS maximum host name length supported in the name table. */
 #ifndef DNS_MAX_NAME_LENGTH
-#define DNS_MAX_NAME_LENGTH             256
+#define DNS_MAX_NAME_LENGTH             128
+#endif
+
+/** DNS seconds a name that could not be resolved is answered from the table. */
+#ifndef DNS_NEG_TTL
+#define DNS_NEG_TTL                     10
 #endif
 
 /** The maximum of DNS servers */
@@ -983,6 +988,15 @@
 #define TCP_SNDQUEUELOWAT               LWIP_MAX(((TCP_SND_QUEUELEN)/2), 5)
 #endif
 
+/**
+ * TCP_TIMEWAIT_MAX: Once this many pcbs are in TIME_WAIT, tcp_alloc() takes
+ * over the oldest of them instead of allocating another. 0 keeps them all
+ * for 2 * TCP_MSL.
+ */
+#ifndef TCP_TIMEWAIT_MAX
+#define TCP_TIMEWAIT_MAX                8
+#endif
+
 /**
  * TCP_LISTEN_BACKLOG: Enable the backlog option for tcp listen pcb.
  */
@@ -1565,6 +1579,15 @@
 
 #endif /* LWIP_STATS */
 
+/**
+ * LWIP_COUNTERS==1: Keep a few cheap counters in lwip_counters whatever
+ * LWIP_STATS says: pool use, tcp retransmits, out of sequence segments
+ * dropped, zero windows and failed pbuf allocations.
+ */
+#ifndef LWIP_COUNTERS
+#define LWIP_COUNTERS                   1
+#endif
+
 /*
    ---------------------------------
    ---------- PPP options ----------
@@ -46,6 +46,8 @@
 
 // #define BUILD_WOFS		1
 #define BUILD_SPIFFS	1
+// read only files of app/wofs/romfiles.h, for file.map()
+#define BUILD_ROMFS		1
 
 // #define LUA_NUMBER_INTEGRAL
 
@@ -18,6 +18,7 @@
 #define LUA_USE_MODULES_GPIO
 #define LUA_USE_MODULES_WIFI
 #define LUA_USE_MODULES_NET
+#define LUA_USE_MODULES_HTTP
 #define LUA_USE_MODULES_PWM
 #define LUA_USE_MODULES_I2C
 #define LUA_USE_MODULES_SPI
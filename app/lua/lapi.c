@@ -469,6 +469,24 @@ LUA_API void lua_pushrolstring (lua_State *L, const char *s, size_t len) {
 }
 
 
+LUA_API void lua_pushlstringv (lua_State *L, const char *const *s, const size_t *ls, int n) {
+  lua_lock(L);
+  luaC_checkGC(L);
+  setsvalue2s(L, L->top, luaS_newlstrv(L, s, ls, n));
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_pushlstringf (lua_State *L, size_t l, lua_Filler fill, void *ud) {
+  lua_lock(L);
+  luaC_checkGC(L);
+  setsvalue2s(L, L->top, luaS_newlstrf(L, l, fill, ud));
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_pushstring (lua_State *L, const char *s) {
   if (s == NULL)
     lua_pushnil(L);
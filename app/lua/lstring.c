@@ -66,7 +66,8 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   ts->tsv.marked = luaC_white(G(L));
   ts->tsv.tt = LUA_TSTRING;
   if (!readonly) {
-    c_memcpy(ts+1, str, l*sizeof(char));
+    if (str)  /* else filled in by the caller */
+      c_memcpy(ts+1, str, l*sizeof(char));
     ((char *)(ts+1))[l] = '\0';  /* ending 0 */
   } else {
     *(char **)(ts+1) = (char *)str;
@@ -129,6 +130,99 @@ LUAI_FUNC TString *luaS_newrolstr (lua_State *L, const char *str, size_t l) {
 }
 
 
+/* string of n pieces, copied once into the new string */
+TString *luaS_newlstrv (lua_State *L, const char *const *s, const size_t *ls, int n) {
+  GCObject *o;
+  TString *ts;
+  size_t l = 0;
+  size_t base, l1, step;
+  unsigned int h;
+  int i;
+  for (i = 0; i < n; i++)
+    l += ls[i];
+  h = cast(unsigned int, l);  /* seed */
+  step = (l>>5)+1;
+  /* same hash as luaS_newlstr, pieces walked from the end */
+  i = n - 1;
+  base = l - (n > 0 ? ls[i] : 0);
+  for (l1=l; l1>=step; l1-=step) {
+    while (l1-1 < base)
+      base -= ls[--i];
+    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, s[i][l1-1-base]));
+  }
+  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
+       o != NULL;
+       o = o->gch.next) {
+    ts = rawgco2ts(o);
+    if (ts->tsv.len == l) {
+      const char *p = getstr(ts);
+      for (i = 0; i < n && c_memcmp(p, s[i], ls[i]) == 0; i++)
+        p += ls[i];
+      if (i == n) {
+        /* string may be dead */
+        if (isdead(G(L), o)) changewhite(o);
+        return ts;
+      }
+    }
+  }
+  ts = newlstr(L, NULL, l, h, LUAS_REGULAR_STRING);  /* not found */
+  base = 0;
+  for (i = 0; i < n; i++) {
+    c_memcpy(cast(char *, getstr(ts)) + base, s[i], ls[i]);
+    base += ls[i];
+  }
+  return ts;
+}
+
+
+/* string of up to l chars written in place by fill, hashed once it is there;
+** fill must not raise errors, the block is not known to the collector yet */
+TString *luaS_newlstrf (lua_State *L, size_t l, lua_Filler fill, void *ud) {
+  GCObject *o;
+  TString *ts;
+  stringtable *tb;
+  const char *str;
+  size_t l1, step, rl;
+  unsigned int h;
+  if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
+    luaM_toobig(L);
+  tb = &G(L)->strt;
+  if ((tb->nuse + 1) > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
+    luaS_resize(L, tb->size*2);  /* too crowded */
+  ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString)));
+  rl = fill(L, ud, cast(char *, ts+1), l);
+  lua_assert(rl <= l);
+  if (rl < l)  /* give back what was not filled */
+    ts = cast(TString *, luaM_realloc_(L, ts, (l+1)*sizeof(char)+sizeof(TString),
+                                       (rl+1)*sizeof(char)+sizeof(TString)));
+  str = cast(const char *, ts+1);
+  h = cast(unsigned int, rl);  /* seed */
+  step = (rl>>5)+1;
+  for (l1=rl; l1>=step; l1-=step)  /* same hash as luaS_newlstr */
+    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
+  for (o = tb->hash[lmod(h, tb->size)];
+       o != NULL;
+       o = o->gch.next) {
+    TString *es = rawgco2ts(o);
+    if (es->tsv.len == rl && (c_memcmp(str, getstr(es), rl) == 0)) {
+      luaM_freemem(L, ts, (rl+1)*sizeof(char)+sizeof(TString));
+      /* string may be dead */
+      if (isdead(G(L), o)) changewhite(o);
+      return es;
+    }
+  }
+  ts->tsv.len = rl;
+  ts->tsv.hash = h;
+  ts->tsv.marked = luaC_white(G(L));
+  ts->tsv.tt = LUA_TSTRING;
+  ((char *)(ts+1))[rl] = '\0';  /* ending 0 */
+  h = lmod(h, tb->size);
+  ts->tsv.next = tb->hash[h];  /* chain new entry */
+  tb->hash[h] = obj2gco(ts);
+  tb->nuse++;
+  return ts;
+}
+
 Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
   Udata *u;
   if (s > MAX_SIZET - sizeof(Udata))
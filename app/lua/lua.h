@@ -59,6 +59,12 @@ typedef const char * (*lua_Reader) (lua_State *L, void *ud, size_t *sz);
 
 typedef int (*lua_Writer) (lua_State *L, const void* p, size_t sz, void* ud);
 
+/*
+** function that writes up to sz chars of a new string in place, see
+** lua_pushlstringf; returns how many it wrote
+*/
+typedef size_t (*lua_Filler) (lua_State *L, void *ud, char *b, size_t sz);
+
 
 /*
 ** prototype for memory-allocation functions
@@ -162,6 +168,8 @@ LUA_API void  (lua_pushnumber) (lua_State *L, lua_Number n);
 LUA_API void  (lua_pushinteger) (lua_State *L, lua_Integer n);
 LUA_API void  (lua_pushlstring) (lua_State *L, const char *s, size_t l);
 LUA_API void  (lua_pushrolstring) (lua_State *L, const char *s, size_t l);
+LUA_API void  (lua_pushlstringv) (lua_State *L, const char *const *s, const size_t *ls, int n);
+LUA_API void  (lua_pushlstringf) (lua_State *L, size_t l, lua_Filler fill, void *ud);
 LUA_API void  (lua_pushstring) (lua_State *L, const char *s);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
@@ -57,6 +57,7 @@ espconn_copy_partial(struct espconn *pesp_dest, struct espconn *pesp_source)
 		os_memcpy(pesp_dest->proto.udp->local_ip, pesp_source->proto.udp->local_ip, 4);
 	}
 	pesp_dest->recv_callback = pesp_source->recv_callback;
+	pesp_dest->recv_pbuf_callback = pesp_source->recv_pbuf_callback;
 	pesp_dest->sent_callback = pesp_source->sent_callback;
 	pesp_dest->link_cnt = pesp_source->link_cnt;
 	pesp_dest->reverse = pesp_source->reverse;
@@ -426,6 +427,27 @@ espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb)
     return ESPCONN_OK;
 }
 
+/******************************************************************************
+ * FunctionName : espconn_regist_recvpbufcb
+ * Description  : used to specify the function that should be called with the
+ *                pbuf chain of data received on a tcp connection, instead of
+ *                the recv callback with a flat copy of it.
+ * Parameters   : espconn -- espconn to set the recv callback
+ *                recv_pbuf_cb -- function to call with the received pbuf chain,
+ *                NULL for the recv callback again
+ * Returns      : none
+*******************************************************************************/
+sint8 ICACHE_FLASH_ATTR
+espconn_regist_recvpbufcb(struct espconn *espconn, espconn_recv_pbuf_callback recv_pbuf_cb)
+{
+    if (espconn == NULL) {
+    	return ESPCONN_ARG;
+    }
+
+    espconn ->recv_pbuf_callback = recv_pbuf_cb;
+    return ESPCONN_OK;
+}
+
 /******************************************************************************
  * FunctionName : espconn_regist_reconcb
  * Description  : used to specify the function that should be called when connection
@@ -611,12 +633,35 @@ espconn_disconnect(struct espconn *espconn)
     	return ESPCONN_ARG;
 }
 
+/******************************************************************************
+ * FunctionName : espconn_tcp_opt
+ * Description  : carry the options of a connection over to its pcb
+ * Parameters   : pnode -- the connection
+ * Returns      : none
+*******************************************************************************/
+static void ICACHE_FLASH_ATTR
+espconn_tcp_opt(espconn_msg *pnode)
+{
+	struct tcp_pcb *pcb = pnode->pcommon.pcb;
+
+	if (pcb == NULL)
+		return;
+	if (pnode->pcommon.espconn_opt & ESPCONN_NODELAY)
+		tcp_nagle_disable(pcb);
+	else
+		tcp_nagle_enable(pcb);
+	if (pnode->pcommon.espconn_opt & ESPCONN_KEEPALIVE)
+		pcb->so_options |= SOF_KEEPALIVE;
+	else
+		pcb->so_options &= ~SOF_KEEPALIVE;
+}
+
 /******************************************************************************
  * FunctionName : espconn_set_opt
- * Description  : access port value for client so that we don't end up bouncing
- *                all connections at the same time .
- * Parameters   : none
- * Returns      : access port value
+ * Description  : set options of a tcp connection, on top of those it has
+ * Parameters   : espconn -- the espconn used to set the options
+ * 				  opt -- the espconn_option flags to set
+ * Returns      : result
 *******************************************************************************/
 sint8 ICACHE_FLASH_ATTR
 espconn_set_opt(struct espconn *espconn, uint8 opt)
@@ -624,19 +669,91 @@ espconn_set_opt(struct espconn *espconn, uint8 opt)
 	espconn_msg *pnode = NULL;
 	bool value = false;
 
-	if (espconn == NULL || opt > ESPCONN_END) {
+	if (espconn == NULL || (opt & ~ESPCONN_OPT_MASK) != 0) {
 		return ESPCONN_ARG;;
 	} else if (espconn->type != ESPCONN_TCP)
 		return ESPCONN_ARG;
 
 	value = espconn_find_connection(espconn, &pnode);
 	if (value) {
-		pnode->pcommon.espconn_opt = opt;
+		pnode->pcommon.espconn_opt |= opt;
+		espconn_tcp_opt(pnode);
 		return ESPCONN_OK;
 	} else
 		return ESPCONN_ARG;
 }
 
+/******************************************************************************
+ * FunctionName : espconn_clear_opt
+ * Description  : clear options of a tcp connection
+ * Parameters   : espconn -- the espconn used to clear the options
+ * 				  opt -- the espconn_option flags to clear
+ * Returns      : result
+*******************************************************************************/
+sint8 ICACHE_FLASH_ATTR
+espconn_clear_opt(struct espconn *espconn, uint8 opt)
+{
+	espconn_msg *pnode = NULL;
+	bool value = false;
+
+	if (espconn == NULL || (opt & ~ESPCONN_OPT_MASK) != 0) {
+		return ESPCONN_ARG;
+	} else if (espconn->type != ESPCONN_TCP)
+		return ESPCONN_ARG;
+
+	value = espconn_find_connection(espconn, &pnode);
+	if (value) {
+		pnode->pcommon.espconn_opt &= ~opt;
+		espconn_tcp_opt(pnode);
+		return ESPCONN_OK;
+	} else
+		return ESPCONN_ARG;
+}
+
+/******************************************************************************
+ * FunctionName : espconn_set_keepalive
+ * Description  : set the keepalive timing of a tcp connection
+ * Parameters   : espconn -- the espconn used to set the keepalive timing
+ * 				  level -- ESPCONN_KEEPIDLE and ESPCONN_KEEPINTVL in seconds,
+ * 				           ESPCONN_KEEPCNT the probes sent before giving up
+ * 				  optarg -- points to the uint32 value
+ * Returns      : result
+*******************************************************************************/
+sint8 ICACHE_FLASH_ATTR
+espconn_set_keepalive(struct espconn *espconn, uint8 level, void *optarg)
+{
+	espconn_msg *pnode = NULL;
+	struct tcp_pcb *pcb = NULL;
+	uint32 value = 0;
+
+	if (espconn == NULL || optarg == NULL) {
+		return ESPCONN_ARG;
+	} else if (espconn->type != ESPCONN_TCP)
+		return ESPCONN_ARG;
+
+	if (!espconn_find_connection(espconn, &pnode) || pnode->pcommon.pcb == NULL)
+		return ESPCONN_ARG;
+
+	pcb = pnode->pcommon.pcb;
+	value = *(uint32 *)optarg;
+	switch (level) {
+		case ESPCONN_KEEPIDLE:
+			pcb->keep_idle = 1000 * value;
+			break;
+#if LWIP_TCP_KEEPALIVE
+		case ESPCONN_KEEPINTVL:
+			pcb->keep_intvl = 1000 * value;
+			break;
+		case ESPCONN_KEEPCNT:
+			pcb->keep_cnt = value;
+			break;
+#endif
+		default:
+			return ESPCONN_ARG;
+	}
+	return ESPCONN_OK;
+}
+
 /******************************************************************************
  * FunctionName : espconn_delete
  * Description  : disconnect with host
@@ -119,13 +119,16 @@ espconn_tcp_disconnect_successful(void *arg)
 						espconn->proto.tcp->local_ip[3],espconn->proto.tcp->local_port);
 			}
 			pcb = pdiscon_cb->pcommon.pcb;
-			tcp_arg(pcb, NULL);
-			tcp_err(pcb, NULL);
-			/*delete TIME_WAIT State pcb after 2MSL time,for not all data received by application.*/
-			if (pdiscon_cb->pcommon.espconn_opt == ESPCONN_REUSEADDR){
-				if (pcb->state == TIME_WAIT){
-					tcp_pcb_remove(&tcp_tw_pcbs,pcb);
-					memp_free(MEMP_TCP_PCB,pcb);
+			/*the pcb is gone already if the connection was reset*/
+			if (pcb != NULL){
+				tcp_arg(pcb, NULL);
+				tcp_err(pcb, NULL);
+				/*delete TIME_WAIT State pcb after 2MSL time,for not all data received by application.*/
+				if (pdiscon_cb->pcommon.espconn_opt & ESPCONN_REUSEADDR){
+					if (pcb->state == TIME_WAIT){
+						tcp_pcb_remove(&tcp_tw_pcbs,pcb);
+						memp_free(MEMP_TCP_PCB,pcb);
+					}
 				}
 			}
 		}
@@ -276,6 +279,28 @@ espconn_client_close(void *arg, struct tcp_pcb *pcb)
     }
 }
 
+/******************************************************************************
+ * FunctionName : espconn_recv_pbuf
+ * Description  : hands received data to the recv pbuf callback as the pbuf
+ *                chain, which is freed after, instead of copying it into a
+ *                flat buffer first.
+ * Parameters   : precv_cb -- the espconn_msg of the connection
+ *                pcb -- The connection pcb which received data
+ *                p -- The received data
+ * Returns      : none
+*******************************************************************************/
+static void ICACHE_FLASH_ATTR
+espconn_recv_pbuf(espconn_msg *precv_cb, struct tcp_pcb *pcb, struct pbuf *p)
+{
+	if (p->tot_len != 0) {
+		precv_cb->pespconn ->state = ESPCONN_READ;
+		precv_cb->pcommon.pcb = pcb;
+		precv_cb->pespconn->recv_pbuf_callback(precv_cb->pespconn, p);
+		precv_cb->pespconn ->state = ESPCONN_CONNECT;
+	}
+	pbuf_free(p);
+}
+
 /******************************************************************************
  * FunctionName : espconn_client_recv
  * Description  : Data has been received on this pcb.
@@ -296,7 +321,9 @@ espconn_client_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
         tcp_recved(pcb, p ->tot_len);
     }
 
-    if (err == ERR_OK && p != NULL) {
+    if (err == ERR_OK && p != NULL && precv_cb->pespconn->recv_pbuf_callback != NULL) {
+    	espconn_recv_pbuf(precv_cb, pcb, p);
+    } else if (err == ERR_OK && p != NULL) {
     	char *pdata = NULL;
     	u16_t length = 0;
         pdata = (char *)os_zalloc(p ->tot_len + 1);
@@ -561,6 +588,34 @@ espconn_sclose_cb(void *arg)
     }
 }
 
+/******************************************************************************
+ * FunctionName : espconn_sabort_cb
+ * Description  : Reset a connection that ESPCONN_RSTCLOSE closes, from a timer
+ *                as tcp_abort must not be called inside the pcb's callbacks.
+ * Parameters   : arg -- Additional argument to pass to the callback function
+ * Returns      : none
+*******************************************************************************/
+static void ICACHE_FLASH_ATTR
+espconn_sabort_cb(void *arg)
+{
+	espconn_msg *psabort_cb = arg;
+	struct tcp_pcb *pcb = NULL;
+
+	if (psabort_cb == NULL) {
+		return;
+	}
+
+	pcb = psabort_cb->pcommon.pcb;
+	tcp_arg(pcb, NULL);
+	tcp_err(pcb, NULL);
+	tcp_abort(pcb);
+	psabort_cb->pcommon.pcb = NULL;
+	psabort_cb->pespconn->state = ESPCONN_CLOSE;
+	/*remove the node from the server's active connection list*/
+	espconn_list_delete(&plink_active, psabort_cb);
+	espconn_tcp_disconnect_successful(psabort_cb);
+}
+
 /******************************************************************************
  * FunctionName : espconn_server_close
  * Description  : The connection shall be actively closed.
@@ -576,6 +631,16 @@ espconn_server_close(void *arg, struct tcp_pcb *pcb)
 
 	os_timer_disarm(&psclose->pcommon.ptimer);
 
+	/*closing first, reset instead of leaving the pcb in TIME_WAIT*/
+	if ((psclose->pcommon.espconn_opt & ESPCONN_RSTCLOSE) && pcb->state == ESTABLISHED) {
+		tcp_recv(pcb, NULL);
+		tcp_sent(pcb, NULL);
+		tcp_poll(pcb, NULL, 0);
+		os_timer_setfn(&psclose->pcommon.ptimer, espconn_sabort_cb, psclose);
+		os_timer_arm(&psclose->pcommon.ptimer, TCP_FAST_INTERVAL, 0);
+		return;
+	}
+
     tcp_recv(pcb, NULL);
     err = tcp_close(pcb);
 	os_timer_setfn(&psclose->pcommon.ptimer, espconn_sclose_cb, psclose);
@@ -611,7 +676,10 @@ espconn_server_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
         tcp_recved(pcb, p->tot_len);
     }
 
-    if (err == ERR_OK && p != NULL) {
+    if (err == ERR_OK && p != NULL && precv_cb->pespconn->recv_pbuf_callback != NULL) {
+		precv_cb->pcommon.recv_check = 0;
+    	espconn_recv_pbuf(precv_cb, pcb, p);
+    } else if (err == ERR_OK && p != NULL) {
     	u8_t *data_ptr = NULL;
     	u32_t data_cntr = 0;
 		precv_cb->pcommon.recv_check = 0;
@@ -103,6 +103,12 @@
 #define DNS_MAX_TTL               604800
 #endif
 
+/** How long a name that could not be resolved is answered from the table,
+ * in seconds. */
+#ifndef DNS_NEG_TTL
+#define DNS_NEG_TTL               10
+#endif
+
 /* DNS protocol flags */
 #define DNS_FLAG1_RESPONSE        0x80
 #define DNS_FLAG1_OPCODE_STATUS   0x10
@@ -164,6 +170,13 @@ struct dns_answer {
 };
 #define SIZEOF_DNS_ANSWER 10
 
+/** A caller waiting for an entry, besides the one in found/arg */
+struct dns_waiter {
+  struct dns_waiter *next;
+  dns_found_callback found;
+  void *arg;
+};
+
 /** DNS table entry */
 struct dns_table_entry {
   u8_t  state;
@@ -178,6 +191,8 @@ struct dns_table_entry {
   /* pointer to callback on DNS query done */
   dns_found_callback found;
   void *arg;
+  /* more callers for the same name */
+  struct dns_waiter *waiters;
 };
 
 #if DNS_LOCAL_HOSTLIST
@@ -223,6 +238,7 @@ static ip_addr_t              dns_servers[DNS_MAX_SERVERS];
 /** Contiguous buffer for processing responses */
 static u8_t                   dns_payload_buffer[LWIP_MEM_ALIGN_BUFFER(DNS_MSG_SIZE)];
 static u8_t*                  dns_payload;
+static struct dns_stats       dns_stat;
 
 /**
  * Initialize the resolver: set up the UDP pcb and configure the default server
@@ -623,6 +639,78 @@ dns_send(u8_t numdns, const char* name, u8_t id)
   return err;
 }
 
+/**
+ * Add a caller to the ones waiting for an entry.
+ *
+ * @return ERR_OK, or ERR_MEM if there is no memory for one more
+ */
+static err_t ICACHE_FLASH_ATTR
+dns_add_caller(struct dns_table_entry *pEntry, dns_found_callback found, void *callback_arg)
+{
+  struct dns_waiter *w;
+
+  if (pEntry->found == NULL && pEntry->waiters == NULL) {
+    pEntry->found = found;
+    pEntry->arg   = callback_arg;
+    return ERR_OK;
+  }
+  w = (struct dns_waiter *)mem_malloc(sizeof(struct dns_waiter));
+  if (w == NULL) {
+    return ERR_MEM;
+  }
+  w->found = found;
+  w->arg   = callback_arg;
+  w->next  = pEntry->waiters;
+  pEntry->waiters = w;
+  return ERR_OK;
+}
+
+/**
+ * Tell everybody waiting for an entry. The state of the entry is set before,
+ * a callback may ask again for a name.
+ *
+ * @param ipaddr the address, or NULL if the name could not be resolved
+ */
+static void ICACHE_FLASH_ATTR
+dns_call_found(struct dns_table_entry *pEntry, ip_addr_t *ipaddr)
+{
+  dns_found_callback found = pEntry->found;
+  void *arg = pEntry->arg;
+  struct dns_waiter *w = pEntry->waiters;
+  ip_addr_t addr;
+
+  pEntry->found   = NULL;
+  pEntry->waiters = NULL;
+  if (ipaddr != NULL) {
+    /* the entry may be taken for another name by a callback */
+    ip_addr_copy(addr, *ipaddr);
+    ipaddr = &addr;
+  }
+  if (found) {
+    (*found)(pEntry->name, ipaddr, arg);
+  }
+  while (w != NULL) {
+    struct dns_waiter *next = w->next;
+    (*w->found)(pEntry->name, ipaddr, w->arg);
+    mem_free(w);
+    w = next;
+  }
+}
+
+/**
+ * A name could not be resolved: keep it for DNS_NEG_TTL seconds, so asking
+ * again at once does not go to the server again.
+ */
+static void ICACHE_FLASH_ATTR
+dns_negative(struct dns_table_entry *pEntry)
+{
+  dns_stat.failures++;
+  pEntry->state = DNS_STATE_DONE;
+  pEntry->ttl   = DNS_NEG_TTL;
+  ip_addr_set_zero(&pEntry->ipaddr);
+  dns_call_found(pEntry, NULL);
+}
+
 /**
  * dns_check_entry() - see if pEntry has not yet been queried and, if so, sends out a query.
  * Check an entry in the dns_table:
@@ -669,12 +757,8 @@ dns_check_entry(u8_t i)
             break;
           } else {
             LWIP_DEBUGF(DNS_DEBUG, ("dns_check_entry: \"%s\": timeout\n", pEntry->name));
-            /* call specified callback function if provided */
-            if (pEntry->found)
-              (*pEntry->found)(pEntry->name, NULL, pEntry->arg);
-            /* flush this entry */
-            pEntry->state   = DNS_STATE_UNUSED;
-            pEntry->found   = NULL;
+            /* call the callbacks, and remember the failure for a while */
+            dns_negative(pEntry);
             break;
           }
         }
@@ -693,8 +777,13 @@ dns_check_entry(u8_t i)
     }
 
     case DNS_STATE_DONE: {
+      /* callers of a name that failed before are told here, after
+         dns_gethostbyname() returned */
+      if (pEntry->found != NULL || pEntry->waiters != NULL) {
+        dns_call_found(pEntry, NULL);
+      }
       /* if the time to live is nul */
-      if (--pEntry->ttl == 0) {
+      if (pEntry->state == DNS_STATE_DONE && --pEntry->ttl == 0) {
         LWIP_DEBUGF(DNS_DEBUG, ("dns_check_entry: \"%s\": flush\n", pEntry->name));
         /* flush this entry */
         pEntry->state = DNS_STATE_UNUSED;
@@ -806,16 +895,16 @@ dns_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *addr, u16_t
             pEntry->ttl = ntohl(ans.ttl);
             if (pEntry->ttl > DNS_MAX_TTL) {
               pEntry->ttl = DNS_MAX_TTL;
+            } else if (pEntry->ttl == 0) {
+              pEntry->ttl = 1;      /* at least the callers asking now share it */
             }
             /* read the IP address after answer resource record's header */
             SMEMCPY(&(pEntry->ipaddr), (pHostname+SIZEOF_DNS_ANSWER), sizeof(ip_addr_t));
             LWIP_DEBUGF(DNS_DEBUG, ("dns_recv: \"%s\": response = ", pEntry->name));
             ip_addr_debug_print(DNS_DEBUG, (&(pEntry->ipaddr)));
             LWIP_DEBUGF(DNS_DEBUG, ("\n"));
-            /* call specified callback function if provided */
-            if (pEntry->found) {
-              (*pEntry->found)(pEntry->name, &pEntry->ipaddr, pEntry->arg);
-            }
+            /* call the callbacks of everybody asking */
+            dns_call_found(pEntry, &pEntry->ipaddr);
             /* deallocate memory and return */
             goto memerr;
           } else {
@@ -834,13 +923,9 @@ dns_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *addr, u16_t
   goto memerr;
 
 responseerr:
-  /* ERROR: call specified callback function with NULL as name to indicate an error */
-  if (pEntry->found) {
-    (*pEntry->found)(pEntry->name, NULL, pEntry->arg);
-  }
-  /* flush this entry */
-  pEntry->state = DNS_STATE_UNUSED;
-  pEntry->found = NULL;
+  /* ERROR: call the callbacks with NULL to indicate an error, and keep the
+     failure for a while */
+  dns_negative(pEntry);
 
 memerr:
   /* free pbuf */
@@ -865,16 +950,17 @@ dns_enqueue(const char *name, dns_found_callback found, void *callback_arg)
   size_t namelen;
 
   /* search an unused entry, or the oldest one */
-  lseq = lseqi = 0;
+  lseq = 0;
+  lseqi = DNS_TABLE_SIZE;
   for (i = 0; i < DNS_TABLE_SIZE; ++i) {
     pEntry = &dns_table[i];
     /* is it an unused entry ? */
     if (pEntry->state == DNS_STATE_UNUSED)
       break;
 
-    /* check if this is the oldest completed entry */
-    if (pEntry->state == DNS_STATE_DONE) {
-      if ((dns_seqno - pEntry->seqno) > lseq) {
+    /* check if this is the oldest completed entry nobody waits for */
+    if ((pEntry->state == DNS_STATE_DONE) && (pEntry->found == NULL) && (pEntry->waiters == NULL)) {
+      if ((lseqi == DNS_TABLE_SIZE) || ((u8_t)(dns_seqno - pEntry->seqno) > lseq)) {
         lseq = dns_seqno - pEntry->seqno;
         lseqi = i;
       }
@@ -886,6 +972,7 @@ dns_enqueue(const char *name, dns_found_callback found, void *callback_arg)
     if ((lseqi >= DNS_TABLE_SIZE) || (dns_table[lseqi].state != DNS_STATE_DONE)) {
       /* no entry can't be used now, table is full */
       LWIP_DEBUGF(DNS_DEBUG, ("dns_enqueue: \"%s\": DNS entries table is full\n", name));
+      dns_stat.full++;
       return ERR_MEM;
     } else {
       /* use the oldest completed one */
@@ -898,10 +985,12 @@ dns_enqueue(const char *name, dns_found_callback found, void *callback_arg)
   LWIP_DEBUGF(DNS_DEBUG, ("dns_enqueue: \"%s\": use DNS entry %"U16_F"\n", name, (u16_t)(i)));
 
   /* fill the entry */
+  dns_stat.misses++;
   pEntry->state = DNS_STATE_NEW;
   pEntry->seqno = dns_seqno++;
   pEntry->found = found;
   pEntry->arg   = callback_arg;
+  pEntry->waiters = NULL;
   namelen = LWIP_MIN(strlen(name), DNS_MAX_NAME_LENGTH-1);
   MEMCPY(pEntry->name, name, namelen);
   pEntry->name[namelen] = 0;
@@ -937,6 +1026,8 @@ dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback foun
                   void *callback_arg)
 {
   u32_t ipaddr;
+  u8_t i;
+  struct dns_table_entry *pEntry;
   /* not initialized or no valid server yet, or invalid addr pointer
    * or invalid hostname or invalid hostname length */
   if ((dns_pcb == NULL) || (addr == NULL) ||
@@ -954,17 +1045,57 @@ dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback foun
 
   /* host name already in octet notation? set ip addr and return ERR_OK */
   ipaddr = ipaddr_addr(hostname);
-  if (ipaddr == IPADDR_NONE) {
-    /* already have this address cached? */
-//    ipaddr = dns_lookup(hostname);
-  }
   if (ipaddr != IPADDR_NONE) {
     ip4_addr_set_u32(addr, ipaddr);
     return ERR_OK;
   }
 
+  /* already have this name in the table, answered or on its way? */
+  for (i = 0; i < DNS_TABLE_SIZE; ++i) {
+    pEntry = &dns_table[i];
+    if (pEntry->state == DNS_STATE_UNUSED || strcmp(hostname, pEntry->name) != 0) {
+      continue;
+    }
+    if (pEntry->state == DNS_STATE_DONE && !ip_addr_isany(&pEntry->ipaddr)) {
+      dns_stat.hits++;
+      pEntry->seqno = dns_seqno++;    /* the last one used goes last */
+      ip_addr_copy(*addr, pEntry->ipaddr);
+      return ERR_OK;
+    }
+    /* a query on its way, or a failure the callback hears of on the next
+       dns_tmr() */
+    if (pEntry->state == DNS_STATE_DONE) {
+      dns_stat.negative++;
+    } else {
+      dns_stat.coalesced++;
+    }
+    if (dns_add_caller(pEntry, found, callback_arg) != ERR_OK) {
+      return ERR_MEM;
+    }
+    return ERR_INPROGRESS;
+  }
+
   /* queue query with specified callback */
   return dns_enqueue(hostname, found, callback_arg);
 }
 
+/**
+ * Get the counters of the resolver table.
+ *
+ * @param stats filled in, with the number of names in the table
+ */
+void ICACHE_FLASH_ATTR
+dns_getstats(struct dns_stats *stats)
+{
+  u8_t i;
+
+  *stats = dns_stat;
+  stats->entries = 0;
+  for (i = 0; i < DNS_TABLE_SIZE; ++i) {
+    if (dns_table[i].state != DNS_STATE_UNUSED) {
+      stats->entries++;
+    }
+  }
+}
+
 #endif /* LWIP_DNS */
@@ -471,6 +471,53 @@ memp_free(memp_t type, void *mem)
 }
 
 #endif /* MEMP_MEM_MALLOC */
+
+#if MEMP_MEM_MALLOC && LWIP_COUNTERS
+
+const char *memp_desc[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name,num,size,desc,attr)  (desc),
+#include "lwip/memp_std.h"
+};
+
+/**
+ * Get an element of a pool from the heap, counting it against the pool.
+ *
+ * @param type the pool to get an element from
+ * @return a pointer to the element or NULL if the heap is out
+ */
+void *
+memp_malloc(memp_t type)
+{
+  struct counters_memp *c = &lwip_counters.memp[type];
+  void *mem = mem_malloc(memp_sizes[type]);
+
+  if (mem == NULL) {
+    c->err++;
+    return NULL;
+  }
+  if (++c->used > c->max) {
+    c->max = c->used;
+  }
+  return mem;
+}
+
+/**
+ * Give an element of a pool back to the heap.
+ *
+ * @param type the pool mem was taken from
+ * @param mem the element to free
+ */
+void
+memp_free(memp_t type, void *mem)
+{
+  if (mem == NULL) {
+    return;
+  }
+  lwip_counters.memp[type].used--;
+  mem_free(mem);
+}
+
+#endif /* MEMP_MEM_MALLOC && LWIP_COUNTERS */
 #if 0
 void memp_dump(void)
 {
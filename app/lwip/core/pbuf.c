@@ -255,6 +255,7 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
     LWIP_DEBUGF(PBUF_DEBUG | LWIP_DBG_TRACE, ("pbuf_alloc: allocated pbuf %p\n", (void *)p));
     if (p == NULL) {
       PBUF_POOL_IS_EMPTY();
+      COUNTER_INC(pbuf_err);
       return NULL;
     }
     p->type = type;
@@ -287,6 +288,7 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
       q = (struct pbuf *)memp_malloc(MEMP_PBUF_POOL);
       if (q == NULL) {
         PBUF_POOL_IS_EMPTY();
+        COUNTER_INC(pbuf_err);
         /* free chain so far allocated */
         pbuf_free(p);
         /* bail out unsuccesfully */
@@ -322,6 +324,7 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
     /* If pbuf is to be allocated in RAM, allocate memory for it. */
     p = (struct pbuf*)mem_malloc(LWIP_MEM_ALIGN_SIZE(SIZEOF_STRUCT_PBUF + offset) + LWIP_MEM_ALIGN_SIZE(length));
     if (p == NULL) {
+      COUNTER_INC(pbuf_err);
       return NULL;
     }
     /* Set up internal structure of the pbuf. */
@@ -346,6 +349,7 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
       LWIP_DEBUGF(PBUF_DEBUG | LWIP_DBG_LEVEL_SERIOUS,
                   ("pbuf_alloc: Could not allocate MEMP_PBUF for PBUF_%s.\n",
                   (type == PBUF_ROM) ? "ROM" : "REF"));
+      COUNTER_INC(pbuf_err);
       return NULL;
     }
     /* caller must set this field properly, afterwards */
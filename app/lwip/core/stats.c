@@ -38,6 +38,12 @@
 
 #include "lwip/opt.h"
 
+#if LWIP_COUNTERS
+#include "lwip/stats.h"
+
+struct counters_ lwip_counters;
+#endif /* LWIP_COUNTERS */
+
 #if LWIP_STATS /* don't build if not configured for use in lwipopts.h */
 
 #include "lwip/def.h"
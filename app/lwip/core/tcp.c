@@ -1180,10 +1180,49 @@ tcp_kill_timewait(void)
   if (inactive != NULL) {
     LWIP_DEBUGF(TCP_DEBUG, ("tcp_kill_timewait: killing oldest TIME-WAIT PCB %p (%"S32_F")\n",
            (void *)inactive, inactivity));
+    COUNTER_INC(tcp_tw_recycled);
     tcp_abort(inactive);
   }
 }
 
+#if TCP_TIMEWAIT_MAX
+/**
+ * Takes the oldest pcb in TIME_WAIT off its list once TCP_TIMEWAIT_MAX of
+ * them are waiting, for tcp_alloc() to use again. A server taking short
+ * connections at a steady rate would otherwise hold them for 2 * TCP_MSL.
+ * pcbs still known to their application (callback_arg set) are left alone.
+ *
+ * @return the pcb or NULL if fewer are waiting
+ */
+static struct tcp_pcb * ICACHE_FLASH_ATTR
+tcp_reuse_timewait(void)
+{
+  struct tcp_pcb *pcb, *inactive;
+  u32_t inactivity;
+  u16_t n;
+
+  n = 0;
+  inactivity = 0;
+  inactive = NULL;
+  for(pcb = tcp_tw_pcbs; pcb != NULL; pcb = pcb->next) {
+    n++;
+    if (pcb->callback_arg == NULL &&
+        (u32_t)(tcp_ticks - pcb->tmr) >= inactivity) {
+      inactivity = tcp_ticks - pcb->tmr;
+      inactive = pcb;
+    }
+  }
+  if (n < TCP_TIMEWAIT_MAX || inactive == NULL) {
+    return NULL;
+  }
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_reuse_timewait: reusing oldest TIME-WAIT PCB %p (%"S32_F")\n",
+         (void *)inactive, inactivity));
+  COUNTER_INC(tcp_tw_recycled);
+  tcp_pcb_remove(&tcp_tw_pcbs, inactive);
+  return inactive;
+}
+#endif /* TCP_TIMEWAIT_MAX */
+
 /**
  * Allocate a new tcp_pcb structure.
  *����һ��TCP���ƿ�ṹ������ʼ������ֶ�
@@ -1196,7 +1235,15 @@ tcp_alloc(u8_t prio)
   struct tcp_pcb *pcb;
   u32_t iss;
   
+#if TCP_TIMEWAIT_MAX
+  /* Take over the oldest TIME-WAIT pcb rather than add to the heap. */
+  pcb = tcp_reuse_timewait();
+  if (pcb == NULL) {
+    pcb = (struct tcp_pcb *)memp_malloc(MEMP_TCP_PCB);
+  }
+#else /* TCP_TIMEWAIT_MAX */
   pcb = (struct tcp_pcb *)memp_malloc(MEMP_TCP_PCB);//�����ڴ�ؿռ�
+#endif /* TCP_TIMEWAIT_MAX */
   if (pcb == NULL) {
 	//os_printf("tcp_pcb memory is fail\n");
 	/* Try killing oldest connection in TIME-WAIT. */
@@ -910,6 +910,9 @@ tcp_receive(struct tcp_pcb *pcb)
     if (TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
        (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
        (pcb->snd_wl2 == ackno && tcphdr->wnd > pcb->snd_wnd)) {
+      if (tcphdr->wnd == 0 && pcb->snd_wnd != 0) {
+        COUNTER_INC(tcp_zero_wnd);
+      }
       pcb->snd_wnd = tcphdr->wnd;
       pcb->snd_wl1 = seqno;
       pcb->snd_wl2 = ackno;
@@ -1390,6 +1393,10 @@ tcp_receive(struct tcp_pcb *pcb)
       } else {
         /* We get here if the incoming segment is out-of-sequence. */
         tcp_send_empty_ack(pcb);
+#if !TCP_QUEUE_OOSEQ
+        /* with nowhere to keep it the segment is dropped */
+        COUNTER_INC(tcp_ooseq_drop);
+#endif /* !TCP_QUEUE_OOSEQ */
 #if TCP_QUEUE_OOSEQ
         /* We queue the segment on the ->ooseq queue. */
         if (pcb->ooseq == NULL) {
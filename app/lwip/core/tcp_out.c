@@ -1251,6 +1251,7 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
 
   /* increment number of retransmissions */
   ++pcb->nrtx;
+  COUNTER_INC(tcp_rexmit);
 
   /* Don't take any RTT measurements after retransmitting. */
   pcb->rttest = 0;
@@ -1290,6 +1291,7 @@ tcp_rexmit(struct tcp_pcb *pcb)
   *cur_seg = seg;
 
   ++pcb->nrtx;
+  COUNTER_INC(tcp_rexmit);
 
   /* Don't take any rtt measurements after retransmitting. */
   pcb->rttest = 0;
@@ -0,0 +1,31 @@
+/*
+ * host stand-in for include/c_types.h: the same names, with 32 bit types
+ * that stay 32 bits on a 64 bit host
+ */
+
+#ifndef _C_TYPES_H_
+#define _C_TYPES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef unsigned char       uint8;
+typedef signed char         sint8;
+typedef unsigned short      uint16;
+typedef signed short        sint16;
+typedef unsigned int        uint32;
+typedef signed int          sint32;
+
+#define LOCAL       static
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+
+typedef unsigned char   bool;
+#define BOOL            bool
+#define true            (1)
+#define false           (0)
+#define TRUE            true
+#define FALSE           false
+
+#endif /* _C_TYPES_H_ */
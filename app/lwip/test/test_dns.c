@@ -0,0 +1,187 @@
+/*
+ * test_dns.c
+ *
+ * host check of the resolver table in ../core/dns.c: answers kept for their
+ * TTL, queries for the same name joined, failed names answered from the table
+ *
+ *   gcc -std=gnu99 -D__ets__ -DLWIP_OPEN_SRC -Ihost -I../../include -I../../../include \
+ *       test_dns.c ../core/dns.c -o test_dns
+ *   ./test_dns
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lwip/opt.h"
+#include "lwip/udp.h"
+#include "lwip/pbuf.h"
+#include "lwip/dns.h"
+
+static int failed;
+
+#define CHECK(c) do { if(!(c)){ printf("%s:%d: %s\n", __FILE__, __LINE__, #c); failed++; } } while(0)
+
+/* what dns.c needs from the rest of the stack */
+
+const ip_addr_t ip_addr_any = { 0 };
+
+void *pvPortMalloc(size_t n) { return malloc(n); }
+void vPortFree(void *p) { free(p); }
+
+u32_t ipaddr_addr(const char *cp)
+{
+  unsigned a, b, c, d;
+  if(sscanf(cp, "%u.%u.%u.%u", &a, &b, &c, &d) == 4)
+    return a | b << 8 | c << 16 | d << 24;
+  return IPADDR_NONE;
+}
+
+static struct udp_pcb pcb;
+static udp_recv_fn recv_fn;
+static unsigned char query[600];
+static int query_len, queries;
+
+struct udp_pcb *udp_new(void) { return &pcb; }
+err_t udp_bind(struct udp_pcb *p, ip_addr_t *a, u16_t port) { return ERR_OK; }
+err_t udp_connect(struct udp_pcb *p, ip_addr_t *a, u16_t port) { return ERR_OK; }
+void udp_recv(struct udp_pcb *p, udp_recv_fn f, void *arg) { recv_fn = f; }
+
+err_t udp_sendto(struct udp_pcb *p, struct pbuf *b, ip_addr_t *a, u16_t port)
+{
+  memcpy(query, b->payload, b->len);
+  query_len = b->len;
+  queries++;
+  return ERR_OK;
+}
+
+struct pbuf *pbuf_alloc(pbuf_layer l, u16_t len, pbuf_type t)
+{
+  struct pbuf *p = calloc(1, sizeof(*p));
+  p->payload = calloc(1, len);
+  p->len = p->tot_len = len;
+  return p;
+}
+
+void pbuf_realloc(struct pbuf *p, u16_t len) { p->len = p->tot_len = len; }
+u8_t pbuf_free(struct pbuf *p) { free(p->payload); free(p); return 1; }
+
+u16_t pbuf_copy_partial(struct pbuf *p, void *d, u16_t len, u16_t off)
+{
+  memcpy(d, (char *)p->payload + off, len);
+  return len;
+}
+
+// the server answers the last query with one A record, or with rcode
+static void answer(int rcode, u32_t ip, u32_t ttl)
+{
+  unsigned char a[] = { 0xc0, 0x0c, 0, 1, 0, 1,
+    ttl >> 24, ttl >> 16, ttl >> 8, ttl, 0, 4, ip, ip >> 8, ip >> 16, ip >> 24 };
+  struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, query_len + sizeof(a), PBUF_RAM);
+  unsigned char *b = p->payload;
+
+  memcpy(b, query, query_len);
+  b[2] = 0x81;
+  b[3] = 0x80 | rcode;
+  b[7] = rcode ? 0 : 1;
+  if(!rcode)
+    memcpy(b + query_len, a, sizeof(a));  // else zeros, only there for the size check
+  recv_fn(NULL, &pcb, p, NULL, 53);
+}
+
+static int found_calls, found_nulls;
+static u32_t found_ip;
+
+static void found(const char *name, ip_addr_t *ip, void *arg)
+{
+  found_calls++;
+  if(ip)
+    found_ip = ip->addr;
+  else
+    found_nulls++;
+}
+
+static struct dns_stats stats(void)
+{
+  struct dns_stats s;
+  dns_getstats(&s);
+  return s;
+}
+
+static void test_cache(void)
+{
+  ip_addr_t a;
+  int i;
+
+  // three asks while the first is on its way go out as one query
+  CHECK(dns_gethostbyname("a.com", &a, found, NULL) == ERR_INPROGRESS);
+  CHECK(dns_gethostbyname("a.com", &a, found, NULL) == ERR_INPROGRESS);
+  CHECK(dns_gethostbyname("a.com", &a, found, NULL) == ERR_INPROGRESS);
+  CHECK(queries == 1 && stats().misses == 1 && stats().coalesced == 2);
+  answer(0, 0x04030201, 3);
+  CHECK(found_calls == 3 && found_nulls == 0 && found_ip == 0x04030201);
+
+  // answered from the table, without a callback
+  a.addr = 0;
+  CHECK(dns_gethostbyname("a.com", &a, found, NULL) == ERR_OK);
+  CHECK(a.addr == 0x04030201 && found_calls == 3 && stats().hits == 1);
+
+  // asked again once the TTL ran out
+  for(i = 0; i < 3; i++)
+    dns_tmr();
+  CHECK(dns_gethostbyname("a.com", &a, found, NULL) == ERR_INPROGRESS);
+  CHECK(queries == 2);
+  answer(0, 0x04030201, 300);
+  CHECK(found_calls == 4);
+}
+
+static void test_negative(void)
+{
+  ip_addr_t a;
+  int calls = found_calls, nulls = found_nulls, q = queries, i;
+
+  CHECK(dns_gethostbyname("nx.com", &a, found, NULL) == ERR_INPROGRESS);
+  answer(3, 0, 0);
+  CHECK(found_calls == calls + 1 && found_nulls == nulls + 1 && stats().failures == 1);
+
+  // failed again from the table on the next tick, nothing sent
+  CHECK(dns_gethostbyname("nx.com", &a, found, NULL) == ERR_INPROGRESS);
+  CHECK(found_calls == calls + 1 && stats().negative == 1);
+  dns_tmr();
+  CHECK(found_calls == calls + 2 && found_nulls == nulls + 2 && queries == q + 1);
+
+  // asked again after DNS_NEG_TTL
+  for(i = 0; i < DNS_NEG_TTL; i++)
+    dns_tmr();
+  CHECK(dns_gethostbyname("nx.com", &a, found, NULL) == ERR_INPROGRESS);
+  CHECK(queries == q + 2);
+}
+
+static void test_full(void)
+{
+  ip_addr_t a;
+  char name[16];
+  int i, busy = 0;
+
+  // names still being asked for are not thrown out of the table
+  for(i = 0; i < DNS_TABLE_SIZE + 2; i++){
+    sprintf(name, "h%d.com", i);
+    if(dns_gethostbyname(name, &a, found, NULL) != ERR_INPROGRESS)
+      busy++;
+  }
+  CHECK(busy > 0 && stats().full == (u32_t)busy);
+
+  // every query in flight gives up in the end, and tells its caller
+  for(i = 0; i < 40; i++)
+    dns_tmr();
+  CHECK(stats().entries == 0);
+}
+
+int main(int argc, char **args)
+{
+  dns_init();
+  test_cache();
+  test_negative();
+  test_full();
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -40,6 +40,9 @@ LUALIB_API int ( luaopen_bit )( lua_State *L );
 #define AUXLIB_NET      "net"
 LUALIB_API int ( luaopen_net )( lua_State *L );
 
+#define AUXLIB_HTTP     "http"
+LUALIB_API int ( luaopen_http )( lua_State *L );
+
 #define AUXLIB_CPU      "cpu"
 LUALIB_API int ( luaopen_cpu )( lua_State* L );
 
@@ -9,7 +9,10 @@
 
 #include "c_types.h"
 #include "flash_fs.h"
+#include "romfs.h"
 #include "c_string.h"
+#include "c_stdlib.h"
+#include "osapi.h"
 
 static volatile int file_fd = FS_OPEN_OK - 1;
 
@@ -83,21 +86,35 @@ static int file_list( lua_State* L )
 
 extern spiffs fs;
 
-// Lua: list()
+// Lua: list([prefix[, max[, cursor]]])
+// returns name -> size for at most max files, plus the cursor to pass to
+// the next call while there are more
 static int file_list( lua_State* L )
 {
-  spiffs_DIR d;
-  struct spiffs_dirent e;
-  struct spiffs_dirent *pe = &e;
+  const char *prefix = luaL_optstring( L, 1, NULL );
+  uint32_t max = luaL_optinteger( L, 2, 0 );
+  uint32_t cursor = luaL_optinteger( L, 3, 0 );
+  struct spiffs_dirent e[4];
+  uint32_t count = 0;
 
   lua_newtable( L );
-  SPIFFS_opendir(&fs, "/", &d);
-  while ((pe = SPIFFS_readdir(&d, pe))) {
-    // NODE_ERR("  %s size:%i\n", pe->name, pe->size);
-    lua_pushinteger(L, pe->size);
-    lua_setfield( L, -2, pe->name );
+  while (cursor != SPIFFS_LIST_END && (max == 0 || count < max)) {
+    uint32_t want = sizeof(e) / sizeof(e[0]);
+    if (max > 0 && max - count < want)
+      want = max - count;
+    s32_t i, n = SPIFFS_list(&fs, &cursor, prefix, e, want);
+    if (n < 0)
+      return luaL_error(L, "file system error");
+    for (i = 0; i < n; i++) {
+      lua_pushinteger(L, e[i].size);
+      lua_setfield( L, -2, (char *)e[i].name );
+    }
+    count += n;
+  }
+  if (max > 0 && cursor != SPIFFS_LIST_END) {
+    lua_pushinteger(L, cursor);
+    return 2;
   }
-  SPIFFS_closedir(&d);
   return 1;
 }
 
@@ -140,15 +157,161 @@ static int file_flush( lua_State* L )
     lua_pushnil(L);
   return 1;
 }
-#if 0
-// Lua: check()
+static os_timer_t check_timer;
+static spiffs_check_state check_state;
+static u8_t *check_work = NULL;
+static int check_ref = LUA_NOREF;
+static int check_steps = 1;
+static lua_State *check_L = NULL;
+static u32_t check_fixes, check_reported;
+static int check_percent;
+static int check_run;     // a check(nil) or a new check() from a callback changes it
+
+// called inside the file system, only counts, Lua is called between steps
+static void file_check_report( spiffs_check_type type, spiffs_check_report report, u32_t arg1, u32_t arg2 )
+{
+  if( report == SPIFFS_CHECK_PROGRESS ){
+    check_percent = (type * 256 + (arg1 > 256 ? 256 : arg1)) * 100 / (3 * 256);
+  } else if( report != SPIFFS_CHECK_ERROR ){
+    check_fixes++;
+  }
+}
+
+static void file_check_stop( void )
+{
+  os_timer_disarm(&check_timer);
+  c_free(check_work);
+  check_work = NULL;
+  luaL_unref(check_L, LUA_REGISTRYINDEX, check_ref);
+  check_ref = LUA_NOREF;
+}
+
+// calls back with ("progress", percent), ("fix", count), ("done", fixes)
+// or ("error", code)
+static void file_check_timer_cb( void *arg )
+{
+  lua_State *L = check_L;
+  int last_percent = check_percent;
+  int run = check_run;
+  int i, res = 1;
+  for( i = 0; i < check_steps && res > 0; i++ )
+    res = SPIFFS_check_step(&fs, &check_state);
+  if( check_fixes > check_reported ){
+    lua_rawgeti(L, LUA_REGISTRYINDEX, check_ref);
+    lua_pushstring(L, "fix");
+    lua_pushinteger(L, check_fixes - check_reported);
+    check_reported = check_fixes;
+    lua_call(L, 2, 0);
+    if( check_work == NULL || check_run != run )
+      return;   // stopped or started over by the callback
+  }
+  if( res > 0 ){
+    if( check_percent != last_percent ){
+      lua_rawgeti(L, LUA_REGISTRYINDEX, check_ref);
+      lua_pushstring(L, "progress");
+      lua_pushinteger(L, check_percent);
+      lua_call(L, 2, 0);
+    }
+    return;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, check_ref);
+  if( res == 0 ){
+    lua_pushstring(L, "done");
+    lua_pushinteger(L, check_fixes);
+  } else {
+    lua_pushstring(L, "error");
+    lua_pushinteger(L, SPIFFS_errno(&fs));
+    SPIFFS_clearerr(&fs);
+  }
+  file_check_stop();
+  lua_call(L, 2, 0);
+}
+
+// Lua: check(function(event, n) end, [interval_ms], [steps]), check(nil) stops it
+// Runs the consistency check in the background, at most one block of the
+// file system per step, so it can run on a live system without long stalls.
 static int file_check( lua_State* L )
 {
-  file_close(L);
-  lua_pushinteger(L, fs_check());
+  if( check_work )
+    file_check_stop();
+  if( lua_isnoneornil(L, 1) )
+    return 0;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  int interval = luaL_optint(L, 2, 10);
+  int steps = luaL_optint(L, 3, 1);
+  if( interval < 1 || steps < 1 )
+    return luaL_error( L, "wrong arg range" );
+
+  check_work = (u8_t *)c_malloc(fs.cfg.log_page_size);
+  if( !check_work )
+    return luaL_error( L, "not enough memory" );
+  if( SPIFFS_check_start(&fs, &check_state, check_work, file_check_report) < 0 ){
+    SPIFFS_clearerr(&fs);
+    c_free(check_work);
+    check_work = NULL;
+    return luaL_error( L, "file system not mounted" );
+  }
+  lua_pushvalue(L, 1);
+  check_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  check_L = L;
+  check_run++;
+  check_steps = steps;
+  check_fixes = check_reported = 0;
+  check_percent = 0;
+  os_timer_setfn(&check_timer, (os_timer_func_t *)file_check_timer_cb, NULL);
+  os_timer_arm(&check_timer, interval, 1);
+  return 0;
+}
+
+// Lua: replace(filename, [data])
+// With data, the file gets the new content in one step. Without, the file is
+// opened for writing a replacement, which file.commit() puts in its place and
+// file.close() drops. Readers see the old content until then, also after a
+// reset halfway.
+static int file_replace( lua_State* L )
+{
+  size_t len, dlen;
+  if((FS_OPEN_OK - 1)!=file_fd){
+    fs_close(file_fd);
+    file_fd = FS_OPEN_OK - 1;
+  }
+
+  const char *fname = luaL_checklstring( L, 1, &len );
+  if( len > FS_NAME_MAX_LENGTH )
+    return luaL_error(L, "filename too long");
+  if( lua_isnoneornil(L, 2) ){
+    file_fd = fs_open(fname, FS_REPLACE|FS_RDWR|FS_TRUNC);
+    if(file_fd < FS_OPEN_OK){
+      file_fd = FS_OPEN_OK - 1;
+      lua_pushnil(L);
+    } else {
+      lua_pushboolean(L, 1);
+    }
+    return 1;
+  }
+  const char *data = luaL_checklstring( L, 2, &dlen );
+  if( SPIFFS_replace(&fs, (char *)fname, (u8_t *)data, dlen) < 0 ){
+    SPIFFS_clearerr(&fs);
+    lua_pushnil(L);
+  } else {
+    lua_pushboolean(L, 1);
+  }
+  return 1;
+}
+
+// Lua: commit()
+static int file_commit( lua_State* L )
+{
+  if((FS_OPEN_OK - 1)==file_fd)
+    return luaL_error(L, "open a file first");
+  int res = fs_commit(file_fd);
+  file_fd = FS_OPEN_OK - 1;
+  if(res == 0)
+    lua_pushboolean(L, 1);
+  else
+    lua_pushnil(L);
   return 1;
 }
-#endif
 
 // Lua: rename("oldname", "newname")
 static int file_rename( lua_State* L )
@@ -176,21 +339,240 @@ static int file_rename( lua_State* L )
 }
 
 // Lua: fsinfo()
+// returns remaining, used, total and deleted bytes, the deleted ones are
+// free again once garbage collected, and the number of erased blocks
 static int file_fsinfo( lua_State* L )
 {
-  uint32_t total, used;
-  SPIFFS_info(&fs, &total, &used);
-  NODE_DBG("total: %d, used:%d\n", total, used);
-  if(total>0x7FFFFFFF || used>0x7FFFFFFF || used > total)
+  spiffs_fsinfo info;
+  SPIFFS_fsinfo(&fs, &info);
+  NODE_DBG("total: %d, used:%d, deleted:%d\n", info.total, info.used, info.deleted);
+  if(info.total>0x7FFFFFFF || info.used>0x7FFFFFFF || info.used > info.total)
   {
     return luaL_error(L, "file system error");;
   }
-  lua_pushinteger(L, total-used);
-  lua_pushinteger(L, used);
-  lua_pushinteger(L, total);
-  return 3;
+  lua_pushinteger(L, info.total-info.used);
+  lua_pushinteger(L, info.used);
+  lua_pushinteger(L, info.total);
+  lua_pushinteger(L, info.deleted);
+  lua_pushinteger(L, info.free_blocks);
+  return 5;
+}
+
+
+static os_timer_t gc_timer;
+static int gc_keep_free_blocks = SPIFFS_GC_KEEP_FREE_BLOCKS;
+
+// do at most budget gc steps, returns the number of steps done
+static int file_gc_run( int budget )
+{
+  int done = 0;
+  while( done < budget && fs_gc_step(gc_keep_free_blocks) > 0 )
+    done++;
+  return done;
 }
 
+static void file_gc_timer_cb( void *arg )
+{
+  file_gc_run(1);   // one step per tick, keep each slice short
+}
+
+// Lua: gc_step([budget])
+static int file_gc_step( lua_State* L )
+{
+  int budget = luaL_optint(L, 1, 1);
+  if( budget < 1 )
+    return luaL_error( L, "wrong arg range" );
+  lua_pushinteger(L, file_gc_run(budget));
+  return 1;
+}
+
+// Lua: gc_auto(interval_ms, [keep_free_blocks]), interval 0 stops it
+static int file_gc_auto( lua_State* L )
+{
+  int interval = luaL_checkinteger(L, 1);
+  int keep = luaL_optint(L, 2, SPIFFS_GC_KEEP_FREE_BLOCKS);
+  if( interval < 0 || keep < 1 )
+    return luaL_error( L, "wrong arg range" );
+  gc_keep_free_blocks = keep;
+  os_timer_disarm(&gc_timer);
+  if( interval > 0 ){
+    os_timer_setfn(&gc_timer, (os_timer_func_t *)file_gc_timer_cb, NULL);
+    os_timer_arm(&gc_timer, interval, 1);
+  }
+  return 0;
+}
+
+#define LOG_BUF_SIZE        (2*fs.cfg.log_page_size)   // two pages, rounded down to data pages
+#define LOG_REC_MAX         1024
+
+static spiffs_log file_log;
+static u8_t *log_buf = NULL;
+
+// Lua: log_open(name, max_size, [segments])
+static int file_log_open( lua_State* L )
+{
+  size_t len;
+  const char *name = luaL_checklstring( L, 1, &len );
+  if( len > FS_NAME_MAX_LENGTH )
+    return luaL_error(L, "filename too long");
+  int max_size = luaL_checkinteger( L, 2 );
+  int segments = luaL_optint( L, 3, 4 );
+  if( max_size <= 0 || segments < 2 )
+    return luaL_error( L, "wrong arg range" );
+
+  // taken anew each time, a remount may have changed the page size
+  if( log_buf ){
+    SPIFFS_log_close(&file_log);
+    c_free(log_buf);
+  }
+  log_buf = (u8_t *)c_malloc(LOG_BUF_SIZE);
+  if( !log_buf )
+    return luaL_error( L, "not enough memory" );
+  if( SPIFFS_log_open(&fs, &file_log, (char *)name, max_size, segments,
+      log_buf, LOG_BUF_SIZE) < 0 ){
+    c_free(log_buf);
+    log_buf = NULL;
+    lua_pushnil(L);
+  } else {
+    lua_pushboolean(L, 1);
+  }
+  return 1;
+}
+
+// Lua: log_append(string)
+static int file_log_append( lua_State* L )
+{
+  size_t len;
+  const char *rec = luaL_checklstring( L, 1, &len );
+  if( !log_buf )
+    return luaL_error(L, "open a log first");
+  if( len > LOG_REC_MAX )
+    return luaL_error( L, "record too long" );
+  if( SPIFFS_log_append(&file_log, (void *)rec, len) < 0 )
+    lua_pushnil(L);
+  else
+    lua_pushboolean(L, 1);
+  return 1;
+}
+
+// Lua: log_flush()
+static int file_log_flush( lua_State* L )
+{
+  if( !log_buf )
+    return luaL_error(L, "open a log first");
+  if( SPIFFS_log_flush(&file_log) < 0 )
+    lua_pushnil(L);
+  else
+    lua_pushboolean(L, 1);
+  return 1;
+}
+
+// Lua: log_close()
+static int file_log_close( lua_State* L )
+{
+  if( log_buf ){
+    SPIFFS_log_close(&file_log);
+    c_free(log_buf);
+    log_buf = NULL;
+  }
+  return 0;
+}
+
+// Lua: log_tail([n]), returns a table with the last n records, oldest first
+static int file_log_tail( lua_State* L )
+{
+  spiffs_log_iter it;
+  int n = luaL_optint( L, 1, 10 );
+  int i = 1;
+  s32_t len;
+  if( !log_buf )
+    return luaL_error(L, "open a log first");
+  if( n < 0 )
+    return luaL_error( L, "wrong arg range" );
+
+  char *rec = (char *)c_malloc(LOG_REC_MAX);
+  if( !rec )
+    return luaL_error( L, "not enough memory" );
+  if( SPIFFS_log_iter_start(&file_log, &it, n) < 0 ){
+    c_free(rec);
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_newtable( L );
+  while( (len = SPIFFS_log_iter_next(&it, rec, LOG_REC_MAX)) >= 0 ){
+    lua_pushlstring(L, rec, len < LOG_REC_MAX ? len : LOG_REC_MAX);
+    lua_rawseti(L, -2, i++);
+  }
+  SPIFFS_log_iter_end(&it);
+  SPIFFS_clearerr(&fs);
+  c_free(rec);
+  return 1;
+}
+
+// Lua: mount({page=, cache=, fds=, format=}), mount() returns page, cache, fds
+// Remounts with another logical page size, number of cache pages or file
+// descriptors. Without a page size the one on flash is kept, another needs
+// format=true, which erases all files. Without cache pages the cache is sized
+// to the free heap. Returns true, or nil and the error code.
+static int file_mount( lua_State* L )
+{
+  u32_t page = 0, cache = 0, fds = 0;
+  int format = 0;
+  if( lua_isnoneornil(L, 1) ){
+    myspiffs_geometry(&page, &cache, &fds);
+    lua_pushinteger(L, page);
+    lua_pushinteger(L, cache);
+    lua_pushinteger(L, fds);
+    return 3;
+  }
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_getfield(L, 1, "page");
+  page = luaL_optint(L, -1, 0);
+  lua_getfield(L, 1, "cache");
+  cache = luaL_optint(L, -1, 0);
+  lua_getfield(L, 1, "fds");
+  fds = luaL_optint(L, -1, 0);
+  lua_getfield(L, 1, "format");
+  format = lua_toboolean(L, -1);
+  lua_pop(L, 4);
+  if( (int)page < 0 || (int)cache < 0 || cache > 16 || (int)fds < 0 || fds > 8 )
+    return luaL_error( L, "wrong arg range" );
+
+  // all of these hold descriptors or buffers of the mounted file system
+  file_close(L);
+  file_log_close(L);
+  if( check_work )
+    file_check_stop();
+  int res = myspiffs_remount(page, cache, fds, format);
+  if( res < 0 ){
+    lua_pushnil(L);
+    lua_pushinteger(L, res);
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+#endif
+
+#if defined(BUILD_ROMFS) || defined(BUILD_WOFS)
+// Lua: file.map(filename) returns the address (lightuserdata) and size of a
+// ROMFS/WOFS file, or nil. The file is not copied, the address is in the
+// memory mapped flash, e.g. for u8g.setFont().
+static int file_map_file( lua_State* L )
+{
+  size_t len;
+  const uint8_t *addr;
+  uint32_t size;
+  const char *fname = luaL_checklstring( L, 1, &len );
+  if( len > MAX_FNAME_LENGTH )
+    return luaL_error(L, "filename too long");
+  if( !romfs_map( fname, &addr, &size ) )
+    return 0;
+  lua_pushlightuserdata( L, (void *)addr );
+  lua_pushinteger( L, size );
+  return 2;
+}
 #endif
 
 // g_read()
@@ -234,21 +616,45 @@ static int file_g_read( lua_State* L, int n, int16_t end_char )
   return 1;  /* read at least an `eol' */ 
 }
 
+static size_t file_g_fill( lua_State* L, void *ud, char *b, size_t sz )
+{
+  return fs_read(file_fd, b, sz);
+}
+
+// reads up to n bytes with a single fs_read straight into the new string,
+// for reads without an end char
+static int file_g_read_block( lua_State* L, unsigned n )
+{
+  size_t rl;
+  if((FS_OPEN_OK - 1)==file_fd)
+    return luaL_error(L, "open a file first");
+#if defined(BUILD_SPIFFS)
+  // no bigger than what is left of the file
+  int left = (int)fs_size(file_fd) - fs_tell(file_fd);
+  if( left >= 0 && n > (unsigned)left )
+    n = left;
+#endif
+  if( n == 0 )
+    return 0;
+  lua_pushlstringf(L, n, file_g_fill, NULL);
+  lua_tolstring(L, -1, &rl);
+  return rl > 0 ? 1 : 0;
+}
+
 // Lua: read()
 // file.read() will read all byte in file
 // file.read(10) will read 10 byte from file, or EOF is reached.
 // file.read('q') will read until 'q' or EOF is reached. 
 static int file_read( lua_State* L )
 {
-  unsigned need_len = LUAL_BUFFERSIZE;
-  int16_t end_char = EOF;
   size_t el;
   if( lua_type( L, 1 ) == LUA_TNUMBER )
   {
-    need_len = ( unsigned )luaL_checkinteger( L, 1 );
-    if( need_len > LUAL_BUFFERSIZE ){
-      need_len = LUAL_BUFFERSIZE;
-    }
+    int need_len = luaL_checkinteger( L, 1 );
+    if( need_len < 0 )
+      return luaL_error( L, "wrong arg range" );
+    // any length, in one read
+    return file_g_read_block(L, need_len);
   }
   else if(lua_isstring(L, 1))
   {
@@ -256,10 +662,10 @@ static int file_read( lua_State* L )
     if(el!=1){
       return luaL_error( L, "wrong arg range" );
     }
-    end_char = (int16_t)end[0];
+    return file_g_read(L, LUAL_BUFFERSIZE, (int16_t)end[0]);
   }
 
-  return file_g_read(L, need_len, end_char);
+  return file_g_read_block(L, LUAL_BUFFERSIZE);
 }
 
 // Lua: readline()
@@ -268,14 +674,127 @@ static int file_readline( lua_State* L )
   return file_g_read(L, LUAL_BUFFERSIZE, '\n');
 }
 
-// Lua: write("string")
+#define FILE_BUFFER_MT "file.buffer"
+
+// growable byte buffer, for reading and writing without Lua strings
+typedef struct {
+  size_t size;
+  size_t len;
+  char *data;
+} file_buffer;
+
+static int file_buffer_grow( file_buffer *fb, size_t size )
+{
+  if( size <= fb->size )
+    return 1;
+  char *data = (char *)c_realloc(fb->data, size);
+  if( !data )
+    return 0;
+  fb->data = data;
+  fb->size = size;
+  return 1;
+}
+
+// Lua: buffer([size])
+static int file_buffer_new( lua_State* L )
+{
+  int size = luaL_optint(L, 1, LUAL_BUFFERSIZE);
+  if( size < 0 )
+    return luaL_error( L, "wrong arg range" );
+  file_buffer *fb = (file_buffer *)lua_newuserdata(L, sizeof(file_buffer));
+  fb->size = 0;
+  fb->len = 0;
+  fb->data = NULL;
+  luaL_getmetatable(L, FILE_BUFFER_MT);
+  lua_setmetatable(L, -2);
+  if( !file_buffer_grow(fb, size) )
+    return luaL_error( L, "not enough memory" );
+  return 1;
+}
+
+static int file_buffer_delete( lua_State* L )
+{
+  file_buffer *fb = (file_buffer *)luaL_checkudata(L, 1, FILE_BUFFER_MT);
+  c_free(fb->data);
+  fb->data = NULL;
+  fb->size = fb->len = 0;
+  return 0;
+}
+
+// Lua: buf:len()
+static int file_buffer_len( lua_State* L )
+{
+  file_buffer *fb = (file_buffer *)luaL_checkudata(L, 1, FILE_BUFFER_MT);
+  lua_pushinteger(L, fb->len);
+  return 1;
+}
+
+// Lua: buf:tostring([i, [j]]), positions as string.sub
+static int file_buffer_tostring( lua_State* L )
+{
+  file_buffer *fb = (file_buffer *)luaL_checkudata(L, 1, FILE_BUFFER_MT);
+  int len = (int)fb->len;
+  int i = luaL_optint(L, 2, 1);
+  int j = luaL_optint(L, 3, -1);
+  if( i < 0 ) i += len + 1;
+  if( j < 0 ) j += len + 1;
+  if( i < 1 ) i = 1;
+  if( j > len ) j = len;
+  if( i > j )
+    lua_pushliteral(L, "");
+  else
+    lua_pushlstring(L, fb->data + i - 1, j - i + 1);
+  return 1;
+}
+
+// Lua: buf:clear()
+static int file_buffer_clear( lua_State* L )
+{
+  file_buffer *fb = (file_buffer *)luaL_checkudata(L, 1, FILE_BUFFER_MT);
+  fb->len = 0;
+  return 0;
+}
+
+// Lua: readinto(buf, [offset], [n])
+// Reads up to n bytes to buf at offset, by default the end of the data in
+// it, and n the room left or LUAL_BUFFERSIZE. The buffer grows as needed,
+// and ends after the bytes read. Returns their number, nil at end of file.
+static int file_readinto( lua_State* L )
+{
+  file_buffer *fb = (file_buffer *)luaL_checkudata(L, 1, FILE_BUFFER_MT);
+  int offset = luaL_optint(L, 2, fb->len);
+  if( offset < 0 || (size_t)offset > fb->len )
+    return luaL_error( L, "wrong arg range" );
+  int n = luaL_optint(L, 3, fb->size > (size_t)offset ? fb->size - offset : LUAL_BUFFERSIZE);
+  if( n < 0 )
+    return luaL_error( L, "wrong arg range" );
+  if((FS_OPEN_OK - 1)==file_fd)
+    return luaL_error(L, "open a file first");
+  if( !file_buffer_grow(fb, offset + n) )
+    return luaL_error( L, "not enough memory" );
+  size_t rl = n > 0 ? fs_read(file_fd, fb->data + offset, n) : 0;
+  fb->len = offset + rl;
+  if( rl == 0 && n > 0 )
+    return 0;
+  lua_pushinteger(L, rl);
+  return 1;
+}
+
+// Lua: write("string") or write(buf)
 static int file_write( lua_State* L )
 {
   if((FS_OPEN_OK - 1)==file_fd)
     return luaL_error(L, "open a file first");
   size_t l, rl;
-  const char *s = luaL_checklstring(L, 1, &l);
-  rl = fs_write(file_fd, s, l);
+  const char *s;
+  if( lua_isuserdata(L, 1) ){
+    file_buffer *fb = (file_buffer *)luaL_checkudata(L, 1, FILE_BUFFER_MT);
+    s = fb->data;
+    l = fb->len;
+  } else {
+    s = luaL_checklstring(L, 1, &l);
+  }
+  rl = l > 0 ? fs_write(file_fd, s, l) : 0;
   if(rl==l)
     lua_pushboolean(L, 1);
   else
@@ -307,6 +826,19 @@ static int file_writeline( lua_State* L )
 // Module function map
 #define MIN_OPT_LEVEL 2
 #include "lrodefs.h"
+static const LUA_REG_TYPE file_buffer_map[] =
+{
+  { LSTRKEY( "len" ), LFUNCVAL( file_buffer_len ) },
+  { LSTRKEY( "tostring" ), LFUNCVAL( file_buffer_tostring ) },
+  { LSTRKEY( "clear" ), LFUNCVAL( file_buffer_clear ) },
+  { LSTRKEY( "__len" ), LFUNCVAL( file_buffer_len ) },
+  { LSTRKEY( "__gc" ), LFUNCVAL( file_buffer_delete ) },
+#if LUA_OPTIMIZE_MEMORY > 0
+  { LSTRKEY( "__index" ), LROVAL( file_buffer_map ) },
+#endif
+  { LNILKEY, LNILVAL }
+};
+
 const LUA_REG_TYPE file_map[] = 
 {
   { LSTRKEY( "list" ), LFUNCVAL( file_list ) },
@@ -315,16 +847,31 @@ const LUA_REG_TYPE file_map[] =
   { LSTRKEY( "write" ), LFUNCVAL( file_write ) },
   { LSTRKEY( "writeline" ), LFUNCVAL( file_writeline ) },
   { LSTRKEY( "read" ), LFUNCVAL( file_read ) },
+  { LSTRKEY( "readinto" ), LFUNCVAL( file_readinto ) },
+  { LSTRKEY( "buffer" ), LFUNCVAL( file_buffer_new ) },
   { LSTRKEY( "readline" ), LFUNCVAL( file_readline ) },
   { LSTRKEY( "format" ), LFUNCVAL( file_format ) },
+#if defined(BUILD_ROMFS) || defined(BUILD_WOFS)
+  { LSTRKEY( "map" ), LFUNCVAL( file_map_file ) },
+#endif
 #if defined(BUILD_WOFS)
 #elif defined(BUILD_SPIFFS)
   { LSTRKEY( "remove" ), LFUNCVAL( file_remove ) },
   { LSTRKEY( "seek" ), LFUNCVAL( file_seek ) },
   { LSTRKEY( "flush" ), LFUNCVAL( file_flush ) },
-  // { LSTRKEY( "check" ), LFUNCVAL( file_check ) },
+  { LSTRKEY( "check" ), LFUNCVAL( file_check ) },
   { LSTRKEY( "rename" ), LFUNCVAL( file_rename ) },
+  { LSTRKEY( "replace" ), LFUNCVAL( file_replace ) },
+  { LSTRKEY( "commit" ), LFUNCVAL( file_commit ) },
   { LSTRKEY( "fsinfo" ), LFUNCVAL( file_fsinfo ) },
+  { LSTRKEY( "mount" ), LFUNCVAL( file_mount ) },
+  { LSTRKEY( "gc_step" ), LFUNCVAL( file_gc_step ) },
+  { LSTRKEY( "gc_auto" ), LFUNCVAL( file_gc_auto ) },
+  { LSTRKEY( "log_open" ), LFUNCVAL( file_log_open ) },
+  { LSTRKEY( "log_append" ), LFUNCVAL( file_log_append ) },
+  { LSTRKEY( "log_flush" ), LFUNCVAL( file_log_flush ) },
+  { LSTRKEY( "log_close" ), LFUNCVAL( file_log_close ) },
+  { LSTRKEY( "log_tail" ), LFUNCVAL( file_log_tail ) },
 #endif
   
 #if LUA_OPTIMIZE_MEMORY > 0
@@ -336,9 +883,22 @@ const LUA_REG_TYPE file_map[] =
 LUALIB_API int luaopen_file( lua_State *L )
 {
 #if LUA_OPTIMIZE_MEMORY > 0
+  luaL_rometatable(L, FILE_BUFFER_MT, (void *)file_buffer_map);  // create metatable for file.buffer
   return 0;
 #else // #if LUA_OPTIMIZE_MEMORY > 0
+  int n;
   luaL_register( L, AUXLIB_FILE, file_map );
+  n = lua_gettop(L);
+
+  // create metatable
+  luaL_newmetatable(L, FILE_BUFFER_MT);
+  // metatable.__index = metatable
+  lua_pushliteral(L, "__index");
+  lua_pushvalue(L,-2);
+  lua_rawset(L,-3);
+  // Setup the methods inside metatable
+  luaL_register( L, NULL, file_buffer_map );
+  lua_settop(L, n);
   // Add constants
 
   return 1;
@@ -0,0 +1,2039 @@
+// Module for http and websockets, a server and clients that parse and send in C
+
+//#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+#include "platform.h"
+#include "auxmods.h"
+#include "lrotable.h"
+
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "c_stdio.h"
+
+#include "c_types.h"
+#include "mem.h"
+#include "espconn.h"
+#include "user_interface.h"
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+#include "flash_fs.h"
+
+#include "http_parser.h"
+#include "websocket.h"
+
+#define HTTP_DEFAULT_TIMEOUT  30
+#define HTTP_FILE_CHUNK       (2*TCP_MSS)   // a file is read in what fits the tcp send buffer
+#define HTTP_SEND_MAX         0x8000        // espconn_sent() takes a 16 bit length
+#define HTTP_PENDING_MAX      (HTTP_HEAD_MAX + HTTP_BODY_MAX)
+
+struct lhttp_userdata;
+struct lws_userdata;
+
+// an accepted connection, espconn->reverse points here. a close comes with
+// the listening espconn, the accepted one is freed by then: the connection
+// is found by the peer's ip and port.
+typedef struct http_conn
+{
+  struct http_conn *next;
+  struct lhttp_userdata *srv;   // NULL once the server is closed
+  struct espconn *pesp_conn;    // NULL once espconn let go of it
+  uint8_t remote_ip[4];
+  int remote_port;
+  http_request req;
+  char *out;              // response in flight, or the chunk of a file
+  uint32_t out_len;
+  uint32_t out_sent;
+  int fd;                 // file being sent, FS_OPEN_OK - 1 if none
+  uint32_t file_left;
+  char *pending;          // bytes that came while a response was going out
+  uint16_t pending_len;
+  uint8_t busy;
+  uint8_t close;          // disconnect once the response is out
+  struct lws_userdata *ws;  // the connection went over to a websocket
+}http_conn;
+
+typedef struct lhttp_userdata
+{
+  struct lhttp_userdata *next;
+  struct espconn *pesp_conn;    // listening, its reverse is not ours
+  int self_ref;           // held while listening
+  int routes_ref;         // table, path -> function(req)
+  int ws_ref;             // table, path -> function(ws, req)
+  http_conn *conns;
+  uint8_t closing;
+  uint8_t static_on;
+  char root[FS_NAME_MAX_LENGTH + 1];
+}lhttp_userdata;
+
+static lua_State *gL = NULL;
+static lhttp_userdata *servers = NULL;   // listening, found by local port
+
+static const char *http_reason(int status)
+{
+  switch(status){
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "";
+  }
+}
+
+static const struct
+{
+  const char *ext;
+  const char *type;
+} http_types[] = {
+  { "html", "text/html" },
+  { "htm", "text/html" },
+  { "css", "text/css" },
+  { "js", "application/javascript" },
+  { "json", "application/json" },
+  { "txt", "text/plain" },
+  { "xml", "text/xml" },
+  { "png", "image/png" },
+  { "jpg", "image/jpeg" },
+  { "gif", "image/gif" },
+  { "ico", "image/x-icon" },
+  { "svg", "image/svg+xml" },
+  { NULL, "application/octet-stream" }
+};
+
+// content type by the extension of a file name, without a .gz
+static const char *http_type(const char *name, size_t len)
+{
+  const char *ext = name + len;
+  int i;
+  while(ext > name && ext[-1] != '.')
+    ext--;
+  if(ext == name)
+    return http_types[sizeof(http_types) / sizeof(http_types[0]) - 1].type;
+  for(i = 0; http_types[i].ext; i++){
+    size_t n = c_strlen(http_types[i].ext);
+    if(n == (size_t)(name + len - ext) && c_strncmp(ext, http_types[i].ext, n) == 0)
+      break;
+  }
+  return http_types[i].type;
+}
+
+static void http_server_delete(lhttp_userdata *srv);
+static void http_feed(http_conn *c, const char *data, int len);
+static bool http_websocket(http_conn *c);
+static void lws_feed(struct lws_userdata *ws, char *data, uint32_t len);
+
+static void http_conn_free(http_conn *c)
+{
+  lhttp_userdata *srv = c->srv;
+  http_conn **p;
+
+  if(c->fd != FS_OPEN_OK - 1)
+    fs_close(c->fd);
+  if(c->out)
+    c_free(c->out);
+  if(c->pending)
+    c_free(c->pending);
+  http_request_free(&c->req);
+  if(srv){
+    for(p = &srv->conns; *p; p = &(*p)->next){
+      if(*p == c){
+        *p = c->next;
+        break;
+      }
+    }
+  }
+  c_free(c);
+  // a closed server goes once its last connection is gone
+  if(srv && srv->closing && srv->conns == NULL)
+    http_server_delete(srv);
+}
+
+static void http_disconnect(http_conn *c)
+{
+  c->close = 1;
+  if(c->pesp_conn == NULL)
+    return;
+  if(c->pesp_conn->proto.tcp->remote_port || c->pesp_conn->proto.tcp->local_port)
+    espconn_disconnect(c->pesp_conn);
+}
+
+// hand the next piece of the response to espconn
+static bool http_send_next(http_conn *c)
+{
+  uint32_t n = c->out_len - c->out_sent;
+  if(n > HTTP_SEND_MAX)
+    n = HTTP_SEND_MAX;
+  if(espconn_sent(c->pesp_conn, (unsigned char *)c->out + c->out_sent, n) != ESPCONN_OK)
+    return false;
+  c->out_sent += n;
+  return true;
+}
+
+// push "name: value\r\n" for each string key of the table at idx, the
+// empty string if idx is 0
+static void http_push_headers(lua_State *L, int idx)
+{
+  int n = 0;
+  if(idx){
+    lua_pushnil(L);
+    while(lua_next(L, idx) != 0){
+      if(lua_type(L, -2) == LUA_TSTRING && lua_isstring(L, -1)){
+        lua_pushvalue(L, -2);
+        lua_pushliteral(L, ": ");
+        lua_pushvalue(L, -3);
+        lua_pushliteral(L, "\r\n");
+        lua_concat(L, 4);
+        lua_insert(L, -3);  // below the key lua_next() walks with
+        n++;
+      }
+      lua_pop(L, 1);
+    }
+  }
+  lua_concat(L, n);
+}
+
+// send a response held in memory. the head is built in a lua buffer, with
+// the headers of the table at index headers if there is one.
+static void http_respond(http_conn *c, int status, const char *type, int headers,
+                         const char *body, size_t blen)
+{
+  http_request *r = &c->req;
+  luaL_Buffer b;
+  char num[16];
+  const char *head, *extra;
+  size_t hlen, elen, clen = blen;
+
+  if(r->state == HTTP_DONE && c_strcmp(http_request_str(r, r->method), "HEAD") == 0)
+    blen = 0;   // Content-Length of what GET would give, without the body
+  http_push_headers(gL, headers);
+  extra = lua_tolstring(gL, -1, &elen);
+
+  luaL_buffinit(gL, &b);
+  c_sprintf(num, "%d ", status);
+  luaL_addstring(&b, "HTTP/1.1 ");
+  luaL_addstring(&b, num);
+  luaL_addstring(&b, http_reason(status));
+  luaL_addstring(&b, "\r\n");
+  luaL_addlstring(&b, extra, elen);
+  if(type){
+    luaL_addstring(&b, "Content-Type: ");
+    luaL_addstring(&b, type);
+    luaL_addstring(&b, "\r\n");
+  }
+  c_sprintf(num, "%u", (unsigned)clen);
+  luaL_addstring(&b, "Content-Length: ");
+  luaL_addstring(&b, num);
+  luaL_addstring(&b, c->close ? "\r\nConnection: close\r\n\r\n" : "\r\nConnection: keep-alive\r\n\r\n");
+  luaL_pushresult(&b);
+  head = lua_tolstring(gL, -1, &hlen);
+
+  // espconn sends without copying, the response stays here until it is out
+  c->out = (char *)c_malloc(hlen + blen);
+  if(c->out == NULL){
+    lua_pop(gL, 2);
+    http_disconnect(c);
+    return;
+  }
+  c_memcpy(c->out, head, hlen);
+  if(blen)
+    c_memcpy(c->out + hlen, body, blen);
+  lua_pop(gL, 2);
+  c->out_len = hlen + blen;
+  c->out_sent = 0;
+  c->busy = 1;
+  if(!http_send_next(c))
+    http_disconnect(c);
+}
+
+static void http_respond_status(http_conn *c, int status)
+{
+  const char *reason = http_reason(status);
+  http_respond(c, status, "text/plain", 0, reason, c_strlen(reason));
+}
+
+// read the next chunk of the file into out
+static bool http_file_next(http_conn *c, uint32_t offset)
+{
+  uint32_t n = HTTP_FILE_CHUNK - offset;
+  if(n > c->file_left)
+    n = c->file_left;
+  if(n && fs_read(c->fd, c->out + offset, n) != n)
+    return false;
+  c->file_left -= n;
+  c->out_len = offset + n;
+  c->out_sent = 0;
+  return true;
+}
+
+// GET of a file under the static root, name.gz if the client takes gzip
+static bool http_static(http_conn *c)
+{
+  http_request *r = &c->req;
+  const char *method = http_request_str(r, r->method);
+  const char *path = http_request_str(r, r->path) + 1;
+  char name[FS_NAME_MAX_LENGTH + 4];
+  size_t len, plen = c_strlen(path);
+  bool head = c_strcmp(method, "HEAD") == 0;
+  bool gz = false;
+  int fd = FS_OPEN_OK - 1;
+  int size, n;
+
+  if(!c->srv->static_on || (!head && c_strcmp(method, "GET") != 0))
+    return false;
+  len = c_strlen(c->srv->root);
+  if(len + plen + (plen == 0 || path[plen - 1] == '/' ? 10 : 0) > FS_NAME_MAX_LENGTH)
+    return false;
+  c_strcpy(name, c->srv->root);
+  c_strcpy(name + len, path);
+  len += plen;
+  if(plen == 0 || path[plen - 1] == '/'){
+    c_strcpy(name + len, "index.html");
+    len += 10;
+  }
+  if(r->gzip && len + 3 <= FS_NAME_MAX_LENGTH){
+    c_strcpy(name + len, ".gz");
+    fd = fs_open(name, FS_RDONLY);
+    gz = fd >= FS_OPEN_OK;
+    name[len] = 0;
+  }
+  if(!gz)
+    fd = fs_open(name, FS_RDONLY);
+  if(fd < FS_OPEN_OK)
+    return false;
+  size = fs_seek(fd, 0, FS_SEEK_END);
+  if(size < 0 || fs_seek(fd, 0, FS_SEEK_SET) < 0 || (c->out = (char *)c_malloc(HTTP_FILE_CHUNK)) == NULL){
+    fs_close(fd);
+    http_respond_status(c, size < 0 ? 500 : 503);
+    return true;
+  }
+  c_sprintf(c->out, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n%sConnection: %s\r\n\r\n",
+      http_type(name, len), size, gz ? "Content-Encoding: gzip\r\n" : "", c->close ? "close" : "keep-alive");
+  n = c_strlen(c->out);
+  c->fd = fd;
+  c->file_left = head ? 0 : size;
+  c->busy = 1;
+  if(!http_file_next(c, n) || !http_send_next(c))
+    http_disconnect(c);
+  return true;
+}
+
+// the request, as a handler sees it
+static void http_push_request(http_request *r)
+{
+  int i;
+
+  lua_createtable(gL, 0, 5);
+  lua_pushstring(gL, http_request_str(r, r->method));
+  lua_setfield(gL, -2, "method");
+  lua_pushstring(gL, http_request_str(r, r->path));
+  lua_setfield(gL, -2, "path");
+  lua_pushstring(gL, http_request_str(r, r->query));
+  lua_setfield(gL, -2, "query");
+  lua_createtable(gL, 0, r->nheaders);
+  for(i = 0; i < r->nheaders; i++){
+    lua_pushstring(gL, http_request_str(r, r->header[i][1]));
+    lua_setfield(gL, -2, http_request_str(r, r->header[i][0]));
+  }
+  lua_setfield(gL, -2, "headers");
+  if(r->body){
+    lua_pushlstring(gL, r->body, r->body_len);
+    lua_setfield(gL, -2, "body");
+  }
+}
+
+// exact routes first, then "/a/b/*", "/a/*" and "/*" for "/a/b/c"
+static bool http_route(http_conn *c)
+{
+  http_request *r = &c->req;
+  const char *path = http_request_str(r, r->path);
+  size_t l = c_strlen(path);
+  int top = lua_gettop(gL);
+  int status, headers = 0;
+  const char *type = "text/html";
+  const char *body;
+  size_t blen;
+
+  lua_rawgeti(gL, LUA_REGISTRYINDEX, c->srv->routes_ref);
+  lua_getfield(gL, -1, path);
+  while(!lua_isfunction(gL, -1)){
+    lua_pop(gL, 1);
+    while(l > 0 && path[l - 1] != '/')
+      l--;
+    if(l == 0){
+      lua_settop(gL, top);
+      return false;
+    }
+    lua_pushlstring(gL, path, l);
+    lua_pushliteral(gL, "*");
+    lua_concat(gL, 2);
+    lua_rawget(gL, -2);
+    l--;
+  }
+
+  http_push_request(r);
+
+  // a script error is answered with a 500, it does not take the node down
+  if(lua_pcall(gL, 1, 3, 0) != 0){
+    NODE_ERR("http: %s\n", lua_tostring(gL, -1));
+    lua_settop(gL, top);
+    http_respond_status(c, 500);
+    return true;
+  }
+  status = lua_isnumber(gL, top + 2) ? lua_tointeger(gL, top + 2) : 200;
+  body = lua_tolstring(gL, top + 3, &blen);
+  if(body == NULL)
+    blen = 0;
+  if(lua_type(gL, top + 4) == LUA_TSTRING){
+    type = lua_tostring(gL, top + 4);
+  } else if(lua_istable(gL, top + 4)){
+    headers = top + 4;
+    lua_getfield(gL, headers, "Content-Type");
+    if(!lua_isnil(gL, -1))
+      type = NULL;
+    lua_pop(gL, 1);
+  }
+  http_respond(c, status, type, headers, body, blen);
+  lua_settop(gL, top);
+  return true;
+}
+
+static void http_dispatch(http_conn *c)
+{
+  http_request *r = &c->req;
+  c->close = c->close || !r->keep_alive || c->srv == NULL;
+  if(r->state == HTTP_ERROR)
+    http_respond_status(c, r->error);
+  else if(c->srv == NULL)
+    http_respond_status(c, 503);
+  else if(!http_websocket(c) && !http_route(c) && !http_static(c))
+    http_respond_status(c, 404);
+  http_request_free(r);
+}
+
+// the response is out, clean up and carry on with what came meanwhile
+static void http_done(http_conn *c)
+{
+  char *pending = c->pending;
+  uint16_t len = c->pending_len;
+
+  if(c->out){
+    c_free(c->out);
+    c->out = NULL;
+  }
+  if(c->fd != FS_OPEN_OK - 1){
+    fs_close(c->fd);
+    c->fd = FS_OPEN_OK - 1;
+  }
+  c->busy = 0;
+  if(c->close){
+    http_disconnect(c);
+    return;
+  }
+  c->pending = NULL;
+  c->pending_len = 0;
+  if(pending){
+    http_feed(c, pending, len);
+    c_free(pending);
+  }
+}
+
+// run the parser over received bytes, answering each complete request
+static void http_feed(http_conn *c, const char *data, int len)
+{
+  while(len > 0 && !c->close){
+    if(c->busy){
+      // the last response is still going out, keep the rest for later
+      char *p;
+      if(c->pending_len + len > HTTP_PENDING_MAX ||
+          (p = (char *)c_malloc(c->pending_len + len)) == NULL){
+        http_disconnect(c);
+        return;
+      }
+      if(c->pending){
+        c_memcpy(p, c->pending, c->pending_len);
+        c_free(c->pending);
+      }
+      c_memcpy(p + c->pending_len, data, len);
+      c->pending = p;
+      c->pending_len += len;
+      return;
+    }
+    int n = http_request_parse(&c->req, data, len);
+    data += n;
+    len -= n;
+    if(c->req.state >= HTTP_DONE)
+      http_dispatch(c);
+    if(c->ws){
+      // upgraded, what follows the request is websocket frames. the data is
+      // espconn's copy or pending, the frames are unmasked in place.
+      struct lws_userdata *ws = c->ws;
+      http_conn_free(c);
+      if(len > 0)
+        lws_feed(ws, (char *)data, len);
+      return;
+    }
+  }
+}
+
+static void http_received(void *arg, char *pdata, unsigned short len)
+{
+  struct espconn *pesp_conn = arg;
+  if(pesp_conn == NULL || pesp_conn->reverse == NULL)
+    return;
+  http_feed((http_conn *)pesp_conn->reverse, pdata, len);
+}
+
+static void http_sent(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  http_conn *c;
+  if(pesp_conn == NULL || (c = (http_conn *)pesp_conn->reverse) == NULL)
+    return;
+  if(c->out_sent < c->out_len){
+    if(!http_send_next(c))
+      http_disconnect(c);
+    return;
+  }
+  if(c->file_left > 0){
+    if(!http_file_next(c, 0) || !http_send_next(c))
+      http_disconnect(c);
+    return;
+  }
+  http_done(c);
+}
+
+static lhttp_userdata *http_server_find(int port)
+{
+  lhttp_userdata *srv;
+  for(srv = servers; srv; srv = srv->next){
+    if(srv->pesp_conn && srv->pesp_conn->proto.tcp->local_port == port)
+      return srv;
+  }
+  return NULL;
+}
+
+// the connection of the peer espconn has in remote_ip and remote_port
+static http_conn *http_conn_find(struct espconn *pesp_conn)
+{
+  esp_tcp *tcp = pesp_conn->proto.tcp;
+  lhttp_userdata *srv = http_server_find(tcp->local_port);
+  http_conn *c;
+  for(c = srv ? srv->conns : NULL; c; c = c->next){
+    if(c->remote_port == tcp->remote_port && c_memcmp(c->remote_ip, tcp->remote_ip, 4) == 0)
+      return c;
+  }
+  return NULL;
+}
+
+// called with the listening espconn, the accepted one is already freed
+static void http_disconnected(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  http_conn *c;
+  if(pesp_conn == NULL || pesp_conn->proto.tcp == NULL)
+    return;
+  pesp_conn->reverse = NULL;    // espconn copied the accepted one's here
+  if((c = http_conn_find(pesp_conn)) == NULL)
+    return;
+  c->pesp_conn = NULL;
+  http_conn_free(c);
+}
+
+static void http_reconnected(void *arg, sint8_t err)
+{
+  http_disconnected(arg);
+}
+
+static void http_connected(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  lhttp_userdata *srv;
+  http_conn *c = NULL;
+
+  if(pesp_conn == NULL)
+    return;
+  pesp_conn->reverse = NULL;    // whatever the listening espconn had
+  srv = http_server_find(pesp_conn->proto.tcp->local_port);
+  if(srv && !srv->closing)
+    c = (http_conn *)c_zalloc(sizeof(http_conn));
+  if(c == NULL){
+    // not accept this conn
+    if(pesp_conn->proto.tcp->remote_port || pesp_conn->proto.tcp->local_port)
+      espconn_disconnect(pesp_conn);
+    return;
+  }
+  http_request_init(&c->req);
+  c->fd = FS_OPEN_OK - 1;
+  c->srv = srv;
+  c->pesp_conn = pesp_conn;
+  c_memcpy(c->remote_ip, pesp_conn->proto.tcp->remote_ip, 4);
+  c->remote_port = pesp_conn->proto.tcp->remote_port;
+  c->next = srv->conns;
+  srv->conns = c;
+  pesp_conn->reverse = c;
+
+  espconn_regist_recvcb(pesp_conn, http_received);
+  espconn_regist_sentcb(pesp_conn, http_sent);
+  espconn_regist_disconcb(pesp_conn, http_disconnected);
+  espconn_regist_reconcb(pesp_conn, http_reconnected);
+}
+
+// stop listening and let go of the lua side
+static void http_server_delete(lhttp_userdata *srv)
+{
+  lhttp_userdata **p;
+
+  for(p = &servers; *p; p = &(*p)->next){
+    if(*p == srv){
+      *p = srv->next;
+      break;
+    }
+  }
+  if(srv->pesp_conn){
+    espconn_delete(srv->pesp_conn);
+    if(srv->pesp_conn->proto.tcp)
+      c_free(srv->pesp_conn->proto.tcp);
+    c_free(srv->pesp_conn);
+    srv->pesp_conn = NULL;
+  }
+  if(gL == NULL)
+    return;
+  if(srv->routes_ref != LUA_NOREF){
+    luaL_unref(gL, LUA_REGISTRYINDEX, srv->routes_ref);
+    srv->routes_ref = LUA_NOREF;
+  }
+  if(srv->ws_ref != LUA_NOREF){
+    luaL_unref(gL, LUA_REGISTRYINDEX, srv->ws_ref);
+    srv->ws_ref = LUA_NOREF;
+  }
+  if(srv->self_ref != LUA_NOREF){
+    luaL_unref(gL, LUA_REGISTRYINDEX, srv->self_ref);
+    srv->self_ref = LUA_NOREF;
+  }
+}
+
+// Lua: srv = http.createServer(port, [timeout])
+static int http_create_server( lua_State* L )
+{
+  unsigned port = luaL_checkinteger( L, 1 );
+  unsigned timeout = luaL_optinteger( L, 2, HTTP_DEFAULT_TIMEOUT );
+  lhttp_userdata *srv;
+  struct espconn *pesp_conn;
+
+  if( port == 0 || port > 65535 || timeout > 28800 )
+    return luaL_error( L, "wrong arg range" );
+  gL = L;
+
+  srv = (lhttp_userdata *)lua_newuserdata(L, sizeof(lhttp_userdata));
+  srv->next = NULL;
+  srv->pesp_conn = NULL;
+  srv->self_ref = LUA_NOREF;
+  srv->routes_ref = LUA_NOREF;
+  srv->ws_ref = LUA_NOREF;
+  srv->conns = NULL;
+  srv->closing = 0;
+  srv->static_on = 0;
+  srv->root[0] = 0;
+  luaL_getmetatable(L, "http.server");
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  srv->routes_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_newtable(L);
+  srv->ws_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  pesp_conn = (struct espconn *)c_zalloc(sizeof(struct espconn));
+  if(pesp_conn == NULL)
+    return luaL_error( L, "not enough memory" );
+  pesp_conn->proto.tcp = (esp_tcp *)c_zalloc(sizeof(esp_tcp));
+  if(pesp_conn->proto.tcp == NULL){
+    c_free(pesp_conn);
+    return luaL_error( L, "not enough memory" );
+  }
+  pesp_conn->type = ESPCONN_TCP;
+  pesp_conn->state = ESPCONN_NONE;
+  pesp_conn->proto.tcp->local_port = port;
+  srv->pesp_conn = pesp_conn;
+
+  espconn_regist_connectcb(pesp_conn, http_connected);
+  if(espconn_accept(pesp_conn) != ESPCONN_OK){
+    http_server_delete(srv);
+    return luaL_error( L, "cannot listen on %d", port );
+  }
+  srv->next = servers;
+  servers = srv;
+  espconn_regist_time(pesp_conn, timeout, 0);
+
+  lua_pushvalue(L, -1);
+  srv->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);   // kept while listening
+  return 1;
+}
+
+// Lua: srv:route(path, function(req) return status, body, [type | headers] end)
+// a path ending in "*" takes everything below it, nil removes the route
+static int http_server_route( lua_State* L )
+{
+  lhttp_userdata *srv = (lhttp_userdata *)luaL_checkudata(L, 1, "http.server");
+  luaL_checkstring( L, 2 );
+  if( !lua_isnil(L, 3) )
+    luaL_checkanyfunction( L, 3 );
+  if( srv->routes_ref == LUA_NOREF )
+    return luaL_error( L, "server closed" );
+  lua_rawgeti(L, LUA_REGISTRYINDEX, srv->routes_ref);
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, 3);
+  lua_rawset(L, -3);
+  return 0;
+}
+
+// Lua: srv:websocket(path, function(ws, req) end)
+// a websocket upgrade of path is taken, ws is open when the function is called
+static int http_server_websocket( lua_State* L )
+{
+  lhttp_userdata *srv = (lhttp_userdata *)luaL_checkudata(L, 1, "http.server");
+  luaL_checkstring( L, 2 );
+  if( !lua_isnil(L, 3) )
+    luaL_checkanyfunction( L, 3 );
+  if( srv->ws_ref == LUA_NOREF )
+    return luaL_error( L, "server closed" );
+  lua_rawgeti(L, LUA_REGISTRYINDEX, srv->ws_ref);
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, 3);
+  lua_rawset(L, -3);
+  return 0;
+}
+
+// Lua: srv:static([prefix])
+// GET of a path no route takes sends the file prefix..path, prefix..path..".gz"
+// if the client takes gzip, index.html for a path ending in "/". nil turns it off
+static int http_server_static( lua_State* L )
+{
+  lhttp_userdata *srv = (lhttp_userdata *)luaL_checkudata(L, 1, "http.server");
+  size_t l;
+  const char *prefix;
+
+  if( lua_isnoneornil(L, 2) ){
+    srv->static_on = 0;
+    return 0;
+  }
+  prefix = luaL_checklstring( L, 2, &l );
+  if( l > FS_NAME_MAX_LENGTH - 1 )
+    return luaL_error( L, "prefix too long" );
+  c_strcpy(srv->root, prefix);
+  srv->static_on = 1;
+  return 0;
+}
+
+// Lua: srv:close()
+// stops listening, open connections are closed
+static int http_server_close( lua_State* L )
+{
+  lhttp_userdata *srv = (lhttp_userdata *)luaL_checkudata(L, 1, "http.server");
+  http_conn *c;
+
+  if( srv->pesp_conn == NULL || srv->closing )
+    return 0;
+  srv->closing = 1;
+  for(c = srv->conns; c; c = c->next)
+    http_disconnect(c);
+  if(srv->conns == NULL)
+    http_server_delete(srv);
+  return 0;
+}
+
+static int http_server_gc( lua_State* L )
+{
+  lhttp_userdata *srv = (lhttp_userdata *)luaL_checkudata(L, 1, "http.server");
+  http_conn *c;
+
+  // only reached once the server let go of itself, or it never listened
+  for(c = srv->conns; c; c = c->next)
+    c->srv = NULL;
+  srv->conns = NULL;
+  http_server_delete(srv);
+  return 0;
+}
+
+// http.request() keeps the connections it may use again, by host and port
+#define HTTP_CLIENT_MAX       4           // connections, busy and idle
+#define HTTP_CLIENT_TIMEOUT   10          // seconds
+#define HTTP_CLIENT_BODY_MAX  (16*1024)   // as a string, beyond take it in chunks or to a file
+#define HTTP_HOST_MAX         64
+
+// codes the callback gets instead of a status
+#define HTTP_ERR_CONNECT      -1          // no connection, or it closed early
+#define HTTP_ERR_TIMEOUT      -2
+#define HTTP_ERR_RESPONSE     -3          // not http, or the body is too big
+#define HTTP_ERR_MEMORY       -4          // out of memory, or the file failed
+
+typedef enum {
+  CLIENT_DNS,
+  CLIENT_CONNECTING,
+  CLIENT_BUSY,
+  CLIENT_IDLE
+} http_client_state;
+
+typedef struct http_client
+{
+  struct http_client *next;
+  struct espconn *pesp_conn;
+  char host[HTTP_HOST_MAX];
+  uint16_t port;
+  ip_addr_t ip;
+  uint8_t state;
+  uint8_t closing;        // waiting for espconn to let go of pesp_conn
+  uint8_t reused;         // sent on a kept connection, may be tried once more
+  int8_t failed;          // HTTP_ERR_ from the body callback
+  http_response resp;
+  char *out;              // the request, until it is acknowledged
+  uint32_t out_len;
+  uint32_t out_sent;
+  int cb_ref;             // function(code, body, headers), LUA_NOREF if idle
+  int chunk_ref;          // function(data), the body as it comes
+  int headers_ref;
+  char file[FS_NAME_MAX_LENGTH + 1];  // the body goes to this file
+  int fd;
+  char *body;             // or is collected here
+  uint32_t body_len;
+  uint32_t body_size;
+  ETSTimer timer;
+}http_client;
+
+static http_client *clients = NULL;
+
+static void http_client_free(http_client *c)
+{
+  http_client **p;
+
+  os_timer_disarm(&c->timer);
+  for(p = &clients; *p; p = &(*p)->next){
+    if(*p == c){
+      *p = c->next;
+      break;
+    }
+  }
+  if(c->out)
+    c_free(c->out);
+  if(c->body)
+    c_free(c->body);
+  if(c->fd != FS_OPEN_OK - 1)
+    fs_close(c->fd);
+  http_response_free(&c->resp);
+  if(gL){
+    luaL_unref(gL, LUA_REGISTRYINDEX, c->cb_ref);
+    luaL_unref(gL, LUA_REGISTRYINDEX, c->chunk_ref);
+    luaL_unref(gL, LUA_REGISTRYINDEX, c->headers_ref);
+  }
+  if(c->pesp_conn){
+    c->pesp_conn->reverse = NULL;
+    if(c->pesp_conn->proto.tcp)
+      c_free(c->pesp_conn->proto.tcp);
+    c_free(c->pesp_conn);
+  }
+  c_free(c);
+}
+
+// done with the connection. it is freed once espconn calls back
+static void http_client_close(http_client *c)
+{
+  if(c->closing)
+    return;
+  c->closing = 1;
+  if(c->state == CLIENT_BUSY || c->state == CLIENT_IDLE)
+    espconn_disconnect(c->pesp_conn);
+}
+
+// the request is over, hand the result to lua. the connection is kept if
+// the server lets it
+static void http_client_finish(http_client *c, int code)
+{
+  int ref = c->cb_ref;
+
+  if(ref == LUA_NOREF)
+    return;
+  c->cb_ref = LUA_NOREF;
+  os_timer_disarm(&c->timer);
+  if(c->failed)
+    code = c->failed;
+  lua_rawgeti(gL, LUA_REGISTRYINDEX, ref);
+  luaL_unref(gL, LUA_REGISTRYINDEX, ref);
+  lua_pushinteger(gL, code);
+  if(c->body)
+    lua_pushlstring(gL, c->body, c->body_len);
+  else
+    lua_pushnil(gL);
+  lua_rawgeti(gL, LUA_REGISTRYINDEX, c->headers_ref);
+
+  if(c->body){
+    c_free(c->body);
+    c->body = NULL;
+  }
+  c->body_len = c->body_size = 0;
+  if(c->fd != FS_OPEN_OK - 1){
+    fs_close(c->fd);
+    c->fd = FS_OPEN_OK - 1;
+  }
+  luaL_unref(gL, LUA_REGISTRYINDEX, c->chunk_ref);
+  luaL_unref(gL, LUA_REGISTRYINDEX, c->headers_ref);
+  c->chunk_ref = c->headers_ref = LUA_NOREF;
+  // the answer can beat the ack of the request, the connection is only
+  // handed out again once c->out is gone
+  if(code > 0 && c->resp.keep_alive && !c->closing && c->out_sent == c->out_len)
+    c->state = CLIENT_IDLE;
+  else
+    http_client_close(c);
+  http_response_free(&c->resp);
+  c->failed = 0;
+
+  lua_call(gL, 3, 0);
+}
+
+static void http_client_body(void *arg, const char *data, uint32_t len)
+{
+  http_client *c = (http_client *)arg;
+
+  if(c->failed)
+    return;
+  if(c->fd != FS_OPEN_OK - 1){
+    if(fs_write(c->fd, data, len) != len)
+      c->failed = HTTP_ERR_MEMORY;
+  } else if(c->chunk_ref != LUA_NOREF){
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, c->chunk_ref);
+    lua_pushlstring(gL, data, len);
+    lua_call(gL, 1, 0);
+  } else {
+    if(c->body_len + len > HTTP_CLIENT_BODY_MAX){
+      c->failed = HTTP_ERR_RESPONSE;
+      return;
+    }
+    if(c->body_len + len > c->body_size){
+      uint32_t size = c->body_size ? c->body_size : 512;
+      char *p;
+      while(size < c->body_len + len)
+        size *= 2;
+      if(size > HTTP_CLIENT_BODY_MAX)
+        size = HTTP_CLIENT_BODY_MAX;
+      p = (char *)c_malloc(size);
+      if(p == NULL){
+        c->failed = HTTP_ERR_MEMORY;
+        return;
+      }
+      if(c->body){
+        c_memcpy(p, c->body, c->body_len);
+        c_free(c->body);
+      }
+      c->body = p;
+      c->body_size = size;
+    }
+    c_memcpy(c->body + c->body_len, data, len);
+    c->body_len += len;
+  }
+}
+
+// the headers are in: a table for lua, and the file for a 2xx body
+static void http_client_head(http_client *c)
+{
+  http_response *r = &c->resp;
+  int i;
+
+  lua_createtable(gL, 0, r->nheaders);
+  for(i = 0; i < r->nheaders; i++){
+    lua_pushstring(gL, http_response_str(r, r->header[i][1]));
+    lua_setfield(gL, -2, http_response_str(r, r->header[i][0]));
+  }
+  c->headers_ref = luaL_ref(gL, LUA_REGISTRYINDEX);
+  if(c->file[0] && r->status >= 200 && r->status < 300){
+    c->fd = fs_open(c->file, FS_WRONLY | FS_CREAT | FS_TRUNC);
+    if(c->fd < FS_OPEN_OK){
+      c->fd = FS_OPEN_OK - 1;
+      c->failed = HTTP_ERR_MEMORY;
+    }
+  }
+}
+
+static bool http_client_send_next(http_client *c)
+{
+  uint32_t n = c->out_len - c->out_sent;
+  if(n > HTTP_SEND_MAX)
+    n = HTTP_SEND_MAX;
+  if(espconn_sent(c->pesp_conn, (unsigned char *)c->out + c->out_sent, n) != ESPCONN_OK)
+    return false;
+  c->out_sent += n;
+  return true;
+}
+
+static void http_client_received(void *arg, char *pdata, unsigned short len)
+{
+  struct espconn *pesp_conn = arg;
+  http_client *c;
+  http_response *r;
+
+  if(pesp_conn == NULL || (c = (http_client *)pesp_conn->reverse) == NULL)
+    return;
+  if(c->closing || c->cb_ref == LUA_NOREF)
+    return;
+  r = &c->resp;
+  while(len > 0 && r->state < HTTP_DONE && !c->failed){
+    bool head = r->state <= HTTP_HEADERS;
+    int n = http_response_parse(r, pdata, len, http_client_body, c);
+    pdata += n;
+    len -= n;
+    if(head && r->state > HTTP_HEADERS && r->state != HTTP_ERROR)
+      http_client_head(c);
+  }
+  if(c->failed)
+    http_client_finish(c, c->failed);
+  else if(r->state == HTTP_DONE)
+    http_client_finish(c, r->status);
+  else if(r->state == HTTP_ERROR)
+    http_client_finish(c, HTTP_ERR_RESPONSE);
+}
+
+static void http_client_sent(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  http_client *c;
+
+  if(pesp_conn == NULL || (c = (http_client *)pesp_conn->reverse) == NULL)
+    return;
+  if(c->out == NULL)
+    return;
+  if(c->out_sent < c->out_len){
+    if(!http_client_send_next(c)){
+      http_client_finish(c, HTTP_ERR_CONNECT);
+      http_client_close(c);
+    }
+    return;
+  }
+  c_free(c->out);
+  c->out = NULL;
+}
+
+static void http_client_connect(http_client *c);
+
+// espconn is done with the connection, closed or failed
+static void http_client_gone(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  http_client *c;
+
+  if(pesp_conn == NULL || (c = (http_client *)pesp_conn->reverse) == NULL)
+    return;
+  if(!c->closing && c->cb_ref != LUA_NOREF){
+    if(c->reused && c->resp.state == HTTP_REQ_LINE && c->resp.len == 0){
+      // the server dropped the kept connection before it answered, the
+      // request goes again on a fresh one
+      c->pesp_conn->reverse = NULL;
+      c_free(c->pesp_conn->proto.tcp);
+      c_free(c->pesp_conn);
+      c->pesp_conn = NULL;
+      c->reused = 0;
+      http_client_connect(c);
+      return;
+    }
+    c->closing = 1;
+    http_response_eof(&c->resp);
+    http_client_finish(c, c->resp.state == HTTP_DONE ? c->resp.status : HTTP_ERR_CONNECT);
+  }
+  http_client_free(c);
+}
+
+static void http_client_reconnected(void *arg, sint8_t err)
+{
+  http_client_gone(arg);
+}
+
+static void http_client_connected(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  http_client *c;
+
+  if(pesp_conn == NULL || (c = (http_client *)pesp_conn->reverse) == NULL)
+    return;
+  c->state = CLIENT_BUSY;
+  if(c->closing){
+    espconn_disconnect(pesp_conn);
+    return;
+  }
+  espconn_regist_recvcb(pesp_conn, http_client_received);
+  espconn_regist_sentcb(pesp_conn, http_client_sent);
+  espconn_regist_disconcb(pesp_conn, http_client_gone);
+  if(!http_client_send_next(c)){
+    http_client_finish(c, HTTP_ERR_CONNECT);
+    http_client_close(c);
+  }
+}
+
+static void http_client_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  http_client *c;
+
+  if(pesp_conn == NULL || (c = (http_client *)pesp_conn->reverse) == NULL)
+    return;
+  if(c->closing || ipaddr == NULL || ipaddr->addr == 0){
+    c->closing = 1;
+    http_client_finish(c, HTTP_ERR_CONNECT);
+    http_client_free(c);
+    return;
+  }
+  c->ip.addr = ipaddr->addr;
+  c->state = CLIENT_CONNECTING;
+  c_memcpy(pesp_conn->proto.tcp->remote_ip, &c->ip.addr, 4);
+  espconn_connect(pesp_conn);
+}
+
+// a new connection to c->host, through dns unless it is an address.
+// c->out is sent once it is up
+static void http_client_connect(http_client *c)
+{
+  struct espconn *pesp_conn;
+
+  c->state = CLIENT_DNS;
+  pesp_conn = (struct espconn *)c_zalloc(sizeof(struct espconn));
+  if(pesp_conn)
+    pesp_conn->proto.tcp = (esp_tcp *)c_zalloc(sizeof(esp_tcp));
+  if(pesp_conn == NULL || pesp_conn->proto.tcp == NULL){
+    if(pesp_conn)
+      c_free(pesp_conn);
+    c->closing = 1;
+    http_client_finish(c, HTTP_ERR_MEMORY);
+    http_client_free(c);
+    return;
+  }
+  pesp_conn->type = ESPCONN_TCP;
+  pesp_conn->state = ESPCONN_NONE;
+  pesp_conn->proto.tcp->remote_port = c->port;
+  pesp_conn->proto.tcp->local_port = espconn_port();
+  pesp_conn->reverse = c;
+  c->pesp_conn = pesp_conn;
+  c->out_sent = 0;
+  espconn_regist_connectcb(pesp_conn, http_client_connected);
+  espconn_regist_reconcb(pesp_conn, http_client_reconnected);
+
+  if(c->ip.addr != 0 && c->ip.addr != IPADDR_NONE){
+    // an address, or the one dns gave before a retry
+    c->state = CLIENT_CONNECTING;
+    c_memcpy(pesp_conn->proto.tcp->remote_ip, &c->ip.addr, 4);
+    espconn_connect(pesp_conn);
+  } else {
+    switch(espconn_gethostbyname(pesp_conn, c->host, &c->ip, http_client_dns_found)){
+      case ESPCONN_OK:          // answered from the resolver table
+        http_client_dns_found(c->host, &c->ip, pesp_conn);
+        break;
+      case ESPCONN_INPROGRESS:
+        break;
+      default:                  // not queued, no callback comes
+        http_client_dns_found(c->host, NULL, pesp_conn);
+        break;
+    }
+  }
+}
+
+static void http_client_timeout(void *arg)
+{
+  http_client *c = (http_client *)arg;
+  http_client_finish(c, HTTP_ERR_TIMEOUT);
+  http_client_close(c);
+}
+
+// scheme://host[:port]/path, an error is raised for anything else. port is
+// left alone if the url has none.
+static void http_parse_url(lua_State *L, const char *url, const char *scheme,
+                           const char **host, size_t *hl, unsigned *port, const char **path)
+{
+  size_t sl = c_strlen(scheme);
+  const char *p;
+
+  if( c_strncmp(url, scheme, sl) != 0 )
+    luaL_error( L, "%s url expected", scheme );
+  *host = url + sl;
+  for( p = *host; *p && *p != ':' && *p != '/'; p++ )
+    ;
+  *hl = p - *host;
+  if( *hl == 0 || *hl >= HTTP_HOST_MAX )
+    luaL_error( L, "bad host" );
+  if( *p == ':' ){
+    *port = c_strtol(p + 1, (char **)&p, 10);
+    if( *port == 0 || *port > 65535 )
+      luaL_error( L, "bad port" );
+  }
+  *path = *p ? p : "/";
+  if( **path != '/' )
+    luaL_error( L, "bad url" );
+}
+
+// Lua: http.request(url, [options], function(code, body, headers))
+// options: method, headers, body, file, chunk = function(data), timeout
+// code is the status, or negative if there was no answer. the body is nil
+// when it went to options.file or options.chunk
+static int http_client_request( lua_State* L )
+{
+  size_t l, hl, bl = 0;
+  const char *url = luaL_checklstring( L, 1, &l );
+  const char *host, *path, *method = NULL, *body = NULL, *extra;
+  unsigned port = 80;
+  unsigned timeout = HTTP_CLIENT_TIMEOUT;
+  int opt = 0, fn = 2, n = 0, top;
+  http_client *c, *idle = NULL;
+  luaL_Buffer b;
+  char num[16];
+
+  if( lua_istable(L, 2) ){
+    opt = 2;
+    fn = 3;
+  }
+  luaL_checkanyfunction( L, fn );
+  gL = L;
+
+  http_parse_url(L, url, "http://", &host, &hl, &port, &path);
+
+  top = lua_gettop(L);
+  if( opt ){
+    lua_getfield(L, opt, "body");
+    body = lua_tolstring(L, -1, &bl);
+    lua_getfield(L, opt, "method");
+    method = lua_tostring(L, -1);
+    lua_getfield(L, opt, "timeout");
+    if( lua_isnumber(L, -1) )
+      timeout = lua_tointeger(L, -1);
+    lua_getfield(L, opt, "file");
+    if( lua_isstring(L, -1) && lua_strlen(L, -1) > FS_NAME_MAX_LENGTH )
+      return luaL_error( L, "filename too long" );
+    lua_getfield(L, opt, "headers");
+    if( lua_istable(L, -1) )
+      n = lua_gettop(L);
+  }
+  if( method == NULL )
+    method = body ? "POST" : "GET";
+
+  // the request, while there is a lua buffer to build it in
+  http_push_headers(L, n);
+  extra = lua_tostring(L, -1);
+  luaL_buffinit(L, &b);
+  luaL_addstring(&b, method);
+  luaL_addchar(&b, ' ');
+  luaL_addstring(&b, path);
+  luaL_addstring(&b, " HTTP/1.1\r\nHost: ");
+  luaL_addlstring(&b, host, hl);
+  if( port != 80 ){
+    c_sprintf(num, ":%u", port);
+    luaL_addstring(&b, num);
+  }
+  luaL_addstring(&b, "\r\nConnection: keep-alive\r\n");
+  luaL_addstring(&b, extra);
+  if( body ){
+    c_sprintf(num, "%u", (unsigned)bl);
+    luaL_addstring(&b, "Content-Length: ");
+    luaL_addstring(&b, num);
+    luaL_addstring(&b, "\r\n");
+  }
+  luaL_addstring(&b, "\r\n");
+  luaL_pushresult(&b);
+
+  // a kept connection to the same place, or a new one
+  for( c = clients, n = 0; c; c = c->next ){
+    if( c->closing )
+      continue;
+    n++;
+    if( c->state == CLIENT_IDLE && c->cb_ref == LUA_NOREF && c->out == NULL ){
+      if( c->port == port && c_strlen(c->host) == hl && c_strncmp(c->host, host, hl) == 0 )
+        break;
+      idle = c;
+    }
+  }
+  if( c == NULL && n >= HTTP_CLIENT_MAX ){
+    if( idle == NULL )
+      return luaL_error( L, "too many requests" );
+    http_client_close(idle);
+  }
+  if( c == NULL ){
+    c = (http_client *)c_zalloc(sizeof(http_client));
+    if( c == NULL )
+      return luaL_error( L, "not enough memory" );
+    c_memcpy(c->host, host, hl);
+    c->host[hl] = 0;
+    c->port = port;
+    c->ip.addr = ipaddr_addr(c->host);
+    c->fd = FS_OPEN_OK - 1;
+    c->cb_ref = c->chunk_ref = c->headers_ref = LUA_NOREF;
+    c->state = CLIENT_DNS;
+    c->next = clients;
+    clients = c;
+  } else {
+    c->reused = 1;
+  }
+
+  c->out_len = lua_strlen(L, -1) + bl;
+  c->out = (char *)c_malloc(c->out_len);
+  if( c->out == NULL ){
+    if( !c->reused ){
+      c->closing = 1;
+      http_client_free(c);
+    }
+    return luaL_error( L, "not enough memory" );
+  }
+  c_memcpy(c->out, lua_tostring(L, -1), lua_strlen(L, -1));
+  if( bl )
+    c_memcpy(c->out + lua_strlen(L, -1), body, bl);
+  c->out_sent = 0;
+  http_response_init(&c->resp);
+  c->resp.no_body = c_strcmp(method, "HEAD") == 0;
+  c->file[0] = 0;
+  if( opt ){
+    lua_getfield(L, opt, "file");
+    if( lua_isstring(L, -1) )
+      c_strcpy(c->file, lua_tostring(L, -1));
+    lua_getfield(L, opt, "chunk");
+    if( lua_isfunction(L, -1) ){
+      lua_pushvalue(L, -1);
+      c->chunk_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+  }
+  lua_pushvalue(L, fn);
+  c->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_settop(L, top);
+
+  os_timer_disarm(&c->timer);
+  os_timer_setfn(&c->timer, (os_timer_func_t *)http_client_timeout, c);
+  os_timer_arm(&c->timer, timeout * 1000, 0);
+  if( c->reused ){
+    c->state = CLIENT_BUSY;
+    if( !http_client_send_next(c) ){
+      http_client_finish(c, HTTP_ERR_CONNECT);
+      http_client_close(c);
+    }
+  } else {
+    http_client_connect(c);
+  }
+  return 0;
+}
+
+// websockets, taken over from the server by srv:websocket() or opened by
+// http.websocket(). frames go straight from the lua string into the send
+// queue, masked on the way for a client.
+#define WS_QUEUE_MAX          (16*1024)   // queued to send, beyond send() raises an error
+#define WS_CHUNK_MIN          256         // small frames share a buffer
+#define WS_CLOSE_NONE         1005        // a close frame without a code
+#define WS_CLOSE_ABNORMAL     1006        // no close frame at all
+
+typedef struct ws_out
+{
+  struct ws_out *next;
+  uint32_t len;
+  uint32_t size;
+  char data[1];
+}ws_out;
+
+typedef enum {
+  WS_DNS,
+  WS_CONNECTING,
+  WS_HANDSHAKE,         // a client waiting for the 101
+  WS_OPEN,
+  WS_CLOSED
+} lws_state;
+
+typedef struct lws_userdata
+{
+  struct lws_userdata *next;    // in lws_accepted, for the server side
+  struct espconn *pesp_conn;    // NULL once espconn let go of it
+  int self_ref;           // held while connected
+  int cb_connection_ref;
+  int cb_message_ref;
+  int cb_close_ref;
+  ws_parser parser;
+  ws_out *out_head;       // the head is with espconn while out_busy
+  ws_out *out_tail;
+  uint32_t out_bytes;
+  uint8_t out_busy;
+  uint8_t state;
+  uint8_t client;         // pesp_conn is ours, frames are masked
+  uint8_t close_sent;
+  uint8_t close_rcvd;
+  uint16_t close_code;
+  uint16_t port;          // the peer
+  ip_addr_t ip;
+  uint16_t local_port;    // the server's, for the server side
+  char host[HTTP_HOST_MAX];
+  http_response *resp;    // the answer to the handshake
+  char accept[WS_ACCEPT_LEN + 1];   // Sec-WebSocket-Accept it has to have
+}lws_userdata;
+
+static uint32_t lws_seed;
+static lws_userdata *lws_accepted = NULL;   // taken over from a server
+
+// the mask only has to be unpredictable to what is between us and the server
+static uint32_t lws_random(void)
+{
+  lws_seed ^= system_get_time();
+  lws_seed ^= lws_seed << 13;
+  lws_seed ^= lws_seed >> 17;
+  lws_seed ^= lws_seed << 5;
+  return lws_seed;
+}
+
+// room for n bytes at the end of the queue, in the last buffer if it is
+// not with espconn yet
+static char *lws_queue(lws_userdata *ws, uint32_t n)
+{
+  ws_out *t = ws->out_tail;
+  char *p;
+
+  if(t && !(t == ws->out_head && ws->out_busy) && t->size - t->len >= n){
+    p = t->data + t->len;
+    t->len += n;
+    ws->out_bytes += n;
+    return p;
+  }
+  t = (ws_out *)c_malloc(sizeof(ws_out) - 1 + (n < WS_CHUNK_MIN ? WS_CHUNK_MIN : n));
+  if(t == NULL)
+    return NULL;
+  t->next = NULL;
+  t->len = n;
+  t->size = n < WS_CHUNK_MIN ? WS_CHUNK_MIN : n;
+  if(ws->out_tail)
+    ws->out_tail->next = t;
+  else
+    ws->out_head = t;
+  ws->out_tail = t;
+  ws->out_bytes += n;
+  return t->data;
+}
+
+static void lws_queue_free(lws_userdata *ws)
+{
+  while(ws->out_head){
+    ws_out *t = ws->out_head;
+    ws->out_head = t->next;
+    c_free(t);
+  }
+  ws->out_tail = NULL;
+  ws->out_bytes = 0;
+  ws->out_busy = 0;
+}
+
+static void lws_kick(lws_userdata *ws)
+{
+  if(ws->out_busy || ws->out_head == NULL || ws->state < WS_HANDSHAKE || ws->pesp_conn == NULL)
+    return;
+  if(espconn_sent(ws->pesp_conn, (unsigned char *)ws->out_head->data, ws->out_head->len) != ESPCONN_OK){
+    espconn_disconnect(ws->pesp_conn);
+    return;
+  }
+  ws->out_busy = 1;
+}
+
+// frame len bytes of data into the queue. control frames are always taken
+static bool lws_push(lws_userdata *ws, int opcode, const char *data, uint32_t len)
+{
+  uint8_t head[WS_HEAD_MAX];
+  uint32_t mask;
+  int hl;
+  char *p;
+
+  if(ws->close_sent)
+    return true;    // nothing goes after a close
+  if(!(opcode & 0x8) && ws->out_bytes + len > WS_QUEUE_MAX)
+    return false;
+  mask = lws_random();
+  hl = ws_frame_head(head, opcode, len, ws->client ? (uint8_t *)&mask : NULL);
+  p = lws_queue(ws, hl + len);
+  if(p == NULL)
+    return false;
+  c_memcpy(p, head, hl);
+  if(ws->client)
+    ws_mask(p + hl, data, len, (uint8_t *)&mask);
+  else if(len)
+    c_memcpy(p + hl, data, len);
+  if(opcode == WS_OP_CLOSE)
+    ws->close_sent = 1;
+  lws_kick(ws);
+  return true;
+}
+
+static void lws_push_close(lws_userdata *ws, uint16_t code)
+{
+  char c[2];
+  c[0] = code >> 8;
+  c[1] = code;
+  lws_push(ws, WS_OP_CLOSE, c, 2);
+}
+
+// the connection is gone: "close" with the code, and let go of lua
+static void lws_gone(lws_userdata *ws)
+{
+  if(ws->state == WS_CLOSED)
+    return;
+  ws->state = WS_CLOSED;
+  if(ws->client && ws->pesp_conn){
+    // ours, espconn frees the one of a server side connection
+    ws->pesp_conn->reverse = NULL;
+    if(ws->pesp_conn->proto.tcp)
+      c_free(ws->pesp_conn->proto.tcp);
+    c_free(ws->pesp_conn);
+  }
+  ws->pesp_conn = NULL;
+  if(!ws->client){
+    lws_userdata **p;
+    for(p = &lws_accepted; *p; p = &(*p)->next){
+      if(*p == ws){
+        *p = ws->next;
+        break;
+      }
+    }
+  }
+  lws_queue_free(ws);
+  ws_parser_free(&ws->parser);
+  if(ws->resp){
+    http_response_free(ws->resp);
+    c_free(ws->resp);
+    ws->resp = NULL;
+  }
+  if(gL == NULL)
+    return;
+  if(ws->cb_close_ref != LUA_NOREF && ws->self_ref != LUA_NOREF){
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, ws->cb_close_ref);
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, ws->self_ref);
+    lua_pushinteger(gL, ws->close_code ? ws->close_code : WS_CLOSE_ABNORMAL);
+    if(lua_pcall(gL, 2, 0, 0) != 0){
+      NODE_ERR("http: %s\n", lua_tostring(gL, -1));
+      lua_pop(gL, 1);
+    }
+  }
+  luaL_unref(gL, LUA_REGISTRYINDEX, ws->self_ref);
+  ws->self_ref = LUA_NOREF;
+}
+
+static void lws_message(void *arg, int opcode, char *data, uint32_t len)
+{
+  lws_userdata *ws = (lws_userdata *)arg;
+
+  if(ws->close_rcvd)
+    return;
+  switch(opcode){
+  case WS_OP_TEXT:
+  case WS_OP_BINARY:
+    if(ws->cb_message_ref == LUA_NOREF || ws->self_ref == LUA_NOREF)
+      return;
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, ws->cb_message_ref);
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, ws->self_ref);
+    lua_pushlstring(gL, data, len);
+    lua_pushboolean(gL, opcode == WS_OP_BINARY);
+    // a script error closes the websocket, it does not take the node down
+    if(lua_pcall(gL, 3, 0, 0) != 0){
+      NODE_ERR("http: %s\n", lua_tostring(gL, -1));
+      lua_pop(gL, 1);
+      lws_push_close(ws, 1011);
+    }
+    break;
+  case WS_OP_PING:
+    lws_push(ws, WS_OP_PONG, data, len);
+    break;
+  case WS_OP_CLOSE:
+    ws->close_rcvd = 1;
+    ws->close_code = len >= 2 ? (uint8_t)data[0] << 8 | (uint8_t)data[1] : WS_CLOSE_NONE;
+    // answer with the same code, the connection goes once it is out
+    if(!ws->close_sent)
+      lws_push_close(ws, len >= 2 ? ws->close_code : WS_CLOSE_NORMAL);
+    break;
+  }
+}
+
+static void lws_feed(lws_userdata *ws, char *data, uint32_t len)
+{
+  int err = ws_parse(&ws->parser, data, len, lws_message, ws);
+  if(err && !ws->close_sent){
+    ws->close_code = err;
+    lws_push_close(ws, err);
+  }
+}
+
+// the answer to a client's handshake
+static void lws_handshake(lws_userdata *ws, char *data, uint32_t len)
+{
+  http_response *r = ws->resp;
+  const char *v;
+  int n;
+
+  n = http_response_parse(r, data, len, NULL, NULL);
+  if(r->state <= HTTP_HEADERS)
+    return;
+  v = http_response_header(r, "sec-websocket-accept");
+  if(r->state == HTTP_ERROR || r->status != 101 || v == NULL || c_strcmp(v, ws->accept) != 0){
+    ws->close_code = WS_CLOSE_PROTOCOL;
+    espconn_disconnect(ws->pesp_conn);
+    return;
+  }
+  http_response_free(r);
+  c_free(r);
+  ws->resp = NULL;
+  ws->state = WS_OPEN;
+  if(ws->cb_connection_ref != LUA_NOREF){
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, ws->cb_connection_ref);
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, ws->self_ref);
+    if(lua_pcall(gL, 1, 0, 0) != 0){
+      NODE_ERR("http: %s\n", lua_tostring(gL, -1));
+      lua_pop(gL, 1);
+      lws_push_close(ws, 1011);
+    }
+  }
+  if(ws->state == WS_OPEN && (uint32_t)n < len)
+    lws_feed(ws, data + n, len - n);
+}
+
+static void lws_received(void *arg, char *pdata, unsigned short len)
+{
+  struct espconn *pesp_conn = arg;
+  lws_userdata *ws;
+
+  if(pesp_conn == NULL || (ws = (lws_userdata *)pesp_conn->reverse) == NULL)
+    return;
+  if(ws->state == WS_HANDSHAKE && ws->resp)
+    lws_handshake(ws, pdata, len);
+  else if(ws->state == WS_OPEN)
+    lws_feed(ws, pdata, len);
+}
+
+static void lws_sent(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  lws_userdata *ws;
+  ws_out *t;
+
+  if(pesp_conn == NULL || (ws = (lws_userdata *)pesp_conn->reverse) == NULL)
+    return;
+  ws->out_busy = 0;
+  t = ws->out_head;
+  if(t){
+    ws->out_head = t->next;
+    if(ws->out_head == NULL)
+      ws->out_tail = NULL;
+    ws->out_bytes -= t->len;
+    c_free(t);
+  }
+  if(ws->out_head)
+    lws_kick(ws);
+  else if(ws->close_sent)
+    espconn_disconnect(pesp_conn);
+}
+
+static void lws_disconnected(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  if(pesp_conn == NULL || pesp_conn->reverse == NULL)
+    return;
+  lws_gone((lws_userdata *)pesp_conn->reverse);
+}
+
+static void lws_reconnected(void *arg, sint8_t err)
+{
+  lws_disconnected(arg);
+}
+
+// a server side websocket, called with the listening espconn like
+// http_disconnected()
+static void lws_accepted_disconnected(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  esp_tcp *tcp;
+  lws_userdata *ws;
+
+  if(pesp_conn == NULL || (tcp = pesp_conn->proto.tcp) == NULL)
+    return;
+  pesp_conn->reverse = NULL;
+  for(ws = lws_accepted; ws; ws = ws->next){
+    if(ws->local_port == tcp->local_port && ws->port == tcp->remote_port &&
+        c_memcmp(&ws->ip.addr, tcp->remote_ip, 4) == 0){
+      ws->pesp_conn = NULL;
+      lws_gone(ws);
+      return;
+    }
+  }
+}
+
+static void lws_accepted_reconnected(void *arg, sint8_t err)
+{
+  lws_accepted_disconnected(arg);
+}
+
+static void lws_connected(void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  lws_userdata *ws;
+
+  if(pesp_conn == NULL || (ws = (lws_userdata *)pesp_conn->reverse) == NULL)
+    return;
+  ws->state = WS_HANDSHAKE;
+  if(ws->close_sent){
+    espconn_disconnect(pesp_conn);
+    return;
+  }
+  espconn_regist_recvcb(pesp_conn, lws_received);
+  espconn_regist_sentcb(pesp_conn, lws_sent);
+  espconn_regist_disconcb(pesp_conn, lws_disconnected);
+  lws_kick(ws);   // the handshake is queued
+}
+
+static void lws_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
+{
+  struct espconn *pesp_conn = arg;
+  lws_userdata *ws;
+
+  if(pesp_conn == NULL || (ws = (lws_userdata *)pesp_conn->reverse) == NULL)
+    return;
+  if(ws->close_sent || ipaddr == NULL || ipaddr->addr == 0){
+    lws_gone(ws);
+    return;
+  }
+  ws->ip.addr = ipaddr->addr;
+  ws->state = WS_CONNECTING;
+  c_memcpy(pesp_conn->proto.tcp->remote_ip, &ws->ip.addr, 4);
+  espconn_connect(pesp_conn);
+}
+
+static lws_userdata *lws_new(lua_State *L, bool client)
+{
+  lws_userdata *ws = (lws_userdata *)lua_newuserdata(L, sizeof(lws_userdata));
+  c_memset(ws, 0, sizeof(lws_userdata));
+  ws->self_ref = LUA_NOREF;
+  ws->cb_connection_ref = LUA_NOREF;
+  ws->cb_message_ref = LUA_NOREF;
+  ws->cb_close_ref = LUA_NOREF;
+  ws->client = client;
+  ws_parser_init(&ws->parser, !client);
+  luaL_getmetatable(L, "http.websocket");
+  lua_setmetatable(L, -2);
+  return ws;
+}
+
+// a GET with Upgrade: websocket for a path of srv:websocket(). the 101 goes
+// out through the websocket's queue and the connection is its from now on.
+static bool http_websocket(http_conn *c)
+{
+  http_request *r = &c->req;
+  const char *v, *key;
+  char *p;
+  lws_userdata *ws;
+  int top = lua_gettop(gL);
+
+  v = http_request_header(r, "upgrade");
+  if(v == NULL || !http_has_token(v, "websocket"))
+    return false;
+  lua_rawgeti(gL, LUA_REGISTRYINDEX, c->srv->ws_ref);
+  lua_getfield(gL, -1, http_request_str(r, r->path));
+  if(!lua_isfunction(gL, -1)){
+    lua_settop(gL, top);
+    return false;
+  }
+  key = http_request_header(r, "sec-websocket-key");
+  if(key == NULL || c_strcmp(http_request_str(r, r->method), "GET") != 0){
+    lua_settop(gL, top);
+    http_respond_status(c, 400);
+    return true;
+  }
+
+  ws = lws_new(gL, false);
+  lua_pushvalue(gL, -1);
+  ws->self_ref = luaL_ref(gL, LUA_REGISTRYINDEX);
+  ws->pesp_conn = c->pesp_conn;
+  ws->state = WS_OPEN;
+  p = lws_queue(ws, WS_SWITCHING_LEN);
+  if(p == NULL){
+    ws->pesp_conn = NULL;   // still c's
+    lws_gone(ws);
+    lua_settop(gL, top);
+    http_disconnect(c);
+    return true;
+  }
+  ws_switching(p, key, c_strlen(key));
+
+  // the connection goes over, http_feed() lets go of c
+  c->ws = ws;
+  c->pesp_conn = NULL;
+  c_memcpy(&ws->ip.addr, c->remote_ip, 4);
+  ws->port = c->remote_port;
+  ws->local_port = c->srv->pesp_conn->proto.tcp->local_port;
+  ws->next = lws_accepted;
+  lws_accepted = ws;
+  ws->pesp_conn->reverse = ws;
+  espconn_regist_recvcb(ws->pesp_conn, lws_received);
+  espconn_regist_sentcb(ws->pesp_conn, lws_sent);
+  espconn_regist_disconcb(ws->pesp_conn, lws_accepted_disconnected);
+  espconn_regist_reconcb(ws->pesp_conn, lws_accepted_reconnected);
+  lws_kick(ws);
+
+  http_push_request(r);
+  if(lua_pcall(gL, 2, 0, 0) != 0){
+    NODE_ERR("http: %s\n", lua_tostring(gL, -1));
+    lws_push_close(ws, 1011);
+  }
+  lua_settop(gL, top);
+  return true;
+}
+
+// Lua: ws = http.websocket(url, [headers])
+// url is ws://host[:port]/path, "connection" fires once the handshake is done
+static int http_websocket_open( lua_State* L )
+{
+  const char *url = luaL_checkstring( L, 1 );
+  const char *host, *path, *extra;
+  size_t hl;
+  unsigned port = 80;
+  int headers = lua_istable(L, 2) ? 2 : 0;
+  lws_userdata *ws;
+  struct espconn *pesp_conn;
+  uint8_t raw[18];
+  char key[25];
+  luaL_Buffer b;
+  char num[8];
+  size_t len;
+  char *p;
+  int i;
+
+  http_parse_url(L, url, "ws://", &host, &hl, &port, &path);
+  gL = L;
+
+  // Sec-WebSocket-Key is 16 random bytes in base64
+  for(i = 0; i < 16; i += 4){
+    uint32_t v = lws_random();
+    c_memcpy(raw + i, &v, 4);
+  }
+  raw[16] = raw[17] = 0;
+  for(i = 0; i < 6; i++){
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint32_t v = raw[3*i] << 16 | raw[3*i + 1] << 8 | raw[3*i + 2];
+    key[4*i] = b64[v >> 18];
+    key[4*i + 1] = b64[(v >> 12) & 0x3f];
+    key[4*i + 2] = b64[(v >> 6) & 0x3f];
+    key[4*i + 3] = b64[v & 0x3f];
+  }
+  key[22] = key[23] = '=';
+  key[24] = 0;
+
+  http_push_headers(L, headers);
+  extra = lua_tostring(L, -1);
+  luaL_buffinit(L, &b);
+  luaL_addstring(&b, "GET ");
+  luaL_addstring(&b, path);
+  luaL_addstring(&b, " HTTP/1.1\r\nHost: ");
+  luaL_addlstring(&b, host, hl);
+  if( port != 80 ){
+    c_sprintf(num, ":%u", port);
+    luaL_addstring(&b, num);
+  }
+  luaL_addstring(&b, "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: ");
+  luaL_addstring(&b, key);
+  luaL_addstring(&b, "\r\n");
+  luaL_addstring(&b, extra);
+  luaL_addstring(&b, "\r\n");
+  luaL_pushresult(&b);
+
+  ws = lws_new(L, true);
+  ws_accept_key(key, 24, ws->accept);
+  c_memcpy(ws->host, host, hl);
+  ws->host[hl] = 0;
+  ws->port = port;
+  ws->ip.addr = ipaddr_addr(ws->host);
+  ws->state = WS_DNS;
+  ws->resp = (http_response *)c_zalloc(sizeof(http_response));
+  extra = lua_tolstring(L, -2, &len);
+  p = ws->resp ? lws_queue(ws, len) : NULL;
+  pesp_conn = (struct espconn *)c_zalloc(sizeof(struct espconn));
+  if(pesp_conn)
+    pesp_conn->proto.tcp = (esp_tcp *)c_zalloc(sizeof(esp_tcp));
+  if(p == NULL || pesp_conn == NULL || pesp_conn->proto.tcp == NULL){
+    if(pesp_conn){
+      if(pesp_conn->proto.tcp)
+        c_free(pesp_conn->proto.tcp);
+      c_free(pesp_conn);
+    }
+    lws_gone(ws);
+    return luaL_error( L, "not enough memory" );
+  }
+  c_memcpy(p, extra, len);
+  pesp_conn->type = ESPCONN_TCP;
+  pesp_conn->state = ESPCONN_NONE;
+  pesp_conn->proto.tcp->remote_port = port;
+  pesp_conn->proto.tcp->local_port = espconn_port();
+  pesp_conn->reverse = ws;
+  ws->pesp_conn = pesp_conn;
+  espconn_regist_connectcb(pesp_conn, lws_connected);
+  espconn_regist_reconcb(pesp_conn, lws_reconnected);
+
+  lua_pushvalue(L, -1);
+  ws->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);   // kept while connecting and connected
+  if(ws->ip.addr != IPADDR_NONE){
+    ws->state = WS_CONNECTING;
+    c_memcpy(pesp_conn->proto.tcp->remote_ip, &ws->ip.addr, 4);
+    espconn_connect(pesp_conn);
+  } else {
+    switch(espconn_gethostbyname(pesp_conn, ws->host, &ws->ip, lws_dns_found)){
+      case ESPCONN_OK:          // answered from the resolver table
+        lws_dns_found(ws->host, &ws->ip, pesp_conn);
+        break;
+      case ESPCONN_INPROGRESS:
+        break;
+      default:                  // not queued, no callback comes
+        lws_gone(ws);
+        break;
+    }
+  }
+  return 1;
+}
+
+// Lua: ws:on("connection" | "message" | "close", function)
+// message: function(ws, data, binary), close: function(ws, code)
+static int http_websocket_on( lua_State* L )
+{
+  lws_userdata *ws = (lws_userdata *)luaL_checkudata(L, 1, "http.websocket");
+  const char *event = luaL_checkstring( L, 2 );
+  int *ref;
+
+  if( c_strcmp(event, "connection") == 0 )
+    ref = &ws->cb_connection_ref;
+  else if( c_strcmp(event, "message") == 0 )
+    ref = &ws->cb_message_ref;
+  else if( c_strcmp(event, "close") == 0 )
+    ref = &ws->cb_close_ref;
+  else
+    return luaL_error( L, "method not supported" );
+  luaL_unref(L, LUA_REGISTRYINDEX, *ref);
+  *ref = LUA_NOREF;
+  if( !lua_isnil(L, 3) ){
+    luaL_checkanyfunction( L, 3 );
+    lua_pushvalue(L, 3);
+    *ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  return 0;
+}
+
+// Lua: ws:send(data, [binary])
+static int http_websocket_send( lua_State* L )
+{
+  lws_userdata *ws = (lws_userdata *)luaL_checkudata(L, 1, "http.websocket");
+  size_t l;
+  const char *data = luaL_checklstring( L, 2, &l );
+
+  if( ws->state != WS_OPEN || ws->close_sent )
+    return luaL_error( L, "not connected" );
+  gL = L;
+  if( !lws_push(ws, lua_toboolean(L, 3) ? WS_OP_BINARY : WS_OP_TEXT, data, l) )
+    return luaL_error( L, "send queue full" );
+  return 0;
+}
+
+// Lua: ws:close([code])
+static int http_websocket_close( lua_State* L )
+{
+  lws_userdata *ws = (lws_userdata *)luaL_checkudata(L, 1, "http.websocket");
+  unsigned code = luaL_optinteger( L, 2, WS_CLOSE_NORMAL );
+
+  if( ws->state == WS_CLOSED || ws->close_sent )
+    return 0;
+  gL = L;
+  if( ws->state < WS_OPEN ){
+    ws->close_sent = 1;   // goes once espconn calls back
+    if( ws->state == WS_HANDSHAKE )
+      espconn_disconnect(ws->pesp_conn);
+    return 0;
+  }
+  ws->close_code = code;
+  lws_push_close(ws, code);
+  return 0;
+}
+
+static int http_websocket_gc( lua_State* L )
+{
+  lws_userdata *ws = (lws_userdata *)luaL_checkudata(L, 1, "http.websocket");
+
+  // only reached once it is closed, or it never got a connection
+  lws_gone(ws);
+  luaL_unref(L, LUA_REGISTRYINDEX, ws->cb_connection_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, ws->cb_message_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, ws->cb_close_ref);
+  ws->cb_connection_ref = ws->cb_message_ref = ws->cb_close_ref = LUA_NOREF;
+  return 0;
+}
+
+// Module function map
+#define MIN_OPT_LEVEL 2
+#include "lrodefs.h"
+
+static const LUA_REG_TYPE http_server_map[] =
+{
+  { LSTRKEY( "route" ), LFUNCVAL( http_server_route ) },
+  { LSTRKEY( "static" ), LFUNCVAL( http_server_static ) },
+  { LSTRKEY( "websocket" ), LFUNCVAL( http_server_websocket ) },
+  { LSTRKEY( "close" ), LFUNCVAL( http_server_close ) },
+  { LSTRKEY( "__gc" ), LFUNCVAL( http_server_gc ) },
+#if LUA_OPTIMIZE_MEMORY > 0
+  { LSTRKEY( "__index" ), LROVAL( http_server_map ) },
+#endif
+  { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE http_websocket_map[] =
+{
+  { LSTRKEY( "on" ), LFUNCVAL( http_websocket_on ) },
+  { LSTRKEY( "send" ), LFUNCVAL( http_websocket_send ) },
+  { LSTRKEY( "close" ), LFUNCVAL( http_websocket_close ) },
+  { LSTRKEY( "__gc" ), LFUNCVAL( http_websocket_gc ) },
+#if LUA_OPTIMIZE_MEMORY > 0
+  { LSTRKEY( "__index" ), LROVAL( http_websocket_map ) },
+#endif
+  { LNILKEY, LNILVAL }
+};
+
+const LUA_REG_TYPE http_map[] =
+{
+  { LSTRKEY( "createServer" ), LFUNCVAL( http_create_server ) },
+  { LSTRKEY( "request" ), LFUNCVAL( http_client_request ) },
+  { LSTRKEY( "websocket" ), LFUNCVAL( http_websocket_open ) },
+#if LUA_OPTIMIZE_MEMORY > 0
+  { LSTRKEY( "__metatable" ), LROVAL( http_map ) },
+#endif
+  { LNILKEY, LNILVAL }
+};
+
+LUALIB_API int luaopen_http( lua_State *L )
+{
+#if LUA_OPTIMIZE_MEMORY > 0
+  luaL_rometatable(L, "http.server", (void *)http_server_map);  // create metatable for http.server
+  luaL_rometatable(L, "http.websocket", (void *)http_websocket_map);  // create metatable for http.websocket
+  return 0;
+#else // #if LUA_OPTIMIZE_MEMORY > 0
+  int n;
+  luaL_register( L, AUXLIB_HTTP, http_map );
+
+  // create metatable for http.server
+  n = lua_gettop(L);
+  luaL_newmetatable(L, "http.server");
+  lua_pushliteral(L, "__index");
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -3);
+  luaL_register( L, NULL, http_server_map );
+  lua_settop(L, n);
+
+  // create metatable for http.websocket
+  luaL_newmetatable(L, "http.websocket");
+  lua_pushliteral(L, "__index");
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -3);
+  luaL_register( L, NULL, http_websocket_map );
+  lua_settop(L, n);
+
+  return 1;
+#endif // #if LUA_OPTIMIZE_MEMORY > 0
+}
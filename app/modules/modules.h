@@ -181,6 +181,14 @@
 #define ROM_MODULES_DHT
 #endif
 
+#if defined(LUA_USE_MODULES_HTTP)
+#define MODULES_HTTP        "http"
+#define ROM_MODULES_HTTP    \
+    _ROM(MODULES_HTTP, luaopen_http, http_map)
+#else
+#define ROM_MODULES_HTTP
+#endif
+
 #define LUA_MODULES_ROM     \
         ROM_MODULES_GPIO    \
         ROM_MODULES_PWM		\
@@ -194,6 +202,7 @@
         ROM_MODULES_NODE    \
         ROM_MODULES_FILE    \
         ROM_MODULES_NET     \
+        ROM_MODULES_HTTP    \
         ROM_MODULES_ADC     \
         ROM_MODULES_UART    \
         ROM_MODULES_OW      \
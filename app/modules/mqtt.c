@@ -777,7 +777,6 @@ static void socket_connect(struct espconn *pesp_conn)
 }
 
 static void socket_dns_found(const char *name, ip_addr_t *ipaddr, void *arg);
-static dns_reconn_count = 0;
 static ip_addr_t host_ip; // for dns
 static void socket_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
 {
@@ -788,25 +787,19 @@ static void socket_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
     return;
   }
 
+  // the resolver has retried already, and answers a name that just failed
+  // from its table for a while
   if(ipaddr == NULL)
   {
-    dns_reconn_count++;
-    if( dns_reconn_count >= 5 ){
-      NODE_ERR( "DNS Fail!\n" );
-      // Note: should delete the pesp_conn or unref self_ref here.
-      mqtt_socket_disconnected(arg);   // although not connected, but fire disconnect callback to release every thing.
-      return;
-    }
-    NODE_ERR( "DNS retry %d!\n", dns_reconn_count );
-    host_ip.addr = 0;
-    espconn_gethostbyname(pesp_conn, name, &host_ip, socket_dns_found);
+    NODE_ERR( "DNS Fail!\n" );
+    // Note: should delete the pesp_conn or unref self_ref here.
+    mqtt_socket_disconnected(arg);   // although not connected, but fire disconnect callback to release every thing.
     return;
   }
 
   // ipaddr->addr is a uint32_t ip
   if(ipaddr->addr != 0)
   {
-    dns_reconn_count = 0;
     c_memcpy(pesp_conn->proto.tcp->remote_ip, &(ipaddr->addr), 4);
     NODE_DBG("TCP ip is set: ");
     NODE_DBG(IPSTR, IP2STR(&(ipaddr->addr)));
@@ -940,7 +933,6 @@ static int mqtt_socket_connect( lua_State* L )
   if((ipaddr.addr == IPADDR_NONE) && (c_memcmp(domain,"255.255.255.255",16) != 0))
   {
     host_ip.addr = 0;
-    dns_reconn_count = 0;
     if(ESPCONN_OK == espconn_gethostbyname(pesp_conn, domain, &host_ip, socket_dns_found)){
       socket_dns_found(domain, &host_ip, pesp_conn);  // ip is returned in host_ip.
     }
@@ -12,8 +12,13 @@
 
 #include "c_types.h"
 #include "mem.h"
+#include "user_interface.h"
 #include "espconn.h"
 #include "lwip/dns.h" 
+#include "lwip/pbuf.h"
+#include "lwip/stats.h"
+#include "flash_fs.h"
+#include "romfs.h"
 
 #ifdef CLIENT_SSL_ENABLE
 unsigned char *default_certificate;
@@ -31,9 +36,26 @@ static ip_addr_t host_ip; // for dns
 static int expose_array(lua_State* L, char *array, unsigned short len);
 #endif
 
-#define MAX_SOCKET 5
-static int socket_num = 0;
-static int socket[MAX_SOCKET];
+// connections accepted by the tcp server. the table grows with the number of
+// clients, up to what listen() raised the lwip pcb limit to for the free heap.
+// it is kept dense, a userdata knows its slot, so adding and removing one is
+// O(1), and close() walks only the live ones.
+#define SOCKET_TABLE_MIN    4
+#define NET_CONN_HEAP       1024        // heap an idle accepted connection costs
+#define NET_ACCEPT_HEAP_MIN (8*1024)    // accept is refused below this
+
+struct lnet_userdata;
+typedef struct
+{
+  int ref;
+  struct lnet_userdata *nud;
+}net_socket_slot;
+
+static net_socket_slot *socket = NULL;
+static uint16_t socket_num = 0;
+static uint16_t socket_size = 0;
+static uint16_t socket_max = 0;     // pcb limit set by listen()
+static uint32_t socket_refused = 0;
 static lua_State *gL = NULL;
 static int tcpserver_cb_connect_ref = LUA_NOREF;  // for tcp server connected callback
 static uint16_t tcp_server_timeover = 30;
@@ -41,6 +63,30 @@ static uint16_t tcp_server_timeover = 30;
 static struct espconn *pTcpServer = NULL;
 static struct espconn *pUdpServer = NULL;
 
+// sendfile() reads the file in chunks that fit the tcp send buffer, so one
+// espconn_sent() per acknowledgement keeps the pipe full.
+#define SENDFILE_CHUNK_SIZE (2*TCP_MSS)
+
+// socket:send() copies the payload into a queue of chunks, so it takes any
+// length and may be called again before the last one was acknowledged.
+// espconn hands the data to tcp_write() without copying, the head chunk has
+// to stay put until net_socket_sent(). send() returns false once the queue is
+// above the high water mark, "drain" fires when it fell below the low one.
+#define SENDQ_CHUNK_SIZE  (2*TCP_MSS)   // one chunk fills the tcp send buffer
+#define SENDQ_MIN_CHUNK   256           // small sends are coalesced into this
+#define SENDQ_HIGH_WATER  (2*SENDQ_CHUNK_SIZE)
+#define SENDQ_LOW_WATER   SENDQ_CHUNK_SIZE
+#define SENDQ_MAX         (16*1024)     // send() fails beyond this
+#define SENDQ_SNDBUF_MAX  (32*1024)     // the most setopt{sndbuf} takes
+
+typedef struct net_sendq_chunk
+{
+  struct net_sendq_chunk *next;
+  uint16_t len;
+  uint16_t size;
+  char data[1];
+}net_sendq_chunk;
+
 typedef struct lnet_userdata
 {
   struct espconn *pesp_conn;
@@ -51,11 +97,254 @@ typedef struct lnet_userdata
   int cb_receive_ref;
   int cb_send_ref;
   int cb_dns_found_ref;
+  int cb_sendfile_ref;
+  int sendfile_fd;        // FS_OPEN_OK - 1 if no sendfile() in progress
+  uint32_t sendfile_left; // bytes still to be read from sendfile_fd
+  char *sendfile_buf;
+  const uint8_t *sendfile_map;  // file mapped from ROMFS/WOFS, sent in place
+  int cb_drain_ref;
+  net_sendq_chunk *sendq_head;  // in flight if sendq_busy
+  net_sendq_chunk *sendq_tail;
+  uint32_t sendq_bytes;
+  uint32_t sendq_high;
+  uint32_t sendq_low;
+  uint32_t sendq_max;
+  uint8_t sendq_busy;
+  uint8_t sendq_full;     // went above sendq_high, "drain" is due
+  int16_t slot;           // in socket[], -1 if not accepted by the server
 #ifdef CLIENT_SSL_ENABLE
   uint8_t secure;
 #endif
 }lnet_userdata;
 
+#define net_sendfile_active(nud) ((nud)->sendfile_fd != FS_OPEN_OK - 1 || (nud)->sendfile_map != NULL)
+
+static void net_sendfile_release(lnet_userdata *nud)
+{
+  if(nud->sendfile_fd != FS_OPEN_OK - 1){   // a mapped file has no fd
+    fs_close(nud->sendfile_fd);
+    nud->sendfile_fd = FS_OPEN_OK - 1;
+  }
+  if(nud->sendfile_buf){
+    c_free(nud->sendfile_buf);
+    nud->sendfile_buf = NULL;
+  }
+  nud->sendfile_map = NULL;
+  nud->sendfile_left = 0;
+}
+
+// finish a sendfile(), call the lua callback with (socket, ok)
+static void net_sendfile_done(lnet_userdata *nud, bool ok)
+{
+  int ref = nud->cb_sendfile_ref;
+  net_sendfile_release(nud);
+  nud->cb_sendfile_ref = LUA_NOREF;
+  if(ref == LUA_NOREF)
+    return;
+  if(gL != NULL && nud->self_ref != LUA_NOREF){
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, ref);
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);
+    lua_pushboolean(gL, ok);
+    luaL_unref(gL, LUA_REGISTRYINDEX, ref);
+    lua_call(gL, 2, 0);
+  } else if(gL != NULL) {
+    luaL_unref(gL, LUA_REGISTRYINDEX, ref);
+  }
+}
+
+// read the next chunk of the file and hand it to espconn.
+// returns 1 if a chunk is in flight, 0 at end of file, -1 on error.
+static int net_sendfile_next(lnet_userdata *nud)
+{
+  struct espconn *pesp_conn = nud->pesp_conn;
+  unsigned char *data;
+  size_t n;
+  sint8_t res;
+
+  if(pesp_conn == NULL)
+    return -1;
+  if(nud->sendfile_left == 0)
+    return 0;
+  n = nud->sendfile_left < SENDFILE_CHUNK_SIZE ? nud->sendfile_left : SENDFILE_CHUNK_SIZE;
+  if(nud->sendfile_map){
+    // mapped file, espconn copies straight from the flash
+    data = (unsigned char *)nud->sendfile_map;
+    nud->sendfile_map += n;
+  } else {
+    n = fs_read(nud->sendfile_fd, nud->sendfile_buf, n);
+    if(n == 0)    // end of file or read error, the length was just an upper bound
+      return 0;
+    data = (unsigned char *)nud->sendfile_buf;
+  }
+  nud->sendfile_left -= n;
+#ifdef CLIENT_SSL_ENABLE
+  if(nud->secure)
+    res = espconn_secure_sent(pesp_conn, data, n);
+  else
+#endif
+    res = espconn_sent(pesp_conn, data, n);
+  return res == ESPCONN_OK ? 1 : -1;
+}
+
+static void net_sendq_init(lnet_userdata *nud)
+{
+  nud->cb_drain_ref = LUA_NOREF;
+  nud->sendq_head = nud->sendq_tail = NULL;
+  nud->sendq_bytes = 0;
+  nud->sendq_high = SENDQ_HIGH_WATER;
+  nud->sendq_low = SENDQ_LOW_WATER;
+  nud->sendq_max = SENDQ_MAX;
+  nud->sendq_busy = 0;
+  nud->sendq_full = 0;
+}
+
+static void net_sendq_release(lnet_userdata *nud)
+{
+  net_sendq_chunk *c;
+  while((c = nud->sendq_head) != NULL){
+    nud->sendq_head = c->next;
+    c_free(c);
+  }
+  nud->sendq_tail = NULL;
+  nud->sendq_bytes = 0;
+  nud->sendq_busy = 0;
+  nud->sendq_full = 0;
+}
+
+// copy a payload to the tail of the queue. all or nothing, returns false if
+// out of memory.
+static bool net_sendq_push(lnet_userdata *nud, const char *payload, size_t l)
+{
+  net_sendq_chunk *first = NULL, *last = NULL, *c;
+  net_sendq_chunk *tail = nud->sendq_tail;
+  size_t n;
+
+  // top up the tail unless espconn is sending from it
+  if(tail && !(tail == nud->sendq_head && nud->sendq_busy)){
+    n = tail->size - tail->len;
+    if(n > l)
+      n = l;
+    c_memcpy(tail->data + tail->len, payload, n);
+    tail->len += n;
+    nud->sendq_bytes += n;
+    payload += n;
+    l -= n;
+  }
+  while(l > 0){
+    n = l < SENDQ_CHUNK_SIZE ? l : SENDQ_CHUNK_SIZE;
+    uint16_t size = n < SENDQ_MIN_CHUNK ? SENDQ_MIN_CHUNK : n;
+    c = (net_sendq_chunk *)c_malloc(sizeof(net_sendq_chunk) - 1 + size);
+    if(c == NULL){
+      while((c = first) != NULL){
+        first = c->next;
+        c_free(c);
+      }
+      return false;
+    }
+    c->next = NULL;
+    c->len = n;
+    c->size = size;
+    c_memcpy(c->data, payload, n);
+    if(last)
+      last->next = c;
+    else
+      first = c;
+    last = c;
+    payload += n;
+    l -= n;
+  }
+  if(first){
+    if(nud->sendq_tail)
+      nud->sendq_tail->next = first;
+    else
+      nud->sendq_head = first;
+    nud->sendq_tail = last;
+    for(c = first; c; c = c->next)
+      nud->sendq_bytes += c->len;
+  }
+  return true;
+}
+
+// hand the head chunk to espconn, unless it or a sendfile() chunk is in
+// flight. returns false if espconn refused it.
+static bool net_sendq_kick(lnet_userdata *nud)
+{
+  struct espconn *pesp_conn = nud->pesp_conn;
+  sint8_t res;
+
+  if(nud->sendq_head == NULL || nud->sendq_busy || net_sendfile_active(nud))
+    return true;
+  if(pesp_conn == NULL)
+    return false;
+#ifdef CLIENT_SSL_ENABLE
+  if(nud->secure)
+    res = espconn_secure_sent(pesp_conn, (unsigned char *)nud->sendq_head->data, nud->sendq_head->len);
+  else
+#endif
+    res = espconn_sent(pesp_conn, (unsigned char *)nud->sendq_head->data, nud->sendq_head->len);
+  if(res != ESPCONN_OK)
+    return false;
+  nud->sendq_busy = 1;
+  return true;
+}
+
+// raise the lwip pcb limit to the connections the free heap can hold, never
+// below what it is
+static void net_socket_limit(void)
+{
+  uint32_t heap = system_get_free_heap_size();
+  uint32_t n = heap > NET_ACCEPT_HEAP_MIN ? (heap - NET_ACCEPT_HEAP_MIN) / NET_CONN_HEAP : 0;
+  uint8_t cur = espconn_tcp_get_max_con();
+
+  if(n > 255)
+    n = 255;
+  if(n > cur)
+    espconn_tcp_set_max_con(n);
+  else
+    n = cur;
+  socket_max = n;
+}
+
+// the slot for a newly accepted connection, the table grows as needed.
+// -1 if the server is at its limit or the heap is short.
+static int net_socket_slot_new(void)
+{
+  net_socket_slot *t;
+  uint16_t size;
+  int i;
+
+  if(socket_num >= socket_max || system_get_free_heap_size() < NET_ACCEPT_HEAP_MIN)
+    return -1;
+  if(socket_num < socket_size)
+    return socket_num;
+  size = socket_size ? socket_size * 2 : SOCKET_TABLE_MIN;
+  if(size > socket_max)
+    size = socket_max;
+  t = (net_socket_slot *)c_realloc(socket, size * sizeof(net_socket_slot));
+  if(t == NULL)
+    return -1;
+  for(i = socket_size; i < size; i++){
+    t[i].ref = LUA_NOREF;
+    t[i].nud = NULL;
+  }
+  socket = t;
+  socket_size = size;
+  return socket_num;
+}
+
+// heap net holds for a connection: its userdata, espconn and what is queued
+static uint32_t net_socket_mem(lnet_userdata *nud)
+{
+  uint32_t mem = sizeof(lnet_userdata) + sizeof(struct espconn) + sizeof(esp_tcp);
+  net_sendq_chunk *c;
+
+  for(c = nud->sendq_head; c; c = c->next)
+    mem += sizeof(net_sendq_chunk) - 1 + c->size;
+  if(nud->sendfile_buf)
+    mem += SENDFILE_CHUNK_SIZE;
+  return mem;
+}
+
 static void net_server_disconnected(void *arg)    // for tcp server only
 {
   NODE_DBG("net_server_disconnected is called.\n");
@@ -76,25 +365,32 @@ static void net_server_disconnected(void *arg)    // for tcp server only
   NODE_DBG("%d",pesp_conn->proto.tcp->remote_port);
   NODE_DBG(" disconnected.\n");
 #endif
+  if(net_sendfile_active(nud))
+    net_sendfile_done(nud, false);
+  net_sendq_release(nud);
   if(nud->cb_disconnect_ref != LUA_NOREF && nud->self_ref != LUA_NOREF)
   {
     lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->cb_disconnect_ref);
     lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);  // pass the userdata(client) to callback func in lua
     lua_call(gL, 1, 0);
   }
-  int i;
+  int i = nud->slot;
   lua_gc(gL, LUA_GCSTOP, 0);
-  for(i=0;i<MAX_SOCKET;i++){
-    if( (LUA_NOREF!=socket[i]) && (socket[i] == nud->self_ref) ){
-      // found the saved client
-      nud->pesp_conn->reverse = NULL;
-      nud->pesp_conn = NULL;    // the espconn is made by low level sdk, do not need to free, delete() will not free it.
-      nud->self_ref = LUA_NOREF;   // unref this, and the net.socket userdata will delete it self
-      luaL_unref(gL, LUA_REGISTRYINDEX, socket[i]);
-      socket[i] = LUA_NOREF;
-      socket_num--;
-      break;
+  if(i >= 0 && i < socket_num && socket[i].nud == nud){
+    // found the saved client
+    nud->pesp_conn->reverse = NULL;
+    nud->pesp_conn = NULL;    // the espconn is made by low level sdk, do not need to free, delete() will not free it.
+    nud->self_ref = LUA_NOREF;   // unref this, and the net.socket userdata will delete it self
+    nud->slot = -1;
+    luaL_unref(gL, LUA_REGISTRYINDEX, socket[i].ref);
+    // move the last one into the hole
+    socket_num--;
+    if(i != socket_num){
+      socket[i] = socket[socket_num];
+      socket[i].nud->slot = i;
     }
+    socket[socket_num].ref = LUA_NOREF;
+    socket[socket_num].nud = NULL;
   }
   lua_gc(gL, LUA_GCRESTART, 0);
 }
@@ -108,6 +404,9 @@ static void net_socket_disconnected(void *arg)    // tcp only
   lnet_userdata *nud = (lnet_userdata *)pesp_conn->reverse;
   if(nud == NULL)
     return;
+  if(net_sendfile_active(nud))
+    net_sendfile_done(nud, false);
+  net_sendq_release(nud);
   if(nud->cb_disconnect_ref != LUA_NOREF && nud->self_ref != LUA_NOREF)
   {
     lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->cb_disconnect_ref);
@@ -165,6 +464,43 @@ static void net_socket_received(void *arg, char *pdata, unsigned short len)
   lua_call(gL, 2, 0);
 }
 
+// pbufs of a received chain made into one Lua string at a time
+#define NET_RECV_PIECES 8
+
+// Received tcp data straight from the pbuf chain: the Lua string is built
+// from the pbuf payloads, each byte copied once
+static void net_socket_received_pbuf(void *arg, struct pbuf *p)
+{
+  NODE_DBG("net_socket_received_pbuf is called.\n");
+  struct espconn *pesp_conn = arg;
+  const char *piece[NET_RECV_PIECES];
+  size_t piece_len[NET_RECV_PIECES];
+  int n, strings = 0;
+  if(pesp_conn == NULL)
+    return;
+  lnet_userdata *nud = (lnet_userdata *)pesp_conn->reverse;
+  if(nud == NULL)
+    return;
+  if(nud->cb_receive_ref == LUA_NOREF)
+    return;
+  if(nud->self_ref == LUA_NOREF)
+    return;
+  lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->cb_receive_ref);
+  lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);  // pass the userdata(server) to callback func in lua
+  while(p != NULL){
+    for(n = 0; p != NULL && n < NET_RECV_PIECES; p = p->next, n++){
+      piece[n] = (const char *)p->payload;
+      piece_len[n] = p->len;
+    }
+    lua_pushlstringv(gL, piece, piece_len, n);
+    strings++;
+  }
+  // longer chains than that are rare, joined with one more copy
+  if(strings > 1)
+    lua_concat(gL, strings);
+  lua_call(gL, 2, 0);
+}
+
 static void net_socket_sent(void *arg)
 {
   // NODE_DBG("net_socket_sent is called.\n");
@@ -174,6 +510,44 @@ static void net_socket_sent(void *arg)
   lnet_userdata *nud = (lnet_userdata *)pesp_conn->reverse;
   if(nud == NULL)
     return;
+  if(nud->sendq_busy){
+    // the head chunk is acknowledged
+    net_sendq_chunk *c = nud->sendq_head;
+    nud->sendq_head = c->next;
+    if(nud->sendq_head == NULL)
+      nud->sendq_tail = NULL;
+    nud->sendq_bytes -= c->len;
+    nud->sendq_busy = 0;
+    c_free(c);
+  } else if(net_sendfile_active(nud)){
+    // a sendfile() is in progress, chain the next chunk off this ack
+    int res = net_sendfile_next(nud);
+    if(res > 0)
+      return;
+    net_sendfile_done(nud, res == 0);
+    if(nud->pesp_conn == NULL)
+      return;
+    // send()s made during the sendfile() go out now
+    if(nud->sendq_head == NULL)
+      return;
+  }
+  if(!net_sendq_kick(nud)){
+    net_sendq_release(nud);
+    return;
+  }
+  if(nud->self_ref == LUA_NOREF)
+    return;
+  if(nud->sendq_full && nud->sendq_bytes <= nud->sendq_low){
+    nud->sendq_full = 0;
+    if(nud->cb_drain_ref != LUA_NOREF){
+      lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->cb_drain_ref);
+      lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);
+      lua_call(gL, 1, 0);
+    }
+  }
+  // "sent" once everything queued is out
+  if(nud->sendq_head != NULL || nud->pesp_conn == NULL || nud->self_ref == LUA_NOREF)
+    return;
   if(nud->cb_send_ref == LUA_NOREF)
     return;
   if(nud->self_ref == LUA_NOREF)
@@ -237,7 +611,7 @@ static void net_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
     // ipaddr->addr is a uint32_t ip
     char ip_str[20];
     c_memset(ip_str, 0, sizeof(ip_str));
-    if(host_ip.addr == 0 && ipaddr->addr != 0)
+    if(ipaddr->addr != 0)
     {
       c_sprintf(ip_str, IPSTR, IP2STR(&(ipaddr->addr)));
     }
@@ -278,15 +652,11 @@ static void net_server_connected(void *arg) // for tcp only
   NODE_DBG(" connected.\n");
 #endif
 
-  for(i=0;i<MAX_SOCKET;i++){
-    if(socket[i] == LUA_NOREF)  // found empty slot
-    {
-      break;
-    }
-  }
-  if(i>=MAX_SOCKET) // can't create more socket
+  i = net_socket_slot_new();
+  if(i < 0) // can't take more sockets
   {
-    NODE_ERR("MAX_SOCKET\n");
+    NODE_ERR("no slot for socket\n");
+    socket_refused++;
     pesp_conn->reverse = NULL;    // not accept this conn
     if(pesp_conn->proto.tcp->remote_port || pesp_conn->proto.tcp->local_port)
       espconn_disconnect(pesp_conn);
@@ -314,7 +684,9 @@ static void net_server_connected(void *arg) // for tcp only
   skt->self_ref = LUA_NOREF;
   lua_pushvalue(gL, -1);  // copy the top of stack
   skt->self_ref = luaL_ref(gL, LUA_REGISTRYINDEX);    // ref to it self, for module api to find the userdata
-  socket[i] = skt->self_ref;  // save to socket array
+  socket[i].ref = skt->self_ref;  // save to socket table
+  socket[i].nud = skt;
+  skt->slot = i;
   socket_num++;
   skt->cb_connect_ref = LUA_NOREF;  // this socket already connected
   skt->cb_reconnect_ref = LUA_NOREF;
@@ -323,6 +695,12 @@ static void net_server_connected(void *arg) // for tcp only
   skt->cb_receive_ref = LUA_NOREF;
   skt->cb_send_ref = LUA_NOREF;
   skt->cb_dns_found_ref = LUA_NOREF;
+  skt->cb_sendfile_ref = LUA_NOREF;
+  skt->sendfile_fd = FS_OPEN_OK - 1;
+  skt->sendfile_left = 0;
+  skt->sendfile_buf = NULL;
+  skt->sendfile_map = NULL;
+  net_sendq_init(skt);
 
 #ifdef CLIENT_SSL_ENABLE
   skt->secure = 0;    // as a server SSL is not supported.
@@ -332,6 +710,7 @@ static void net_server_connected(void *arg) // for tcp only
   pesp_conn->reverse = skt;   // let espcon carray the info of this userdata(net.socket)
 
   espconn_regist_recvcb(pesp_conn, net_socket_received);
+  espconn_regist_recvpbufcb(pesp_conn, net_socket_received_pbuf);
   espconn_regist_sentcb(pesp_conn, net_socket_sent);
   espconn_regist_disconcb(pesp_conn, net_server_disconnected);
   espconn_regist_reconcb(pesp_conn, net_server_reconnected);
@@ -351,6 +730,7 @@ static void net_socket_connected(void *arg)
     return;
   // can receive and send data, even if there is no connected callback in lua.
   espconn_regist_recvcb(pesp_conn, net_socket_received);
+  espconn_regist_recvpbufcb(pesp_conn, net_socket_received_pbuf);
   espconn_regist_sentcb(pesp_conn, net_socket_sent);
   espconn_regist_disconcb(pesp_conn, net_socket_disconnected);
 
@@ -429,6 +809,13 @@ static int net_create( lua_State* L, const char* mt )
   nud->cb_receive_ref = LUA_NOREF;
   nud->cb_send_ref = LUA_NOREF;
   nud->cb_dns_found_ref = LUA_NOREF;
+  nud->cb_sendfile_ref = LUA_NOREF;
+  nud->sendfile_fd = FS_OPEN_OK - 1;
+  nud->sendfile_left = 0;
+  nud->sendfile_buf = NULL;
+  nud->sendfile_map = NULL;
+  net_sendq_init(nud);
+  nud->slot = -1;
   nud->pesp_conn = NULL;
 #ifdef CLIENT_SSL_ENABLE
   nud->secure = secure;
@@ -575,6 +962,16 @@ static int net_delete( lua_State* L, const char* mt )
     luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_dns_found_ref);
     nud->cb_dns_found_ref = LUA_NOREF;
   }
+  net_sendfile_release(nud);
+  if(LUA_NOREF!=nud->cb_sendfile_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_sendfile_ref);
+    nud->cb_sendfile_ref = LUA_NOREF;
+  }
+  net_sendq_release(nud);
+  if(LUA_NOREF!=nud->cb_drain_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_drain_ref);
+    nud->cb_drain_ref = LUA_NOREF;
+  }
   lua_gc(gL, LUA_GCSTOP, 0);
   if(LUA_NOREF!=nud->self_ref){
     luaL_unref(L, LUA_REGISTRYINDEX, nud->self_ref);
@@ -612,7 +1009,6 @@ static void socket_connect(struct espconn *pesp_conn)
 }
 
 static void socket_dns_found(const char *name, ip_addr_t *ipaddr, void *arg);
-static dns_reconn_count = 0;
 static void socket_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
 {
   NODE_DBG("socket_dns_found is called.\n");
@@ -626,29 +1022,23 @@ static void socket_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
     return;
   if(gL == NULL)
     return;
+  // the resolver has retried already, and answers a name that just failed
+  // from its table for a while
   if(ipaddr == NULL)
   {
-    dns_reconn_count++;
-    if( dns_reconn_count >= 5 ){
-      NODE_ERR( "DNS Fail!\n" );
-      lua_gc(gL, LUA_GCSTOP, 0);
-      if(nud->self_ref != LUA_NOREF){
-        luaL_unref(gL, LUA_REGISTRYINDEX, nud->self_ref);
-        nud->self_ref = LUA_NOREF; // unref this, and the net.socket userdata will delete it self
-      }
-      lua_gc(gL, LUA_GCRESTART, 0);
-      return;
+    NODE_ERR( "DNS Fail!\n" );
+    lua_gc(gL, LUA_GCSTOP, 0);
+    if(nud->self_ref != LUA_NOREF){
+      luaL_unref(gL, LUA_REGISTRYINDEX, nud->self_ref);
+      nud->self_ref = LUA_NOREF; // unref this, and the net.socket userdata will delete it self
     }
-    NODE_ERR( "DNS retry %d!\n", dns_reconn_count );
-    host_ip.addr = 0;
-    espconn_gethostbyname(pesp_conn, name, &host_ip, socket_dns_found);
+    lua_gc(gL, LUA_GCRESTART, 0);
     return;
   }
 
   // ipaddr->addr is a uint32_t ip
   if(ipaddr->addr != 0)
   {
-    dns_reconn_count = 0;
     if( pesp_conn->type == ESPCONN_TCP )
     {
       c_memcpy(pesp_conn->proto.tcp->remote_ip, &(ipaddr->addr), 4);
@@ -791,6 +1181,7 @@ static int net_start( lua_State* L, const char* mt )
   {
     if(isserver){   // no secure server support for now
       espconn_regist_connectcb(pesp_conn, net_server_connected);
+      net_socket_limit();
       // tcp server, SSL is not supported
 #ifdef CLIENT_SSL_ENABLE
       // if(nud->secure)
@@ -832,7 +1223,6 @@ static int net_start( lua_State* L, const char* mt )
     if((ipaddr.addr == IPADDR_NONE) && (c_memcmp(domain,"255.255.255.255",16) != 0))
     {
       host_ip.addr = 0;
-      dns_reconn_count = 0;
       if(ESPCONN_OK == espconn_gethostbyname(pesp_conn, domain, &host_ip, socket_dns_found)){
         socket_dns_found(domain, &host_ip, pesp_conn);  // ip is returned in host_ip.
       }
@@ -880,16 +1270,14 @@ static int net_close( lua_State* L, const char* mt )
 
   int n = lua_gettop(L);
   skt = nud;
+  i = socket_num;   // from the end, net_server_disconnected() may fill the hole
 
   do{
     if(isserver && skt == NULL){
-      if(socket[i] != LUA_NOREF){  // there is client socket exists
-        lua_rawgeti(L, LUA_REGISTRYINDEX, socket[i]);    // get the referenced user_data to stack top
-#if 0
-        socket[i] = LUA_NOREF;
-        socket_num--;
-#endif  // do this in net_server_disconnected
-        i++;
+      i--;
+      if(socket[i].ref != LUA_NOREF){  // there is client socket exists
+        lua_rawgeti(L, LUA_REGISTRYINDEX, socket[i].ref);    // get the referenced user_data to stack top
+        // the slot is freed in net_server_disconnected
         if(lua_isuserdata(L,-1)){
           skt = lua_touserdata(L,-1);
         } else {
@@ -897,8 +1285,6 @@ static int net_close( lua_State* L, const char* mt )
           continue;
         }
       }else{
-        // skip LUA_NOREF
-        i++;
         continue;
       }
     }
@@ -944,7 +1330,7 @@ static int net_close( lua_State* L, const char* mt )
 #endif
     lua_settop(L, n);   // reset the stack top
     skt = NULL;
-  } while( isserver && i<MAX_SOCKET);
+  } while( isserver && i > 0 && i <= socket_num);
 #if 0
   // unref the self_ref, for both socket and server
   if(LUA_NOREF!=nud->self_ref){    // for a server self_ref is NOREF
@@ -1008,6 +1394,10 @@ static int net_on( lua_State* L, const char* mt )
     if(nud->cb_send_ref != LUA_NOREF)
       luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_send_ref);
     nud->cb_send_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }else if(!isserver && nud->pesp_conn->type == ESPCONN_TCP && sl == 5 && c_strcmp(method, "drain") == 0){
+    if(nud->cb_drain_ref != LUA_NOREF)
+      luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_drain_ref);
+    nud->cb_drain_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }else if(!isserver && nud->pesp_conn->type == ESPCONN_TCP && sl == 3 && c_strcmp(method, "dns") == 0){
     if(nud->cb_dns_found_ref != LUA_NOREF)
       luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_dns_found_ref);
@@ -1021,6 +1411,8 @@ static int net_on( lua_State* L, const char* mt )
 }
 
 // Lua: server/socket:send( string, function(sent) )
+// a tcp socket returns false when its send queue is above the high water mark,
+// nil and a message when the data could not be queued at all
 static int net_send( lua_State* L, const char* mt )
 {
   // NODE_DBG("net_send is called.\n");
@@ -1067,8 +1459,15 @@ static int net_send( lua_State* L, const char* mt )
 #endif
 
   const char *payload = luaL_checklstring( L, 2, &l );
-  if (l>1460 || payload == NULL)
+  if (payload == NULL)
+    return luaL_error( L, "wrong arg type" );
+  if (pesp_conn->type != ESPCONN_TCP && l>1460)
     return luaL_error( L, "need <1460 payload" );
+  if (pesp_conn->type == ESPCONN_TCP && nud->sendq_bytes + l > nud->sendq_max){
+    lua_pushnil(L);
+    lua_pushstring(L, "send queue full");
+    return 2;
+  }
 
   if (lua_type(L, 3) == LUA_TFUNCTION || lua_type(L, 3) == LUA_TLIGHTFUNCTION){
     lua_pushvalue(L, 3);  // copy argument (func) to the top of stack
@@ -1076,12 +1475,24 @@ static int net_send( lua_State* L, const char* mt )
       luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_send_ref);
     nud->cb_send_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }
-#ifdef CLIENT_SSL_ENABLE
-  if(nud->secure)
-    espconn_secure_sent(pesp_conn, (unsigned char *)payload, l);
-  else
-#endif
-    espconn_sent(pesp_conn, (unsigned char *)payload, l);
+  if (pesp_conn->type == ESPCONN_TCP){
+    if (!net_sendq_push(nud, payload, l)){
+      lua_pushnil(L);
+      lua_pushstring(L, "not enough memory");
+      return 2;
+    }
+    if (!net_sendq_kick(nud)){
+      net_sendq_release(nud);
+      lua_pushnil(L);
+      lua_pushstring(L, "send failed");
+      return 2;
+    }
+    if (nud->sendq_bytes > nud->sendq_high)
+      nud->sendq_full = 1;
+    lua_pushboolean(L, !nud->sendq_full);
+    return 1;
+  }
+  espconn_sent(pesp_conn, (unsigned char *)payload, l);
 
   return 0;  
 }
@@ -1137,7 +1548,16 @@ static int net_dns( lua_State* L, const char* mt )
   }
 
   host_ip.addr = 0;
-  espconn_gethostbyname(pesp_conn, domain, &host_ip, net_dns_found);
+  switch(espconn_gethostbyname(pesp_conn, domain, &host_ip, net_dns_found)){
+    case ESPCONN_OK:          // answered from the resolver table, no callback comes
+      net_dns_found(domain, &host_ip, pesp_conn);
+      break;
+    case ESPCONN_INPROGRESS:
+      break;
+    default:                  // not queued, report the failure and let go of self_ref
+      net_dns_found(domain, NULL, pesp_conn);
+      break;
+  }
 
   return 0;  
 }
@@ -1202,7 +1622,16 @@ static int net_dns_static( lua_State* L )
   }
 
   host_ip.addr = 0;
-  espconn_gethostbyname(pesp_conn, domain, &host_ip, net_dns_found);
+  switch(espconn_gethostbyname(pesp_conn, domain, &host_ip, net_dns_found)){
+    case ESPCONN_OK:          // answered from the resolver table, no callback comes
+      net_dns_found(domain, &host_ip, pesp_conn);
+      break;
+    case ESPCONN_INPROGRESS:
+      break;
+    default:                  // not queued, report the failure and let go of self_ref
+      net_dns_found(domain, NULL, pesp_conn);
+      break;
+  }
 
   return 0;
 }
@@ -1291,6 +1720,91 @@ static int net_socket_send( lua_State* L )
   return net_send(L, mt);
 }
 
+// Lua: socket:sendfile( filename, [offset, [len]], [function(socket, ok)] )
+static int net_socket_sendfile( lua_State* L )
+{
+  const char *mt = "net.socket";
+  lnet_userdata *nud;
+  size_t l;
+  int stack = 3;
+  int fd;
+  int offset = 0;
+  int len = -1;
+  int res;
+
+  nud = (lnet_userdata *)luaL_checkudata(L, 1, mt);
+  luaL_argcheck(L, nud, 1, "Server/Socket expected");
+  if(nud==NULL){
+    NODE_DBG("userdata is nil.\n");
+    return 0;
+  }
+
+  if(nud->pesp_conn == NULL){
+    NODE_DBG("nud->pesp_conn is NULL.\n");
+    return 0;
+  }
+  if(nud->pesp_conn->type != ESPCONN_TCP)
+    return luaL_error( L, "tcp socket expected" );
+  if(net_sendfile_active(nud))
+    return luaL_error( L, "sendfile in progress" );
+  if(nud->sendq_head != NULL)
+    return luaL_error( L, "send in progress" );
+
+  const char *fname = luaL_checklstring( L, 2, &l );
+  if( l > FS_NAME_MAX_LENGTH )
+    return luaL_error(L, "filename too long");
+  if( lua_isnumber(L, stack) ){
+    offset = lua_tointeger(L, stack);
+    stack++;
+    if( lua_isnumber(L, stack) ){
+      len = lua_tointeger(L, stack);
+      stack++;
+    }
+  }
+  if( offset < 0 )
+    return luaL_error( L, "wrong arg range" );
+
+#if defined(BUILD_ROMFS) || defined(BUILD_WOFS)
+  // files of the read only FS are sent from the flash, without a buffer
+  const uint8_t *map;
+  uint32_t size;
+  if( romfs_map(fname, &map, &size) ){
+    if( (uint32_t)offset > size )
+      return luaL_error( L, "cannot seek %s", fname );
+    size -= offset;
+    nud->sendfile_map = map + offset;
+    nud->sendfile_left = (len < 0 || (uint32_t)len > size) ? size : (uint32_t)len;
+  } else
+#endif
+  {
+    fd = fs_open(fname, FS_RDONLY);
+    if(fd < FS_OPEN_OK)
+      return luaL_error( L, "cannot open %s", fname );
+    if(offset > 0 && fs_seek(fd, offset, FS_SEEK_SET) < 0){
+      fs_close(fd);
+      return luaL_error( L, "cannot seek %s", fname );
+    }
+    nud->sendfile_buf = (char *)c_malloc(SENDFILE_CHUNK_SIZE);
+    if(!nud->sendfile_buf){
+      fs_close(fd);
+      return luaL_error( L, "not enough memory" );
+    }
+    nud->sendfile_fd = fd;
+    nud->sendfile_left = len < 0 ? (uint32_t)-1 : (uint32_t)len;
+  }
+
+  if (lua_type(L, stack) == LUA_TFUNCTION || lua_type(L, stack) == LUA_TLIGHTFUNCTION){
+    lua_pushvalue(L, stack);  // copy argument (func) to the top of stack
+    nud->cb_sendfile_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  // the remaining chunks are sent from net_socket_sent()
+  res = net_sendfile_next(nud);
+  if(res <= 0)
+    net_sendfile_done(nud, res == 0);
+  return 0;
+}
+
 static int net_socket_hold( lua_State* L )
 {
   const char *mt = "net.socket";
@@ -1339,6 +1853,90 @@ static int net_socket_unhold( lua_State* L )
   return 0;
 }
 
+// Lua: sk:setopt{nodelay=b, sndbuf=n, idle_timeout=s, keepalive=b|s, rst_close=b}
+// options left out are not changed. sndbuf is what send() queues before it
+// returns false, idle_timeout (0 for never) and rst_close are for connections
+// the server accepted, keepalive may give the idle seconds before the first
+// probe.
+static int net_socket_setopt( lua_State* L )
+{
+  const char *mt = "net.socket";
+  struct espconn *pesp_conn = NULL;
+  lnet_userdata *nud;
+  int sndbuf = -1, idle = -1, nodelay = -1, keepalive = -1, rst_close = -1;
+  uint32 keepidle = 0;
+
+  nud = (lnet_userdata *)luaL_checkudata(L, 1, mt);
+  luaL_argcheck(L, nud, 1, "Server/Socket expected");
+  luaL_checktype(L, 2, LUA_TTABLE);
+  pesp_conn = nud->pesp_conn;
+  if(pesp_conn == NULL || pesp_conn->type != ESPCONN_TCP)
+    return luaL_error( L, "tcp only" );
+
+  lua_getfield(L, 2, "sndbuf");
+  if(!lua_isnil(L, -1)){
+    sndbuf = luaL_checkinteger(L, -1);
+    if(sndbuf < SENDQ_MIN_CHUNK || sndbuf > SENDQ_SNDBUF_MAX)
+      return luaL_error( L, "sndbuf out of range" );
+  }
+  lua_getfield(L, 2, "idle_timeout");
+  if(!lua_isnil(L, -1)){
+    idle = luaL_checkinteger(L, -1);
+    if(idle < 0 || idle > 28800)
+      return luaL_error( L, "idle_timeout out of range" );
+    if(nud->slot < 0)
+      return luaL_error( L, "idle_timeout is for server connections" );
+  }
+  lua_getfield(L, 2, "nodelay");
+  if(!lua_isnil(L, -1))
+    nodelay = lua_toboolean(L, -1);
+  lua_getfield(L, 2, "keepalive");
+  if(lua_isnumber(L, -1)){
+    keepalive = lua_tointeger(L, -1);
+    if(keepalive < 0 || keepalive > 28800)
+      return luaL_error( L, "keepalive out of range" );
+    keepidle = keepalive;
+    keepalive = keepidle > 0;
+  } else if(!lua_isnil(L, -1))
+    keepalive = lua_toboolean(L, -1);
+  lua_getfield(L, 2, "rst_close");
+  if(!lua_isnil(L, -1)){
+    rst_close = lua_toboolean(L, -1);
+    if(nud->slot < 0)
+      return luaL_error( L, "rst_close is for server connections" );
+  }
+  lua_pop(L, 5);
+
+  if(sndbuf >= 0){
+    nud->sendq_high = sndbuf;
+    nud->sendq_low = sndbuf / 2;
+    nud->sendq_max = sndbuf > SENDQ_MAX / 2 ? 2 * sndbuf : SENDQ_MAX;
+  }
+  if(idle >= 0){
+    // the server polls once a second, 0 would fall back to its timeout
+    if(espconn_regist_time(pesp_conn, idle ? idle : 0xffffffff, 1) != ESPCONN_OK)
+      return luaL_error( L, "not connected" );
+  }
+  if(nodelay >= 0){
+    if((nodelay ? espconn_set_opt(pesp_conn, ESPCONN_NODELAY)
+                : espconn_clear_opt(pesp_conn, ESPCONN_NODELAY)) != ESPCONN_OK)
+      return luaL_error( L, "not connected" );
+  }
+  if(keepalive >= 0){
+    if((keepalive ? espconn_set_opt(pesp_conn, ESPCONN_KEEPALIVE)
+                  : espconn_clear_opt(pesp_conn, ESPCONN_KEEPALIVE)) != ESPCONN_OK)
+      return luaL_error( L, "not connected" );
+    if(keepidle > 0)
+      espconn_set_keepalive(pesp_conn, ESPCONN_KEEPIDLE, &keepidle);
+  }
+  if(rst_close >= 0){
+    if((rst_close ? espconn_set_opt(pesp_conn, ESPCONN_RSTCLOSE)
+                  : espconn_clear_opt(pesp_conn, ESPCONN_RSTCLOSE)) != ESPCONN_OK)
+      return luaL_error( L, "not connected" );
+  }
+  return 0;
+}
+
 // Lua: ip,port = sk:getpeer()
 static int net_socket_getpeer( lua_State* L )
 {
@@ -1419,6 +2017,61 @@ static int net_multicastLeave( lua_State* L )
 	return net_multicastJoinLeave(L,0);
 }
 
+// Lua: count, limit, bytes, refused = net.connections()
+// connections accepted by the tcp server, how many it may take, the heap
+// they hold in net, and how many were turned away
+static int net_connections( lua_State* L )
+{
+  uint32_t mem = socket_size * sizeof(net_socket_slot);
+  int i;
+
+  for(i = 0; i < socket_num; i++)
+    mem += net_socket_mem(socket[i].nud);
+  lua_pushinteger(L, socket_num);
+  lua_pushinteger(L, socket_max);
+  lua_pushinteger(L, mem);
+  lua_pushinteger(L, socket_refused);
+  return 4;
+}
+
+// Lua: t = net.stats()
+// what the stack holds and what it was refused: used, max and err of each
+// pool by name in t.pool, tcp retransmits, segments dropped for being out of
+// sequence, windows closed by the peer, failed pbufs, TIME_WAIT pcbs taken
+// over for new connections and the free heap
+static int net_stats( lua_State* L )
+{
+  lua_createtable(L, 0, 7);
+#if LWIP_COUNTERS
+  int i;
+
+  lua_createtable(L, 0, MEMP_MAX);
+  for(i = 0; i < MEMP_MAX; i++){
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, lwip_counters.memp[i].used);
+    lua_setfield(L, -2, "used");
+    lua_pushinteger(L, lwip_counters.memp[i].max);
+    lua_setfield(L, -2, "max");
+    lua_pushinteger(L, lwip_counters.memp[i].err);
+    lua_setfield(L, -2, "err");
+    lua_setfield(L, -2, memp_desc[i]);
+  }
+  lua_setfield(L, -2, "pool");
+  lua_pushinteger(L, lwip_counters.tcp_rexmit);
+  lua_setfield(L, -2, "retransmits");
+  lua_pushinteger(L, lwip_counters.tcp_ooseq_drop);
+  lua_setfield(L, -2, "ooseq_dropped");
+  lua_pushinteger(L, lwip_counters.tcp_zero_wnd);
+  lua_setfield(L, -2, "zero_window");
+  lua_pushinteger(L, lwip_counters.pbuf_err);
+  lua_setfield(L, -2, "pbuf_failed");
+  lua_pushinteger(L, lwip_counters.tcp_tw_recycled);
+  lua_setfield(L, -2, "timewait_recycled");
+#endif
+  lua_pushinteger(L, system_get_free_heap_size());
+  lua_setfield(L, -2, "heap");
+  return 1;
+}
 
 // Lua: s = net.dns.setdnsserver(ip_addr, [index])
 static int net_setdnsserver( lua_State* L )
@@ -1441,6 +2094,34 @@ static int net_setdnsserver( lua_State* L )
   return 0;
 }
 
+// Lua: t = net.dns.stats()
+// hits and misses of the resolver table, queries joined while on their way,
+// failures and how many were answered from the table again
+static int net_dns_stats( lua_State* L )
+{
+  struct dns_stats s;
+
+  dns_getstats(&s);
+  lua_createtable(L, 0, 8);
+  lua_pushinteger(L, s.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, s.misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushinteger(L, s.coalesced);
+  lua_setfield(L, -2, "coalesced");
+  lua_pushinteger(L, s.failures);
+  lua_setfield(L, -2, "failures");
+  lua_pushinteger(L, s.negative);
+  lua_setfield(L, -2, "negative");
+  lua_pushinteger(L, s.full);
+  lua_setfield(L, -2, "full");
+  lua_pushinteger(L, s.entries);
+  lua_setfield(L, -2, "entries");
+  lua_pushinteger(L, DNS_TABLE_SIZE);
+  lua_setfield(L, -2, "size");
+  return 1;
+}
+
 // Lua: s = net.dns.getdnsserver([index])
 static int net_getdnsserver( lua_State* L )
 {
@@ -1515,8 +2196,10 @@ static const LUA_REG_TYPE net_socket_map[] =
   { LSTRKEY( "close" ), LFUNCVAL ( net_socket_close ) },
   { LSTRKEY( "on" ), LFUNCVAL ( net_socket_on ) },
   { LSTRKEY( "send" ), LFUNCVAL ( net_socket_send ) },
+  { LSTRKEY( "sendfile" ), LFUNCVAL ( net_socket_sendfile ) },
   { LSTRKEY( "hold" ), LFUNCVAL ( net_socket_hold ) },
   { LSTRKEY( "unhold" ), LFUNCVAL ( net_socket_unhold ) },
+  { LSTRKEY( "setopt" ), LFUNCVAL ( net_socket_setopt ) },
   { LSTRKEY( "dns" ), LFUNCVAL ( net_socket_dns ) },
   { LSTRKEY( "getpeer" ), LFUNCVAL ( net_socket_getpeer ) },
   // { LSTRKEY( "delete" ), LFUNCVAL ( net_socket_delete ) },
@@ -1540,6 +2223,7 @@ static const LUA_REG_TYPE net_dns_map[] =
   { LSTRKEY( "setdnsserver" ), LFUNCVAL ( net_setdnsserver ) },  
   { LSTRKEY( "getdnsserver" ), LFUNCVAL ( net_getdnsserver ) }, 
   { LSTRKEY( "resolve" ), LFUNCVAL ( net_dns_static ) },  
+  { LSTRKEY( "stats" ), LFUNCVAL ( net_dns_stats ) },
   { LNILKEY, LNILVAL }
 };
 
@@ -1549,6 +2233,8 @@ const LUA_REG_TYPE net_map[] =
   { LSTRKEY( "createConnection" ), LFUNCVAL ( net_createConnection ) },
   { LSTRKEY( "multicastJoin"), LFUNCVAL( net_multicastJoin ) },
   { LSTRKEY( "multicastLeave"), LFUNCVAL( net_multicastLeave ) },
+  { LSTRKEY( "connections" ), LFUNCVAL( net_connections ) },
+  { LSTRKEY( "stats" ), LFUNCVAL( net_stats ) },
 #if LUA_OPTIMIZE_MEMORY > 0
   { LSTRKEY( "dns" ), LROVAL( net_dns_map ) },
   { LSTRKEY( "TCP" ), LNUMVAL( TCP ) },
@@ -1561,12 +2247,6 @@ const LUA_REG_TYPE net_map[] =
 
 LUALIB_API int luaopen_net( lua_State *L )
 {
-  int i;
-  for(i=0;i<MAX_SOCKET;i++)
-  {
-    socket[i] = LUA_NOREF;
-  }
-
 #if LUA_OPTIMIZE_MEMORY > 0
   luaL_rometatable(L, "net.server", (void *)net_server_map);  // create metatable for net.server
   luaL_rometatable(L, "net.socket", (void *)net_socket_map);  // create metatable for net.socket
@@ -8,6 +8,11 @@
 #endif
 
 int fs_mode2flag(const char *mode){
+#ifdef FS_COMPRESS
+  // "wz" writes a compressed file, reading it back is transparent
+  if(c_strcmp(mode, "wz")==0)
+    return FS_WRONLY|FS_CREAT|FS_TRUNC|FS_COMPRESS;
+#endif
   if(c_strlen(mode)==1){
   	if(c_strcmp(mode,"w")==0)
   	  return FS_WRONLY|FS_CREAT|FS_TRUNC;
@@ -48,6 +48,8 @@
 #define FS_TRUNC SPIFFS_TRUNC
 #define FS_CREAT SPIFFS_CREAT
 #define FS_EXCL SPIFFS_EXCL
+#define FS_COMPRESS MYSPIFFS_COMPRESS
+#define FS_REPLACE SPIFFS_REPLACE
 
 #define FS_SEEK_SET SPIFFS_SEEK_SET
 #define FS_SEEK_CUR SPIFFS_SEEK_CUR
@@ -65,11 +67,13 @@
 #define fs_error myspiffs_error
 #define fs_clearerr myspiffs_clearerr
 #define fs_tell myspiffs_tell
+#define fs_commit myspiffs_commit
 
 #define fs_format myspiffs_format
 #define fs_check myspiffs_check
 #define fs_rename myspiffs_rename
 #define fs_size myspiffs_size
+#define fs_gc_step myspiffs_gc_step
 
 #define fs_mount myspiffs_mount
 #define fs_unmount myspiffs_unmount
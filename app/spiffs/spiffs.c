@@ -1,14 +1,40 @@
 #include "c_stdio.h"
+#include "c_stdlib.h"
 #include "platform.h"
 #include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "user_interface.h"
   
 spiffs fs;
 
+// default geometry, the page size of a file system already on flash is
+// found by SPIFFS_probe_page_size
 #define LOG_PAGE_SIZE       256
-  
-static u8_t spiffs_work_buf[LOG_PAGE_SIZE*2];
-static u8_t spiffs_fds[32*4];
-static u8_t spiffs_cache[(LOG_PAGE_SIZE+32)*4];
+#define CACHE_PAGES         4
+#define FILE_DESCS          4
+
+#define MIN_PAGE_SIZE       128
+#define MAX_PAGE_SIZE       1024
+#define MAX_CACHE_PAGES     16
+#define MAX_FILE_DESCS      8
+// heap left to the rest of the firmware after mounting
+#define MOUNT_HEAP_RESERVE  (16*1024)
+
+#define FILE_WBUF_SIZE      (spiffs_page_size*2)
+
+// buffers of the mounted file system, allocated by myspiffs_remount
+static u8_t *spiffs_work_buf;
+static u8_t *spiffs_fds;
+static u8_t *spiffs_cache_buf;
+static u32_t spiffs_page_size;
+static u32_t spiffs_cache_pages;
+static u32_t spiffs_fd_count;
+// write back buffers of descriptors opened for writing
+static u8_t *spiffs_wbufs[MAX_FILE_DESCS];
+// state of descriptors of compressed files, with the work buffer behind it
+static spiffs_lz *spiffs_lzs[MAX_FILE_DESCS];
+
+#define MYSPIFFS_LZ(fd)     ( ( fd ) > 0 && ( fd ) <= MAX_FILE_DESCS ? spiffs_lzs[( fd )-1] : NULL )
 
 static s32_t my_spiffs_read(u32_t addr, u32_t size, u8_t *dst) {
   platform_flash_read(dst, addr, size);
@@ -42,42 +68,38 @@ The small 4KB sectors allow for greater flexibility in applications th
 
 ********************/
 
-void myspiffs_mount() {
-  spiffs_config cfg;
-  cfg.phys_addr = ( u32_t )platform_flash_get_first_free_block_address( NULL ); 
-  cfg.phys_addr += 0x3000;
-  cfg.phys_addr &= 0xFFFFC000;  // align to 4 sector.
-  cfg.phys_size = INTERNAL_FLASH_SIZE - ( ( u32_t )cfg.phys_addr - INTERNAL_FLASH_START_ADDRESS );
-  cfg.phys_erase_block = INTERNAL_FLASH_SECTOR_SIZE; // according to datasheet
-  cfg.log_block_size = INTERNAL_FLASH_SECTOR_SIZE; // let us not complicate things
-  cfg.log_page_size = LOG_PAGE_SIZE; // as we said
-  NODE_DBG("fs.start:%x,max:%x\n",cfg.phys_addr,cfg.phys_size);
-
-  cfg.hal_read_f = my_spiffs_read;
-  cfg.hal_write_f = my_spiffs_write;
-  cfg.hal_erase_f = my_spiffs_erase;
-  
-  int res = SPIFFS_mount(&fs,
-    &cfg,
-    spiffs_work_buf,
-    spiffs_fds,
-    sizeof(spiffs_fds),
-    spiffs_cache,
-    sizeof(spiffs_cache),
-    // myspiffs_check_callback);
-    0);
-  NODE_DBG("mount res: %i\n", res);
+static void myspiffs_config( spiffs_config *cfg ){
+  cfg->phys_addr = ( u32_t )platform_flash_get_first_free_block_address( NULL ); 
+  cfg->phys_addr += 0x3000;
+  cfg->phys_addr &= 0xFFFFC000;  // align to 4 sector.
+  cfg->phys_size = INTERNAL_FLASH_SIZE - ( ( u32_t )cfg->phys_addr - INTERNAL_FLASH_START_ADDRESS );
+  cfg->phys_erase_block = INTERNAL_FLASH_SECTOR_SIZE; // according to datasheet
+  cfg->log_block_size = INTERNAL_FLASH_SECTOR_SIZE; // let us not complicate things
+  cfg->log_page_size = spiffs_page_size;
+  cfg->hal_read_f = my_spiffs_read;
+  cfg->hal_write_f = my_spiffs_write;
+  cfg->hal_erase_f = my_spiffs_erase;
 }
 
-void myspiffs_unmount() {
-  SPIFFS_unmount(&fs);
+// Bytes of heap the buffers of a mount take
+static u32_t myspiffs_heap_needed( u32_t page, u32_t cache_pages, u32_t fds ){
+  return page * 2 + fds * sizeof(spiffs_fd) +
+    sizeof(spiffs_cache) + cache_pages * (sizeof(spiffs_cache_page) + page);
 }
 
-// FS formatting function
-// Returns 1 if OK, 0 for error
-int myspiffs_format( void )
-{
-  SPIFFS_unmount(&fs);
+static void myspiffs_free_bufs( void ){
+  if( spiffs_work_buf )
+    c_free(spiffs_work_buf);
+  if( spiffs_fds )
+    c_free(spiffs_fds);
+  if( spiffs_cache_buf )
+    c_free(spiffs_cache_buf);
+  spiffs_work_buf = NULL;
+  spiffs_fds = NULL;
+  spiffs_cache_buf = NULL;
+}
+
+static int myspiffs_erase_all( void ){
   u32_t sect_first, sect_last;
   sect_first = ( u32_t )platform_flash_get_first_free_block_address( NULL ); 
   sect_first += 0x3000;
@@ -89,10 +111,146 @@ int myspiffs_format( void )
   while( sect_first <= sect_last )
     if( platform_flash_erase_sector( sect_first ++ ) == PLATFORM_ERR )
       return 0;
-  myspiffs_mount();
   return 1;
 }
 
+// Takes buffers for the given geometry and mounts with them, the buffers are
+// given back again when the mount fails
+static s32_t myspiffs_mount_bufs( spiffs_config *cfg, u32_t page, u32_t cache_pages, u32_t fds ){
+  u32_t cache_size = myspiffs_heap_needed(page, cache_pages, 0) - page * 2;
+  s32_t res;
+
+  spiffs_work_buf = (u8_t *)c_malloc(page * 2);
+  spiffs_fds = (u8_t *)c_malloc(fds * sizeof(spiffs_fd));
+  spiffs_cache_buf = (u8_t *)c_malloc(cache_size);
+  if( !spiffs_work_buf || !spiffs_fds || !spiffs_cache_buf ){
+    myspiffs_free_bufs();
+    return SPIFFS_ERR_MOUNT_HEAP;
+  }
+  spiffs_page_size = page;
+  spiffs_cache_pages = cache_pages;
+  spiffs_fd_count = fds;
+  cfg->log_page_size = page;
+  NODE_DBG("fs.start:%x,max:%x,page:%d\n",cfg->phys_addr,cfg->phys_size,page);
+
+  res = SPIFFS_mount(&fs,
+    cfg,
+    spiffs_work_buf,
+    spiffs_fds,
+    fds * sizeof(spiffs_fd),
+    spiffs_cache_buf,
+    cache_size,
+    // myspiffs_check_callback);
+    0);
+  NODE_DBG("mount res: %i\n", res);
+  if( res < 0 )
+    myspiffs_free_bufs();
+  return res;
+}
+
+// Mounts with given logical page size, number of cache pages and file
+// descriptors. A page size of 0 takes the one the file system on flash was
+// written with, or else the one mounted last; another page size than the one
+// on flash needs format, which erases the file system first. 0 descriptors
+// keeps the number mounted last, 0 cache pages sizes the cache to a 32nd of
+// the free heap. Returns SPIFFS_OK or an error, the file system stays as it
+// was when the page size or the heap does not fit, and is mounted again with
+// the geometry it had when the new one fails to mount.
+int myspiffs_remount( u32_t page, u32_t cache_pages, u32_t fds, int format ){
+  spiffs_config cfg;
+  u32_t heap, held, needed;
+  u32_t old_page = spiffs_page_size, old_cache_pages = spiffs_cache_pages, old_fds = spiffs_fd_count;
+  int mounted = spiffs_work_buf != NULL;
+  s32_t res;
+
+  myspiffs_config(&cfg);
+  res = SPIFFS_probe_page_size(&cfg);
+  if( res < 0 )
+    return res;
+  if( page == 0 )
+    page = res > 0 && !format ? (u32_t)res : ( spiffs_page_size ? spiffs_page_size : LOG_PAGE_SIZE );
+  if( page < MIN_PAGE_SIZE || page > MAX_PAGE_SIZE || ( page & ( page - 1 ) ) )
+    return SPIFFS_ERR_PAGE_SIZE;
+  if( res > 0 && page != (u32_t)res && !format )
+    return SPIFFS_ERR_PAGE_SIZE;
+  if( fds == 0 )
+    fds = spiffs_fd_count ? spiffs_fd_count : FILE_DESCS;
+  if( fds > MAX_FILE_DESCS )
+    fds = MAX_FILE_DESCS;
+
+  // the buffers held now are given back before allocating
+  heap = system_get_free_heap_size();
+  held = mounted ? myspiffs_heap_needed(old_page, old_cache_pages, old_fds) : 0;
+  heap += held;
+  if( cache_pages == 0 ){
+    cache_pages = heap / 32 / ( page + sizeof(spiffs_cache_page) );
+    if( cache_pages < 2 )
+      cache_pages = 2;
+    if( cache_pages > CACHE_PAGES * 2 )
+      cache_pages = CACHE_PAGES * 2;
+  }
+  if( cache_pages > MAX_CACHE_PAGES )
+    cache_pages = MAX_CACHE_PAGES;
+  // the reserve only holds against taking more than is held now, so that a
+  // format with the same geometry is never refused for it
+  needed = myspiffs_heap_needed(page, cache_pages, fds);
+  if( needed > heap || ( needed > held && needed + MOUNT_HEAP_RESERVE > heap ) )
+    return SPIFFS_ERR_MOUNT_HEAP;
+
+  myspiffs_unmount();
+  if( format && !myspiffs_erase_all() )
+    res = SPIFFS_ERR_INTERNAL;
+  else
+    res = myspiffs_mount_bufs(&cfg, page, cache_pages, fds);
+  // a fragmented heap or a failed erase leaves no file system, the old
+  // geometry is mounted again then
+  if( res < 0 && mounted )
+    myspiffs_mount_bufs(&cfg, old_page, old_cache_pages, old_fds);
+  return res;
+}
+
+void myspiffs_mount() {
+  myspiffs_remount(0, 0, 0, 0);
+}
+
+// Geometry of the file system mounted last
+void myspiffs_geometry( u32_t *page, u32_t *cache_pages, u32_t *fds ){
+  *page = spiffs_page_size;
+  *cache_pages = spiffs_cache_pages;
+  *fds = spiffs_fd_count;
+}
+
+static void myspiffs_free_wbuf( int fd ){
+  if( fd > 0 && fd <= MAX_FILE_DESCS && spiffs_wbufs[fd-1] ){
+    c_free(spiffs_wbufs[fd-1]);
+    spiffs_wbufs[fd-1] = NULL;
+  }
+}
+
+static void myspiffs_free_lz( int fd ){
+  if( MYSPIFFS_LZ(fd) ){
+    c_free(spiffs_lzs[fd-1]);
+    spiffs_lzs[fd-1] = NULL;
+  }
+}
+
+void myspiffs_unmount() {
+  int fd;
+  SPIFFS_unmount(&fs);
+  for( fd = 1; fd <= MAX_FILE_DESCS; fd++ ){
+    myspiffs_free_wbuf(fd);
+    myspiffs_free_lz(fd);
+  }
+  myspiffs_free_bufs();
+}
+
+// FS formatting function
+// Returns 1 if OK, 0 for error
+int myspiffs_format( void )
+{
+  return myspiffs_remount(0, spiffs_cache_pages, 0, 1) == SPIFFS_OK;
+}
+
 int myspiffs_check( void )
 {
   // ets_wdt_disable();
@@ -101,14 +259,102 @@ int myspiffs_check( void )
   // return res;
 }
 
+// Sets up reading or writing a compressed file on fd, returns fd or -1
+static int myspiffs_open_lz( int fd, int writing ){
+  u32_t work = writing ? SPIFFS_LZ_WRITE_WORK_SIZE : SPIFFS_LZ_READ_WORK_SIZE;
+  spiffs_lz *lz;
+  s32_t res;
+  if( fd <= 0 || fd > MAX_FILE_DESCS )
+    return -1;
+  myspiffs_free_lz(fd);
+  lz = (spiffs_lz *)c_malloc(sizeof(spiffs_lz) + work);
+  if( !lz )
+    return -1;
+  if( writing )
+    res = SPIFFS_lz_write_start(&fs, lz, (spiffs_file)fd, (u8_t *)(lz + 1));
+  else
+    res = SPIFFS_lz_read_start(&fs, lz, (spiffs_file)fd, (u8_t *)(lz + 1));
+  if( res < 0 ){
+    c_free(lz);
+    return -1;
+  }
+  spiffs_lzs[fd-1] = lz;
+  return fd;
+}
+
 int myspiffs_open(const char *name, int flags){
-  return (int)SPIFFS_open(&fs, (char *)name, (spiffs_flags)flags, 0);
+  int compress = flags & MYSPIFFS_COMPRESS;
+  int compressed = 0;
+  spiffs_file probe;
+  flags &= ~MYSPIFFS_COMPRESS;
+  if( compress ){
+    // compressed files are written in one go, from the start
+    if( (flags & SPIFFS_RDONLY) || (flags & SPIFFS_APPEND) || !(flags & SPIFFS_TRUNC) )
+      return -1;
+  } else if( (flags & SPIFFS_WRONLY) && !(flags & SPIFFS_TRUNC) ){
+    // a compressed file can not be changed in place
+    probe = SPIFFS_open(&fs, (char *)name, SPIFFS_RDONLY, 0);
+    if( probe > 0 ){
+      compressed = SPIFFS_lz_probe(&fs, probe) == 1;
+      SPIFFS_close(&fs, probe);
+    }
+    SPIFFS_clearerr(&fs);
+    if( compressed )
+      return -1;
+  }
+  int fd = (int)SPIFFS_open(&fs, (char *)name, (spiffs_flags)flags, 0);
+  if( fd > 0 && !compress && !(flags & SPIFFS_WRONLY) && SPIFFS_lz_probe(&fs, (spiffs_file)fd) == 1 ){
+    // reads return the uncompressed data
+    if( myspiffs_open_lz(fd, 0) < 0 ){
+      SPIFFS_close(&fs, (spiffs_file)fd);
+      return -1;
+    }
+    return fd;
+  }
+  if( fd > 0 && fd <= MAX_FILE_DESCS && (flags & SPIFFS_WRONLY) ){
+    // gather small writes into page sized appends, best effort
+    myspiffs_free_wbuf(fd);
+    u8_t *buf = (u8_t *)c_malloc(FILE_WBUF_SIZE);
+    if( buf && SPIFFS_setvbuf(&fs, (spiffs_file)fd, buf, FILE_WBUF_SIZE) < 0 ){
+      c_free(buf);
+      buf = NULL;
+    }
+    spiffs_wbufs[fd-1] = buf;
+  }
+  if( fd > 0 && compress && myspiffs_open_lz(fd, 1) < 0 ){
+    myspiffs_close(fd);
+    SPIFFS_remove(&fs, (char *)name);
+    return -1;
+  }
+  return fd;
 }
 
 int myspiffs_close( int fd ){
+  spiffs_lz *lz = MYSPIFFS_LZ(fd);
+  if( lz && SPIFFS_lz_close(lz) < 0 )
+    NODE_DBG("close errno %i\n", SPIFFS_errno(&fs));
   SPIFFS_close(&fs, (spiffs_file)fd);
+  myspiffs_free_wbuf(fd);
+  myspiffs_free_lz(fd);
   return 0;
 }
+// Commits and closes a file opened with FS_REPLACE, returns 0 or -1. On
+// error the replacement is dropped and the old file stays.
+int myspiffs_commit( int fd ){
+  spiffs_lz *lz = MYSPIFFS_LZ(fd);
+  int res = 0;
+  if( lz && SPIFFS_lz_close(lz) < 0 )
+    res = -1;
+  if( res == 0 && SPIFFS_commit(&fs, (spiffs_file)fd) < 0 )
+    res = -1;
+  if( res < 0 ){
+    NODE_DBG("commit errno %i\n", SPIFFS_errno(&fs));
+    SPIFFS_close(&fs, (spiffs_file)fd);
+  }
+  myspiffs_free_wbuf(fd);
+  myspiffs_free_lz(fd);
+  return res;
+}
 size_t myspiffs_write( int fd, const void* ptr, size_t len ){
 #if 0
   if(fd==c_stdout || fd==c_stderr){
@@ -116,7 +362,8 @@ size_t myspiffs_write( int fd, const void* ptr, size_t len ){
     return len;
   }
 #endif
-  int res = SPIFFS_write(&fs, (spiffs_file)fd, (void *)ptr, len);
+  spiffs_lz *lz = MYSPIFFS_LZ(fd);
+  int res = lz ? SPIFFS_lz_write(lz, ptr, len) : SPIFFS_write(&fs, (spiffs_file)fd, (void *)ptr, len);
   if (res < 0) {
     NODE_DBG("write errno %i\n", SPIFFS_errno(&fs));
     return 0;
@@ -124,7 +371,8 @@ size_t myspiffs_write( int fd, const void* ptr, size_t len ){
   return res;
 }
 size_t myspiffs_read( int fd, void* ptr, size_t len){
-  int res = SPIFFS_read(&fs, (spiffs_file)fd, ptr, len);
+  spiffs_lz *lz = MYSPIFFS_LZ(fd);
+  int res = lz ? SPIFFS_lz_read(lz, ptr, len) : SPIFFS_read(&fs, (spiffs_file)fd, ptr, len);
   if (res < 0) {
     NODE_DBG("read errno %i\n", SPIFFS_errno(&fs));
     return 0;
@@ -132,19 +380,28 @@ size_t myspiffs_read( int fd, void* ptr, size_t len){
   return res;
 }
 int myspiffs_lseek( int fd, int off, int whence ){
+  spiffs_lz *lz = MYSPIFFS_LZ(fd);
+  if( lz )
+    return SPIFFS_lz_lseek(lz, off, whence);
   return SPIFFS_lseek(&fs, (spiffs_file)fd, off, whence);
 }
 int myspiffs_eof( int fd ){
+  spiffs_lz *lz = MYSPIFFS_LZ(fd);
+  if( lz )
+    return lz->pos >= lz->size;
   return SPIFFS_eof(&fs, (spiffs_file)fd);
 }
 int myspiffs_tell( int fd ){
+  spiffs_lz *lz = MYSPIFFS_LZ(fd);
+  if( lz )
+    return lz->pos;
   return SPIFFS_tell(&fs, (spiffs_file)fd);
 }
 int myspiffs_getc( int fd ){
   unsigned char c = 0xFF;
   int res;
   if(!myspiffs_eof(fd)){
-    res = SPIFFS_read(&fs, (spiffs_file)fd, &c, 1);
+    res = myspiffs_read(fd, &c, 1);
     if (res != 1) {
       NODE_DBG("getc errno %i\n", SPIFFS_errno(&fs));
       return (int)EOF;
@@ -155,7 +412,7 @@ int myspiffs_getc( int fd ){
   return (int)EOF;
 }
 int myspiffs_ungetc( int c, int fd ){
-  return SPIFFS_lseek(&fs, (spiffs_file)fd, -1, SEEK_CUR);
+  return myspiffs_lseek(fd, -1, SEEK_CUR);
 }
 int myspiffs_flush( int fd ){
   return SPIFFS_fflush(&fs, (spiffs_file)fd);
@@ -170,8 +427,15 @@ int myspiffs_rename( const char *old, const char *newname ){
   return SPIFFS_rename(&fs, (char *)old, (char *)newname);
 }
 size_t myspiffs_size( int fd ){
+  spiffs_lz *lz = MYSPIFFS_LZ(fd);
+  if( lz )
+    return lz->size;
   return SPIFFS_size(&fs, (spiffs_file)fd);
 }
+// Returns 1 if a block was reclaimed, 0 if nothing to do, -1 on error
+int myspiffs_gc_step( int keep_free_blocks ){
+  return SPIFFS_gc_step(&fs, (u32_t)keep_free_blocks);
+}
 #if 0
 void test_spiffs() {
   char buf[12];
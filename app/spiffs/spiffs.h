@@ -41,6 +41,11 @@ extern "C" {
 #define SPIFFS_ERR_NOT_WRITABLE         -10021
 #define SPIFFS_ERR_NOT_READABLE         -10022
 #define SPIFFS_ERR_CONFLICTING_NAME     -10023
+#define SPIFFS_ERR_LOG_CONFIG           -10024
+#define SPIFFS_ERR_LZ_FORMAT            -10025
+#define SPIFFS_ERR_NOT_REPLACEMENT      -10026
+#define SPIFFS_ERR_PAGE_SIZE            -10027
+#define SPIFFS_ERR_MOUNT_HEAP           -10028
 
 #define SPIFFS_ERR_INTERNAL             -10050
 
@@ -113,6 +118,9 @@ typedef void (*spiffs_check_callback)(spiffs_check_type type, spiffs_check_repor
 #define SPIFFS_RDWR                     (SPIFFS_RDONLY | SPIFFS_WRONLY)
 /* Any writes to the filehandle will never be cached */
 #define SPIFFS_DIRECT                   (1<<5)
+/* A new, hidden file is opened that replaces the file of that name on
+   SPIFFS_commit, or is removed when closed without commit */
+#define SPIFFS_REPLACE                  (1<<6)
 
 #define SPIFFS_SEEK_SET                 (0)
 #define SPIFFS_SEEK_CUR                 (1)
@@ -197,6 +205,12 @@ typedef struct {
   u8_t cleaning;
   // max erase count amongst all blocks
   spiffs_obj_id max_erase_count;
+  // block being erased ahead of need, one sector at a time, or -1
+  spiffs_block_ix erase_bix;
+  // sectors of erase_bix left to erase
+  u32_t erase_sectors;
+  // set when pages were deleted since the last search for deleted blocks
+  u8_t erase_scan;
 
 #if SPIFFS_GC_STATS
   u32_t stats_gc_runs;
@@ -239,6 +253,103 @@ typedef struct {
   int entry;
 } spiffs_DIR;
 
+// state of an incremental consistency check, see SPIFFS_check_step
+typedef struct {
+  // check being run, a spiffs_check_type, or the final recount
+  u8_t phase;
+  // next block to check in this phase
+  spiffs_block_ix block;
+  // page check: first page of the range being checked
+  spiffs_page_ix pix_offset;
+  // index check: used entries of the object id table in work
+  u32_t log_ix;
+  // file system counters after the last step, to notice writes in between
+  u32_t p_allocated;
+  u32_t p_deleted;
+  spiffs_obj_id erase_count;
+  // progress and fix reports, or 0
+  spiffs_check_callback cb;
+  // memory of logical page size, kept between steps
+  u8_t *work;
+} spiffs_check_state;
+
+// cursor value of a finished listing, see SPIFFS_list
+#define SPIFFS_LIST_END         ((u32_t)-1)
+
+typedef struct {
+  // bytes available for file data
+  u32_t total;
+  // bytes in pages holding file data or indices
+  u32_t used;
+  // bytes in deleted pages, free again after garbage collection
+  u32_t deleted;
+  // erased blocks, ready to be written without garbage collection
+  u32_t free_blocks;
+} spiffs_fsinfo;
+
+/* ring log, see SPIFFS_log_open */
+typedef struct {
+  spiffs *fs;
+  // base name, segments are named <name>.<seq>
+  char name[SPIFFS_OBJ_NAME_LEN];
+  // max bytes per segment
+  u32_t seg_size;
+  // max number of segments
+  u32_t seg_count;
+  // sequence number of oldest segment
+  u32_t first_seq;
+  // sequence number of segment appended to
+  u32_t last_seq;
+  // file handle of segment appended to
+  spiffs_file fd;
+  // bytes written to segment appended to, excluding buffer
+  u32_t seg_offs;
+  // append buffer
+  u8_t *buf;
+  u32_t buf_size;
+  u32_t buf_len;
+} spiffs_log;
+
+typedef struct {
+  spiffs_log *log;
+  u32_t seq;
+  spiffs_file fd;
+} spiffs_log_iter;
+
+/* compressed file, see SPIFFS_lz_read_start */
+#define SPIFFS_LZ_WINDOW            1024
+#define SPIFFS_LZ_HASH_BITS         9
+#define SPIFFS_LZ_IO_SIZE           128
+// work buffer sizes
+#define SPIFFS_LZ_READ_WORK_SIZE    (SPIFFS_LZ_WINDOW)
+#define SPIFFS_LZ_WRITE_WORK_SIZE   (2*SPIFFS_LZ_WINDOW + (2 << SPIFFS_LZ_HASH_BITS))
+
+typedef struct {
+  spiffs *fs;
+  spiffs_file fh;
+  u8_t writing;
+  // length of uncompressed data
+  u32_t size;
+  // position in uncompressed data
+  u32_t pos;
+  // reading: bytes decoded, window is the last SPIFFS_LZ_WINDOW of them
+  u32_t out;
+  u8_t flags;
+  u8_t flag_bits;
+  u16_t match_dist;
+  u16_t match_left;
+  // writing: input data in work buffer, compressed up to in_pos
+  u32_t in_len;
+  u32_t in_pos;
+  // offset of flag byte of current group in io buffer
+  u16_t group;
+  // compressed data buffer
+  u16_t io_len;
+  u16_t io_pos;
+  u8_t io[SPIFFS_LZ_IO_SIZE];
+  u8_t *work;
+} spiffs_lz;
+
 // functions
 
 /**
@@ -265,6 +376,17 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
  */
 void SPIFFS_unmount(spiffs *fs);
 
+/**
+ * Finds the logical page size a file system was written with, the page size
+ * is not stored on flash. Looks at the object lookup of the first blocks and
+ * the page headers the entries stand for, for page sizes from 64 bytes up to
+ * a quarter block. Only reads, the file system need not be mounted.
+ * Returns the page size, 0 if nothing on flash tells (e.g. no files) or a
+ * negative error from the hal read function.
+ * @param config        the physical configuration, log_page_size is ignored
+ */
+s32_t SPIFFS_probe_page_size(spiffs_config *config);
+
 /**
  * Creates a new file.
  * @param fs            the file system struct
@@ -368,6 +490,24 @@ s32_t SPIFFS_fstat(spiffs *fs, spiffs_file fh, spiffs_stat *s);
  */
 s32_t SPIFFS_fflush(spiffs *fs, spiffs_file fh);
 
+#if SPIFFS_CACHE_WR
+/**
+ * Attaches a write back buffer to given filehandle. Following writes are
+ * gathered in the buffer and written to flash each time the buffer reaches a
+ * data page boundary of the file, turning many small writes into whole page
+ * appends. Buffered data is written back on SPIFFS_fflush, SPIFFS_close,
+ * SPIFFS_lseek and on any read or stat of the filehandle, and only then is it
+ * on flash. Writes that are not contiguous also write the buffer back first.
+ * The buffer must stay valid until the file is closed or another buffer is
+ * set. Passing a null buffer or zero size detaches the buffer.
+ * @param fs            the file system struct
+ * @param fh            the filehandle
+ * @param buf           the buffer, preferably at least one page
+ * @param size          size of the buffer
+ */
+s32_t SPIFFS_setvbuf(spiffs *fs, spiffs_file fh, u8_t *buf, u32_t size);
+#endif
+
 /**
  * Closes a filehandle. If there are pending write operations, these are finalized before closing.
  * @param fs            the file system struct
@@ -375,6 +515,26 @@ s32_t SPIFFS_fflush(spiffs *fs, spiffs_file fh);
  */
 void SPIFFS_close(spiffs *fs, spiffs_file fh);
 
+/**
+ * Closes a filehandle opened with SPIFFS_REPLACE and makes it take the place
+ * of the file it replaces, which is removed. Until then the old file is seen,
+ * from then on the new one, also when power is lost halfway.
+ * @param fs            the file system struct
+ * @param fh            the filehandle of the replacement
+ */
+s32_t SPIFFS_commit(spiffs *fs, spiffs_file fh);
+
+/**
+ * Replaces the content of a file, or creates it, in one step as seen by
+ * readers and across power loss.
+ * @param fs            the file system struct
+ * @param path          the path of the file
+ * @param buf           the new content
+ * @param len           the length of the new content
+ * @returns len, or -1 on error
+ */
+s32_t SPIFFS_replace(spiffs *fs, char *path, u8_t *buf, s32_t len);
+
 /**
  * Renames a file
  * @param fs            the file system struct
@@ -420,12 +580,51 @@ s32_t SPIFFS_closedir(spiffs_DIR *d);
  */
 struct spiffs_dirent *SPIFFS_readdir(spiffs_DIR *d, struct spiffs_dirent *e);
 
+/**
+ * Lists files in bulk. Each lookup page is read once for all of its
+ * entries, instead of once per file as with SPIFFS_readdir, and only the
+ * header pages of object indices are read.
+ * A listing is started with *cursor set to 0 and continued with the cursor
+ * as returned until it reads SPIFFS_LIST_END. Files created or removed
+ * between calls may or may not be listed.
+ * @param fs            the file system struct
+ * @param cursor        position to list from, updated to where to continue
+ * @param prefix        only list files whose name starts with this, or 0
+ * @param ents          array of dirent structs to fill
+ * @param max           number of entries in ents
+ * @returns number of entries filled in, or -1 on error
+ */
+s32_t SPIFFS_list(spiffs *fs, u32_t *cursor, const char *prefix,
+    struct spiffs_dirent *ents, u32_t max);
+
 /**
  * Runs a consistency check on given filesystem.
  * @param fs            the file system struct
  */
 s32_t SPIFFS_check(spiffs *fs);
 
+/**
+ * Starts an incremental consistency check, run it with SPIFFS_check_step.
+ * The file system can be used between the steps.
+ * @param fs            the file system struct
+ * @param st            the check state, kept by the caller until done
+ * @param work          memory of logical page size, kept until done
+ * @param cb            callback for progress and fixes, or 0
+ */
+s32_t SPIFFS_check_start(spiffs *fs, spiffs_check_state *st, u8_t *work,
+    spiffs_check_callback cb);
+
+/**
+ * Does a bounded piece of a consistency check started with SPIFFS_check_start,
+ * at most the pages of one block. Parts of the check are redone when the file
+ * system was written since the last step, a page range of the page check
+ * starts over, so steps must come faster than writes to finish.
+ * @param fs            the file system struct
+ * @param st            the check state
+ * @returns 1 while there is more to do, 0 when done, or -1 on error
+ */
+s32_t SPIFFS_check_step(spiffs *fs, spiffs_check_state *st);
+
 
 /**
  * Returns number of total bytes available and number of used bytes.
@@ -441,6 +640,29 @@ s32_t SPIFFS_check(spiffs *fs);
  */
 s32_t SPIFFS_info(spiffs *fs, u32_t *total, u32_t *used);
 
+/**
+ * Returns total, used and deleted bytes of the filesystem and the number of
+ * erased blocks, as SPIFFS_info from the counters kept up to date by the
+ * nucleus, without flash access.
+ * @param fs            the file system struct
+ * @param info          populated with the usage
+ */
+s32_t SPIFFS_fsinfo(spiffs *fs, spiffs_fsinfo *info);
+
+/**
+ * Performs a bounded step of garbage collection: per call, either one
+ * block is cleaned by moving its remaining pages, or one physical sector
+ * of a block holding only deleted pages is erased. Calling this when idle
+ * keeps erased blocks ready, so that writes do not need to garbage collect
+ * or erase synchronously.
+ * Nothing new is started while at least keep_free_blocks blocks are free.
+ * Writes only avoid garbage collection while more than 3 blocks are free.
+ * @param fs                the file system struct
+ * @param keep_free_blocks  number of free blocks to keep available
+ * @returns 1 if a step was done, 0 if nothing was done, -1 on error
+ */
+s32_t SPIFFS_gc_step(spiffs *fs, u32_t keep_free_blocks);
+
 /**
  * Check if EOF reached.
  * @param fs            the file system struct
@@ -450,6 +672,130 @@ s32_t SPIFFS_eof(spiffs *fs, spiffs_file fh);
 s32_t SPIFFS_tell(spiffs *fs, spiffs_file fh);
 s32_t SPIFFS_size(spiffs *fs, spiffs_file fh);
 
+/**
+ * Opens a ring log, creating it if it does not exist. A ring log keeps at
+ * most max_size bytes of records in seg_count segment files; when full, the
+ * oldest segment and all records in it are dropped. Records are buffered in
+ * given buffer and written a whole number of data pages at a time, so they
+ * are not on flash until the buffer fills up or SPIFFS_log_flush is called.
+ * @param fs            the file system struct
+ * @param log           the log struct to populate
+ * @param name          base name of the log, at most SPIFFS_OBJ_NAME_LEN-10 characters
+ * @param max_size      max number of bytes kept, including two bytes per record
+ * @param seg_count     number of segments, at least 2
+ * @param buf           append buffer, kept until the log is closed
+ * @param buf_size      size of buffer, at least one data page
+ */
+s32_t SPIFFS_log_open(spiffs *fs, spiffs_log *log, char *name,
+    u32_t max_size, u32_t seg_count, u8_t *buf, u32_t buf_size);
+
+/**
+ * Appends a record to a ring log.
+ * @param log           the log
+ * @param rec           the record data
+ * @param len           length of record, at most max_size/seg_count-2 bytes
+ */
+s32_t SPIFFS_log_append(spiffs_log *log, void *rec, u16_t len);
+
+/**
+ * Writes out buffered records. All records appended before are on flash
+ * when this returns successfully.
+ * @param log           the log
+ */
+s32_t SPIFFS_log_flush(spiffs_log *log);
+
+/**
+ * Flushes and closes a ring log.
+ * @param log           the log
+ */
+s32_t SPIFFS_log_close(spiffs_log *log);
+
+/**
+ * Starts iterating the records of a ring log, oldest first. Appending to the
+ * log while iterating may drop records from under the iterator.
+ * @param log           the log
+ * @param it            the iterator to populate
+ * @param tail          if non zero, start at the tail'th newest record
+ */
+s32_t SPIFFS_log_iter_start(spiffs_log *log, spiffs_log_iter *it, u32_t tail);
+
+/**
+ * Reads next record from a ring log iterator.
+ * @param it            the iterator
+ * @param buf           buffer to read record into
+ * @param max_len       size of buffer, longer records are truncated
+ * @returns the full length of the record, or -1 with SPIFFS_ERR_END_OF_OBJECT
+ *          when there are no more records
+ */
+s32_t SPIFFS_log_iter_next(spiffs_log_iter *it, void *buf, u16_t max_len);
+
+/**
+ * Ends iteration, releasing the file handle held by the iterator.
+ * @param it            the iterator
+ */
+void SPIFFS_log_iter_end(spiffs_log_iter *it);
+
+/**
+ * Returns 1 if the file is compressed, 0 if not. The file must be opened for
+ * reading and is positioned at its start afterwards.
+ * @param fs            the file system struct
+ * @param fh            the filehandle of the file
+ */
+s32_t SPIFFS_lz_probe(spiffs *fs, spiffs_file fh);
+
+/**
+ * Starts reading a compressed file, see spiffs_lz.c for the format. Reads
+ * return the uncompressed data.
+ * @param fs            the file system struct
+ * @param lz            the struct to populate
+ * @param fh            the filehandle of the file, opened for reading
+ * @param work          buffer of SPIFFS_LZ_READ_WORK_SIZE bytes, kept until done
+ */
+s32_t SPIFFS_lz_read_start(spiffs *fs, spiffs_lz *lz, spiffs_file fh, u8_t *work);
+
+/**
+ * Reads uncompressed data, as SPIFFS_read.
+ * @param lz            the compressed file
+ * @param buf           where to put read data
+ * @param len           how much to read
+ */
+s32_t SPIFFS_lz_read(spiffs_lz *lz, void *buf, u32_t len);
+
+/**
+ * Moves the read position in the uncompressed data, as SPIFFS_lseek.
+ * Seeking back further than SPIFFS_LZ_WINDOW bytes decodes the file again
+ * from its start. A file being written can not seek.
+ * @param lz            the compressed file
+ * @param offs          how much/where to move the offset
+ * @param whence        SPIFFS_SEEK_SET, SPIFFS_SEEK_CUR or SPIFFS_SEEK_END
+ */
+s32_t SPIFFS_lz_lseek(spiffs_lz *lz, s32_t offs, int whence);
+
+/**
+ * Starts writing a compressed file.
+ * @param fs            the file system struct
+ * @param lz            the struct to populate
+ * @param fh            the filehandle of the file, opened for writing and empty
+ * @param work          buffer of SPIFFS_LZ_WRITE_WORK_SIZE bytes, kept until closed
+ */
+s32_t SPIFFS_lz_write_start(spiffs *fs, spiffs_lz *lz, spiffs_file fh, u8_t *work);
+
+/**
+ * Compresses and writes data. Data is kept in the work buffer until there is
+ * enough of it to compress, the file is complete when SPIFFS_lz_close returns.
+ * @param lz            the compressed file
+ * @param buf           the data to write
+ * @param len           how much to write
+ */
+s32_t SPIFFS_lz_write(spiffs_lz *lz, const void *buf, u32_t len);
+
+/**
+ * Writes out remaining data of a compressed file being written and its
+ * length. The file handle is left open.
+ * @param lz            the compressed file
+ */
+s32_t SPIFFS_lz_close(spiffs_lz *lz);
+
 #if SPIFFS_TEST_VISUALISATION
 /**
  * Prints out a visualization of the filesystem.
@@ -477,10 +823,17 @@ u32_t SPIFFS_buffer_bytes_for_cache(spiffs *fs, u32_t num_pages);
 #if SPIFFS_CACHE
 #endif
 
+// myspiffs_open flag: write a compressed file, see spiffs_lz.c. Compressed
+// files are recognized when opened for reading, reads are uncompressed.
+#define MYSPIFFS_COMPRESS               (1<<8)
+
 void myspiffs_mount();
+int myspiffs_remount( u32_t page, u32_t cache_pages, u32_t fds, int format );
+void myspiffs_geometry( u32_t *page, u32_t *cache_pages, u32_t *fds );
 void myspiffs_unmount();
 int myspiffs_open(const char *name, int flags);
 int myspiffs_close( int fd );
+int myspiffs_commit( int fd );
 size_t myspiffs_write( int fd, const void* ptr, size_t len );
 size_t myspiffs_read( int fd, void* ptr, size_t len);
 int myspiffs_lseek( int fd, int off, int whence );
@@ -494,6 +847,7 @@ void myspiffs_clearerr( int fd );
 int myspiffs_check( void );
 int myspiffs_rename( const char *old, const char *newname );
 size_t myspiffs_size( int fd );
+int myspiffs_gc_step( int keep_free_blocks );
 
 #if defined(__cplusplus)
 }
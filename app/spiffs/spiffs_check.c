@@ -426,14 +426,18 @@ static s32_t spiffs_lookup_check_validate(spiffs *fs, spiffs_obj_id lu_obj_id, s
   return res;
 }
 
+// user_data, if not 0, is the block to stop at
 static s32_t spiffs_lookup_check_v(spiffs *fs, spiffs_obj_id obj_id, spiffs_block_ix cur_block, int cur_entry,
     u32_t user_data, void *user_p) {
-  (void)user_data;
   (void)user_p;
   s32_t res = SPIFFS_OK;
   spiffs_page_header p_hdr;
   spiffs_page_ix cur_pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, cur_block, cur_entry);
 
+  if (user_data && cur_block >= user_data) {
+    return SPIFFS_OK;
+  }
+
   if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_LOOKUP, SPIFFS_CHECK_PROGRESS,
       (cur_block * 256)/fs->block_count, 0);
 
@@ -480,344 +484,372 @@ s32_t spiffs_lookup_consistency_check(spiffs *fs, u8_t check_all_objects) {
 //---------------------------------------
 // Page consistency
 
-// Scans all pages (except lu pages), reserves 4 bits in working memory for each page
-// bit 0: 0 == FREE|DELETED, 1 == USED
-// bit 1: 0 == UNREFERENCED, 1 == REFERENCED
-// bit 2: 0 == NOT_INDEX,    1 == INDEX
-// bit 3: unused
-// A consistent file system will have only pages being
-//  * x000 free, unreferenced, not index
-//  * x011 used, referenced only once, not index
-//  * x101 used, unreferenced, index
-// The working memory might not fit all pages so several scans might be needed
-static s32_t spiffs_page_consistency_check_i(spiffs *fs) {
+// Scans the pages of one block for the page consistency check, marking the
+// pages of the range starting at pix_offset in map and following the
+// references of index pages. Sets restart if a fix changed the filesystem,
+// then the range must be scanned again.
+static s32_t spiffs_page_consistency_check_block(spiffs *fs, u8_t *map, spiffs_page_ix pix_offset,
+    spiffs_block_ix cur_block, u8_t *restart) {
   const u32_t bits = 4;
   const spiffs_page_ix pages_per_scan = SPIFFS_CFG_LOG_PAGE_SZ(fs) * 8 / bits;
-
   s32_t res = SPIFFS_OK;
-  spiffs_page_ix pix_offset = 0;
 
-  // for each range of pages fitting into work memory
-  while (pix_offset < SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count) {
-    // set this flag to abort all checks and rescan the page range
-    u8_t restart = 0;
-    c_memset(fs->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
+  // traverse each page except for lookup pages
+  spiffs_page_ix cur_pix = SPIFFS_OBJ_LOOKUP_PAGES(fs) + SPIFFS_PAGES_PER_BLOCK(fs) * cur_block;
+  while (!*restart && cur_pix < SPIFFS_PAGES_PER_BLOCK(fs) * (cur_block+1)) {
+    // read header
+    spiffs_page_header p_hdr;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
+    SPIFFS_CHECK_RES(res);
 
-    spiffs_block_ix cur_block = 0;
-    // build consistency bitmap for id range traversing all blocks
-    while (!restart && cur_block < fs->block_count) {
-      if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_PROGRESS,
-          (pix_offset*256)/(SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count) +
-          ((((cur_block * pages_per_scan * 256)/ (SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count))) / fs->block_count),
-          0);
+    u8_t within_range = (cur_pix >= pix_offset && cur_pix < pix_offset + pages_per_scan);
+    const u32_t pix_byte_ix = (cur_pix - pix_offset) / (8/bits);
+    const u8_t pix_bit_ix = (cur_pix & ((8/bits)-1)) * bits;
 
-      // traverse each page except for lookup pages
-      spiffs_page_ix cur_pix = SPIFFS_OBJ_LOOKUP_PAGES(fs) + SPIFFS_PAGES_PER_BLOCK(fs) * cur_block;
-      while (!restart && cur_pix < SPIFFS_PAGES_PER_BLOCK(fs) * (cur_block+1)) {
-        // read header
-        spiffs_page_header p_hdr;
-        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-            0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
-        SPIFFS_CHECK_RES(res);
+    if (within_range &&
+        (p_hdr.flags & SPIFFS_PH_FLAG_DELET) && (p_hdr.flags & SPIFFS_PH_FLAG_USED) == 0) {
+      // used
+      map[pix_byte_ix] |= (1<<(pix_bit_ix + 0));
+    }
+    if ((p_hdr.flags & SPIFFS_PH_FLAG_DELET) &&
+        (p_hdr.flags & SPIFFS_PH_FLAG_IXDELE) &&
+        (p_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_USED)) == 0) {
+      // found non-deleted index
+      if (within_range) {
+        map[pix_byte_ix] |= (1<<(pix_bit_ix + 2));
+      }
 
-        u8_t within_range = (cur_pix >= pix_offset && cur_pix < pix_offset + pages_per_scan);
-        const u32_t pix_byte_ix = (cur_pix - pix_offset) / (8/bits);
-        const u8_t pix_bit_ix = (cur_pix & ((8/bits)-1)) * bits;
+      // load non-deleted index
+      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+          0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+      SPIFFS_CHECK_RES(res);
 
-        if (within_range &&
-            (p_hdr.flags & SPIFFS_PH_FLAG_DELET) && (p_hdr.flags & SPIFFS_PH_FLAG_USED) == 0) {
-          // used
-          fs->work[pix_byte_ix] |= (1<<(pix_bit_ix + 0));
-        }
-        if ((p_hdr.flags & SPIFFS_PH_FLAG_DELET) &&
-            (p_hdr.flags & SPIFFS_PH_FLAG_IXDELE) &&
-            (p_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_USED)) == 0) {
-          // found non-deleted index
-          if (within_range) {
-            fs->work[pix_byte_ix] |= (1<<(pix_bit_ix + 2));
-          }
+      // traverse index for referenced pages
+      spiffs_page_ix *object_page_index;
+      spiffs_page_header *objix_p_hdr = (spiffs_page_header *)fs->lu_work;
+
+      int entries;
+      int i;
+      spiffs_span_ix data_spix_offset;
+      if (p_hdr.span_ix == 0) {
+        // object header page index
+        entries = SPIFFS_OBJ_HDR_IX_LEN(fs);
+        data_spix_offset = 0;
+        object_page_index = (spiffs_page_ix *)((u8_t *)fs->lu_work + sizeof(spiffs_page_object_ix_header));
+      } else {
+        // object page index
+        entries = SPIFFS_OBJ_IX_LEN(fs);
+        data_spix_offset = SPIFFS_OBJ_HDR_IX_LEN(fs) + SPIFFS_OBJ_IX_LEN(fs) * (p_hdr.span_ix - 1);
+        object_page_index = (spiffs_page_ix *)((u8_t *)fs->lu_work + sizeof(spiffs_page_object_ix));
+      }
 
-          // load non-deleted index
-          res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-              0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+      // for all entries in index
+      for (i = 0; !*restart && i < entries; i++) {
+        spiffs_page_ix rpix = object_page_index[i];
+        u8_t rpix_within_range = rpix >= pix_offset && rpix < pix_offset + pages_per_scan;
+
+        if ((rpix != (spiffs_page_ix)-1 && rpix > SPIFFS_MAX_PAGES(fs))
+            || (rpix_within_range && SPIFFS_IS_LOOKUP_PAGE(fs, rpix))) {
+
+          // bad reference
+          SPIFFS_CHECK_DBG("PA: pix %04x bad pix / LU referenced from page %04x\n",
+              rpix, cur_pix);
+          // check for data page elsewhere
+          spiffs_page_ix data_pix;
+          res = spiffs_obj_lu_find_id_and_span(fs, objix_p_hdr->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG,
+              data_spix_offset + i, 0, &data_pix);
+          if (res == SPIFFS_ERR_NOT_FOUND) {
+            res = SPIFFS_OK;
+            data_pix = 0;
+          }
           SPIFFS_CHECK_RES(res);
-
-          // traverse index for referenced pages
-          spiffs_page_ix *object_page_index;
-          spiffs_page_header *objix_p_hdr = (spiffs_page_header *)fs->lu_work;
-
-          int entries;
-          int i;
-          spiffs_span_ix data_spix_offset;
-          if (p_hdr.span_ix == 0) {
-            // object header page index
-            entries = SPIFFS_OBJ_HDR_IX_LEN(fs);
-            data_spix_offset = 0;
-            object_page_index = (spiffs_page_ix *)((u8_t *)fs->lu_work + sizeof(spiffs_page_object_ix_header));
+          if (data_pix == 0) {
+            // if not, allocate free page
+            spiffs_page_header new_ph;
+            new_ph.flags = 0xff & ~(SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_FINAL);
+            new_ph.obj_id = objix_p_hdr->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG;
+            new_ph.span_ix = data_spix_offset + i;
+            res = spiffs_page_allocate_data(fs, new_ph.obj_id, &new_ph, 0, 0, 0, 1, &data_pix);
+            SPIFFS_CHECK_RES(res);
+            SPIFFS_CHECK_DBG("PA: FIXUP: found no existing data page, created new @ %04x\n", data_pix);
+          }
+          // remap index
+          SPIFFS_CHECK_DBG("PA: FIXUP: rewriting index pix %04x\n", cur_pix);
+          res = spiffs_rewrite_index(fs, objix_p_hdr->obj_id | SPIFFS_OBJ_ID_IX_FLAG,
+              data_spix_offset + i, data_pix, cur_pix);
+          if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
+            // index bad also, cannot mend this file
+            SPIFFS_CHECK_DBG("PA: FIXUP: index bad %i, cannot mend - delete object\n", res);
+            if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, objix_p_hdr->obj_id, 0);
+            // delete file
+            res = spiffs_page_delete(fs, cur_pix);
           } else {
-            // object page index
-            entries = SPIFFS_OBJ_IX_LEN(fs);
-            data_spix_offset = SPIFFS_OBJ_HDR_IX_LEN(fs) + SPIFFS_OBJ_IX_LEN(fs) * (p_hdr.span_ix - 1);
-            object_page_index = (spiffs_page_ix *)((u8_t *)fs->lu_work + sizeof(spiffs_page_object_ix));
+            if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, objix_p_hdr->obj_id, objix_p_hdr->span_ix);
           }
+          SPIFFS_CHECK_RES(res);
+          *restart = 1;
 
-          // for all entries in index
-          for (i = 0; !restart && i < entries; i++) {
-            spiffs_page_ix rpix = object_page_index[i];
-            u8_t rpix_within_range = rpix >= pix_offset && rpix < pix_offset + pages_per_scan;
+        } else if (rpix_within_range) {
 
-            if ((rpix != (spiffs_page_ix)-1 && rpix > SPIFFS_MAX_PAGES(fs))
-                || (rpix_within_range && SPIFFS_IS_LOOKUP_PAGE(fs, rpix))) {
+          // valid reference
+          // read referenced page header
+          spiffs_page_header rp_hdr;
+          res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+              0, SPIFFS_PAGE_TO_PADDR(fs, rpix), sizeof(spiffs_page_header), (u8_t*)&rp_hdr);
+          SPIFFS_CHECK_RES(res);
 
-              // bad reference
-              SPIFFS_CHECK_DBG("PA: pix %04x bad pix / LU referenced from page %04x\n",
+          // cross reference page header check
+          if (rp_hdr.obj_id != (p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) ||
+              rp_hdr.span_ix != data_spix_offset + i ||
+              (rp_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_USED)) !=
+                  (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_INDEX)) {
+           SPIFFS_CHECK_DBG("PA: pix %04x has inconsistent page header ix id/span:%04x/%04x, ref id/span:%04x/%04x flags:%02x\n",
+                rpix, p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG, data_spix_offset + i,
+                rp_hdr.obj_id, rp_hdr.span_ix, rp_hdr.flags);
+           // try finding correct page
+           spiffs_page_ix data_pix;
+           res = spiffs_obj_lu_find_id_and_span(fs, p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG,
+               data_spix_offset + i, rpix, &data_pix);
+           if (res == SPIFFS_ERR_NOT_FOUND) {
+             res = SPIFFS_OK;
+             data_pix = 0;
+           }
+           SPIFFS_CHECK_RES(res);
+           if (data_pix == 0) {
+             // not found, this index is badly borked
+             SPIFFS_CHECK_DBG("PA: FIXUP: index bad, delete object id %04x\n", p_hdr.obj_id);
+             if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
+             res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
+             SPIFFS_CHECK_RES(res);
+             break;
+           } else {
+             // found it, so rewrite index
+             SPIFFS_CHECK_DBG("PA: FIXUP: found correct data pix %04x, rewrite ix pix %04x id %04x\n",
+                 data_pix, cur_pix, p_hdr.obj_id);
+             res = spiffs_rewrite_index(fs, p_hdr.obj_id, data_spix_offset + i, data_pix, cur_pix);
+             if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
+               // index bad also, cannot mend this file
+               SPIFFS_CHECK_DBG("PA: FIXUP: index bad %i, cannot mend!\n", res);
+               if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
+               res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
+             } else {
+               if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, p_hdr.obj_id, p_hdr.span_ix);
+             }
+             SPIFFS_CHECK_RES(res);
+             *restart = 1;
+           }
+          }
+          else {
+            // mark rpix as referenced
+            const u32_t rpix_byte_ix = (rpix - pix_offset) / (8/bits);
+            const u8_t rpix_bit_ix = (rpix & ((8/bits)-1)) * bits;
+            if (map[rpix_byte_ix] & (1<<(rpix_bit_ix + 1))) {
+              SPIFFS_CHECK_DBG("PA: pix %04x multiple referenced from page %04x\n",
                   rpix, cur_pix);
-              // check for data page elsewhere
-              spiffs_page_ix data_pix;
-              res = spiffs_obj_lu_find_id_and_span(fs, objix_p_hdr->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG,
-                  data_spix_offset + i, 0, &data_pix);
-              if (res == SPIFFS_ERR_NOT_FOUND) {
-                res = SPIFFS_OK;
-                data_pix = 0;
-              }
+              // Here, we should have fixed all broken references - getting this means there
+              // must be multiple files with same object id. Only solution is to delete
+              // the object which is referring to this page
+              SPIFFS_CHECK_DBG("PA: FIXUP: removing object %04x and page %04x\n",
+                  p_hdr.obj_id, cur_pix);
+              if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
+              res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
               SPIFFS_CHECK_RES(res);
-              if (data_pix == 0) {
-                // if not, allocate free page
-                spiffs_page_header new_ph;
-                new_ph.flags = 0xff & ~(SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_FINAL);
-                new_ph.obj_id = objix_p_hdr->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG;
-                new_ph.span_ix = data_spix_offset + i;
-                res = spiffs_page_allocate_data(fs, new_ph.obj_id, &new_ph, 0, 0, 0, 1, &data_pix);
-                SPIFFS_CHECK_RES(res);
-                SPIFFS_CHECK_DBG("PA: FIXUP: found no existing data page, created new @ %04x\n", data_pix);
-              }
-              // remap index
-              SPIFFS_CHECK_DBG("PA: FIXUP: rewriting index pix %04x\n", cur_pix);
-              res = spiffs_rewrite_index(fs, objix_p_hdr->obj_id | SPIFFS_OBJ_ID_IX_FLAG,
-                  data_spix_offset + i, data_pix, cur_pix);
-              if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
-                // index bad also, cannot mend this file
-                SPIFFS_CHECK_DBG("PA: FIXUP: index bad %i, cannot mend - delete object\n", res);
-                if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, objix_p_hdr->obj_id, 0);
-                // delete file
-                res = spiffs_page_delete(fs, cur_pix);
-              } else {
-                if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, objix_p_hdr->obj_id, objix_p_hdr->span_ix);
-              }
+              // extra precaution, delete this page also
+              res = spiffs_page_delete(fs, cur_pix);
               SPIFFS_CHECK_RES(res);
-              restart = 1;
+              *restart = 1;
+            }
+            map[rpix_byte_ix] |= (1<<(rpix_bit_ix + 1));
+          }
+        }
+      } // for all index entries
+    } // found index
 
-            } else if (rpix_within_range) {
+    // next page
+    cur_pix++;
+  }
+  return res;
+}
 
-              // valid reference
-              // read referenced page header
-              spiffs_page_header rp_hdr;
-              res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-                  0, SPIFFS_PAGE_TO_PADDR(fs, rpix), sizeof(spiffs_page_header), (u8_t*)&rp_hdr);
-              SPIFFS_CHECK_RES(res);
+// Checks the consistency map of the page range starting at pix_offset once
+// all blocks are scanned, and fixes irregularities. Sets restart if a fix
+// changed the filesystem, then the range must be scanned again.
+static s32_t spiffs_page_consistency_check_map(spiffs *fs, u8_t *map, spiffs_page_ix pix_offset,
+    u8_t *restart) {
+  const u32_t bits = 4;
+  s32_t res = SPIFFS_OK;
 
-              // cross reference page header check
-              if (rp_hdr.obj_id != (p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) ||
-                  rp_hdr.span_ix != data_spix_offset + i ||
-                  (rp_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_USED)) !=
-                      (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_INDEX)) {
-               SPIFFS_CHECK_DBG("PA: pix %04x has inconsistent page header ix id/span:%04x/%04x, ref id/span:%04x/%04x flags:%02x\n",
-                    rpix, p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG, data_spix_offset + i,
-                    rp_hdr.obj_id, rp_hdr.span_ix, rp_hdr.flags);
-               // try finding correct page
-               spiffs_page_ix data_pix;
-               res = spiffs_obj_lu_find_id_and_span(fs, p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG,
-                   data_spix_offset + i, rpix, &data_pix);
-               if (res == SPIFFS_ERR_NOT_FOUND) {
-                 res = SPIFFS_OK;
-                 data_pix = 0;
-               }
-               SPIFFS_CHECK_RES(res);
-               if (data_pix == 0) {
-                 // not found, this index is badly borked
-                 SPIFFS_CHECK_DBG("PA: FIXUP: index bad, delete object id %04x\n", p_hdr.obj_id);
-                 if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
-                 res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
-                 SPIFFS_CHECK_RES(res);
-                 break;
-               } else {
-                 // found it, so rewrite index
-                 SPIFFS_CHECK_DBG("PA: FIXUP: found correct data pix %04x, rewrite ix pix %04x id %04x\n",
-                     data_pix, cur_pix, p_hdr.obj_id);
-                 res = spiffs_rewrite_index(fs, p_hdr.obj_id, data_spix_offset + i, data_pix, cur_pix);
-                 if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
-                   // index bad also, cannot mend this file
-                   SPIFFS_CHECK_DBG("PA: FIXUP: index bad %i, cannot mend!\n", res);
-                   if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
-                   res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
-                 } else {
-                   if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, p_hdr.obj_id, p_hdr.span_ix);
-                 }
-                 SPIFFS_CHECK_RES(res);
-                 restart = 1;
-               }
-              }
-              else {
-                // mark rpix as referenced
-                const u32_t rpix_byte_ix = (rpix - pix_offset) / (8/bits);
-                const u8_t rpix_bit_ix = (rpix & ((8/bits)-1)) * bits;
-                if (fs->work[rpix_byte_ix] & (1<<(rpix_bit_ix + 1))) {
-                  SPIFFS_CHECK_DBG("PA: pix %04x multiple referenced from page %04x\n",
-                      rpix, cur_pix);
-                  // Here, we should have fixed all broken references - getting this means there
-                  // must be multiple files with same object id. Only solution is to delete
-                  // the object which is referring to this page
-                  SPIFFS_CHECK_DBG("PA: FIXUP: removing object %04x and page %04x\n",
-                      p_hdr.obj_id, cur_pix);
-                  if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
-                  res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
-                  SPIFFS_CHECK_RES(res);
-                  // extra precaution, delete this page also
-                  res = spiffs_page_delete(fs, cur_pix);
-                  SPIFFS_CHECK_RES(res);
-                  restart = 1;
-                }
-                fs->work[rpix_byte_ix] |= (1<<(rpix_bit_ix + 1));
-              }
-            }
-          } // for all index entries
-        } // found index
+  spiffs_page_ix objix_pix;
+  spiffs_page_ix rpix;
 
-        // next page
-        cur_pix++;
-      }
-      // next block
-      cur_block++;
-    }
-    // check consistency bitmap
-    if (!restart) {
-      spiffs_page_ix objix_pix;
-      spiffs_page_ix rpix;
+  u32_t byte_ix;
+  u8_t bit_ix;
+  for (byte_ix = 0; !*restart && byte_ix < SPIFFS_CFG_LOG_PAGE_SZ(fs); byte_ix++) {
+    for (bit_ix = 0; !*restart && bit_ix < 8/bits; bit_ix ++) {
+      u8_t bitmask = (map[byte_ix] >> (bit_ix * bits)) & 0x7;
+      spiffs_page_ix cur_pix = pix_offset + byte_ix * (8/bits) + bit_ix;
 
-      u32_t byte_ix;
-      u8_t bit_ix;
-      for (byte_ix = 0; !restart && byte_ix < SPIFFS_CFG_LOG_PAGE_SZ(fs); byte_ix++) {
-        for (bit_ix = 0; !restart && bit_ix < 8/bits; bit_ix ++) {
-          u8_t bitmask = (fs->work[byte_ix] >> (bit_ix * bits)) & 0x7;
-          spiffs_page_ix cur_pix = pix_offset + byte_ix * (8/bits) + bit_ix;
+      // 000 ok - free, unreferenced, not index
 
-          // 000 ok - free, unreferenced, not index
+      if (bitmask == 0x1) {
 
-          if (bitmask == 0x1) {
+        // 001
+        SPIFFS_CHECK_DBG("PA: pix %04x USED, UNREFERENCED, not index\n", cur_pix);
 
-            // 001
-            SPIFFS_CHECK_DBG("PA: pix %04x USED, UNREFERENCED, not index\n", cur_pix);
+        u8_t rewrite_ix_to_this = 0;
+        u8_t delete_page = 0;
+        // check corresponding object index entry
+        spiffs_page_header p_hdr;
+        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+            0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
+        SPIFFS_CHECK_RES(res);
 
-            u8_t rewrite_ix_to_this = 0;
-            u8_t delete_page = 0;
-            // check corresponding object index entry
-            spiffs_page_header p_hdr;
+        res = spiffs_object_get_data_page_index_reference(fs, p_hdr.obj_id, p_hdr.span_ix,
+            &rpix, &objix_pix);
+        if (res == SPIFFS_OK) {
+          if (((rpix == (spiffs_page_ix)-1 || rpix > SPIFFS_MAX_PAGES(fs)) || (SPIFFS_IS_LOOKUP_PAGE(fs, rpix)))) {
+            // pointing to a bad page altogether, rewrite index to this
+            rewrite_ix_to_this = 1;
+            SPIFFS_CHECK_DBG("PA: corresponding ref is bad: %04x, rewrite to this %04x\n", rpix, cur_pix);
+          } else {
+            // pointing to something else, check what
+            spiffs_page_header rp_hdr;
             res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-                0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
+                0, SPIFFS_PAGE_TO_PADDR(fs, rpix), sizeof(spiffs_page_header), (u8_t*)&rp_hdr);
             SPIFFS_CHECK_RES(res);
-
-            res = spiffs_object_get_data_page_index_reference(fs, p_hdr.obj_id, p_hdr.span_ix,
-                &rpix, &objix_pix);
-            if (res == SPIFFS_OK) {
-              if (((rpix == (spiffs_page_ix)-1 || rpix > SPIFFS_MAX_PAGES(fs)) || (SPIFFS_IS_LOOKUP_PAGE(fs, rpix)))) {
-                // pointing to a bad page altogether, rewrite index to this
+            if (((p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) == rp_hdr.obj_id) &&
+                ((rp_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_FINAL)) ==
+                    (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_DELET))) {
+              // pointing to something else valid, just delete this page then
+              SPIFFS_CHECK_DBG("PA: corresponding ref is good but different: %04x, delete this %04x\n", rpix, cur_pix);
+              delete_page = 1;
+            } else {
+              // pointing to something weird, update index to point to this page instead
+              if (rpix != cur_pix) {
+                SPIFFS_CHECK_DBG("PA: corresponding ref is weird: %04x %s%s%s%s, rewrite this %04x\n", rpix,
+                    (rp_hdr.flags & SPIFFS_PH_FLAG_INDEX) ? "" : "INDEX ",
+                        (rp_hdr.flags & SPIFFS_PH_FLAG_DELET) ? "" : "DELETED ",
+                            (rp_hdr.flags & SPIFFS_PH_FLAG_USED) ? "NOTUSED " : "",
+                                (rp_hdr.flags & SPIFFS_PH_FLAG_FINAL) ? "NOTFINAL " : "",
+                    cur_pix);
                 rewrite_ix_to_this = 1;
-                SPIFFS_CHECK_DBG("PA: corresponding ref is bad: %04x, rewrite to this %04x\n", rpix, cur_pix);
               } else {
-                // pointing to something else, check what
-                spiffs_page_header rp_hdr;
-                res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-                    0, SPIFFS_PAGE_TO_PADDR(fs, rpix), sizeof(spiffs_page_header), (u8_t*)&rp_hdr);
-                SPIFFS_CHECK_RES(res);
-                if (((p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) == rp_hdr.obj_id) &&
-                    ((rp_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_FINAL)) ==
-                        (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_DELET))) {
-                  // pointing to something else valid, just delete this page then
-                  SPIFFS_CHECK_DBG("PA: corresponding ref is good but different: %04x, delete this %04x\n", rpix, cur_pix);
-                  delete_page = 1;
-                } else {
-                  // pointing to something weird, update index to point to this page instead
-                  if (rpix != cur_pix) {
-                    SPIFFS_CHECK_DBG("PA: corresponding ref is weird: %04x %s%s%s%s, rewrite this %04x\n", rpix,
-                        (rp_hdr.flags & SPIFFS_PH_FLAG_INDEX) ? "" : "INDEX ",
-                            (rp_hdr.flags & SPIFFS_PH_FLAG_DELET) ? "" : "DELETED ",
-                                (rp_hdr.flags & SPIFFS_PH_FLAG_USED) ? "NOTUSED " : "",
-                                    (rp_hdr.flags & SPIFFS_PH_FLAG_FINAL) ? "NOTFINAL " : "",
-                        cur_pix);
-                    rewrite_ix_to_this = 1;
-                  } else {
-                    // should not happen, destined for fubar
-                  }
-                }
+                // should not happen, destined for fubar
               }
-            } else if (res == SPIFFS_ERR_NOT_FOUND) {
-              SPIFFS_CHECK_DBG("PA: corresponding ref not found, delete %04x\n", cur_pix);
-              delete_page = 1;
-              res = SPIFFS_OK;
             }
+          }
+        } else if (res == SPIFFS_ERR_NOT_FOUND) {
+          SPIFFS_CHECK_DBG("PA: corresponding ref not found, delete %04x\n", cur_pix);
+          delete_page = 1;
+          res = SPIFFS_OK;
+        }
 
-            if (rewrite_ix_to_this) {
-              // if pointing to invalid page, redirect index to this page
-              SPIFFS_CHECK_DBG("PA: FIXUP: rewrite index id %04x data spix %04x to point to this pix: %04x\n",
-                  p_hdr.obj_id, p_hdr.span_ix, cur_pix);
-              res = spiffs_rewrite_index(fs, p_hdr.obj_id, p_hdr.span_ix, cur_pix, objix_pix);
-              if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
-                // index bad also, cannot mend this file
-                SPIFFS_CHECK_DBG("PA: FIXUP: index bad %i, cannot mend!\n", res);
-                if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
-                res = spiffs_page_delete(fs, cur_pix);
-                SPIFFS_CHECK_RES(res);
-                res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
-              } else {
-                if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, p_hdr.obj_id, p_hdr.span_ix);
-              }
-              SPIFFS_CHECK_RES(res);
-              restart = 1;
-              continue;
-            } else if (delete_page) {
-              SPIFFS_CHECK_DBG("PA: FIXUP: deleting page %04x\n", cur_pix);
-              if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_PAGE, cur_pix, 0);
-              res = spiffs_page_delete(fs, cur_pix);
-            }
+        if (rewrite_ix_to_this) {
+          // if pointing to invalid page, redirect index to this page
+          SPIFFS_CHECK_DBG("PA: FIXUP: rewrite index id %04x data spix %04x to point to this pix: %04x\n",
+              p_hdr.obj_id, p_hdr.span_ix, cur_pix);
+          res = spiffs_rewrite_index(fs, p_hdr.obj_id, p_hdr.span_ix, cur_pix, objix_pix);
+          if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
+            // index bad also, cannot mend this file
+            SPIFFS_CHECK_DBG("PA: FIXUP: index bad %i, cannot mend!\n", res);
+            if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
+            res = spiffs_page_delete(fs, cur_pix);
             SPIFFS_CHECK_RES(res);
+            res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
+          } else {
+            if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, p_hdr.obj_id, p_hdr.span_ix);
           }
-          if (bitmask == 0x2) {
+          SPIFFS_CHECK_RES(res);
+          *restart = 1;
+          continue;
+        } else if (delete_page) {
+          SPIFFS_CHECK_DBG("PA: FIXUP: deleting page %04x\n", cur_pix);
+          if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_PAGE, cur_pix, 0);
+          res = spiffs_page_delete(fs, cur_pix);
+        }
+        SPIFFS_CHECK_RES(res);
+      }
+      if (bitmask == 0x2) {
 
-            // 010
-            SPIFFS_CHECK_DBG("PA: pix %04x FREE, REFERENCED, not index\n", cur_pix);
+        // 010
+        SPIFFS_CHECK_DBG("PA: pix %04x FREE, REFERENCED, not index\n", cur_pix);
 
-            // no op, this should be taken care of when checking valid references
-          }
+        // no op, this should be taken care of when checking valid references
+      }
 
-          // 011 ok - busy, referenced, not index
+      // 011 ok - busy, referenced, not index
 
-          if (bitmask == 0x4) {
+      if (bitmask == 0x4) {
 
-            // 100
-            SPIFFS_CHECK_DBG("PA: pix %04x FREE, unreferenced, INDEX\n", cur_pix);
+        // 100
+        SPIFFS_CHECK_DBG("PA: pix %04x FREE, unreferenced, INDEX\n", cur_pix);
 
-            // this should never happen, major fubar
-          }
+        // this should never happen, major fubar
+      }
 
-          // 101 ok - busy, unreferenced, index
+      // 101 ok - busy, unreferenced, index
 
-          if (bitmask == 0x6) {
+      if (bitmask == 0x6) {
 
-            // 110
-            SPIFFS_CHECK_DBG("PA: pix %04x FREE, REFERENCED, INDEX\n", cur_pix);
+        // 110
+        SPIFFS_CHECK_DBG("PA: pix %04x FREE, REFERENCED, INDEX\n", cur_pix);
 
-            // no op, this should be taken care of when checking valid references
-          }
-          if (bitmask == 0x7) {
+        // no op, this should be taken care of when checking valid references
+      }
+      if (bitmask == 0x7) {
 
-            // 111
-            SPIFFS_CHECK_DBG("PA: pix %04x USED, REFERENCED, INDEX\n", cur_pix);
+        // 111
+        SPIFFS_CHECK_DBG("PA: pix %04x USED, REFERENCED, INDEX\n", cur_pix);
 
-            // no op, this should be taken care of when checking valid references
-          }
-        }
+        // no op, this should be taken care of when checking valid references
       }
     }
+  }
+  return res;
+}
+
+// Scans all pages (except lu pages), reserves 4 bits in working memory for each page
+// bit 0: 0 == FREE|DELETED, 1 == USED
+// bit 1: 0 == UNREFERENCED, 1 == REFERENCED
+// bit 2: 0 == NOT_INDEX,    1 == INDEX
+// bit 3: unused
+// A consistent file system will have only pages being
+//  * x000 free, unreferenced, not index
+//  * x011 used, referenced only once, not index
+//  * x101 used, unreferenced, index
+// The working memory might not fit all pages so several scans might be needed
+static s32_t spiffs_page_consistency_check_i(spiffs *fs) {
+  const u32_t bits = 4;
+  const spiffs_page_ix pages_per_scan = SPIFFS_CFG_LOG_PAGE_SZ(fs) * 8 / bits;
+
+  s32_t res = SPIFFS_OK;
+  spiffs_page_ix pix_offset = 0;
+
+  // for each range of pages fitting into work memory
+  while (pix_offset < SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count) {
+    // set this flag to abort all checks and rescan the page range
+    u8_t restart = 0;
+    c_memset(fs->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
+
+    spiffs_block_ix cur_block = 0;
+    // build consistency bitmap for id range traversing all blocks
+    while (!restart && cur_block < fs->block_count) {
+      if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_PROGRESS,
+          (pix_offset*256)/(SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count) +
+          ((((cur_block * pages_per_scan * 256)/ (SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count))) / fs->block_count),
+          0);
+
+      res = spiffs_page_consistency_check_block(fs, fs->work, pix_offset, cur_block, &restart);
+      SPIFFS_CHECK_RES(res);
+      // next block
+      cur_block++;
+    }
+    // check consistency bitmap
+    if (!restart) {
+      res = spiffs_page_consistency_check_map(fs, fs->work, pix_offset, &restart);
+      SPIFFS_CHECK_RES(res);
+    }
     // next page range
     if (!restart) {
       pix_offset += pages_per_scan;
@@ -840,11 +872,16 @@ s32_t spiffs_page_consistency_check(spiffs *fs) {
 //---------------------------------------
 // Object index consistency
 
+// temporary object id index, see spiffs_object_index_consistency_check
+typedef struct {
+  spiffs_obj_id *obj_table;
+  u32_t log_ix;
+} spiffs_check_obj_index;
+
 // searches for given object id in temporary object id index,
 // returns the index or -1
-static int spiffs_object_index_search(spiffs *fs, spiffs_obj_id obj_id) {
+static int spiffs_object_index_search(spiffs *fs, spiffs_obj_id *obj_table, spiffs_obj_id obj_id) {
   u32_t i;
-  spiffs_obj_id *obj_table = (spiffs_obj_id *)fs->work;
   obj_id &= ~SPIFFS_OBJ_ID_IX_FLAG;
   for (i = 0; i < SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id); i++) {
     if ((obj_table[i] & ~SPIFFS_OBJ_ID_IX_FLAG) == obj_id) {
@@ -854,13 +891,17 @@ static int spiffs_object_index_search(spiffs *fs, spiffs_obj_id obj_id) {
   return -1;
 }
 
+// user_data, if not 0, is the block to stop at
 static s32_t spiffs_object_index_consistency_check_v(spiffs *fs, spiffs_obj_id obj_id, spiffs_block_ix cur_block,
     int cur_entry, u32_t user_data, void *user_p) {
-  (void)user_data;
   s32_t res_c = SPIFFS_VIS_COUNTINUE;
   s32_t res = SPIFFS_OK;
-  u32_t *log_ix = (u32_t *)user_p;
-  spiffs_obj_id *obj_table = (spiffs_obj_id *)fs->work;
+  u32_t *log_ix = &((spiffs_check_obj_index *)user_p)->log_ix;
+  spiffs_obj_id *obj_table = ((spiffs_check_obj_index *)user_p)->obj_table;
+
+  if (user_data && cur_block >= user_data) {
+    return SPIFFS_OK;
+  }
 
   if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_INDEX, SPIFFS_CHECK_PROGRESS,
       (cur_block * 256)/fs->block_count, 0);
@@ -892,7 +933,7 @@ static s32_t spiffs_object_index_consistency_check_v(spiffs *fs, spiffs_obj_id o
 
     if (p_hdr.span_ix == 0) {
       // objix header page, register objid as reachable
-      int r = spiffs_object_index_search(fs, obj_id);
+      int r = spiffs_object_index_search(fs, obj_table, obj_id);
       if (r == -1) {
         // not registered, do it
         obj_table[*log_ix] = obj_id & ~SPIFFS_OBJ_ID_IX_FLAG;
@@ -903,7 +944,7 @@ static s32_t spiffs_object_index_consistency_check_v(spiffs *fs, spiffs_obj_id o
       }
     } else { // span index
       // objix page, see if header can be found
-      int r = spiffs_object_index_search(fs, obj_id);
+      int r = spiffs_object_index_search(fs, obj_table, obj_id);
       u8_t delete = 0;
       if (r == -1) {
         // not in temporary index, try finding it
@@ -957,9 +998,11 @@ s32_t spiffs_object_index_consistency_check(spiffs *fs) {
   // In the temporary object index memory, SPIFFS_OBJ_ID_IX_FLAG bit is used to indicate
   // a reachable/unreachable object id.
   c_memset(fs->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
-  u32_t obj_id_log_ix = 0;
+  spiffs_check_obj_index ix;
+  ix.obj_table = (spiffs_obj_id *)fs->work;
+  ix.log_ix = 0;
   if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_INDEX, SPIFFS_CHECK_PROGRESS, 0, 0);
-  res = spiffs_obj_lu_find_entry_visitor(fs, 0, 0, 0, 0, spiffs_object_index_consistency_check_v, 0, &obj_id_log_ix,
+  res = spiffs_obj_lu_find_entry_visitor(fs, 0, 0, 0, 0, spiffs_object_index_consistency_check_v, 0, &ix,
       0, 0);
   if (res == SPIFFS_VIS_END) {
     res = SPIFFS_OK;
@@ -971,3 +1014,159 @@ s32_t spiffs_object_index_consistency_check(spiffs *fs) {
   return res;
 }
 
+
+//---------------------------------------
+// Incremental check
+
+#define SPIFFS_CHECK_PHASE_SCAN     (SPIFFS_CHECK_PAGE + 1)
+#define SPIFFS_CHECK_PHASE_DONE     (SPIFFS_CHECK_PAGE + 2)
+
+// Remembers the page counters. Pages are never rewritten in place, so any
+// change to the filesystem allocates or deletes a page, and deleted pages
+// only go away by erasing a block, which counts up the erase count.
+static void spiffs_check_mark(spiffs *fs, spiffs_check_state *st) {
+  st->p_allocated = fs->stats_p_allocated;
+  st->p_deleted = fs->stats_p_deleted;
+  st->erase_count = fs->max_erase_count;
+}
+
+static int spiffs_check_changed(spiffs *fs, spiffs_check_state *st) {
+  return st->p_allocated != fs->stats_p_allocated ||
+      st->p_deleted != fs->stats_p_deleted ||
+      st->erase_count != fs->max_erase_count;
+}
+
+void spiffs_check_start(spiffs *fs, spiffs_check_state *st, u8_t *work, spiffs_check_callback cb) {
+  c_memset(st, 0, sizeof(spiffs_check_state));
+  st->phase = SPIFFS_CHECK_LOOKUP;
+  st->work = work;
+  st->cb = cb;
+  c_memset(st->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
+  spiffs_check_mark(fs, st);
+}
+
+static s32_t spiffs_check_step_i(spiffs *fs, spiffs_check_state *st) {
+  const spiffs_page_ix pages_per_scan = SPIFFS_CFG_LOG_PAGE_SZ(fs) * 8 / 4;
+  s32_t res = SPIFFS_OK;
+  u8_t restart = 0;
+
+  // the checks expect whole blocks, not partly erased ones
+  res = spiffs_gc_erase_ahead_finish(fs);
+  SPIFFS_CHECK_RES(res);
+
+  if (spiffs_check_changed(fs, st)) {
+    // written between steps, what is known about object ids and the pages
+    // of the current range may be stale
+    if (st->phase == SPIFFS_CHECK_INDEX) {
+      c_memset(st->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
+      st->log_ix = 0;
+    } else if (st->phase == SPIFFS_CHECK_PAGE) {
+      st->block = 0;
+    }
+  }
+
+  switch (st->phase) {
+  case SPIFFS_CHECK_LOOKUP:
+    if (st->block == 0 && fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_LOOKUP, SPIFFS_CHECK_PROGRESS, 0, 0);
+    res = spiffs_obj_lu_find_entry_visitor(fs, st->block, 0, SPIFFS_VIS_NO_WRAP, 0, spiffs_lookup_check_v,
+        st->block + 1, 0, 0, 0);
+    if (res == SPIFFS_VIS_END) {
+      res = SPIFFS_OK;
+    }
+    if (res != SPIFFS_OK) {
+      if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_LOOKUP, SPIFFS_CHECK_ERROR, res, 0);
+      return res;
+    }
+    if (++st->block >= fs->block_count) {
+      if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_LOOKUP, SPIFFS_CHECK_PROGRESS, 256, 0);
+      st->phase = SPIFFS_CHECK_INDEX;
+      st->block = 0;
+    }
+    break;
+
+  case SPIFFS_CHECK_INDEX: {
+    spiffs_check_obj_index ix;
+    ix.obj_table = (spiffs_obj_id *)st->work;
+    ix.log_ix = st->log_ix;
+    if (st->block == 0 && fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_INDEX, SPIFFS_CHECK_PROGRESS, 0, 0);
+    res = spiffs_obj_lu_find_entry_visitor(fs, st->block, 0, SPIFFS_VIS_NO_WRAP, 0,
+        spiffs_object_index_consistency_check_v, st->block + 1, &ix, 0, 0);
+    st->log_ix = ix.log_ix;
+    if (res == SPIFFS_VIS_END) {
+      res = SPIFFS_OK;
+    }
+    if (res != SPIFFS_OK) {
+      if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_INDEX, SPIFFS_CHECK_ERROR, res, 0);
+      return res;
+    }
+    if (++st->block >= fs->block_count) {
+      if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_INDEX, SPIFFS_CHECK_PROGRESS, 256, 0);
+      st->phase = SPIFFS_CHECK_PAGE;
+      st->block = 0;
+      st->pix_offset = 0;
+    }
+    break;
+  }
+
+  case SPIFFS_CHECK_PAGE:
+    if (st->block < fs->block_count) {
+      // build consistency bitmap of the page range, one block at a time
+      if (st->block == 0) {
+        c_memset(st->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
+      }
+      if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_PROGRESS,
+          (st->pix_offset*256)/(SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count) +
+          ((((st->block * pages_per_scan * 256)/ (SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count))) / fs->block_count),
+          0);
+      res = spiffs_page_consistency_check_block(fs, st->work, st->pix_offset, st->block, &restart);
+    } else {
+      // check consistency bitmap
+      res = spiffs_page_consistency_check_map(fs, st->work, st->pix_offset, &restart);
+      if (res == SPIFFS_OK && !restart) {
+        st->pix_offset += pages_per_scan;
+      }
+    }
+    if (res != SPIFFS_OK) {
+      if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_ERROR, res, 0);
+      return res;
+    }
+    if (restart || st->block >= fs->block_count) {
+      st->block = 0;
+    } else {
+      st->block++;
+    }
+    if (st->pix_offset >= SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count) {
+      if (fs->check_cb_f) fs->check_cb_f(SPIFFS_CHECK_PAGE, SPIFFS_CHECK_PROGRESS, 256, 0);
+      st->phase = SPIFFS_CHECK_PHASE_SCAN;
+    }
+    break;
+
+  case SPIFFS_CHECK_PHASE_SCAN:
+    // recount pages and blocks after the fixes
+    res = spiffs_obj_lu_scan(fs);
+    SPIFFS_CHECK_RES(res);
+    fs->erase_scan = 1;
+    st->phase = SPIFFS_CHECK_PHASE_DONE;
+    break;
+  }
+
+  spiffs_check_mark(fs, st);
+  return st->phase == SPIFFS_CHECK_PHASE_DONE ? 0 : 1;
+}
+
+// Does a bounded piece of the consistency check: the lookup or object index
+// check of one block, the page check of one block for the current page range,
+// the evaluation of that range, or the final recount. Progress and fixes are
+// reported through the callback of the check state.
+// Returns 1 while there is more to do, 0 when the check is done.
+s32_t spiffs_check_step(spiffs *fs, spiffs_check_state *st) {
+  s32_t res;
+  spiffs_check_callback check_cb_f = fs->check_cb_f;
+  if (st->phase == SPIFFS_CHECK_PHASE_DONE) {
+    return 0;
+  }
+  fs->check_cb_f = st->cb;
+  res = spiffs_check_step_i(fs, st);
+  fs->check_cb_f = check_cb_f;
+  return res;
+}
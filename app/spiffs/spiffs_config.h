@@ -80,6 +80,13 @@ typedef uint8_t u8_t;
 #define SPIFFS_GC_MAX_RUNS              5
 #endif
 
+// Default number of free blocks background gc (SPIFFS_gc_step) keeps ready.
+// Writes skip synchronous gc while more than 3 blocks are free, one more
+// than that lets a write start a new block between two gc steps.
+#ifndef SPIFFS_GC_KEEP_FREE_BLOCKS
+#define SPIFFS_GC_KEEP_FREE_BLOCKS      5
+#endif
+
 // Enable/disable statistics on gc. Debug/test purpose only.
 #ifndef SPIFFS_GC_STATS
 #define SPIFFS_GC_STATS                 0
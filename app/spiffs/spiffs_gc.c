@@ -1,26 +1,19 @@
 #include "spiffs.h"
 #include "spiffs_nucleus.h"
 
-// Erases a logical block and updates the erase counter.
-// If cache is enabled, all pages that might be cached in this block
-// is dropped.
-static s32_t spiffs_gc_erase_block(
+// Registers a freshly erased logical block: updates the erase counter and
+// free block count. If cache is enabled, all pages that might be cached in
+// this block are dropped.
+static s32_t spiffs_gc_block_erased(
     spiffs *fs,
     spiffs_block_ix bix) {
   s32_t res;
-  u32_t addr = SPIFFS_BLOCK_TO_PADDR(fs, bix);
-  s32_t size = SPIFFS_CFG_LOG_BLOCK_SZ(fs);
 
-  SPIFFS_GC_DBG("gc: erase block %i\n", bix);
-
-  // here we ignore res, just try erasing the block
-  while (size > 0) {
-    SPIFFS_GC_DBG("gc: erase %08x:%08x\n", addr,  SPIFFS_CFG_PHYS_ERASE_SZ(fs));
-    (void)fs->cfg.hal_erase_f(addr, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
-    addr += SPIFFS_CFG_PHYS_ERASE_SZ(fs);
-    size -= SPIFFS_CFG_PHYS_ERASE_SZ(fs);
-  }
   fs->free_blocks++;
+  if (fs->erase_bix == bix) {
+    // was being erased ahead, done now
+    fs->erase_bix = (spiffs_block_ix)-1;
+  }
 
   // register erase count for this block
   res = _spiffs_wr(fs, SPIFFS_OP_C_WRTHRU | SPIFFS_OP_T_OBJ_LU2, 0,
@@ -44,75 +37,206 @@ static s32_t spiffs_gc_erase_block(
   return res;
 }
 
+// Erases a logical block and updates the erase counter.
+static s32_t spiffs_gc_erase_block(
+    spiffs *fs,
+    spiffs_block_ix bix) {
+  u32_t addr = SPIFFS_BLOCK_TO_PADDR(fs, bix);
+  s32_t size = SPIFFS_CFG_LOG_BLOCK_SZ(fs);
+
+  SPIFFS_GC_DBG("gc: erase block %i\n", bix);
+
+  // here we ignore res, just try erasing the block
+  while (size > 0) {
+    SPIFFS_GC_DBG("gc: erase %08x:%08x\n", addr,  SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+    (void)fs->cfg.hal_erase_f(addr, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+    addr += SPIFFS_CFG_PHYS_ERASE_SZ(fs);
+    size -= SPIFFS_CFG_PHYS_ERASE_SZ(fs);
+  }
+  return spiffs_gc_block_erased(fs, bix);
+}
+
+// Checks if all object lookup entries of given block are deleted.
+// Returns 1 if so, 0 if not.
+static s32_t spiffs_gc_block_deleted(
+    spiffs *fs,
+    spiffs_block_ix bix) {
+  s32_t res = SPIFFS_OK;
+  int obj_lookup_page = 0;
+  int cur_entry = 0;
+  int entries_per_page = (SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id));
+  spiffs_obj_id *obj_lu_buf = (spiffs_obj_id *)fs->lu_work;
+
+  // check each object lookup page
+  while (obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
+    int entry_offset = obj_lookup_page * entries_per_page;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+        0, bix * SPIFFS_CFG_LOG_BLOCK_SZ(fs) + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+    SPIFFS_CHECK_RES(res);
+    // check each entry
+    while (cur_entry - entry_offset < entries_per_page &&
+        cur_entry < (int)(SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
+      if (obj_lu_buf[cur_entry-entry_offset] != SPIFFS_OBJ_ID_DELETED) {
+        return 0;
+      }
+      cur_entry++;
+    } // per entry
+    obj_lookup_page++;
+  } // per object lookup page
+  return 1;
+}
+
 // Searches for blocks where all entries are deleted - if one is found,
 // the block is erased. Compared to the non-quick gc, the quick one ensures
 // that no updates are needed on existing objects on pages that are erased.
 s32_t spiffs_gc_quick(
     spiffs *fs) {
   s32_t res = SPIFFS_OK;
-  u32_t blocks = fs->block_count;
-  spiffs_block_ix cur_block = 0;
-  u32_t cur_block_addr = 0;
-  int cur_entry = 0;
-  spiffs_obj_id *obj_lu_buf = (spiffs_obj_id *)fs->lu_work;
+  spiffs_block_ix cur_block;
 
-  SPIFFS_GC_DBG("gc_quick: running\n", cur_block);
+  SPIFFS_GC_DBG("gc_quick: running\n");
 #if SPIFFS_GC_STATS
   fs->stats_gc_runs++;
 #endif
 
-  int entries_per_page = (SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id));
-
   // find fully deleted blocks
   // check each block
-  while (res == SPIFFS_OK && blocks--) {
-    u16_t deleted_pages_in_block = 0;
-
-    int obj_lookup_page = 0;
-    // check each object lookup page
-    while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
-      int entry_offset = obj_lookup_page * entries_per_page;
-      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
-          0, cur_block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
-      // check each entry
-      while (res == SPIFFS_OK &&
-          cur_entry - entry_offset < entries_per_page &&
-          cur_entry < (int)(SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
-        spiffs_obj_id obj_id = obj_lu_buf[cur_entry-entry_offset];
-        if (obj_id == SPIFFS_OBJ_ID_DELETED) {
-          deleted_pages_in_block++;
-        } else if (obj_id == SPIFFS_OBJ_ID_FREE) {
-          // kill scan, go for next block
-          obj_lookup_page = SPIFFS_OBJ_LOOKUP_PAGES(fs);
-          res = 1; // kill object lu loop
-          break;
-        }  else {
-          // kill scan, go for next block
-          obj_lookup_page = SPIFFS_OBJ_LOOKUP_PAGES(fs);
-          res = 1; // kill object lu loop
-          break;
-        }
-        cur_entry++;
-      } // per entry
-      obj_lookup_page++;
-    } // per object lookup page
-    if (res == 1) res = SPIFFS_OK;
-
-    if (res == SPIFFS_OK && deleted_pages_in_block == SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
+  for (cur_block = 0; cur_block < fs->block_count; cur_block++) {
+    res = spiffs_gc_block_deleted(fs, cur_block);
+    SPIFFS_CHECK_RES(res);
+    if (res == 1) {
       // found a fully deleted block
-      fs->stats_p_deleted -= deleted_pages_in_block;
-      res = spiffs_gc_erase_block(fs, cur_block);
-      return res;
+      fs->stats_p_deleted -= SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs);
+      return spiffs_gc_erase_block(fs, cur_block);
     }
-
-    cur_entry = 0;
-    cur_block++;
-    cur_block_addr += SPIFFS_CFG_LOG_BLOCK_SZ(fs);
   } // per block
 
+  return SPIFFS_OK;
+}
+
+// Starts erasing given fully deleted block ahead of need
+static void spiffs_gc_erase_ahead_start(
+    spiffs *fs,
+    spiffs_block_ix bix) {
+  SPIFFS_GC_DBG("gc: erase ahead block %i\n", bix);
+  fs->erase_bix = bix;
+  fs->erase_sectors = SPIFFS_CFG_LOG_BLOCK_SZ(fs) / SPIFFS_CFG_PHYS_ERASE_SZ(fs);
+}
+
+// Erases one physical sector of the block being erased ahead of need.
+// Sectors are erased from the end of the block: the object lookup pages are
+// in the first sector and keep showing all pages as deleted until the last
+// erase, so nothing is allocated in a partly erased block and an interrupted
+// one is found again after mount.
+static s32_t spiffs_gc_erase_ahead_sector(
+    spiffs *fs) {
+  s32_t res;
+  spiffs_block_ix bix = fs->erase_bix;
+  u32_t addr;
+
+  fs->erase_sectors--;
+  if (fs->erase_sectors == 0) {
+    // the lookup pages go with this sector, account them now
+    res = spiffs_gc_erase_page_stats(fs, bix);
+    SPIFFS_CHECK_RES(res);
+  }
+  addr = SPIFFS_BLOCK_TO_PADDR(fs, bix) + fs->erase_sectors * SPIFFS_CFG_PHYS_ERASE_SZ(fs);
+  SPIFFS_GC_DBG("gc: erase %08x:%08x\n", addr, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+  (void)fs->cfg.hal_erase_f(addr, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+  if (fs->erase_sectors == 0) {
+    res = spiffs_gc_block_erased(fs, bix);
+    SPIFFS_CHECK_RES(res);
+  }
+  return 1;
+}
+
+// Completes erasing a block that is partly erased ahead of need
+s32_t spiffs_gc_erase_ahead_finish(
+    spiffs *fs) {
+  s32_t res = SPIFFS_OK;
+  while (res >= 0 && fs->erase_bix != (spiffs_block_ix)-1) {
+    res = spiffs_gc_erase_ahead_sector(fs);
+  }
   return res;
 }
 
+// Performs one bounded piece of garbage collection ahead of need, so that
+// writes do not have to run spiffs_gc_check synchronously. Each call does
+// one of:
+//   erase the next sector of a block being erased ahead
+//   find a fully deleted block and erase its first sector
+//   clean the best candidate block by moving its pages elsewhere, it is
+//   then erased sector by sector in the following calls
+// Searching for fully deleted blocks is skipped unless pages were deleted
+// since the last search found none. Nothing new is started while at least
+// keep_free_blocks blocks are free, or when there are no deleted pages to
+// reclaim.
+// Returns 1 if a piece of work was done, 0 if there was nothing to do.
+s32_t spiffs_gc_step(
+    spiffs *fs,
+    u32_t keep_free_blocks) {
+  s32_t res;
+  u32_t data_pages_per_block = SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs);
+
+  if (fs->erase_bix != (spiffs_block_ix)-1) {
+    return spiffs_gc_erase_ahead_sector(fs);
+  }
+
+  if (fs->free_blocks >= keep_free_blocks || fs->stats_p_deleted == 0) {
+    return 0;
+  }
+
+  // a fully deleted block can be erased without moving any pages
+  if (fs->erase_scan && fs->stats_p_deleted >= data_pages_per_block) {
+    spiffs_block_ix bix;
+    for (bix = 0; bix < fs->block_count; bix++) {
+      res = spiffs_gc_block_deleted(fs, bix);
+      SPIFFS_CHECK_RES(res);
+      if (res == 1) {
+        spiffs_gc_erase_ahead_start(fs, bix);
+        return spiffs_gc_erase_ahead_sector(fs);
+      }
+    }
+    fs->erase_scan = 0;
+  }
+
+  spiffs_block_ix *cands;
+  int count;
+  spiffs_block_ix cand;
+  res = spiffs_gc_find_candidate(fs, &cands, &count);
+  SPIFFS_CHECK_RES(res);
+  if (count == 0) {
+    SPIFFS_GC_DBG("gc_step: no candidates, return\n");
+    return 0;
+  }
+#if SPIFFS_GC_STATS
+  fs->stats_gc_runs++;
+#endif
+  cand = cands[0];
+  fs->cleaning = 1;
+  res = spiffs_gc_clean(fs, cand);
+  fs->cleaning = 0;
+  SPIFFS_GC_DBG("gc_step: cleaning block %i, result %i\n", cand, res);
+  SPIFFS_CHECK_RES(res);
+
+  res = spiffs_gc_block_deleted(fs, cand);
+  SPIFFS_CHECK_RES(res);
+  if (res == 1) {
+    spiffs_gc_erase_ahead_start(fs, cand);
+    return 1;
+  }
+
+  // free pages left in the block must not be allocated while it is partly
+  // erased, so erase it at once
+  res = spiffs_gc_erase_page_stats(fs, cand);
+  SPIFFS_CHECK_RES(res);
+
+  res = spiffs_gc_erase_block(fs, cand);
+  SPIFFS_CHECK_RES(res);
+
+  return 1;
+}
+
 // Checks if garbaga collecting is necessary. If so a candidate block is found,
 // cleansed and erased
 s32_t spiffs_gc_check(
@@ -29,15 +29,14 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
   c_memset(fs, 0, sizeof(spiffs));
   c_memcpy(&fs->cfg, config, sizeof(spiffs_config));
   fs->block_count = SPIFFS_CFG_PHYS_SZ(fs) / SPIFFS_CFG_LOG_BLOCK_SZ(fs);
+  fs->erase_bix = (spiffs_block_ix)-1;
+  fs->erase_scan = 1;
   fs->work = &work[0];
   fs->lu_work = &work[SPIFFS_CFG_LOG_PAGE_SZ(fs)];
   c_memset(fd_space, 0, fd_space_size);
   // align fd_space pointer to pointer size byte boundary, below is safe
   u8_t ptr_size = sizeof(void*);
-// #pragma GCC diagnostic push
-// #pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
-  u8_t addr_lsb = (u8_t)(((u32_t)fd_space) & (ptr_size-1));
-// #pragma GCC diagnostic pop
+  u8_t addr_lsb = (u8_t)(((size_t)fd_space) & (ptr_size-1));
   if (addr_lsb) {
     fd_space += (ptr_size-addr_lsb);
     fd_space_size -= (ptr_size-addr_lsb);
@@ -46,10 +45,7 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
   fs->fd_count = (fd_space_size/sizeof(spiffs_fd));
 
   // align cache pointer to 4 byte boundary, below is safe
-// #pragma GCC diagnostic push
-// #pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
-  addr_lsb = (u8_t)(((u32_t)cache) & (ptr_size-1));
-// #pragma GCC diagnostic pop
+  addr_lsb = (u8_t)(((size_t)cache) & (ptr_size-1));
   if (addr_lsb) {
     u8_t *cache_8 = (u8_t *)cache;
     cache_8 += (ptr_size-addr_lsb);
@@ -102,6 +98,67 @@ void SPIFFS_unmount(spiffs *fs) {
   SPIFFS_UNLOCK(fs);
 }
 
+// number of lookup entries per block looked at by the page size probe
+#define SPIFFS_PROBE_ENTRIES    16
+// used pages to look at before deciding
+#define SPIFFS_PROBE_USED       32
+
+s32_t SPIFFS_probe_page_size(spiffs_config *config) {
+  spiffs_obj_id lu[SPIFFS_PROBE_ENTRIES];
+  spiffs_page_header ph;
+  u32_t block_sz = config->log_block_size;
+  u32_t blocks = config->phys_size / block_sz;
+  u32_t used = 0;
+  u32_t page_sz;
+  u32_t bix;
+  u32_t i;
+  u32_t e;
+  s32_t res;
+  // per candidate page size, 64 bytes up to a quarter block
+  u32_t matches[8];
+  u32_t misses[8];
+  c_memset(matches, 0, sizeof(matches));
+  c_memset(misses, 0, sizeof(misses));
+
+  for (bix = 0; bix < blocks && used < SPIFFS_PROBE_USED; bix++) {
+    u32_t addr = config->phys_addr + bix * block_sz;
+    // the lookup starts the block whatever the page size, only the pages
+    // the entries stand for move
+    res = config->hal_read_f(addr, sizeof(lu), (u8_t *)lu);
+    if (res != SPIFFS_OK) return res;
+    for (page_sz = 64, i = 0; page_sz <= block_sz / 4 && i < 8; page_sz <<= 1, i++) {
+      u32_t pages = block_sz / page_sz;
+      u32_t lu_pages = MAX(1, (pages * sizeof(spiffs_obj_id)) / page_sz);
+      if (block_sz % page_sz) break;
+      for (e = 0; e < SPIFFS_PROBE_ENTRIES && e < pages - lu_pages; e++) {
+        if (lu[e] == SPIFFS_OBJ_ID_DELETED) continue;
+        res = config->hal_read_f(addr + (lu_pages + e) * page_sz,
+            sizeof(spiffs_page_header), (u8_t *)&ph);
+        if (res != SPIFFS_OK) return res;
+        if (lu[e] == SPIFFS_OBJ_ID_FREE) {
+          // a free page is still erased
+          if (ph.obj_id != SPIFFS_OBJ_ID_FREE || ph.flags != 0xff) misses[i]++;
+        } else if (ph.obj_id == lu[e] && (ph.flags & SPIFFS_PH_FLAG_USED) == 0) {
+          matches[i]++;
+        } else {
+          misses[i]++;
+        }
+      }
+    }
+    for (e = 0; e < SPIFFS_PROBE_ENTRIES; e++) {
+      if (lu[e] != SPIFFS_OBJ_ID_FREE && lu[e] != SPIFFS_OBJ_ID_DELETED) used++;
+    }
+  }
+
+  // a bigger page than the real one can line up with the pages of one file,
+  // a smaller one lands in the middle of pages, so the smallest that fits wins.
+  // A page half written at power loss is one miss for the real size.
+  for (page_sz = 64, i = 0; page_sz <= block_sz / 4 && i < 8; page_sz <<= 1, i++) {
+    if (matches[i] > 0 && misses[i] <= matches[i] / 16) return page_sz;
+  }
+  return 0;
+}
+
 s32_t SPIFFS_errno(spiffs *fs) {
   return fs->err_code;
 }
@@ -119,12 +176,52 @@ s32_t SPIFFS_creat(spiffs *fs, char *path, spiffs_mode mode) {
 
   res = spiffs_obj_lu_find_free_obj_id(fs, &obj_id, (u8_t *)path);
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
-  res = spiffs_object_create(fs, obj_id, (u8_t *)path, SPIFFS_TYPE_FILE, 0);
+  res = spiffs_object_create(fs, obj_id, (u8_t *)path, SPIFFS_TYPE_FILE, 0, 0);
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
   SPIFFS_UNLOCK(fs);
   return 0;
 }
 
+// Creates a hidden replacement for the file of given name and opens it.
+// The one lookup by name also finds the file to replace and what an earlier
+// replacement left unfinished, which is removed.
+static s32_t spiffs_open_replacement(spiffs *fs, char *path, spiffs_fd *fd, spiffs_flags flags,
+    spiffs_mode mode) {
+  spiffs_page_ix pix, stale_pix;
+  spiffs_page_header p_hdr;
+  spiffs_obj_id replace_obj_id = SPIFFS_OBJ_ID_FREE;
+  spiffs_obj_id obj_id;
+
+  s32_t res = spiffs_object_find_replaced(fs, (u8_t*)path, &pix, &stale_pix);
+  if (res == SPIFFS_OK) {
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_PAGE_TO_PADDR(fs, pix), sizeof(spiffs_page_header), (u8_t *)&p_hdr);
+    SPIFFS_CHECK_RES(res);
+    replace_obj_id = p_hdr.obj_id;
+  } else if (res != SPIFFS_ERR_NOT_FOUND) {
+    return res;
+  }
+
+  if (stale_pix) {
+    spiffs_file file_nbr = fd->file_nbr;
+    res = spiffs_object_open_by_page(fs, stale_pix, fd, 0, 0);
+    SPIFFS_CHECK_RES(res);
+    res = spiffs_object_truncate(fd, 0, 1);
+    SPIFFS_CHECK_RES(res);
+    // removing the object closed the descriptor
+    fd->file_nbr = file_nbr;
+  }
+
+  res = spiffs_obj_lu_find_free_obj_id(fs, &obj_id, 0);
+  SPIFFS_CHECK_RES(res);
+  res = spiffs_object_create(fs, obj_id, (u8_t*)path, SPIFFS_TYPE_FILE, 1, &pix);
+  SPIFFS_CHECK_RES(res);
+  res = spiffs_object_open_by_page(fs, pix, fd, flags & ~SPIFFS_TRUNC, mode);
+  SPIFFS_CHECK_RES(res);
+  fd->replace_obj_id = replace_obj_id;
+  return res;
+}
+
 spiffs_file SPIFFS_open(spiffs *fs, char *path, spiffs_flags flags, spiffs_mode mode) {
   (void)mode;
   SPIFFS_API_CHECK_MOUNT(fs);
@@ -136,6 +233,17 @@ spiffs_file SPIFFS_open(spiffs *fs, char *path, spiffs_flags flags, spiffs_mode
   s32_t res = spiffs_fd_find_new(fs, &fd);
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
+  if (flags & SPIFFS_REPLACE) {
+    res = spiffs_open_replacement(fs, path, fd, flags, mode);
+    if (res < SPIFFS_OK) {
+      spiffs_fd_return(fs, fd->file_nbr);
+    }
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    fd->fdoffset = 0;
+    SPIFFS_UNLOCK(fs);
+    return fd->file_nbr;
+  }
+
   res = spiffs_object_find_object_index_header_by_name(fs, (u8_t*)path, &pix);
   if ((flags & SPIFFS_CREAT) == 0) {
     if (res < SPIFFS_OK) {
@@ -152,7 +260,7 @@ spiffs_file SPIFFS_open(spiffs *fs, char *path, spiffs_flags flags, spiffs_mode
       spiffs_fd_return(fs, fd->file_nbr);
     }
     SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
-    res = spiffs_object_create(fs, obj_id, (u8_t*)path, SPIFFS_TYPE_FILE, &pix);
+    res = spiffs_object_create(fs, obj_id, (u8_t*)path, SPIFFS_TYPE_FILE, 0, &pix);
     if (res < SPIFFS_OK) {
       spiffs_fd_return(fs, fd->file_nbr);
     }
@@ -281,6 +389,60 @@ static s32_t spiffs_hydro_write(spiffs *fs, spiffs_fd *fd, void *buf, u32_t offs
 
 }
 
+#if SPIFFS_CACHE_WR
+// Writes back the contents of the write back buffer of given fd, if any
+static s32_t spiffs_fd_wbuf_flush(spiffs *fs, spiffs_fd *fd) {
+  s32_t res = SPIFFS_OK;
+  if (fd->wbuf_len > 0) {
+    res = spiffs_hydro_write(fs, fd, fd->wbuf, fd->wbuf_offset, fd->wbuf_len);
+    fd->wbuf_len = 0;
+  }
+  return res;
+}
+
+// Stores a write in the write back buffer of given fd. The buffer is written
+// back each time it reaches a data page boundary of the file, so that small
+// writes end up as whole page appends and the object index is updated once
+// per buffer instead of once per write.
+static s32_t spiffs_fd_wbuf_write(spiffs *fs, spiffs_fd *fd, u8_t *buf, u32_t offset, u32_t len) {
+  s32_t res;
+  u32_t dps = SPIFFS_DATA_PAGE_SIZE(fs);
+  if (fd->wbuf_len > 0 && offset != fd->wbuf_offset + fd->wbuf_len) {
+    // not contiguous with buffered data, write back first
+    res = spiffs_fd_wbuf_flush(fs, fd);
+    SPIFFS_CHECK_RES(res);
+  }
+  while (len > 0) {
+    if (fd->wbuf_len == 0) {
+      fd->wbuf_offset = offset;
+    }
+    u32_t end = fd->wbuf_offset + fd->wbuf_size;
+    u32_t fill = end - (end % dps);
+    fill = fill > fd->wbuf_offset ? fill - fd->wbuf_offset : fd->wbuf_size;
+    u32_t n;
+    if (fd->wbuf_len == 0 && len >= fill) {
+      // no point in copying, write all whole pages directly
+      n = len < dps ? len : len - ((offset + len) % dps);
+      n = MAX(n, fill);
+      res = spiffs_hydro_write(fs, fd, buf, offset, n);
+      SPIFFS_CHECK_RES(res);
+    } else {
+      n = MIN(len, fill - fd->wbuf_len);
+      c_memcpy(&fd->wbuf[fd->wbuf_len], buf, n);
+      fd->wbuf_len += n;
+      if (fd->wbuf_len == fill) {
+        res = spiffs_fd_wbuf_flush(fs, fd);
+        SPIFFS_CHECK_RES(res);
+      }
+    }
+    buf += n;
+    offset += n;
+    len -= n;
+  }
+  return SPIFFS_OK;
+}
+#endif
+
 s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, u32_t len) {
   SPIFFS_API_CHECK_MOUNT(fs);
   SPIFFS_LOCK(fs);
@@ -315,10 +477,21 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, u32_t len) {
     if (fd->cache_page) {
       offset = MAX(offset, fd->cache_page->offset + fd->cache_page->size);
     }
+    if (fd->wbuf_len > 0) {
+      offset = MAX(offset, fd->wbuf_offset + fd->wbuf_len);
+    }
 #endif
   }
 
 #if SPIFFS_CACHE_WR
+  if (fd->wbuf && (fd->flags & SPIFFS_DIRECT) == 0) {
+    res = spiffs_fd_wbuf_write(fs, fd, (u8_t *)buf, offset, len);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    fd->fdoffset += len;
+    SPIFFS_UNLOCK(fs);
+    return len;
+  }
+
   if ((fd->flags & SPIFFS_DIRECT) == 0) {
     if (len < (s32_t)SPIFFS_CFG_LOG_PAGE_SZ(fs)) {
       // small write, try to cache it
@@ -492,6 +665,7 @@ s32_t SPIFFS_fremove(spiffs *fs, spiffs_file fh) {
 
 #if SPIFFS_CACHE_WR
   spiffs_cache_fd_release(fs, fd->cache_page);
+  fd->wbuf_len = 0;
 #endif
 
   res = spiffs_object_truncate(fd, 0, 1);
@@ -572,6 +746,13 @@ static s32_t spiffs_fflush_cache(spiffs *fs, spiffs_file fh) {
   res = spiffs_fd_get(fs, fh, &fd);
   SPIFFS_API_CHECK_RES(fs, res);
 
+  if (fd->wbuf_len > 0) {
+    res = spiffs_fd_wbuf_flush(fs, fd);
+    if (res < SPIFFS_OK) {
+      fs->err_code = res;
+    }
+  }
+
   if ((fd->flags & SPIFFS_DIRECT) == 0) {
     if (fd->cache_page == 0) {
       // see if object id is associated with cache already
@@ -607,6 +788,33 @@ s32_t SPIFFS_fflush(spiffs *fs, spiffs_file fh) {
   return res;
 }
 
+#if SPIFFS_CACHE_WR
+s32_t SPIFFS_setvbuf(spiffs *fs, spiffs_file fh, u8_t *buf, u32_t size) {
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  spiffs_fd *fd;
+  s32_t res;
+  res = spiffs_fd_get(fs, fh, &fd);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  res = spiffs_fflush_cache(fs, fh);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  if (buf == 0 || size == 0) {
+    fd->wbuf = 0;
+    fd->wbuf_size = 0;
+  } else {
+    fd->wbuf = buf;
+    fd->wbuf_size = MIN(size, 0xffff);
+  }
+  fd->wbuf_len = 0;
+
+  SPIFFS_UNLOCK(fs);
+  return SPIFFS_OK;
+}
+#endif
+
 void SPIFFS_close(spiffs *fs, spiffs_file fh) {
   if (!SPIFFS_CHECK_MOUNT(fs)) {
     fs->err_code = SPIFFS_ERR_NOT_MOUNTED;
@@ -617,9 +825,105 @@ void SPIFFS_close(spiffs *fs, spiffs_file fh) {
 #if SPIFFS_CACHE
   spiffs_fflush_cache(fs, fh);
 #endif
+  spiffs_fd *fd;
+  if (spiffs_fd_get(fs, fh, &fd) == SPIFFS_OK && (fd->flags & SPIFFS_REPLACE)) {
+    // closed without commit, the replaced file stays
+    s32_t res = spiffs_object_truncate(fd, 0, 1);
+    if (res != SPIFFS_OK) fs->err_code = res;
+  }
+  spiffs_fd_return(fs, fh);
+
+  SPIFFS_UNLOCK(fs);
+}
+
+s32_t SPIFFS_commit(spiffs *fs, spiffs_file fh) {
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  spiffs_fd *fd;
+  spiffs_fd *old_fd = 0;
+  spiffs_page_ix pix;
+  spiffs_page_object_ix_header objix_hdr;
+  u8_t name[SPIFFS_OBJ_NAME_LEN];
+  s32_t res;
+
+  res = spiffs_fd_get(fs, fh, &fd);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  if ((fd->flags & SPIFFS_REPLACE) == 0) {
+    res = SPIFFS_ERR_NOT_REPLACEMENT;
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+#if SPIFFS_CACHE
+  res = spiffs_fflush_cache(fs, fh);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+#endif
+  if (fd->replace_obj_id != SPIFFS_OBJ_ID_FREE) {
+    // removing the replaced file needs a descriptor, get it before any change
+    res = spiffs_fd_find_new(fs, &old_fd);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+      0, SPIFFS_PAGE_TO_PADDR(fs, fd->objix_hdr_pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+  if (res == SPIFFS_OK) {
+    c_memcpy(name, objix_hdr.name, SPIFFS_OBJ_NAME_LEN);
+    // from here on the replacement survives being cut short, once the
+    // replaced file below is removed
+    res = spiffs_object_ready_replacement(fs, fd->objix_hdr_pix);
+  }
+  if (res != SPIFFS_OK) {
+    if (old_fd) spiffs_fd_return(fs, old_fd->file_nbr);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+  fd->flags &= ~SPIFFS_REPLACE;
+
+  if (old_fd) {
+    // the replaced file is found by id, its header is the only page read
+    res = spiffs_obj_lu_find_id_and_span(fs, fd->replace_obj_id | SPIFFS_OBJ_ID_IX_FLAG, 0, 0, &pix);
+    if (res == SPIFFS_OK) {
+      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+          0, SPIFFS_PAGE_TO_PADDR(fs, pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+    }
+    // unless removed meanwhile and the id given to another file
+    if (res == SPIFFS_OK && strcmp((char *)objix_hdr.name, (char *)name) == 0) {
+      res = spiffs_object_open_by_page(fs, pix, old_fd, 0, 0);
+      if (res == SPIFFS_OK) {
+        // the first write hides it, the replacement takes over from there
+        res = spiffs_object_truncate(old_fd, 0, 1);
+      }
+    } else if (res == SPIFFS_ERR_NOT_FOUND) {
+      res = SPIFFS_OK;
+    }
+    spiffs_fd_return(fs, old_fd->file_nbr);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+
+  res = spiffs_object_commit_replacement(fs, fd->objix_hdr_pix);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
   spiffs_fd_return(fs, fh);
 
   SPIFFS_UNLOCK(fs);
+  return 0;
+}
+
+s32_t SPIFFS_replace(spiffs *fs, char *path, u8_t *buf, s32_t len) {
+  spiffs_file fh = SPIFFS_open(fs, path, SPIFFS_REPLACE | SPIFFS_RDWR, 0);
+  if (fh < 0) {
+    return -1;
+  }
+  if (len > 0 && SPIFFS_write(fs, fh, buf, len) != len) {
+    s32_t res = fs->err_code;
+    SPIFFS_close(fs, fh);
+    fs->err_code = res;
+    return -1;
+  }
+  if (SPIFFS_commit(fs, fh) < 0) {
+    s32_t res = fs->err_code;
+    SPIFFS_close(fs, fh);
+    fs->err_code = res;
+    return -1;
+  }
+  return len;
 }
 
 s32_t SPIFFS_rename(spiffs *fs, char *old, char *new) {
@@ -696,7 +1000,8 @@ static s32_t spiffs_read_dir_v(
   if ((obj_id & SPIFFS_OBJ_ID_IX_FLAG) &&
       objix_hdr.p_hdr.span_ix == 0 &&
       (objix_hdr.p_hdr.flags& (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) ==
-          (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE)) {
+          (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE) &&
+      !SPIFFS_PH_HIDDEN(objix_hdr.p_hdr.flags)) {
     struct spiffs_dirent *e = (struct spiffs_dirent *)user_p;
     e->obj_id = obj_id;
     strcpy((char *)e->name, (char *)objix_hdr.name);
@@ -747,11 +1052,77 @@ s32_t SPIFFS_closedir(spiffs_DIR *d) {
   return 0;
 }
 
+s32_t SPIFFS_list(spiffs *fs, u32_t *cursor, const char *prefix,
+    struct spiffs_dirent *ents, u32_t max) {
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  s32_t res = SPIFFS_OK;
+  u32_t count = 0;
+  u32_t entries_per_page = SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id);
+  u32_t entries_per_block = SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+  u32_t end = fs->block_count * entries_per_block;
+  u32_t prefix_len = prefix ? strlen(prefix) : 0;
+  spiffs_obj_id *obj_lu_buf = (spiffs_obj_id *)fs->lu_work;
+  u32_t pos = *cursor;
+
+  while (count < max && pos < end) {
+    spiffs_block_ix bix = pos / entries_per_block;
+    int entry = pos % entries_per_block;
+    int entry_offset = (entry / entries_per_page) * entries_per_page;
+    int entry_end = MIN(entry_offset + entries_per_page, entries_per_block);
+    // one read for all entries of the lookup page
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+        0, bix * SPIFFS_CFG_LOG_BLOCK_SZ(fs) + SPIFFS_PAGE_TO_PADDR(fs, entry / entries_per_page),
+        SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+    if (res != SPIFFS_OK) break;
+    for (; entry < entry_end && count < max; entry++) {
+      spiffs_obj_id obj_id = obj_lu_buf[entry - entry_offset];
+      if (obj_id == SPIFFS_OBJ_ID_FREE || obj_id == SPIFFS_OBJ_ID_DELETED ||
+          (obj_id & SPIFFS_OBJ_ID_IX_FLAG) == 0) {
+        continue;
+      }
+      // only index pages can be headers, and their header is all we read
+      spiffs_page_object_ix_header objix_hdr;
+      spiffs_page_ix pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry);
+      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+          0, SPIFFS_PAGE_TO_PADDR(fs, pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+      if (res != SPIFFS_OK) break;
+      if (objix_hdr.p_hdr.span_ix != 0 ||
+          (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) !=
+              (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE) ||
+          SPIFFS_PH_HIDDEN(objix_hdr.p_hdr.flags)) {
+        continue;
+      }
+      if (prefix_len && strncmp(prefix, (char *)objix_hdr.name, prefix_len) != 0) {
+        continue;
+      }
+      struct spiffs_dirent *e = &ents[count++];
+      e->obj_id = obj_id;
+      strcpy((char *)e->name, (char *)objix_hdr.name);
+      e->type = objix_hdr.type;
+      e->size = objix_hdr.size == SPIFFS_UNDEFINED_LEN ? 0 : objix_hdr.size;
+      e->pix = pix;
+    }
+    if (res != SPIFFS_OK) break;
+    pos = bix * entries_per_block + entry;
+  }
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  *cursor = pos < end ? pos : SPIFFS_LIST_END;
+  SPIFFS_UNLOCK(fs);
+  return count;
+}
+
 s32_t SPIFFS_check(spiffs *fs) {
   s32_t res;
   SPIFFS_API_CHECK_MOUNT(fs);
   SPIFFS_LOCK(fs);
 
+  // the checks expect whole blocks, not partly erased ones
+  res = spiffs_gc_erase_ahead_finish(fs);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
   res = spiffs_lookup_consistency_check(fs, 0);
 
   res = spiffs_object_index_consistency_check(fs);
@@ -759,11 +1130,31 @@ s32_t SPIFFS_check(spiffs *fs) {
   res = spiffs_page_consistency_check(fs);
 
   res = spiffs_obj_lu_scan(fs);
+  fs->erase_scan = 1;
 
   SPIFFS_UNLOCK(fs);
   return res;
 }
 
+s32_t SPIFFS_check_start(spiffs *fs, spiffs_check_state *st, u8_t *work,
+    spiffs_check_callback cb) {
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+  spiffs_check_start(fs, st, work, cb);
+  SPIFFS_UNLOCK(fs);
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_check_step(spiffs *fs, spiffs_check_state *st) {
+  s32_t res;
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+  res = spiffs_check_step(fs, st);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_UNLOCK(fs);
+  return res;
+}
+
 s32_t SPIFFS_info(spiffs *fs, u32_t *total, u32_t *used) {
   s32_t res = SPIFFS_OK;
   SPIFFS_API_CHECK_MOUNT(fs);
@@ -787,6 +1178,35 @@ s32_t SPIFFS_info(spiffs *fs, u32_t *total, u32_t *used) {
   return res;
 }
 
+s32_t SPIFFS_fsinfo(spiffs *fs, spiffs_fsinfo *info) {
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  u32_t pages_per_block = SPIFFS_PAGES_PER_BLOCK(fs);
+  u32_t data_page_size = SPIFFS_DATA_PAGE_SIZE(fs);
+  u32_t total_data_pages = (fs->block_count - 2) * (pages_per_block - SPIFFS_OBJ_LOOKUP_PAGES(fs)) + 1;
+
+  info->total = total_data_pages * data_page_size;
+  info->used = fs->stats_p_allocated * data_page_size;
+  info->deleted = fs->stats_p_deleted * data_page_size;
+  info->free_blocks = fs->free_blocks;
+
+  SPIFFS_UNLOCK(fs);
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_gc_step(spiffs *fs, u32_t keep_free_blocks) {
+  s32_t res;
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  res = spiffs_gc_step(fs, keep_free_blocks);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  SPIFFS_UNLOCK(fs);
+  return res;
+}
+
 s32_t SPIFFS_eof(spiffs *fs, spiffs_file fh) {
   SPIFFS_API_CHECK_MOUNT(fs);
   SPIFFS_LOCK(fs);
@@ -910,7 +1330,7 @@ s32_t SPIFFS_vis(spiffs *fs) {
   spiffs_printf("free_blocks: %i\n", fs->free_blocks);
   spiffs_printf("page_alloc:  %i\n", fs->stats_p_allocated);
   spiffs_printf("page_delet:  %i\n", fs->stats_p_deleted);
-  u32_t total, used;
+  u32_t total = 0, used = 0;
   SPIFFS_info(fs, &total, &used);
   spiffs_printf("used:        %i of %i\n", used, total);
 
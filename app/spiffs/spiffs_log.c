@@ -0,0 +1,354 @@
+/*
+ * spiffs_log.c
+ *
+ * Bounded append only record log on top of spiffs.
+ *
+ * A log is kept in a number of segment files named <name>.<seq>, seq being
+ * a hexadecimal, ever increasing sequence number. Records are appended to
+ * the newest segment. When it is full a new segment is started and the
+ * oldest one is removed as a whole, so old records are dropped without ever
+ * rewriting live data and the deleted pages form whole blocks that the gc
+ * can erase without moving anything.
+ *
+ * Records are buffered in ram and written so that each write ends on a data
+ * page boundary of the segment file. This way the object index is updated
+ * once per buffer instead of once per record.
+ *
+ * Each record is stored as a two byte little endian length followed by the
+ * record data.
+ */
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+
+#define SPIFFS_LOG_REC_HDR_LEN    2
+
+static void spiffs_log_seg_name(spiffs_log *log, u32_t seq, char *name) {
+  int len = c_strlen(log->name);
+  int i;
+  c_memcpy(name, log->name, len);
+  name[len++] = '.';
+  // hex digits, most significant first, no leading zeroes
+  for (i = 28; i > 0 && ((seq >> i) & 0xf) == 0; i -= 4);
+  for (; i >= 0; i -= 4) {
+    u8_t d = (seq >> i) & 0xf;
+    name[len++] = d < 10 ? '0' + d : 'a' + d - 10;
+  }
+  name[len] = 0;
+}
+
+// Returns 1 and the sequence number if given file name is a segment of log
+static int spiffs_log_seg_parse(spiffs_log *log, char *name, u32_t *seq) {
+  int len = c_strlen(log->name);
+  int digits = 0;
+  u32_t s = 0;
+  if (c_strncmp(name, log->name, len) != 0 || name[len] != '.') {
+    return 0;
+  }
+  name += len + 1;
+  while (*name) {
+    char c = *name++;
+    if (c >= '0' && c <= '9') {
+      s = (s << 4) | (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      s = (s << 4) | (c - 'a' + 10);
+    } else {
+      return 0;
+    }
+    digits++;
+  }
+  if (digits == 0 || digits > 8) {
+    return 0;
+  }
+  *seq = s;
+  return 1;
+}
+
+static s32_t spiffs_log_seg_open(spiffs_log *log, u32_t seq, spiffs_flags flags) {
+  char name[SPIFFS_OBJ_NAME_LEN];
+  spiffs_log_seg_name(log, seq, name);
+  return SPIFFS_open(log->fs, name, flags, 0);
+}
+
+static s32_t spiffs_log_seg_remove(spiffs_log *log, u32_t seq) {
+  char name[SPIFFS_OBJ_NAME_LEN];
+  spiffs_log_seg_name(log, seq, name);
+  s32_t res = SPIFFS_remove(log->fs, name);
+  if (res < 0 && SPIFFS_errno(log->fs) == SPIFFS_ERR_NOT_FOUND) {
+    SPIFFS_clearerr(log->fs);
+    res = SPIFFS_OK;
+  }
+  return res;
+}
+
+// Drops oldest segments until at most seg_count segments remain
+static s32_t spiffs_log_trim(spiffs_log *log) {
+  s32_t res;
+  while (log->last_seq - log->first_seq + 1 > log->seg_count) {
+    res = spiffs_log_seg_remove(log, log->first_seq);
+    if (res < 0) return res;
+    log->first_seq++;
+  }
+  return SPIFFS_OK;
+}
+
+// Starts a new segment, dropping the oldest one if the log is full
+static s32_t spiffs_log_rotate(spiffs_log *log) {
+  s32_t res;
+  res = SPIFFS_log_flush(log);
+  if (res < 0) return res;
+  SPIFFS_close(log->fs, log->fd);
+  log->fd = -1;
+  log->last_seq++;
+  // make room before the new segment needs it
+  res = spiffs_log_trim(log);
+  if (res < 0) return res;
+  res = spiffs_log_seg_open(log, log->last_seq,
+      SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_APPEND | SPIFFS_RDWR);
+  if (res < 0) return res;
+  log->fd = res;
+  log->seg_offs = 0;
+  return SPIFFS_OK;
+}
+
+// Copies data to the append buffer, writing the buffer out each time it
+// reaches a data page boundary of the segment file
+static s32_t spiffs_log_put(spiffs_log *log, u8_t *data, u32_t len) {
+  s32_t res;
+  u32_t dps = SPIFFS_DATA_PAGE_SIZE(log->fs);
+  while (len > 0) {
+    u32_t fill = log->buf_size - (log->seg_offs % dps);
+    u32_t n = MIN(len, fill - log->buf_len);
+    c_memcpy(&log->buf[log->buf_len], data, n);
+    log->buf_len += n;
+    data += n;
+    len -= n;
+    if (log->buf_len == fill) {
+      res = SPIFFS_write(log->fs, log->fd, log->buf, log->buf_len);
+      if (res < 0) return res;
+      log->seg_offs += log->buf_len;
+      log->buf_len = 0;
+    }
+  }
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_log_open(spiffs *fs, spiffs_log *log, char *name,
+    u32_t max_size, u32_t seg_count, u8_t *buf, u32_t buf_size) {
+  SPIFFS_API_CHECK_MOUNT(fs);
+  s32_t res = SPIFFS_OK;
+  u32_t dps = SPIFFS_DATA_PAGE_SIZE(fs);
+  int found = 0;
+
+  c_memset(log, 0, sizeof(spiffs_log));
+  log->fs = fs;
+  log->fd = -1;
+  // room for '.' and eight hex digits
+  if (c_strlen(name) > SPIFFS_OBJ_NAME_LEN - 10 || seg_count < 2 ||
+      max_size / seg_count < SPIFFS_LOG_REC_HDR_LEN + 1 || buf_size < dps) {
+    res = SPIFFS_ERR_LOG_CONFIG;
+  }
+  SPIFFS_API_CHECK_RES(fs, res);
+  c_strcpy(log->name, name);
+  log->seg_count = seg_count;
+  log->seg_size = max_size / seg_count;
+  log->buf = buf;
+  log->buf_size = buf_size - (buf_size % dps);
+
+  // find existing segments, only names starting with the log name
+  struct spiffs_dirent e[4];
+  u32_t cursor = 0;
+  u32_t seq;
+  while (cursor != SPIFFS_LIST_END) {
+    s32_t i, n = SPIFFS_list(fs, &cursor, log->name, e, sizeof(e) / sizeof(e[0]));
+    if (n < 0) return n;
+    for (i = 0; i < n; i++) {
+      if (!spiffs_log_seg_parse(log, (char *)e[i].name, &seq)) continue;
+      if (!found || seq < log->first_seq) log->first_seq = seq;
+      if (!found || seq > log->last_seq) log->last_seq = seq;
+      found = 1;
+    }
+  }
+
+  res = spiffs_log_trim(log);
+  if (res < 0) return res;
+
+  res = spiffs_log_seg_open(log, log->last_seq, SPIFFS_CREAT | SPIFFS_APPEND | SPIFFS_RDWR);
+  if (res < 0) return res;
+  log->fd = res;
+  // fstat reports a fresh segment as empty, SPIFFS_size would not
+  spiffs_stat s;
+  res = SPIFFS_fstat(fs, log->fd, &s);
+  if (res < 0) {
+    SPIFFS_close(fs, log->fd);
+    log->fd = -1;
+    return res;
+  }
+  log->seg_offs = s.size;
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_log_append(spiffs_log *log, void *rec, u16_t len) {
+  s32_t res = SPIFFS_OK;
+  u8_t hdr[SPIFFS_LOG_REC_HDR_LEN];
+  u32_t need = SPIFFS_LOG_REC_HDR_LEN + len;
+  if (log->fd < 0) {
+    res = SPIFFS_ERR_FILE_CLOSED;
+  } else if (need > log->seg_size) {
+    res = SPIFFS_ERR_LOG_CONFIG;
+  }
+  SPIFFS_API_CHECK_RES(log->fs, res);
+
+  if (log->seg_offs + log->buf_len + need > log->seg_size) {
+    res = spiffs_log_rotate(log);
+    if (res < 0) return res;
+  }
+  hdr[0] = len & 0xff;
+  hdr[1] = len >> 8;
+  res = spiffs_log_put(log, hdr, SPIFFS_LOG_REC_HDR_LEN);
+  if (res < 0) return res;
+  return spiffs_log_put(log, (u8_t *)rec, len);
+}
+
+s32_t SPIFFS_log_flush(spiffs_log *log) {
+  s32_t res;
+  if (log->fd < 0) {
+    SPIFFS_API_CHECK_RES(log->fs, SPIFFS_ERR_FILE_CLOSED);
+  }
+  if (log->buf_len > 0) {
+    res = SPIFFS_write(log->fs, log->fd, log->buf, log->buf_len);
+    if (res < 0) return res;
+    log->seg_offs += log->buf_len;
+    log->buf_len = 0;
+  }
+  // small writes may sit in the spiffs write cache
+  return SPIFFS_fflush(log->fs, log->fd);
+}
+
+s32_t SPIFFS_log_close(spiffs_log *log) {
+  s32_t res = SPIFFS_OK;
+  if (log->fd >= 0) {
+    res = SPIFFS_log_flush(log);
+    SPIFFS_close(log->fs, log->fd);
+    log->fd = -1;
+  }
+  return res;
+}
+
+// Counts the records in a segment by hopping from header to header
+static s32_t spiffs_log_seg_count(spiffs_log *log, u32_t seq, u32_t *count) {
+  spiffs *fs = log->fs;
+  u8_t hdr[SPIFFS_LOG_REC_HDR_LEN];
+  s32_t res;
+  spiffs_file fd = spiffs_log_seg_open(log, seq, SPIFFS_RDONLY);
+  *count = 0;
+  if (fd < 0) {
+    if (SPIFFS_errno(fs) != SPIFFS_ERR_NOT_FOUND) return fd;
+    SPIFFS_clearerr(fs);
+    return SPIFFS_OK;
+  }
+  while ((res = SPIFFS_read(fs, fd, hdr, SPIFFS_LOG_REC_HDR_LEN)) == SPIFFS_LOG_REC_HDR_LEN) {
+    if (SPIFFS_lseek(fs, fd, hdr[0] | (hdr[1] << 8), SPIFFS_SEEK_CUR) < 0) break;
+    (*count)++;
+  }
+  SPIFFS_close(fs, fd);
+  SPIFFS_clearerr(fs);
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_log_iter_start(spiffs_log *log, spiffs_log_iter *it, u32_t tail) {
+  s32_t res;
+  u32_t skip = 0;
+  u8_t hdr[SPIFFS_LOG_REC_HDR_LEN];
+
+  it->log = log;
+  it->fd = -1;
+  // records still in ram must be visible to the iterator
+  res = SPIFFS_log_flush(log);
+  if (res < 0) return res;
+
+  it->seq = log->first_seq;
+  if (tail > 0) {
+    // walk back from the newest segment until enough records are found
+    u32_t total = 0;
+    u32_t count;
+    u32_t seq = log->last_seq;
+    while (1) {
+      res = spiffs_log_seg_count(log, seq, &count);
+      if (res < 0) return res;
+      if (total + count >= tail) {
+        skip = total + count - tail;
+        break;
+      }
+      total += count;
+      if (seq == log->first_seq) break;
+      seq--;
+    }
+    it->seq = seq;
+  }
+
+  res = spiffs_log_seg_open(log, it->seq, SPIFFS_RDONLY);
+  if (res < 0) {
+    if (SPIFFS_errno(log->fs) != SPIFFS_ERR_NOT_FOUND) return res;
+    SPIFFS_clearerr(log->fs);
+    return SPIFFS_OK;
+  }
+  it->fd = res;
+  while (skip--) {
+    res = SPIFFS_read(log->fs, it->fd, hdr, SPIFFS_LOG_REC_HDR_LEN);
+    if (res < 0) return res;
+    res = SPIFFS_lseek(log->fs, it->fd, hdr[0] | (hdr[1] << 8), SPIFFS_SEEK_CUR);
+    if (res < 0) return res;
+  }
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_log_iter_next(spiffs_log_iter *it, void *buf, u16_t max_len) {
+  spiffs_log *log = it->log;
+  spiffs *fs = log->fs;
+  u8_t hdr[SPIFFS_LOG_REC_HDR_LEN];
+  s32_t res;
+  u16_t len;
+
+  while (1) {
+    if (it->fd >= 0) {
+      res = SPIFFS_read(fs, it->fd, hdr, SPIFFS_LOG_REC_HDR_LEN);
+      if (res == SPIFFS_LOG_REC_HDR_LEN) break;
+      if (res < 0 && SPIFFS_errno(fs) != SPIFFS_ERR_END_OF_OBJECT) return res;
+      // end of this segment
+      SPIFFS_clearerr(fs);
+      SPIFFS_close(fs, it->fd);
+      it->fd = -1;
+    }
+    if (it->seq == log->last_seq) {
+      SPIFFS_API_CHECK_RES(fs, SPIFFS_ERR_END_OF_OBJECT);
+    }
+    it->seq++;
+    res = spiffs_log_seg_open(log, it->seq, SPIFFS_RDONLY);
+    if (res < 0) {
+      if (SPIFFS_errno(fs) != SPIFFS_ERR_NOT_FOUND) return res;
+      SPIFFS_clearerr(fs);
+    } else {
+      it->fd = res;
+    }
+  }
+
+  len = hdr[0] | (hdr[1] << 8);
+  if (len > 0 && max_len > 0) {
+    res = SPIFFS_read(fs, it->fd, buf, MIN(len, max_len));
+    if (res < 0) return res;
+  }
+  if (len > max_len) {
+    // record does not fit, skip the rest of it
+    res = SPIFFS_lseek(fs, it->fd, len - max_len, SPIFFS_SEEK_CUR);
+    if (res < 0) return res;
+  }
+  return len;
+}
+
+void SPIFFS_log_iter_end(spiffs_log_iter *it) {
+  if (it->fd >= 0) {
+    SPIFFS_close(it->log->fs, it->fd);
+    it->fd = -1;
+  }
+}
@@ -0,0 +1,348 @@
+/*
+ * spiffs_lz.c
+ *
+ * Compressed files on top of spiffs.
+ *
+ * A compressed file starts with a header of four magic bytes and the four
+ * byte little endian length of the uncompressed data, followed by an LZSS
+ * stream: groups of a flag byte and up to eight items, one per flag bit,
+ * least significant bit first. A set bit is a literal byte, a cleared bit a
+ * two byte match of 3 to 66 bytes at a distance of 1 to 1024 bytes back:
+ *
+ *   byte 0: (distance - 1) & 0xff
+ *   byte 1: ((distance - 1) >> 8) << 6 | (length - 3)
+ *
+ * Decoding needs the last SPIFFS_LZ_WINDOW bytes of output and nothing
+ * else, so a reader fits in about a kilobyte of ram. Reads are streamed,
+ * the compressed data is read in SPIFFS_LZ_IO_SIZE chunks. Seeking back
+ * within the window is served from it, further back decoding restarts at
+ * the beginning of the file.
+ *
+ * The writer is greedy with a single hash table slot per three byte prefix,
+ * which is fast and small and does well enough on text.
+ */
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+
+#define SPIFFS_LZ_HDR_LEN     8
+#define SPIFFS_LZ_MIN_MATCH   3
+#define SPIFFS_LZ_MAX_MATCH   (SPIFFS_LZ_MIN_MATCH + 63)
+#define SPIFFS_LZ_WIN_MASK    (SPIFFS_LZ_WINDOW - 1)
+// flag byte and eight matches
+#define SPIFFS_LZ_GROUP_MAX   17
+
+static const u8_t spiffs_lz_magic[4] = { 0x1f, 'L', 'Z', 0x01 };
+
+static u16_t *spiffs_lz_head(spiffs_lz *lz) {
+  return (u16_t *)(lz->work + 2 * SPIFFS_LZ_WINDOW);
+}
+
+static u32_t spiffs_lz_hash(const u8_t *p) {
+  u32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return (u32_t)(v * 2654435761U) >> (32 - SPIFFS_LZ_HASH_BITS);
+}
+
+s32_t SPIFFS_lz_probe(spiffs *fs, spiffs_file fh) {
+  u8_t hdr[SPIFFS_LZ_HDR_LEN];
+  s32_t res = SPIFFS_read(fs, fh, hdr, SPIFFS_LZ_HDR_LEN);
+  if (res < 0) {
+    if (SPIFFS_errno(fs) != SPIFFS_ERR_END_OF_OBJECT) return res;
+    SPIFFS_clearerr(fs);
+    res = 0;
+  }
+  s32_t seek_res = SPIFFS_lseek(fs, fh, 0, SPIFFS_SEEK_SET);
+  if (seek_res < 0) return seek_res;
+  return res == SPIFFS_LZ_HDR_LEN && c_memcmp(hdr, spiffs_lz_magic, 4) == 0;
+}
+
+//
+// reading
+//
+
+static s32_t spiffs_lz_restart(spiffs_lz *lz) {
+  s32_t res = SPIFFS_lseek(lz->fs, lz->fh, SPIFFS_LZ_HDR_LEN, SPIFFS_SEEK_SET);
+  if (res < 0) return res;
+  lz->out = 0;
+  lz->flags = 0;
+  lz->flag_bits = 0;
+  lz->match_left = 0;
+  lz->io_len = 0;
+  lz->io_pos = 0;
+  return SPIFFS_OK;
+}
+
+static s32_t spiffs_lz_getc(spiffs_lz *lz) {
+  if (lz->io_pos == lz->io_len) {
+    s32_t res = SPIFFS_read(lz->fs, lz->fh, lz->io, SPIFFS_LZ_IO_SIZE);
+    if (res <= 0) {
+      // the header promised more data
+      SPIFFS_clearerr(lz->fs);
+      lz->fs->err_code = SPIFFS_ERR_LZ_FORMAT;
+      return -1;
+    }
+    lz->io_len = res;
+    lz->io_pos = 0;
+  }
+  return lz->io[lz->io_pos++];
+}
+
+// Decodes len bytes to dst, or skips them if dst is 0
+static s32_t spiffs_lz_decode(spiffs_lz *lz, u8_t *dst, u32_t len) {
+  u8_t *win = lz->work;
+  u32_t done = 0;
+  s32_t c;
+  while (done < len) {
+    if (lz->match_left == 0) {
+      if (lz->flag_bits == 0) {
+        if ((c = spiffs_lz_getc(lz)) < 0) return -1;
+        lz->flags = c;
+        lz->flag_bits = 8;
+      }
+      lz->flag_bits--;
+      if (lz->flags & 1) {
+        lz->flags >>= 1;
+        if ((c = spiffs_lz_getc(lz)) < 0) return -1;
+        win[lz->out & SPIFFS_LZ_WIN_MASK] = c;
+        lz->out++;
+        if (dst) *dst++ = c;
+        done++;
+        continue;
+      }
+      lz->flags >>= 1;
+      s32_t b0, b1;
+      if ((b0 = spiffs_lz_getc(lz)) < 0 || (b1 = spiffs_lz_getc(lz)) < 0) return -1;
+      lz->match_dist = (((b1 >> 6) << 8) | b0) + 1;
+      lz->match_left = (b1 & 0x3f) + SPIFFS_LZ_MIN_MATCH;
+      if (lz->match_dist > lz->out) {
+        lz->fs->err_code = SPIFFS_ERR_LZ_FORMAT;
+        return -1;
+      }
+    }
+    while (lz->match_left > 0 && done < len) {
+      c = win[(lz->out - lz->match_dist) & SPIFFS_LZ_WIN_MASK];
+      win[lz->out & SPIFFS_LZ_WIN_MASK] = c;
+      lz->out++;
+      if (dst) *dst++ = c;
+      done++;
+      lz->match_left--;
+    }
+  }
+  return done;
+}
+
+s32_t SPIFFS_lz_read_start(spiffs *fs, spiffs_lz *lz, spiffs_file fh, u8_t *work) {
+  SPIFFS_API_CHECK_MOUNT(fs);
+  u8_t hdr[SPIFFS_LZ_HDR_LEN];
+  s32_t res;
+  c_memset(lz, 0, sizeof(spiffs_lz));
+  lz->fs = fs;
+  lz->fh = fh;
+  lz->work = work;
+  res = SPIFFS_lseek(fs, fh, 0, SPIFFS_SEEK_SET);
+  if (res < 0) return res;
+  res = SPIFFS_read(fs, fh, hdr, SPIFFS_LZ_HDR_LEN);
+  if (res < 0) return res;
+  if (res != SPIFFS_LZ_HDR_LEN || c_memcmp(hdr, spiffs_lz_magic, 4) != 0) {
+    res = SPIFFS_ERR_LZ_FORMAT;
+  }
+  SPIFFS_API_CHECK_RES(fs, res);
+  lz->size = hdr[4] | (hdr[5] << 8) | (hdr[6] << 16) | ((u32_t)hdr[7] << 24);
+  // io buffer is empty, the file position is right after the header
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_lz_read(spiffs_lz *lz, void *buf, u32_t len) {
+  u8_t *dst = (u8_t *)buf;
+  u32_t done = 0;
+  s32_t res;
+  if (lz->writing) {
+    SPIFFS_API_CHECK_RES(lz->fs, SPIFFS_ERR_NOT_READABLE);
+  }
+  if (lz->pos >= lz->size) {
+    SPIFFS_API_CHECK_RES(lz->fs, SPIFFS_ERR_END_OF_OBJECT);
+  }
+  if (len > lz->size - lz->pos) {
+    len = lz->size - lz->pos;
+  }
+  if (lz->pos + SPIFFS_LZ_WINDOW < lz->out) {
+    // no longer in the window
+    res = spiffs_lz_restart(lz);
+    if (res < 0) return res;
+  }
+  while (done < len && lz->pos < lz->out) {
+    dst[done++] = lz->work[lz->pos++ & SPIFFS_LZ_WIN_MASK];
+  }
+  if (lz->pos > lz->out) {
+    res = spiffs_lz_decode(lz, 0, lz->pos - lz->out);
+    if (res < 0) return res;
+  }
+  if (done < len) {
+    res = spiffs_lz_decode(lz, &dst[done], len - done);
+    if (res < 0) return res;
+    lz->pos += res;
+    done += res;
+  }
+  return done;
+}
+
+s32_t SPIFFS_lz_lseek(spiffs_lz *lz, s32_t offs, int whence) {
+  switch (whence) {
+  case SPIFFS_SEEK_CUR:
+    offs = lz->pos + offs;
+    break;
+  case SPIFFS_SEEK_END:
+    offs = lz->size + offs;
+    break;
+  }
+  if (lz->writing ? offs != (s32_t)lz->pos : (offs < 0 || offs > (s32_t)lz->size)) {
+    SPIFFS_API_CHECK_RES(lz->fs, SPIFFS_ERR_END_OF_OBJECT);
+  }
+  // decoded lazily by the next read
+  lz->pos = offs;
+  return 0;
+}
+
+//
+// writing
+//
+
+static s32_t spiffs_lz_flush_io(spiffs_lz *lz) {
+  if (lz->io_len > 0) {
+    s32_t res = SPIFFS_write(lz->fs, lz->fh, lz->io, lz->io_len);
+    if (res < 0) return res;
+    lz->io_len = 0;
+  }
+  return SPIFFS_OK;
+}
+
+// Starts the next item, returns the flag bit of the item
+static s32_t spiffs_lz_item(spiffs_lz *lz) {
+  if (lz->flag_bits == 8) {
+    // groups are never split over flushes, the flag byte is patched in place
+    if (lz->io_len + SPIFFS_LZ_GROUP_MAX > SPIFFS_LZ_IO_SIZE) {
+      s32_t res = spiffs_lz_flush_io(lz);
+      if (res < 0) return res;
+    }
+    lz->group = lz->io_len;
+    lz->io[lz->io_len++] = 0;
+    lz->flag_bits = 0;
+  }
+  return 1 << lz->flag_bits++;
+}
+
+static s32_t spiffs_lz_compress(spiffs_lz *lz, u8_t final) {
+  u8_t *buf = lz->work;
+  u16_t *head = spiffs_lz_head(lz);
+  u32_t p = lz->in_pos;
+  u32_t end = lz->in_len;
+  s32_t res;
+  // unless final, keep enough data ahead for the longest match and for
+  // hashing its last position, so the output does not depend on how the
+  // data was split into writes
+  while (p < end && (final || end - p >= SPIFFS_LZ_MAX_MATCH + SPIFFS_LZ_MIN_MATCH)) {
+    u32_t best_len = 0;
+    u32_t dist = 0;
+    u32_t max = end - p;
+    if (max > SPIFFS_LZ_MAX_MATCH) max = SPIFFS_LZ_MAX_MATCH;
+    if (max >= SPIFFS_LZ_MIN_MATCH) {
+      u32_t h = spiffs_lz_hash(&buf[p]);
+      u32_t cand = head[h];
+      head[h] = p + 1;
+      if (cand > 0 && p - (cand - 1) <= SPIFFS_LZ_WINDOW) {
+        cand--;
+        while (best_len < max && buf[cand + best_len] == buf[p + best_len]) best_len++;
+        dist = p - cand;
+      }
+    }
+    if ((res = spiffs_lz_item(lz)) < 0) return res;
+    if (best_len >= SPIFFS_LZ_MIN_MATCH) {
+      lz->io[lz->io_len++] = (dist - 1) & 0xff;
+      lz->io[lz->io_len++] = (((dist - 1) >> 8) << 6) | (best_len - SPIFFS_LZ_MIN_MATCH);
+      // the rest of the match is only indexed, not searched
+      u32_t q;
+      for (q = p + 1; q < p + best_len && end - q >= SPIFFS_LZ_MIN_MATCH; q++) {
+        head[spiffs_lz_hash(&buf[q])] = q + 1;
+      }
+      p += best_len;
+    } else {
+      lz->io[lz->group] |= res;
+      lz->io[lz->io_len++] = buf[p++];
+    }
+  }
+  lz->in_pos = p;
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_lz_write_start(spiffs *fs, spiffs_lz *lz, spiffs_file fh, u8_t *work) {
+  SPIFFS_API_CHECK_MOUNT(fs);
+  u8_t hdr[SPIFFS_LZ_HDR_LEN];
+  s32_t res;
+  c_memset(lz, 0, sizeof(spiffs_lz));
+  lz->fs = fs;
+  lz->fh = fh;
+  lz->work = work;
+  lz->writing = 1;
+  lz->flag_bits = 8;
+  c_memset(spiffs_lz_head(lz), 0, sizeof(u16_t) << SPIFFS_LZ_HASH_BITS);
+  // length is filled in by SPIFFS_lz_close
+  c_memcpy(hdr, spiffs_lz_magic, 4);
+  c_memset(&hdr[4], 0xff, 4);
+  res = SPIFFS_write(fs, fh, hdr, SPIFFS_LZ_HDR_LEN);
+  if (res < 0) return res;
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_lz_write(spiffs_lz *lz, const void *buf, u32_t len) {
+  const u8_t *src = (const u8_t *)buf;
+  u32_t done = 0;
+  s32_t res;
+  if (!lz->writing) {
+    SPIFFS_API_CHECK_RES(lz->fs, SPIFFS_ERR_NOT_WRITABLE);
+  }
+  while (done < len) {
+    if (lz->in_len == 2 * SPIFFS_LZ_WINDOW) {
+      // keep the last window as history
+      u16_t *head = spiffs_lz_head(lz);
+      u32_t i;
+      c_memcpy(lz->work, lz->work + SPIFFS_LZ_WINDOW, SPIFFS_LZ_WINDOW);
+      lz->in_len -= SPIFFS_LZ_WINDOW;
+      lz->in_pos -= SPIFFS_LZ_WINDOW;
+      for (i = 0; i < (1 << SPIFFS_LZ_HASH_BITS); i++) {
+        head[i] = head[i] > SPIFFS_LZ_WINDOW ? head[i] - SPIFFS_LZ_WINDOW : 0;
+      }
+    }
+    u32_t n = 2 * SPIFFS_LZ_WINDOW - lz->in_len;
+    if (n > len - done) n = len - done;
+    c_memcpy(&lz->work[lz->in_len], &src[done], n);
+    lz->in_len += n;
+    done += n;
+    res = spiffs_lz_compress(lz, 0);
+    if (res < 0) return res;
+  }
+  lz->pos += len;
+  lz->size = lz->pos;
+  return len;
+}
+
+s32_t SPIFFS_lz_close(spiffs_lz *lz) {
+  u8_t len[4];
+  s32_t res;
+  if (!lz->writing) {
+    return SPIFFS_OK;
+  }
+  lz->writing = 0;
+  res = spiffs_lz_compress(lz, 1);
+  if (res < 0) return res;
+  res = spiffs_lz_flush_io(lz);
+  if (res < 0) return res;
+  len[0] = lz->size & 0xff;
+  len[1] = (lz->size >> 8) & 0xff;
+  len[2] = (lz->size >> 16) & 0xff;
+  len[3] = (lz->size >> 24) & 0xff;
+  res = SPIFFS_lseek(lz->fs, lz->fh, 4, SPIFFS_SEEK_SET);
+  if (res < 0) return res;
+  res = SPIFFS_write(lz->fs, lz->fh, len, 4);
+  if (res < 0) return res;
+  return SPIFFS_OK;
+}
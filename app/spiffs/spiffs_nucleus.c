@@ -591,6 +591,7 @@ s32_t spiffs_page_delete(
 
   fs->stats_p_deleted++;
   fs->stats_p_allocated--;
+  fs->erase_scan = 1;
 
   // mark deleted in source page
   res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_DELE,
@@ -608,6 +609,7 @@ s32_t spiffs_object_create(
     spiffs_obj_id obj_id,
     u8_t name[SPIFFS_OBJ_NAME_LEN],
     spiffs_obj_type type,
+    u8_t replacement,
     spiffs_page_ix *objix_hdr_pix) {
   s32_t res = SPIFFS_OK;
   spiffs_block_ix bix;
@@ -635,6 +637,10 @@ s32_t spiffs_object_create(
   oix_hdr.p_hdr.obj_id = obj_id;
   oix_hdr.p_hdr.span_ix = 0;
   oix_hdr.p_hdr.flags = 0xff & ~(SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_USED);
+  if (replacement) {
+    // hidden from lookups by name until committed
+    oix_hdr.p_hdr.flags &= ~SPIFFS_PH_FLAG_REPL;
+  }
   oix_hdr.type = type;
   oix_hdr.size = SPIFFS_UNDEFINED_LEN; // keep ones so we can update later without wasting this page
   strncpy((char *)&oix_hdr.name, (char *)name, SPIFFS_OBJ_NAME_LEN);
@@ -796,6 +802,7 @@ s32_t spiffs_object_open_by_page(
   fd->cursor_objix_spix = 0;
   fd->obj_id = obj_id;
   fd->flags = flags;
+  fd->replace_obj_id = SPIFFS_OBJ_ID_FREE;
 
   SPIFFS_VALIDATE_OBJIX(oix_hdr.p_hdr, fd->obj_id, 0);
 
@@ -1246,6 +1253,18 @@ s32_t spiffs_object_modify(spiffs_fd *fd, u32_t offset, u8_t *data, u32_t len) {
   return res;
 }
 
+typedef struct {
+  u8_t *name;
+  // look at all headers for an unfinished replacement
+  u8_t find_stale;
+  // the header found, when looking at all
+  spiffs_page_ix pix;
+  // written replacement not committed yet, taken when the name is not found
+  spiffs_page_ix ready_pix;
+  // replacement left unfinished
+  spiffs_page_ix stale_pix;
+} spiffs_find_by_name_state;
+
 static s32_t spiffs_object_find_object_index_header_by_name_v(
     spiffs *fs,
     spiffs_obj_id obj_id,
@@ -1255,6 +1274,7 @@ static s32_t spiffs_object_find_object_index_header_by_name_v(
     void *user_p) {
   (void)user_data;
   s32_t res;
+  spiffs_find_by_name_state *state = (spiffs_find_by_name_state *)user_p;
   spiffs_page_object_ix_header objix_hdr;
   spiffs_page_ix pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, ix_entry);
   if (obj_id == SPIFFS_OBJ_ID_FREE || obj_id == SPIFFS_OBJ_ID_DELETED ||
@@ -1267,22 +1287,43 @@ static s32_t spiffs_object_find_object_index_header_by_name_v(
   if (objix_hdr.p_hdr.span_ix == 0 &&
       (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) ==
           (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE)) {
-    if (strcmp((char *)user_p, (char *)objix_hdr.name) == 0) {
-      return SPIFFS_OK;
+    if (strcmp((char *)state->name, (char *)objix_hdr.name) == 0) {
+      if (!SPIFFS_PH_HIDDEN(objix_hdr.p_hdr.flags)) {
+        if (!state->find_stale) {
+          return SPIFFS_OK;
+        }
+        state->pix = pix;
+      } else if ((objix_hdr.p_hdr.flags & SPIFFS_PH_FLAG_READY) == 0) {
+        state->ready_pix = pix;
+      } else {
+        state->stale_pix = pix;
+      }
     }
   }
 
   return SPIFFS_VIS_COUNTINUE;
 }
 
-// Finds object index header page by name
-s32_t spiffs_object_find_object_index_header_by_name(
+// Finds object index header page by name, and an unfinished replacement of
+// that name if stale_pix is given, which takes a look at all headers. A
+// written replacement whose commit was cut short is committed here when the
+// replaced file is already gone. While the replaced file is still there it
+// keeps the name, and the replacement is handed out as stale_pix to be
+// removed, written or not.
+s32_t spiffs_object_find_replaced(
     spiffs *fs,
     u8_t name[SPIFFS_OBJ_NAME_LEN],
-    spiffs_page_ix *pix) {
+    spiffs_page_ix *pix,
+    spiffs_page_ix *stale_pix) {
   s32_t res;
   spiffs_block_ix bix;
   int entry;
+  spiffs_find_by_name_state state;
+  state.name = name;
+  state.find_stale = stale_pix != 0;
+  state.pix = 0;
+  state.ready_pix = 0;
+  state.stale_pix = 0;
 
   res = spiffs_obj_lu_find_entry_visitor(fs,
       fs->cursor_block_ix,
@@ -1291,9 +1332,30 @@ s32_t spiffs_object_find_object_index_header_by_name(
       0,
       spiffs_object_find_object_index_header_by_name_v,
       0,
-      name,
+      &state,
       &bix,
       &entry);
+  if (stale_pix) {
+    // a written replacement next to the file it replaces did not get to
+    // remove it, it is thrown away as well and the old file stays
+    *stale_pix = state.stale_pix ? state.stale_pix : (state.pix ? state.ready_pix : 0);
+  }
+
+  if (res == SPIFFS_VIS_END && state.pix) {
+    if (pix) {
+      *pix = state.pix;
+    }
+    return SPIFFS_OK;
+  }
+
+  if (res == SPIFFS_VIS_END && state.ready_pix) {
+    res = spiffs_object_commit_replacement(fs, state.ready_pix);
+    SPIFFS_CHECK_RES(res);
+    if (pix) {
+      *pix = state.ready_pix;
+    }
+    return SPIFFS_OK;
+  }
 
   if (res == SPIFFS_VIS_END) {
     res = SPIFFS_ERR_NOT_FOUND;
@@ -1310,6 +1372,42 @@ s32_t spiffs_object_find_object_index_header_by_name(
   return res;
 }
 
+// Finds object index header page by name
+s32_t spiffs_object_find_object_index_header_by_name(
+    spiffs *fs,
+    u8_t name[SPIFFS_OBJ_NAME_LEN],
+    spiffs_page_ix *pix) {
+  return spiffs_object_find_replaced(fs, name, pix, 0);
+}
+
+// Clears given flag in the header of an object index header page, in place
+static s32_t spiffs_object_clear_hdr_flag(spiffs *fs, spiffs_page_ix objix_hdr_pix, u8_t flag) {
+  s32_t res;
+  u8_t flags;
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_READ,
+      0, SPIFFS_PAGE_TO_PADDR(fs, objix_hdr_pix) + offsetof(spiffs_page_header, flags),
+      sizeof(u8_t), &flags);
+  SPIFFS_CHECK_RES(res);
+  flags &= ~flag;
+  res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_UPDT,
+      0, SPIFFS_PAGE_TO_PADDR(fs, objix_hdr_pix) + offsetof(spiffs_page_header, flags),
+      sizeof(u8_t), &flags);
+  return res;
+}
+
+// Marks a replacement as completely written. If cut short before the commit
+// it takes over the name once the replaced file is removed; if it is cut
+// short before that, the replaced file stays and the replacement is removed
+// by the next one opened for that name.
+s32_t spiffs_object_ready_replacement(spiffs *fs, spiffs_page_ix objix_hdr_pix) {
+  return spiffs_object_clear_hdr_flag(fs, objix_hdr_pix, SPIFFS_PH_FLAG_READY);
+}
+
+// Makes a replacement an ordinary file, found by name
+s32_t spiffs_object_commit_replacement(spiffs *fs, spiffs_page_ix objix_hdr_pix) {
+  return spiffs_object_clear_hdr_flag(fs, objix_hdr_pix, SPIFFS_PH_FLAG_COMMIT);
+}
+
 // Truncates object to new size. If new size is null, object may be removed totally
 s32_t spiffs_object_truncate(
     spiffs_fd *fd,
@@ -1632,7 +1730,8 @@ static s32_t spiffs_obj_lu_find_free_obj_id_bitmap_v(spiffs *fs, spiffs_obj_id i
       SPIFFS_CHECK_RES(res);
       if (objix_hdr.p_hdr.span_ix == 0 &&
           (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) ==
-              (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE)) {
+              (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE) &&
+          !SPIFFS_PH_HIDDEN(objix_hdr.p_hdr.flags)) {
         if (strcmp((char *)user_p, (char *)objix_hdr.name) == 0) {
           return SPIFFS_ERR_CONFLICTING_NAME;
         }
@@ -1663,7 +1762,8 @@ static s32_t spiffs_obj_lu_find_free_obj_id_compact_v(spiffs *fs, spiffs_obj_id
         ((objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_DELET)) ==
             (SPIFFS_PH_FLAG_DELET))) {
       // ok object look up entry
-      if (state->conflicting_name && strcmp((const char *)state->conflicting_name, (char *)objix_hdr.name) == 0) {
+      if (state->conflicting_name && !SPIFFS_PH_HIDDEN(objix_hdr.p_hdr.flags) &&
+          strcmp((const char *)state->conflicting_name, (char *)objix_hdr.name) == 0) {
         return SPIFFS_ERR_CONFLICTING_NAME;
       }
 
@@ -1784,6 +1884,10 @@ s32_t spiffs_fd_find_new(spiffs *fs, spiffs_fd **fd) {
     spiffs_fd *cur_fd = &fds[i];
     if (cur_fd->file_nbr == 0) {
       cur_fd->file_nbr = i+1;
+#if SPIFFS_CACHE_WR
+      cur_fd->wbuf = 0;
+      cur_fd->wbuf_len = 0;
+#endif
       *fd = cur_fd;
       return SPIFFS_OK;
     }
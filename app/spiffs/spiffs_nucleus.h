@@ -235,6 +235,16 @@
 #define SPIFFS_PH_FLAG_DELET  (1<<7)
 // if 0, this index header is being deleted
 #define SPIFFS_PH_FLAG_IXDELE (1<<6)
+// if 0, this index header is of a replacement, see SPIFFS_REPLACE
+#define SPIFFS_PH_FLAG_REPL   (1<<3)
+// if 0, the replacement is completely written
+#define SPIFFS_PH_FLAG_READY  (1<<4)
+// if 0, the replacement is committed and has taken over the name
+#define SPIFFS_PH_FLAG_COMMIT (1<<5)
+
+// index header of a replacement not committed yet, not found by name
+#define SPIFFS_PH_HIDDEN(flags) \
+  (((flags) & (SPIFFS_PH_FLAG_REPL | SPIFFS_PH_FLAG_COMMIT)) == SPIFFS_PH_FLAG_COMMIT)
 
 
 #define SPIFFS_CHECK_MOUNT(fs) \
@@ -372,8 +382,16 @@ typedef struct {
   u32_t fdoffset;
   // fd flags
   spiffs_flags flags;
+  // SPIFFS_REPLACE: object id of the file to replace, or SPIFFS_OBJ_ID_FREE
+  spiffs_obj_id replace_obj_id;
 #if SPIFFS_CACHE_WR
   spiffs_cache_page *cache_page;
+  // optional write back buffer, see SPIFFS_setvbuf
+  u8_t *wbuf;
+  u16_t wbuf_size;
+  u16_t wbuf_len;
+  // file offset of first byte in write back buffer
+  u32_t wbuf_offset;
 #endif
 } spiffs_fd;
 
@@ -549,6 +567,7 @@ s32_t spiffs_object_create(
     spiffs_obj_id obj_id,
     u8_t name[SPIFFS_OBJ_NAME_LEN],
     spiffs_obj_type type,
+    u8_t replacement,
     spiffs_page_ix *objix_hdr_pix);
 
 s32_t spiffs_object_update_index_hdr(
@@ -612,6 +631,20 @@ s32_t spiffs_object_find_object_index_header_by_name(
     u8_t name[SPIFFS_OBJ_NAME_LEN],
     spiffs_page_ix *pix);
 
+s32_t spiffs_object_find_replaced(
+    spiffs *fs,
+    u8_t name[SPIFFS_OBJ_NAME_LEN],
+    spiffs_page_ix *pix,
+    spiffs_page_ix *stale_pix);
+
+s32_t spiffs_object_ready_replacement(
+    spiffs *fs,
+    spiffs_page_ix objix_hdr_pix);
+
+s32_t spiffs_object_commit_replacement(
+    spiffs *fs,
+    spiffs_page_ix objix_hdr_pix);
+
 // ---------------
 
 s32_t spiffs_gc_check(
@@ -634,6 +667,13 @@ s32_t spiffs_gc_clean(
 s32_t spiffs_gc_quick(
     spiffs *fs);
 
+s32_t spiffs_gc_step(
+    spiffs *fs,
+    u32_t keep_free_blocks);
+
+s32_t spiffs_gc_erase_ahead_finish(
+    spiffs *fs);
+
 // ---------------
 
 s32_t spiffs_fd_find_new(
@@ -682,4 +722,14 @@ s32_t spiffs_page_consistency_check(
 s32_t spiffs_object_index_consistency_check(
     spiffs *fs);
 
+void spiffs_check_start(
+    spiffs *fs,
+    spiffs_check_state *st,
+    u8_t *work,
+    spiffs_check_callback cb);
+
+s32_t spiffs_check_step(
+    spiffs *fs,
+    spiffs_check_state *st);
+
 #endif /* SPIFFS_NUCLEUS_H_ */
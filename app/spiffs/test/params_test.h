@@ -19,7 +19,22 @@
 #define LOG_BLOCK           (SECTOR_SIZE*2)
 #define LOG_PAGE            (SECTOR_SIZE/256)
 
-#define FD_BUF_SIZE     64*6
+// flash timing model, typical ESP8266 with a W25Q32 class spi flash at 40MHz
+// fixed cost per read or write call: command, address, cache disable
+#define FLASH_T_OP_NS         5000
+// spi transfer per byte, dual io at 40MHz
+#define FLASH_T_BYTE_NS       100
+// page program, first byte and each following byte of a 256 byte page
+#define FLASH_PROG_PAGE       256
+#define FLASH_T_PROG_FIRST_NS 30000
+#define FLASH_T_PROG_BYTE_NS  2500
+// sector and block erase latency
+#define FLASH_ERASE_SECTOR    4096
+#define FLASH_ERASE_BLOCK     65536
+#define FLASH_T_ERASE_SECTOR_US 45000
+#define FLASH_T_ERASE_BLOCK_US  150000
+
+#define FD_BUF_SIZE     64*8
 #define CACHE_BUF_SIZE  (LOG_PAGE + 32)*8
 
 #define ASSERT(c, m) real_assert((c),(m), __FILE__, __LINE__);
@@ -414,5 +414,78 @@ TEST(index_cons4) {
 } TEST_END(index_cons4)
 
 
+static int check_step_fixes;
+void check_step_cb(spiffs_check_type type, spiffs_check_report report, u32_t arg1, u32_t arg2) {
+  if (report != SPIFFS_CHECK_PROGRESS && report != SPIFFS_CHECK_ERROR) check_step_fixes++;
+}
+
+TEST(check_step) {
+  int size = SPIFFS_DATA_PAGE_SIZE(FS)*3;
+  int res = test_create_and_write_file("file", size, size);
+  TEST_CHECK(res >= 0);
+  res = test_create_and_write_file("other", size, size);
+  TEST_CHECK(res >= 0);
+
+  spiffs_file fd = SPIFFS_open(FS, "file", SPIFFS_RDONLY, 0);
+  TEST_CHECK(fd > 0);
+  spiffs_stat s;
+  res = SPIFFS_fstat(FS, fd, &s);
+  TEST_CHECK(res >= 0);
+  SPIFFS_close(FS, fd);
+
+  // same corruption as page_cons1, bad page references in the object index
+  spiffs_page_ix pix;
+  res = spiffs_obj_lu_find_id_and_span(FS, s.obj_id | SPIFFS_OBJ_ID_IX_FLAG, 0, 0, &pix);
+  TEST_CHECK(res >= 0);
+  u32_t addr = SPIFFS_PAGE_TO_PADDR(FS, pix) + sizeof(spiffs_page_object_ix_header);
+  spiffs_page_ix bad_pix_ref = 0x55;
+  area_write(addr, (u8_t*)&bad_pix_ref, sizeof(spiffs_page_ix));
+  area_write(addr+2, (u8_t*)&bad_pix_ref, sizeof(spiffs_page_ix));
+#if SPIFFS_CACHE
+  spiffs_cache *cache = spiffs_get_cache(FS);
+  cache->cpage_use_map = 0;
+#endif
+
+  // steps with files written in between
+  spiffs_check_state st;
+  u8_t *work = malloc(SPIFFS_CFG_LOG_PAGE_SZ(FS));
+  int steps = 0;
+  check_step_fixes = 0;
+  res = SPIFFS_check_start(FS, &st, work, check_step_cb);
+  TEST_CHECK(res >= 0);
+  while ((res = SPIFFS_check_step(FS, &st)) > 0) {
+    steps++;
+    if (steps % 25 == 0) {
+      fd = SPIFFS_open(FS, "other", SPIFFS_APPEND | SPIFFS_RDWR, 0);
+      TEST_CHECK(fd > 0);
+      TEST_CHECK(SPIFFS_write(FS, fd, "more", 4) == 4);
+      SPIFFS_close(FS, fd);
+    }
+    TEST_CHECK(steps < 100000);
+  }
+  TEST_CHECK(res == 0);
+  TEST_CHECK(SPIFFS_check_step(FS, &st) == 0);
+  printf("  %i steps, %i fixes\n", steps, check_step_fixes);
+  TEST_CHECK(check_step_fixes > 0);
+  free(work);
+
+  res = read_and_verify("file");
+  TEST_CHECK(res >= 0);
+  fd = SPIFFS_open(FS, "other", SPIFFS_RDONLY, 0);
+  TEST_CHECK(fd > 0);
+  res = SPIFFS_fstat(FS, fd, &s);
+  TEST_CHECK(res >= 0);
+  TEST_CHECK(s.size == size + 4 * (steps / 25));
+  SPIFFS_close(FS, fd);
+
+  // nothing left for a full check to fix
+  check_step_fixes = 0;
+  (FS)->check_cb_f = check_step_cb;
+  SPIFFS_check(FS);
+  TEST_CHECK(check_step_fixes == 0);
+
+  return TEST_RES_OK;
+} TEST_END(check_step)
+
 
 SUITE_END(check_tests)
@@ -0,0 +1,176 @@
+/*
+ * test_geometry.c
+ *
+ * Page size probe and a sweep of logical page sizes against read and write
+ * throughput, to pick the geometry for file.mount()
+ */
+
+
+#include "testrunner.h"
+#include "test_spiffs.h"
+#include "spiffs_nucleus.h"
+#include "spiffs.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+// firmware blocks, 4kB, and the page sizes file.mount() takes
+#define GEO_FS_SIZE     (4096*128)
+#define GEO_MAX_PAGE    1024
+#define GEO_CACHE_PAGES 4
+#define GEO_FDS         4
+
+static u8_t geo_work[GEO_MAX_PAGE*2];
+static u8_t geo_fds[GEO_FDS*sizeof(spiffs_fd)];
+static u8_t geo_cache[sizeof(spiffs_cache) + GEO_CACHE_PAGES*(sizeof(spiffs_cache_page) + GEO_MAX_PAGE)];
+static u8_t geo_wbuf[GEO_MAX_PAGE*2];
+
+// mounts the emulated flash with given page size, erased first if asked
+s32_t geo_mount(u32_t page_sz, int erase) {
+  spiffs_config cfg;
+  if (erase) {
+    fs_reset_specific(0, GEO_FS_SIZE, 4096, 4096, 256);
+  }
+  cfg = (FS)->cfg;
+  SPIFFS_unmount(FS);
+  cfg.log_page_size = page_sz;
+  s32_t res = SPIFFS_mount(FS, &cfg, geo_work, geo_fds, sizeof(geo_fds), geo_cache,
+      sizeof(spiffs_cache) + GEO_CACHE_PAGES*(sizeof(spiffs_cache_page) + page_sz), 0);
+  clear_flash_ops_log();
+  return res;
+}
+
+// writes a file in pieces, with the write back buffer the firmware gives
+// descriptors opened for writing
+int geo_write_file(char *name, u8_t *data, u32_t len, u32_t chunk) {
+  u32_t i;
+  spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  CHECK(fd > 0);
+  CHECK_RES(SPIFFS_setvbuf(FS, fd, geo_wbuf, (FS)->cfg.log_page_size*2));
+  for (i = 0; i < len; i += chunk) {
+    u32_t n = len - i < chunk ? len - i : chunk;
+    CHECK(SPIFFS_write(FS, fd, &data[i], n) == (s32_t)n);
+  }
+  SPIFFS_close(FS, fd);
+  CHECK(SPIFFS_errno(FS) == SPIFFS_OK);
+  return 0;
+}
+
+SUITE(geometry_tests)
+void setup() {
+  _setup_test_only();
+  fs_reset_specific(0, GEO_FS_SIZE, 4096, 4096, 256);
+}
+void teardown() {
+  _teardown();
+}
+
+TEST(probe_page_size)
+{
+  u32_t page_sz;
+  spiffs_config cfg;
+  for (page_sz = 128; page_sz <= GEO_MAX_PAGE; page_sz <<= 1) {
+    TEST_CHECK(geo_mount(page_sz, 1) >= 0);
+    cfg = (FS)->cfg;
+    // nothing written yet, nothing to tell by
+    TEST_CHECK(SPIFFS_probe_page_size(&cfg) == 0);
+    TEST_CHECK(test_create_and_write_file("big", 20000, 1000) >= 0);
+    TEST_CHECK(test_create_and_write_file("small", 100, 100) >= 0);
+    TEST_CHECK(SPIFFS_remove(FS, "small") >= 0);
+    TEST_CHECK(test_create_and_write_file("other", 3000, 77) >= 0);
+    s32_t found = SPIFFS_probe_page_size(&cfg);
+    printf("  page %4i, found %4i\n", page_sz, found);
+    TEST_CHECK(found == (s32_t)page_sz);
+    // and the files are there when mounted with it
+    SPIFFS_unmount(FS);
+    TEST_CHECK(geo_mount(found, 0) >= 0);
+    TEST_CHECK(SPIFFS_check(FS) >= 0);
+    TEST_CHECK(read_and_verify("big") >= 0);
+    TEST_CHECK(read_and_verify("other") >= 0);
+  }
+  return TEST_RES_OK;
+}
+TEST_END(probe_page_size)
+
+
+TEST(page_size_sweep)
+{
+  const u32_t big_len = 64*1024;
+  const u32_t small_len = 200;
+  const int small_files = 20;
+  const int random_reads = 500;
+  u8_t *big = malloc(big_len);
+  u8_t *small = malloc(small_len);
+  u8_t buf[512];
+  char name[32];
+  u32_t page_sz;
+  int i;
+  memrand(big, big_len);
+  memrand(small, small_len);
+
+  printf("  page  write ms  seq read ms  small read ms  random read ms  used kB\n");
+  for (page_sz = 128; page_sz <= GEO_MAX_PAGE; page_sz <<= 1) {
+    float wr_ms, rd_ms, small_ms, rnd_ms;
+    u32_t total, used;
+    spiffs_file fd;
+    TEST_CHECK(geo_mount(page_sz, 1) >= 0);
+
+    // scripts and settings, and a data file written as file.write() does
+    for (i = 0; i < small_files; i++) {
+      sprintf(name, "cfg%i", i);
+      TEST_CHECK(geo_write_file(name, small, small_len, small_len) == 0);
+    }
+    TEST_CHECK(geo_write_file("data", big, big_len, 256) == 0);
+    wr_ms = get_flash_ops_log_time_ms();
+    SPIFFS_info(FS, &total, &used);
+
+    // sequential, in the chunks the file module reads
+    clear_flash_ops_log();
+    fd = SPIFFS_open(FS, "data", SPIFFS_RDONLY, 0);
+    TEST_CHECK(fd > 0);
+    for (i = 0; i < (int)big_len; i += sizeof(buf)) {
+      TEST_CHECK(SPIFFS_read(FS, fd, buf, sizeof(buf)) == sizeof(buf));
+      TEST_CHECK(memcmp(buf, &big[i], sizeof(buf)) == 0);
+    }
+    SPIFFS_close(FS, fd);
+    rd_ms = get_flash_ops_log_time_ms();
+
+    // open, read and close each small file, as dofile() and settings do
+    clear_flash_ops_log();
+    for (i = 0; i < small_files; i++) {
+      sprintf(name, "cfg%i", i);
+      fd = SPIFFS_open(FS, name, SPIFFS_RDONLY, 0);
+      TEST_CHECK(fd > 0);
+      TEST_CHECK(SPIFFS_read(FS, fd, buf, small_len) == (s32_t)small_len);
+      TEST_CHECK(memcmp(buf, small, small_len) == 0);
+      SPIFFS_close(FS, fd);
+    }
+    small_ms = get_flash_ops_log_time_ms();
+
+    // records at random offsets
+    clear_flash_ops_log();
+    fd = SPIFFS_open(FS, "data", SPIFFS_RDONLY, 0);
+    TEST_CHECK(fd > 0);
+    srand(page_sz);
+    for (i = 0; i < random_reads; i++) {
+      u32_t offs = rand() % (big_len - 64);
+      TEST_CHECK(SPIFFS_lseek(FS, fd, offs, SPIFFS_SEEK_SET) >= 0);
+      TEST_CHECK(SPIFFS_read(FS, fd, buf, 64) == 64);
+      TEST_CHECK(memcmp(buf, &big[offs], 64) == 0);
+    }
+    SPIFFS_close(FS, fd);
+    rnd_ms = get_flash_ops_log_time_ms();
+
+    printf("  %4i  %8.1f  %11.1f  %13.1f  %14.1f  %7i\n",
+        page_sz, wr_ms, rd_ms, small_ms, rnd_ms, used / 1024);
+  }
+
+  free(big);
+  free(small);
+  return TEST_RES_OK;
+}
+TEST_END(page_size_sweep)
+
+SUITE_END(geometry_tests)
@@ -36,6 +36,222 @@ TEST(info)
 TEST_END(info)
 
 
+TEST(fsinfo)
+{
+  spiffs_fsinfo info;
+  u32_t used, total;
+  int res = test_create_and_write_file("file", 2000, 100);
+  TEST_CHECK(res >= 0);
+  res = SPIFFS_fsinfo(FS, &info);
+  TEST_CHECK(res == SPIFFS_OK);
+  res = SPIFFS_info(FS, &total, &used);
+  TEST_CHECK(res == SPIFFS_OK);
+  TEST_CHECK(info.total == total);
+  TEST_CHECK(info.used == used && used >= 2000);
+  u32_t was_used = info.used;
+  u32_t was_deleted = info.deleted;
+  res = SPIFFS_remove(FS, "file");
+  TEST_CHECK(res >= 0);
+  res = SPIFFS_fsinfo(FS, &info);
+  TEST_CHECK(res == SPIFFS_OK);
+  TEST_CHECK(info.used < was_used);
+  TEST_CHECK(info.deleted >= was_deleted + 2000);
+  return TEST_RES_OK;
+}
+TEST_END(fsinfo)
+
+
+TEST(list)
+{
+  char name[32];
+  int i, res;
+  const int files = 40;
+  int seen[40];
+  struct spiffs_dirent e[7];
+  u32_t cursor;
+  s32_t n;
+
+  for (i = 0; i < files; i++) {
+    sprintf(name, i % 2 ? "www/page%i" : "data%i", i);
+    res = test_create_and_write_file(name, 10 + i, 10 + i);
+    TEST_CHECK(res >= 0);
+  }
+  res = SPIFFS_remove(FS, "data10");
+  TEST_CHECK(res >= 0);
+
+  // all files, a few at a time
+  memset(seen, 0, sizeof(seen));
+  clear_flash_ops_log();
+  cursor = 0;
+  n = 0;
+  while (cursor != SPIFFS_LIST_END) {
+    s32_t k = SPIFFS_list(FS, &cursor, 0, e, sizeof(e) / sizeof(e[0]));
+    TEST_CHECK(k >= 0 && k <= (s32_t)(sizeof(e) / sizeof(e[0])));
+    for (i = 0; i < k; i++) {
+      int ix = atoi(strpbrk((char *)e[i].name, "0123456789"));
+      TEST_CHECK(ix >= 0 && ix < files && !seen[ix]);
+      TEST_CHECK(e[i].size == 10 + ix);
+      seen[ix] = 1;
+    }
+    n += k;
+  }
+  u32_t list_bytes = get_flash_ops_log_read_bytes();
+  float list_ms = get_flash_ops_log_time_ms();
+  TEST_CHECK(n == files - 1);
+  TEST_CHECK(!seen[10]);
+
+  // the same with readdir
+  spiffs_DIR d;
+  struct spiffs_dirent de;
+  clear_flash_ops_log();
+  SPIFFS_opendir(FS, "/", &d);
+  i = 0;
+  while (SPIFFS_readdir(&d, &de)) i++;
+  SPIFFS_closedir(&d);
+  TEST_CHECK(i == n);
+  printf("  readdir: %i bytes read, %.2f ms; list: %i bytes read, %.2f ms\n",
+      get_flash_ops_log_read_bytes(), get_flash_ops_log_time_ms(), list_bytes, list_ms);
+
+  // only names with the prefix
+  cursor = 0;
+  n = 0;
+  while (cursor != SPIFFS_LIST_END) {
+    s32_t k = SPIFFS_list(FS, &cursor, "www/", e, sizeof(e) / sizeof(e[0]));
+    TEST_CHECK(k >= 0);
+    for (i = 0; i < k; i++) {
+      TEST_CHECK(strncmp((char *)e[i].name, "www/page", 8) == 0);
+    }
+    n += k;
+  }
+  TEST_CHECK(n == files / 2);
+
+  // nothing matches
+  cursor = 0;
+  n = SPIFFS_list(FS, &cursor, "none", e, sizeof(e) / sizeof(e[0]));
+  TEST_CHECK(n == 0 && cursor == SPIFFS_LIST_END);
+  return TEST_RES_OK;
+}
+TEST_END(list)
+
+
+// reads a whole file into buf, returns its length or -1
+int replace_read(char *name, u8_t *buf, u32_t size) {
+  spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_RDONLY, 0);
+  if (fd < 0) return -1;
+  s32_t len = SPIFFS_read(FS, fd, buf, size);
+  SPIFFS_close(FS, fd);
+  SPIFFS_clearerr(FS);
+  return len;
+}
+
+// number of files of given name
+int replace_count(char *name) {
+  spiffs_DIR d;
+  struct spiffs_dirent e;
+  int n = 0;
+  SPIFFS_opendir(FS, "/", &d);
+  while (SPIFFS_readdir(&d, &e)) {
+    if (strcmp((char *)e.name, name) == 0) n++;
+  }
+  SPIFFS_closedir(&d);
+  return n;
+}
+
+TEST(replace)
+{
+  u8_t a[600], b[900], buf[1024];
+  spiffs_fsinfo info;
+  spiffs_file fd;
+  spiffs_fd *fdp;
+  s32_t res;
+  memrand(a, sizeof(a));
+  memrand(b, sizeof(b));
+
+  // creates, then replaces
+  res = SPIFFS_replace(FS, "cfg", a, sizeof(a));
+  TEST_CHECK(res == sizeof(a));
+  TEST_CHECK(replace_read("cfg", buf, sizeof(buf)) == sizeof(a) && memcmp(buf, a, sizeof(a)) == 0);
+  res = SPIFFS_replace(FS, "cfg", b, sizeof(b));
+  TEST_CHECK(res == sizeof(b));
+  TEST_CHECK(replace_read("cfg", buf, sizeof(buf)) == sizeof(b) && memcmp(buf, b, sizeof(b)) == 0);
+  TEST_CHECK(replace_count("cfg") == 1);
+  SPIFFS_fsinfo(FS, &info);
+  u32_t used = info.used;
+
+  // readers see the old content until commit
+  fd = SPIFFS_open(FS, "cfg", SPIFFS_REPLACE | SPIFFS_RDWR, 0);
+  TEST_CHECK(fd > 0);
+  TEST_CHECK(SPIFFS_write(FS, fd, a, sizeof(a)) == sizeof(a));
+  TEST_CHECK(replace_read("cfg", buf, sizeof(buf)) == sizeof(b) && memcmp(buf, b, sizeof(b)) == 0);
+  TEST_CHECK(replace_count("cfg") == 1);
+  TEST_CHECK(SPIFFS_commit(FS, fd) == 0);
+  TEST_CHECK(replace_read("cfg", buf, sizeof(buf)) == sizeof(a) && memcmp(buf, a, sizeof(a)) == 0);
+  TEST_CHECK(replace_count("cfg") == 1);
+
+  // closed without commit, nothing changes
+  fd = SPIFFS_open(FS, "cfg", SPIFFS_REPLACE | SPIFFS_RDWR, 0);
+  TEST_CHECK(fd > 0);
+  TEST_CHECK(SPIFFS_write(FS, fd, b, sizeof(b)) == sizeof(b));
+  SPIFFS_close(FS, fd);
+  TEST_CHECK(replace_read("cfg", buf, sizeof(buf)) == sizeof(a) && memcmp(buf, a, sizeof(a)) == 0);
+  TEST_CHECK(SPIFFS_commit(FS, fd) < 0);
+  SPIFFS_clearerr(FS);
+
+  // cut short while writing, the leftover goes with the next replace
+  fd = SPIFFS_open(FS, "cfg", SPIFFS_REPLACE | SPIFFS_RDWR, 0);
+  TEST_CHECK(fd > 0);
+  TEST_CHECK(SPIFFS_write(FS, fd, b, sizeof(b)) == sizeof(b));
+  SPIFFS_fflush(FS, fd);
+  spiffs_fd_return(FS, fd);
+  TEST_CHECK(replace_read("cfg", buf, sizeof(buf)) == sizeof(a) && memcmp(buf, a, sizeof(a)) == 0);
+  res = SPIFFS_replace(FS, "cfg", b, sizeof(b));
+  TEST_CHECK(res == sizeof(b));
+  SPIFFS_fsinfo(FS, &info);
+  TEST_CHECK(info.used == used);
+
+  // cut short after the old file went, the replacement takes over
+  fd = SPIFFS_open(FS, "cfg", SPIFFS_REPLACE | SPIFFS_RDWR, 0);
+  TEST_CHECK(fd > 0);
+  TEST_CHECK(SPIFFS_write(FS, fd, a, sizeof(a)) == sizeof(a));
+  SPIFFS_fflush(FS, fd);
+  res = spiffs_fd_get(FS, fd, &fdp);
+  TEST_CHECK(res == SPIFFS_OK);
+  res = spiffs_object_ready_replacement(FS, fdp->objix_hdr_pix);
+  TEST_CHECK(res == SPIFFS_OK);
+  spiffs_fd_return(FS, fd);
+  TEST_CHECK(SPIFFS_remove(FS, "cfg") == 0);
+  TEST_CHECK(replace_read("cfg", buf, sizeof(buf)) == sizeof(a) && memcmp(buf, a, sizeof(a)) == 0);
+  TEST_CHECK(replace_count("cfg") == 1);
+
+  // flash use against write to temp, remove and rename
+  int i;
+  for (i = 0; i < 20; i++) {
+    char name[16];
+    sprintf(name, "other%i", i);
+    TEST_CHECK(test_create_and_write_file(name, 300, 300) >= 0);
+  }
+  clear_flash_ops_log();
+  fd = SPIFFS_open(FS, "cfg.tmp", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  TEST_CHECK(fd > 0);
+  TEST_CHECK(SPIFFS_write(FS, fd, b, sizeof(b)) == sizeof(b));
+  SPIFFS_close(FS, fd);
+  TEST_CHECK(SPIFFS_remove(FS, "cfg") == 0);
+  TEST_CHECK(SPIFFS_rename(FS, "cfg.tmp", "cfg") == 0);
+  u32_t rd_rename = get_flash_ops_log_read_bytes();
+  float ms_rename = get_flash_ops_log_time_ms();
+  clear_flash_ops_log();
+  TEST_CHECK(SPIFFS_replace(FS, "cfg", a, sizeof(a)) == sizeof(a));
+  u32_t rd_replace = get_flash_ops_log_read_bytes();
+  float ms_replace = get_flash_ops_log_time_ms();
+  printf("  temp+remove+rename: %u bytes read, %.1f ms\n", rd_rename, ms_rename);
+  printf("  replace:            %u bytes read, %.1f ms\n", rd_replace, ms_replace);
+  TEST_CHECK(rd_replace < rd_rename);
+  TEST_CHECK(replace_read("cfg", buf, sizeof(buf)) == sizeof(a) && memcmp(buf, a, sizeof(a)) == 0);
+  return TEST_RES_OK;
+}
+TEST_END(replace)
+
+
 TEST(missing_file)
 {
   spiffs_file fd = SPIFFS_open(FS, "this_wont_exist", SPIFFS_RDONLY, 0);
@@ -503,6 +719,242 @@ TEST(truncate_big_file)
 TEST_END(truncate_big_file)
 
 
+TEST(gc_step)
+{
+  char name[32];
+  int f;
+  int files = 8;
+  int res;
+  int size = ((60*(FS)->cfg.phys_size)/100)/files;
+  for (f = 0; f < files; f++) {
+    sprintf(name, "gcfile%i", f);
+    res = test_create_and_write_file(name, size, SPIFFS_DATA_PAGE_SIZE(FS));
+    TEST_CHECK(res >= 0);
+  }
+  // leave deleted pages spread over the blocks
+  for (f = 0; f < files; f += 2) {
+    sprintf(name, "gcfile%i", f);
+    res = SPIFFS_remove(FS, name);
+    TEST_CHECK(res >= 0);
+  }
+
+  u32_t keep = (FS)->free_blocks + 2;
+  res = SPIFFS_gc_step(FS, (FS)->free_blocks);
+  TEST_CHECK(res == 0);
+
+  int steps = 0;
+  u32_t free_blocks = (FS)->free_blocks;
+  while ((res = SPIFFS_gc_step(FS, keep)) > 0) {
+    // at most one block per step
+    TEST_CHECK((FS)->free_blocks <= free_blocks + 1);
+    free_blocks = (FS)->free_blocks;
+    steps++;
+    TEST_CHECK(steps < (int)(FS)->block_count);
+  }
+  TEST_CHECK(res == 0);
+  TEST_CHECK(steps > 0);
+  TEST_CHECK((FS)->free_blocks >= keep);
+
+  for (f = 1; f < files; f += 2) {
+    sprintf(name, "gcfile%i", f);
+    res = read_and_verify(name);
+    TEST_CHECK(res >= 0);
+  }
+  res = SPIFFS_check(FS);
+  TEST_CHECK(res >= 0);
+
+  return TEST_RES_OK;
+}
+TEST_END(gc_step)
+
+
+TEST(gc_step_erase_ahead)
+{
+  char name[32];
+  int f;
+  int files = 4;
+  int res;
+  u32_t sectors = SPIFFS_CFG_LOG_BLOCK_SZ(FS) / SPIFFS_CFG_PHYS_ERASE_SZ(FS);
+  int size = 2 * SPIFFS_CFG_LOG_BLOCK_SZ(FS);
+  TEST_CHECK(sectors > 1);
+  for (f = 0; f < files; f++) {
+    sprintf(name, "eafile%i", f);
+    res = test_create_and_write_file(name, size, size);
+    TEST_CHECK(res >= 0);
+  }
+  // whole blocks of deleted pages
+  for (f = 0; f < files; f += 2) {
+    sprintf(name, "eafile%i", f);
+    res = SPIFFS_remove(FS, name);
+    TEST_CHECK(res >= 0);
+  }
+  u32_t keep = (FS)->free_blocks + 2;
+  u32_t free_blocks = (FS)->free_blocks;
+  u32_t deleted = (FS)->stats_p_deleted;
+
+  // one sector per step, the block only counts as free after the last one
+  clear_flash_ops_log();
+  res = SPIFFS_gc_step(FS, keep);
+  TEST_CHECK(res == 1);
+  TEST_CHECK((FS)->erase_bix != (spiffs_block_ix)-1);
+  TEST_CHECK((FS)->erase_sectors == sectors - 1);
+  TEST_CHECK(get_flash_ops_log_erase_bytes() == SPIFFS_CFG_PHYS_ERASE_SZ(FS));
+  // and that sector is one of the block being erased
+  u32_t s, erased = 0, rd = 0, wr = 0;
+  for (s = 0; s < SPIFFS_CFG_PHYS_SZ(FS) / SPIFFS_CFG_PHYS_ERASE_SZ(FS); s++) {
+    rd += get_flash_ops_log_block_read_bytes(s);
+    wr += get_flash_ops_log_block_write_bytes(s);
+    if (s / sectors == (FS)->erase_bix) {
+      erased += get_flash_ops_log_block_erases(s);
+    }
+  }
+  TEST_CHECK(erased == 1);
+  TEST_CHECK(rd == get_flash_ops_log_read_bytes());
+  TEST_CHECK(wr == get_flash_ops_log_write_bytes());
+  TEST_CHECK((FS)->free_blocks == free_blocks);
+  TEST_CHECK((FS)->stats_p_deleted == deleted);
+
+  // state lost halfway, as after a reset: the block is found again
+  (FS)->erase_bix = (spiffs_block_ix)-1;
+  (FS)->erase_scan = 1;
+  u32_t step;
+  for (step = 0; step < sectors; step++) {
+    res = SPIFFS_gc_step(FS, keep);
+    TEST_CHECK(res == 1);
+  }
+  TEST_CHECK((FS)->erase_bix == (spiffs_block_ix)-1);
+  TEST_CHECK((FS)->free_blocks == free_blocks + 1);
+  TEST_CHECK((FS)->stats_p_deleted == deleted - (SPIFFS_PAGES_PER_BLOCK(FS) - SPIFFS_OBJ_LOOKUP_PAGES(FS)));
+
+  // a partly erased block is left alone by writes and finished by check
+  res = SPIFFS_gc_step(FS, keep);
+  TEST_CHECK(res == 1);
+  TEST_CHECK((FS)->erase_bix != (spiffs_block_ix)-1);
+  res = test_create_and_write_file("eafile_new", size, 100);
+  TEST_CHECK(res >= 0);
+  res = SPIFFS_check(FS);
+  TEST_CHECK(res >= 0);
+  TEST_CHECK((FS)->erase_bix == (spiffs_block_ix)-1);
+
+  spiffs_fsinfo info;
+  res = SPIFFS_fsinfo(FS, &info);
+  TEST_CHECK(res >= 0);
+  TEST_CHECK(info.free_blocks == (FS)->free_blocks);
+
+  for (f = 1; f < files; f += 2) {
+    sprintf(name, "eafile%i", f);
+    res = read_and_verify(name);
+    TEST_CHECK(res >= 0);
+  }
+  res = read_and_verify("eafile_new");
+  TEST_CHECK(res >= 0);
+
+  return TEST_RES_OK;
+}
+TEST_END(gc_step_erase_ahead)
+
+
+int small_writes(char *name, u8_t *wbuf, u32_t wbuf_size, u32_t total) {
+  u8_t chunk[32];
+  u32_t written = 0;
+  u32_t i;
+  int res;
+  spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  CHECK(fd > 0);
+  if (wbuf) {
+    res = SPIFFS_setvbuf(FS, fd, wbuf, wbuf_size);
+    CHECK(res >= 0);
+  }
+  while (written < total) {
+    u32_t len = MIN(1 + (written % 31), total - written);
+    for (i = 0; i < len; i++) {
+      chunk[i] = (u8_t)((written + i) * 7);
+    }
+    res = SPIFFS_write(FS, fd, chunk, len);
+    CHECK(res == (int)len);
+    written += len;
+  }
+  SPIFFS_close(FS, fd);
+  return 0;
+}
+
+int small_writes_verify(char *name, u32_t total) {
+  u8_t chunk[256];
+  u32_t offs = 0;
+  u32_t i;
+  spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_RDONLY, 0);
+  CHECK(fd > 0);
+  while (offs < total) {
+    u32_t len = MIN(sizeof(chunk), total - offs);
+    CHECK(SPIFFS_read(FS, fd, chunk, len) == (int)len);
+    for (i = 0; i < len; i++) {
+      CHECK(chunk[i] == (u8_t)((offs + i) * 7));
+    }
+    offs += len;
+  }
+  SPIFFS_close(FS, fd);
+  return 0;
+}
+
+TEST(write_small_buffered)
+{
+  const u32_t total = 256*1024;
+  const u32_t page = SPIFFS_CFG_LOG_PAGE_SZ(FS);
+  u8_t wbuf[page*2];
+  u32_t wr_plain, wr_buf;
+  int res;
+
+  clear_flash_ops_log();
+  res = small_writes("small", 0, 0, total);
+  TEST_CHECK(res >= 0);
+  wr_plain = get_flash_ops_log_write_bytes();
+  dump_flash_bench("1..31 byte writes, write cache only", total);
+  printf("    per MB         %10i pages written %i pages erased\n",
+      (int)(wr_plain / page * (1024*1024 / total)),
+      (int)(get_flash_ops_log_erase_bytes() / page * (1024*1024 / total)));
+  res = small_writes_verify("small", total);
+  TEST_CHECK(res >= 0);
+  res = SPIFFS_remove(FS, "small");
+  TEST_CHECK(res >= 0);
+
+  clear_flash_ops_log();
+  res = small_writes("small", wbuf, sizeof(wbuf), total);
+  TEST_CHECK(res >= 0);
+  wr_buf = get_flash_ops_log_write_bytes();
+  dump_flash_bench("1..31 byte writes, write back buffer", total);
+  printf("    per MB         %10i pages written %i pages erased\n",
+      (int)(wr_buf / page * (1024*1024 / total)),
+      (int)(get_flash_ops_log_erase_bytes() / page * (1024*1024 / total)));
+  res = small_writes_verify("small", total);
+  TEST_CHECK(res >= 0);
+
+  TEST_CHECK(wr_buf < wr_plain);
+
+  // buffered data is visible to reads, seeks and stat on the same fd
+  spiffs_file fd = SPIFFS_open(FS, "small", SPIFFS_RDWR | SPIFFS_APPEND, 0);
+  TEST_CHECK(fd > 0);
+  res = SPIFFS_setvbuf(FS, fd, wbuf, sizeof(wbuf));
+  TEST_CHECK(res >= 0);
+  u8_t data[16];
+  memset(data, 0x5a, sizeof(data));
+  res = SPIFFS_write(FS, fd, data, sizeof(data));
+  TEST_CHECK(res == sizeof(data));
+  TEST_CHECK(SPIFFS_size(FS, fd) == (s32_t)(total + sizeof(data)));
+  res = SPIFFS_lseek(FS, fd, total, SPIFFS_SEEK_SET);
+  TEST_CHECK(res >= 0);
+  memset(data, 0, sizeof(data));
+  res = SPIFFS_read(FS, fd, data, sizeof(data));
+  TEST_CHECK(res == sizeof(data));
+  TEST_CHECK(data[0] == 0x5a && data[sizeof(data)-1] == 0x5a);
+  SPIFFS_close(FS, fd);
+
+  res = SPIFFS_check(FS);
+  TEST_CHECK(res >= 0);
+  return TEST_RES_OK;
+}
+TEST_END(write_small_buffered)
+
+
 TEST(simultaneous_write) {
   int res = SPIFFS_creat(FS, "simul1", 0);
   TEST_CHECK(res >= 0);
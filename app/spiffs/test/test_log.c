@@ -0,0 +1,248 @@
+/*
+ * test_log.c
+ *
+ * Ring log tests and logging benchmark
+ */
+
+
+#include "testrunner.h"
+#include "test_spiffs.h"
+#include "spiffs_nucleus.h"
+#include "spiffs.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+// firmware geometry, 4kB blocks and 256 byte pages
+#define LOG_FS_SIZE     (4096*128)
+
+static u8_t log_buf[256*4];
+
+static int log_rec_fill(u8_t *rec, u32_t n) {
+  int len = 8 + (n % 40);
+  int i;
+  for (i = 0; i < len; i++) {
+    rec[i] = (u8_t)(n + i);
+  }
+  rec[0] = n & 0xff;
+  rec[1] = (n >> 8) & 0xff;
+  rec[2] = (n >> 16) & 0xff;
+  return len;
+}
+
+static int log_rec_check(u8_t *rec, int len, u32_t n) {
+  u8_t exp[64];
+  int exp_len = log_rec_fill(exp, n);
+  return len == exp_len && memcmp(rec, exp, len) == 0;
+}
+
+// iterates the log from given tail, checking that records are consecutive
+// and end with record last, returns number of records seen
+static int log_verify(spiffs_log *log, u32_t tail, u32_t last) {
+  spiffs_log_iter it;
+  u8_t rec[64];
+  int res;
+  int count = 0;
+  u32_t n = 0;
+  res = SPIFFS_log_iter_start(log, &it, tail);
+  CHECK_RES(res);
+  while ((res = SPIFFS_log_iter_next(&it, rec, sizeof(rec))) >= 0) {
+    if (count == 0) {
+      n = rec[0] | (rec[1] << 8) | (rec[2] << 16);
+    }
+    if (!log_rec_check(rec, res, n)) {
+      printf("  record %i mismatch\n", n);
+      SPIFFS_log_iter_end(&it);
+      return -1;
+    }
+    n++;
+    count++;
+  }
+  SPIFFS_log_iter_end(&it);
+  CHECK(SPIFFS_errno(FS) == SPIFFS_ERR_END_OF_OBJECT);
+  SPIFFS_clearerr(FS);
+  CHECK(count > 0 && n == last + 1);
+  return count;
+}
+
+SUITE(log_tests)
+void setup() {
+  _setup_test_only();
+  fs_reset_specific(0, LOG_FS_SIZE, 4096, 4096, 256);
+}
+void teardown() {
+  _teardown();
+}
+
+TEST(log_append_iterate)
+{
+  spiffs_log log;
+  u8_t rec[64];
+  int res;
+  u32_t n;
+  res = SPIFFS_log_open(FS, &log, "sensors", 16*1024, 4, log_buf, sizeof(log_buf));
+  TEST_CHECK(res >= 0);
+
+  for (n = 0; n < 2000; n++) {
+    int len = log_rec_fill(rec, n);
+    res = SPIFFS_log_append(&log, rec, len);
+    TEST_CHECK(res >= 0);
+  }
+  // size is bounded and oldest records are gone
+  int count = log_verify(&log, 0, 1999);
+  TEST_CHECK(count > 0 && count < 2000);
+  printf("  %i records kept\n", count);
+  TEST_CHECK(log.last_seq - log.first_seq + 1 <= 4);
+
+  res = log_verify(&log, 10, 1999);
+  TEST_CHECK(res == 10);
+  res = log_verify(&log, 1000, 1999);
+  TEST_CHECK(res == count);
+
+  // reopen and continue
+  res = SPIFFS_log_close(&log);
+  TEST_CHECK(res >= 0);
+  res = SPIFFS_log_open(FS, &log, "sensors", 16*1024, 4, log_buf, sizeof(log_buf));
+  TEST_CHECK(res >= 0);
+  res = log_verify(&log, 5, 1999);
+  TEST_CHECK(res == 5);
+  for (n = 2000; n < 2100; n++) {
+    int len = log_rec_fill(rec, n);
+    res = SPIFFS_log_append(&log, rec, len);
+    TEST_CHECK(res >= 0);
+  }
+  res = log_verify(&log, 200, 2099);
+  TEST_CHECK(res == 200);
+
+  // too big for a segment
+  res = SPIFFS_log_append(&log, rec, 16*1024/4);
+  TEST_CHECK(res < 0);
+  TEST_CHECK(SPIFFS_errno(FS) == SPIFFS_ERR_LOG_CONFIG);
+  SPIFFS_clearerr(FS);
+
+  res = SPIFFS_log_close(&log);
+  TEST_CHECK(res >= 0);
+  return TEST_RES_OK;
+}
+TEST_END(log_append_iterate)
+
+
+TEST(log_bench)
+{
+  const u32_t records = 40000;
+  const u32_t max_size = 64*1024;
+  u8_t rec[64];
+  u32_t n;
+  u32_t logged;
+  int res;
+
+  // the usual way, open in append mode and write one record at a time,
+  // rotating between two files
+  logged = 0;
+  clear_flash_ops_log();
+  for (n = 0; n < records; n++) {
+    int len = log_rec_fill(rec, n);
+    spiffs_file fd = SPIFFS_open(FS, "plain.log", SPIFFS_CREAT | SPIFFS_APPEND | SPIFFS_RDWR, 0);
+    TEST_CHECK(fd > 0);
+    res = SPIFFS_write(FS, fd, rec, len);
+    TEST_CHECK(res >= 0);
+    s32_t size = SPIFFS_size(FS, fd);
+    SPIFFS_close(FS, fd);
+    logged += len;
+    if (size > (s32_t)max_size/2) {
+      SPIFFS_remove(FS, "plain.old");
+      SPIFFS_clearerr(FS);
+      res = SPIFFS_rename(FS, "plain.log", "plain.old");
+      TEST_CHECK(res >= 0);
+    }
+  }
+  dump_flash_bench("plain append, open/write/close per record", logged);
+  printf("    %.0f appends/s\n", records / (get_flash_ops_log_time_ms() / 1000));
+  SPIFFS_remove(FS, "plain.log");
+  SPIFFS_remove(FS, "plain.old");
+
+  // ring log of the same size
+  spiffs_log log;
+  res = SPIFFS_log_open(FS, &log, "ring", max_size, 8, log_buf, sizeof(log_buf));
+  TEST_CHECK(res >= 0);
+  logged = 0;
+  clear_flash_ops_log();
+  for (n = 0; n < records; n++) {
+    int len = log_rec_fill(rec, n);
+    res = SPIFFS_log_append(&log, rec, len);
+    TEST_CHECK(res >= 0);
+    logged += len;
+  }
+  res = SPIFFS_log_flush(&log);
+  TEST_CHECK(res >= 0);
+  dump_flash_bench("ring log", logged);
+  printf("    %.0f appends/s\n", records / (get_flash_ops_log_time_ms() / 1000));
+  res = log_verify(&log, 100, records - 1);
+  TEST_CHECK(res == 100);
+  res = SPIFFS_log_close(&log);
+  TEST_CHECK(res >= 0);
+
+  return TEST_RES_OK;
+}
+TEST_END(log_bench)
+
+TEST(log_erase_ahead)
+{
+  const u32_t records = 40000;
+  const u32_t max_size = 64*1024;
+  u8_t rec[64];
+  u32_t n;
+  u32_t logged = 0;
+  int res;
+  int pass;
+
+  // the same ring log, first with gc and erases done by the appends, then
+  // with a gc step while idle after every few appends; only the time spent
+  // in the appends is counted
+  for (pass = 0; pass < 2; pass++) {
+    spiffs_log log;
+    float append_ms = 0;
+    u32_t append_erases = 0;
+    u32_t steps = 0;
+    fs_reset_specific(0, LOG_FS_SIZE, 4096, 4096, 256);
+    res = SPIFFS_log_open(FS, &log, "ring", max_size, 8, log_buf, sizeof(log_buf));
+    TEST_CHECK(res >= 0);
+    clear_flash_ops_log();
+    for (n = 0; n < records; n++) {
+      int len = log_rec_fill(rec, n);
+      float t = get_flash_ops_log_time_ms();
+      u32_t er = get_flash_ops_log_erase_bytes();
+      res = SPIFFS_log_append(&log, rec, len);
+      TEST_CHECK(res >= 0);
+      append_ms += get_flash_ops_log_time_ms() - t;
+      append_erases += get_flash_ops_log_erase_bytes() - er;
+      if (pass == 0) logged += len;
+      if (pass == 1 && (n % 16) == 0) {
+        res = SPIFFS_gc_step(FS, SPIFFS_GC_KEEP_FREE_BLOCKS);
+        TEST_CHECK(res >= 0);
+        steps += res;
+      }
+    }
+    res = SPIFFS_log_flush(&log);
+    TEST_CHECK(res >= 0);
+    printf("  %s: appends %.1f ms, %.1f kB/s, %i kB erased by appends, %i idle gc steps\n",
+        pass ? "erase ahead" : "no erase ahead", append_ms, logged / append_ms * 1000 / 1024,
+        append_erases / 1024, steps);
+    if (pass == 1) {
+      TEST_CHECK(append_erases == 0);
+    }
+    res = log_verify(&log, 100, records - 1);
+    TEST_CHECK(res == 100);
+    res = SPIFFS_log_close(&log);
+    TEST_CHECK(res >= 0);
+    res = SPIFFS_check(FS);
+    TEST_CHECK(res >= 0);
+  }
+
+  return TEST_RES_OK;
+}
+TEST_END(log_erase_ahead)
+
+SUITE_END(log_tests)
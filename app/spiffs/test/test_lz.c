@@ -0,0 +1,264 @@
+/*
+ * test_lz.c
+ *
+ * Compressed file tests and read benchmark
+ */
+
+
+#include "testrunner.h"
+#include "test_spiffs.h"
+#include "spiffs_nucleus.h"
+#include "spiffs.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+
+// firmware geometry, 4kB blocks and 256 byte pages
+#define LZ_FS_SIZE      (4096*128)
+
+static u8_t lz_work[SPIFFS_LZ_WRITE_WORK_SIZE];
+
+// text like data, lua source with some variation
+static void lz_fill_text(u8_t *buf, u32_t len) {
+  static const char *lines[] = {
+    "local function on_data(sk, payload)\n",
+    "  if payload:find(\"GET / \") then\n",
+    "    sk:send(\"HTTP/1.1 200 OK\\r\\nContent-Type: text/html\\r\\n\\r\\n\")\n",
+    "  end\n",
+    "end\n",
+    "gpio.write(pin, gpio.HIGH) -- led ",
+    "tmr.alarm(0, 1000, 1, function() print(node.heap()) end)\n",
+    "<tr><td class=\"name\">sensor</td><td class=\"value\">",
+  };
+  u32_t i = 0;
+  u32_t n = 0;
+  u32_t r = 1;
+  while (i < len) {
+    char tmp[128];
+    int l;
+    r = r * 1103515245 + 12345;
+    const char *line = lines[(r >> 16) % (sizeof(lines) / sizeof(lines[0]))];
+    if (n % 2 == 0) {
+      l = sprintf(tmp, "%s%u</td></tr>\n", line, (r >> 8) & 0xffff);
+    } else {
+      l = sprintf(tmp, "%s", line);
+    }
+    if (l > (int)(len - i)) l = len - i;
+    memcpy(&buf[i], tmp, l);
+    i += l;
+    n++;
+  }
+}
+
+// writes data compressed in chunks of given size, returns size on flash
+static s32_t lz_write_file(char *name, u8_t *data, u32_t len, u32_t chunk) {
+  spiffs_lz lz;
+  spiffs_stat s;
+  u32_t i;
+  s32_t res;
+  spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  CHECK(fd > 0);
+  res = SPIFFS_lz_write_start(FS, &lz, fd, lz_work);
+  CHECK_RES(res);
+  for (i = 0; i < len; i += chunk) {
+    u32_t n = len - i < chunk ? len - i : chunk;
+    res = SPIFFS_lz_write(&lz, &data[i], n);
+    CHECK(res == (s32_t)n);
+  }
+  res = SPIFFS_lz_close(&lz);
+  CHECK_RES(res);
+  res = SPIFFS_fstat(FS, fd, &s);
+  CHECK_RES(res);
+  SPIFFS_close(FS, fd);
+  return s.size;
+}
+
+// reads a compressed file in chunks of given size and compares
+static int lz_verify_file(char *name, u8_t *data, u32_t len, u32_t chunk) {
+  spiffs_lz lz;
+  u8_t buf[1500];
+  u32_t i;
+  s32_t res;
+  spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_RDONLY, 0);
+  CHECK(fd > 0);
+  CHECK(SPIFFS_lz_probe(FS, fd) == 1);
+  res = SPIFFS_lz_read_start(FS, &lz, fd, lz_work);
+  CHECK_RES(res);
+  CHECK(lz.size == len);
+  for (i = 0; i < len; i += chunk) {
+    u32_t n = len - i < chunk ? len - i : chunk;
+    res = SPIFFS_lz_read(&lz, buf, n);
+    CHECK(res == (s32_t)n);
+    CHECK(memcmp(buf, &data[i], n) == 0);
+  }
+  res = SPIFFS_lz_read(&lz, buf, 1);
+  CHECK(res < 0 && SPIFFS_errno(FS) == SPIFFS_ERR_END_OF_OBJECT);
+  SPIFFS_clearerr(FS);
+  SPIFFS_close(FS, fd);
+  return 0;
+}
+
+SUITE(lz_tests)
+void setup() {
+  _setup_test_only();
+  fs_reset_specific(0, LZ_FS_SIZE, 4096, 4096, 256);
+}
+void teardown() {
+  _teardown();
+}
+
+TEST(lz_roundtrip)
+{
+  const u32_t len = 30000;
+  u8_t *text = malloc(len);
+  u8_t *rnd = malloc(len);
+  s32_t size;
+  int res;
+  lz_fill_text(text, len);
+  memrand(rnd, len);
+
+  size = lz_write_file("text", text, len, 1000);
+  TEST_CHECK(size > 0 && size < (s32_t)len / 3);
+  printf("  text %i -> %i bytes\n", len, size);
+  TEST_CHECK(lz_verify_file("text", text, len, 1) == 0);
+  TEST_CHECK(lz_verify_file("text", text, len, 1400) == 0);
+  // written in odd pieces gives the same file
+  TEST_CHECK(lz_write_file("text2", text, len, 7) == size);
+  TEST_CHECK(lz_verify_file("text2", text, len, 333) == 0);
+
+  // random data grows by one flag bit per byte
+  size = lz_write_file("rnd", rnd, len, 512);
+  TEST_CHECK(size > 0 && size <= (s32_t)(len + len / 8 + 16));
+  TEST_CHECK(lz_verify_file("rnd", rnd, len, 100) == 0);
+
+  // empty file
+  TEST_CHECK(lz_write_file("empty", text, 0, 1) == 8);
+  TEST_CHECK(lz_verify_file("empty", text, 0, 1) == 0);
+
+  // plain files are not taken for compressed ones
+  res = test_create_and_write_file("plain", 1000, 100);
+  TEST_CHECK(res >= 0);
+  spiffs_file fd = SPIFFS_open(FS, "plain", SPIFFS_RDONLY, 0);
+  TEST_CHECK(fd > 0);
+  TEST_CHECK(SPIFFS_lz_probe(FS, fd) == 0);
+  SPIFFS_close(FS, fd);
+
+  free(text);
+  free(rnd);
+  return TEST_RES_OK;
+}
+TEST_END(lz_roundtrip)
+
+
+TEST(lz_seek)
+{
+  const u32_t len = 20000;
+  u8_t *text = malloc(len);
+  spiffs_lz lz;
+  u8_t buf[64];
+  s32_t res;
+  int i;
+  lz_fill_text(text, len);
+  TEST_CHECK(lz_write_file("text", text, len, 4096) > 0);
+
+  spiffs_file fd = SPIFFS_open(FS, "text", SPIFFS_RDONLY, 0);
+  TEST_CHECK(fd > 0);
+  res = SPIFFS_lz_read_start(FS, &lz, fd, lz_work);
+  TEST_CHECK(res >= 0);
+  // forward, back within the window, back past it, relative and from end
+  u32_t offs[] = { 5000, 4990, 4500, 100, 19990, 0, 12345, 11500 };
+  for (i = 0; i < sizeof(offs) / sizeof(offs[0]); i++) {
+    res = SPIFFS_lz_lseek(&lz, offs[i], SPIFFS_SEEK_SET);
+    TEST_CHECK(res >= 0);
+    u32_t n = len - offs[i] < sizeof(buf) ? len - offs[i] : sizeof(buf);
+    res = SPIFFS_lz_read(&lz, buf, sizeof(buf));
+    TEST_CHECK(res == (s32_t)n);
+    TEST_CHECK(memcmp(buf, &text[offs[i]], n) == 0);
+  }
+  // getc/ungetc as the file module does it
+  res = SPIFFS_lz_lseek(&lz, -1, SPIFFS_SEEK_CUR);
+  TEST_CHECK(res >= 0);
+  TEST_CHECK(SPIFFS_lz_read(&lz, buf, 1) == 1 && buf[0] == text[11500 + 63]);
+  res = SPIFFS_lz_lseek(&lz, -10, SPIFFS_SEEK_END);
+  TEST_CHECK(res >= 0);
+  TEST_CHECK(SPIFFS_lz_read(&lz, buf, sizeof(buf)) == 10);
+  TEST_CHECK(memcmp(buf, &text[len - 10], 10) == 0);
+  res = SPIFFS_lz_lseek(&lz, 1, SPIFFS_SEEK_END);
+  TEST_CHECK(res < 0);
+  SPIFFS_clearerr(FS);
+  SPIFFS_close(FS, fd);
+  free(text);
+  return TEST_RES_OK;
+}
+TEST_END(lz_seek)
+
+
+TEST(lz_bench)
+{
+  const u32_t len = 64*1024;
+  const int rounds = 20;
+  u8_t *text = malloc(len);
+  u8_t buf[512];
+  spiffs_lz lz;
+  s32_t res;
+  u32_t i;
+  int r;
+  lz_fill_text(text, len);
+
+  res = test_create_file("plain");
+  TEST_CHECK(res >= 0);
+  spiffs_file fd = SPIFFS_open(FS, "plain", SPIFFS_RDWR, 0);
+  TEST_CHECK(fd > 0);
+  TEST_CHECK(SPIFFS_write(FS, fd, text, len) == (s32_t)len);
+  SPIFFS_close(FS, fd);
+  s32_t size = lz_write_file("packed", text, len, 512);
+  TEST_CHECK(size > 0);
+  printf("  %i bytes of text, %i compressed, ratio %.2f\n", len, size, (float)len / size);
+
+  // plain read, in the chunks the file module reads
+  clear_flash_ops_log();
+  fd = SPIFFS_open(FS, "plain", SPIFFS_RDONLY, 0);
+  TEST_CHECK(fd > 0);
+  for (i = 0; i < len; i += sizeof(buf)) {
+    TEST_CHECK(SPIFFS_read(FS, fd, buf, sizeof(buf)) == sizeof(buf));
+  }
+  SPIFFS_close(FS, fd);
+  printf("  plain:      %6.1f flash bytes read per kB, %.1f ms\n",
+      get_flash_ops_log_read_bytes() * 1024.0 / len, get_flash_ops_log_time_ms());
+
+  clear_flash_ops_log();
+  fd = SPIFFS_open(FS, "packed", SPIFFS_RDONLY, 0);
+  TEST_CHECK(fd > 0);
+  res = SPIFFS_lz_read_start(FS, &lz, fd, lz_work);
+  TEST_CHECK(res >= 0);
+  for (i = 0; i < len; i += sizeof(buf)) {
+    TEST_CHECK(SPIFFS_lz_read(&lz, buf, sizeof(buf)) == sizeof(buf));
+    TEST_CHECK(memcmp(buf, &text[i], sizeof(buf)) == 0);
+  }
+  SPIFFS_close(FS, fd);
+  printf("  compressed: %6.1f flash bytes read per kB, %.1f ms\n",
+      get_flash_ops_log_read_bytes() * 1024.0 / len, get_flash_ops_log_time_ms());
+
+  // decompression speed on the host, flash access included
+  clock_t start = clock();
+  for (r = 0; r < rounds; r++) {
+    fd = SPIFFS_open(FS, "packed", SPIFFS_RDONLY, 0);
+    TEST_CHECK(fd > 0);
+    res = SPIFFS_lz_read_start(FS, &lz, fd, lz_work);
+    TEST_CHECK(res >= 0);
+    while (SPIFFS_lz_read(&lz, buf, sizeof(buf)) > 0);
+    SPIFFS_clearerr(FS);
+    SPIFFS_close(FS, fd);
+  }
+  float secs = (float)(clock() - start) / CLOCKS_PER_SEC;
+  printf("  decompression: %.1f MB/s on the host\n", secs > 0 ? rounds * len / secs / (1024*1024) : 0);
+
+  free(text);
+  return TEST_RES_OK;
+}
+TEST_END(lz_bench)
+
+SUITE_END(lz_tests)
@@ -30,8 +30,20 @@ static int erases[256];
 static char _path[256];
 static u32_t bytes_rd = 0;
 static u32_t bytes_wr = 0;
+static u32_t bytes_er = 0;
 static u32_t reads = 0;
 static u32_t writes = 0;
+static u32_t erase_ops = 0;
+// simulated flash time in ns according to timing model in params_test.h
+static unsigned long long sim_ns = 0;
+// per erase block accounting since last clear_flash_ops_log, for erase
+// blocks down to the flash sector size
+#define BLK_OPS_MAX (PHYS_FLASH_SIZE / FLASH_ERASE_SECTOR)
+static struct {
+  u32_t rd;
+  u32_t wr;
+  u32_t er;
+} blk_ops[BLK_OPS_MAX];
 static u32_t error_after_bytes_written = 0;
 static u32_t error_after_bytes_read = 0;
 static char error_after_bytes_written_once_only = 0;
@@ -69,10 +81,21 @@ void clear_test_path() {
   }
 }
 
+static u32_t _blk(u32_t addr) {
+  u32_t bix = (addr - __fs.cfg.phys_addr) / __fs.cfg.phys_erase_block;
+  if (bix >= BLK_OPS_MAX) {
+    printf("FATAL erase block %i beyond the ops log of %i blocks\n", bix, BLK_OPS_MAX);
+    exit(0);
+  }
+  return bix;
+}
+
 static s32_t _read(u32_t addr, u32_t size, u8_t *dst) {
   if (log_flash_ops) {
     bytes_rd += size;
     reads++;
+    blk_ops[_blk(addr)].rd += size;
+    sim_ns += FLASH_T_OP_NS + (unsigned long long)size * FLASH_T_BYTE_NS;
     if (error_after_bytes_read > 0 && bytes_rd >= error_after_bytes_read) {
       if (error_after_bytes_read_once_only) {
         error_after_bytes_read = 0;
@@ -96,8 +119,17 @@ static s32_t _write(u32_t addr, u32_t size, u8_t *src) {
   int i;
   //printf("wr %08x %i\n", addr, size);
   if (log_flash_ops) {
+    u32_t a = addr;
     bytes_wr += size;
     writes++;
+    blk_ops[_blk(addr)].wr += size;
+    sim_ns += FLASH_T_OP_NS + (unsigned long long)size * FLASH_T_BYTE_NS;
+    // a program operation per touched flash page
+    while (a < addr + size) {
+      u32_t n = MIN(addr + size, (a / FLASH_PROG_PAGE + 1) * FLASH_PROG_PAGE) - a;
+      sim_ns += FLASH_T_PROG_FIRST_NS + (n - 1) * FLASH_T_PROG_BYTE_NS;
+      a += n;
+    }
     if (error_after_bytes_written > 0 && bytes_wr >= error_after_bytes_written) {
       if (error_after_bytes_written_once_only) {
         error_after_bytes_written = 0;
@@ -139,6 +171,22 @@ static s32_t _erase(u32_t addr, u32_t size) {
     return -1;
   }
   erases[(addr-__fs.cfg.phys_addr)/__fs.cfg.phys_erase_block]++;
+  if (log_flash_ops) {
+    u32_t a = addr;
+    bytes_er += size;
+    erase_ops++;
+    blk_ops[_blk(addr)].er++;
+    // block erase where aligned, sector erase otherwise
+    while (a < addr + size) {
+      if ((a % FLASH_ERASE_BLOCK) == 0 && addr + size - a >= FLASH_ERASE_BLOCK) {
+        sim_ns += FLASH_T_ERASE_BLOCK_US * 1000ULL;
+        a += FLASH_ERASE_BLOCK;
+      } else {
+        sim_ns += FLASH_T_ERASE_SECTOR_US * 1000ULL;
+        a += FLASH_ERASE_SECTOR;
+      }
+    }
+  }
   memset(&area[addr], 0xff, size);
   return 0;
 }
@@ -262,6 +310,32 @@ void dump_erase_counts(spiffs *fs) {
 void dump_flash_access_stats() {
   printf("  RD: %10i reads  %10i bytes %10i avg bytes/read\n", reads, bytes_rd, reads == 0 ? 0 : (bytes_rd / reads));
   printf("  WR: %10i writes %10i bytes %10i avg bytes/write\n", writes, bytes_wr, writes == 0 ? 0 : (bytes_wr / writes));
+  printf("  ER: %10i erases %10i bytes\n", erase_ops, bytes_er);
+  printf("  simulated flash time: %.1f ms\n", get_flash_ops_log_time_ms());
+}
+
+// Prints simulated time, write amplification and wear distribution of the
+// flash operations since last clear, for given amount of data written by
+// the application.
+void dump_flash_bench(const char *name, u32_t logical_bytes) {
+  u32_t blocks = __fs.cfg.phys_size / __fs.cfg.phys_erase_block;
+  u32_t bix;
+  u32_t er_min = 0xffffffff, er_max = 0, er_tot = 0, worn = 0;
+  float ms = get_flash_ops_log_time_ms();
+  for (bix = 0; bix < blocks && bix < BLK_OPS_MAX; bix++) {
+    er_min = MIN(er_min, blk_ops[bix].er);
+    er_max = MAX(er_max, blk_ops[bix].er);
+    er_tot += blk_ops[bix].er;
+    if (blk_ops[bix].er) worn++;
+  }
+  printf("  %s\n", name);
+  printf("    simulated time %10.1f ms %8.1f kB/s\n",
+      ms, ms == 0 ? 0 : (logical_bytes / 1024.0f) / (ms / 1000.0f));
+  printf("    write amp.     %10.2f    %8.2f erased bytes per byte\n",
+      logical_bytes == 0 ? 0 : (float)bytes_wr / logical_bytes,
+      logical_bytes == 0 ? 0 : (float)bytes_er / logical_bytes);
+  printf("    wear           %10i erases, per block min %i avg %.2f max %i, %i of %i blocks erased\n",
+      er_tot, er_min, blocks ? (float)er_tot / blocks : 0, er_max, worn, blocks);
 }
 
 
@@ -350,8 +424,12 @@ void set_flash_ops_log(int enable) {
 void clear_flash_ops_log() {
   bytes_rd = 0;
   bytes_wr = 0;
+  bytes_er = 0;
   reads = 0;
   writes = 0;
+  erase_ops = 0;
+  sim_ns = 0;
+  memset(blk_ops, 0, sizeof(blk_ops));
   error_after_bytes_read = 0;
   error_after_bytes_written = 0;
 }
@@ -364,6 +442,26 @@ u32_t get_flash_ops_log_write_bytes() {
   return bytes_wr;
 }
 
+u32_t get_flash_ops_log_erase_bytes() {
+  return bytes_er;
+}
+
+u32_t get_flash_ops_log_block_read_bytes(u32_t bix) {
+  return bix < BLK_OPS_MAX ? blk_ops[bix].rd : 0;
+}
+
+u32_t get_flash_ops_log_block_write_bytes(u32_t bix) {
+  return bix < BLK_OPS_MAX ? blk_ops[bix].wr : 0;
+}
+
+u32_t get_flash_ops_log_block_erases(u32_t bix) {
+  return bix < BLK_OPS_MAX ? blk_ops[bix].er : 0;
+}
+
+float get_flash_ops_log_time_ms() {
+  return sim_ns / 1000000.0f;
+}
+
 void invoke_error_after_read_bytes(u32_t b, char once_only) {
   error_after_bytes_read = b;
   error_after_bytes_read_once_only = once_only;
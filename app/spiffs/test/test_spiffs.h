@@ -74,6 +74,12 @@ void set_flash_ops_log(int enable);
 void clear_flash_ops_log();
 u32_t get_flash_ops_log_read_bytes();
 u32_t get_flash_ops_log_write_bytes();
+u32_t get_flash_ops_log_erase_bytes();
+u32_t get_flash_ops_log_block_read_bytes(u32_t bix);
+u32_t get_flash_ops_log_block_write_bytes(u32_t bix);
+u32_t get_flash_ops_log_block_erases(u32_t bix);
+float get_flash_ops_log_time_ms();
+void dump_flash_bench(const char *name, u32_t logical_bytes);
 void invoke_error_after_read_bytes(u32_t b, char once_only);
 void invoke_error_after_write_bytes(u32_t b, char once_only);
 
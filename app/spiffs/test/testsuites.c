@@ -12,4 +12,7 @@ void add_suites() {
   ADD_SUITE(check_tests);
   ADD_SUITE(hydrogen_tests)
   ADD_SUITE(bug_tests)
+  ADD_SUITE(log_tests)
+  ADD_SUITE(lz_tests)
+  ADD_SUITE(geometry_tests)
 }
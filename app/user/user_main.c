@@ -15,6 +15,7 @@
 #include "c_stdio.h"
 
 #include "flash_fs.h"
+#include "romfs.h"
 #include "user_interface.h"
 #include "user_exceptions.h"
 
@@ -119,6 +120,9 @@ void nodemcu_init(void)
 #elif defined ( BUILD_SPIFFS )
     fs_mount();
     // test_spiffs();
+#endif
+#if defined( BUILD_ROMFS ) && !defined( BUILD_WOFS )
+    romfs_init();
 #endif
     // endpoint_setup();
 
@@ -1,10 +1,10 @@
-// Generated by mkfs.lua
+// Generated by mkromfs.py
 // DO NOT MODIFY
 
 #ifndef __ROMFILES_H__
 #define __ROMFILES_H__
 
-const unsigned char romfiles_fs[] = 
+const unsigned char romfiles_fs[] ICACHE_RODATA_ATTR __attribute__((aligned(4))) = 
 {
   0xFF
 };
@@ -48,73 +48,198 @@ static void romfs_close_fd( int fd )
   fd_table[ fd ].flags = 0;
 }
 
-// Helper function: read a byte from the FS
-static uint8_t romfsh_read8( uint32_t addr, const FSDATA *pfs )
-{
-  uint8_t temp;
-  if( pfs->flags & ROMFS_FS_FLAG_DIRECT )
-    return pfs->pbase[ addr ];
-  pfs->readf( &temp, addr, 1, pfs );
-  return temp;
-}
-
 // Helper function: return 1 if PFS reffers to a WOFS, 0 otherwise
 static int romfsh_is_wofs( const FSDATA* pfs )
 {
   return ( pfs->flags & ROMFS_FS_FLAG_WO ) != 0;
 }
 
-// Find the next file, returning FS_FILE_OK or FS_FILE_NOT_FOUND if there no file left.
-static uint8_t romfs_next_file( uint32_t *start, char* fname, size_t len, size_t *act_len, FSDATA *pfs )
+// Helper function: read a block from the FS. With an aligned address and size
+// this is a single aligned flash transfer.
+static void romfsh_read( void *to, uint32_t addr, uint32_t size, const FSDATA *pfs )
 {
-  uint32_t i, j, n;
-  uint32_t fsize;
-  int is_deleted;
-  
-  // Look for the file
-  i = *start;
-  *act_len = 0;
-  if( (i >= INTERNAL_FLASH_SIZE) || (romfsh_read8( i, pfs ) == WOFS_END_MARKER_CHAR ))    // end of file system
+  if( pfs->flags & ROMFS_FS_FLAG_DIRECT )
+    c_memcpy( to, pfs->pbase + addr, size );
+  else
+    pfs->readf( to, addr, size, pfs );
+}
+
+// Largest file header: name, alignment, deleted flag and size
+#define ROMFS_HDR_MAX_LEN     ( ( MAX_FNAME_LENGTH + 1 + ROMFS_ALIGN + WOFS_DEL_FIELD_SIZE + ROMFS_SIZE_LEN + 3 ) & ~3 )
+
+// Helper function: read the header of the file at addr with one flash access.
+// Returns FS_FILE_NOT_FOUND at the end of the file system, FS_FILE_OK otherwise
+// with the name, the length of the name, the data address, the size and the
+// deleted flag of the file.
+static uint8_t romfsh_read_header( uint32_t addr, char *fname, uint32_t *pnamelen, uint32_t *pdata,
+                                   uint32_t *psize, int *pdeleted, const FSDATA *pfs )
+{
+  uint32_t buf[ ROMFS_HDR_MAX_LEN / 4 + 1 ];
+  const uint8_t *p;
+  uint32_t base, len, j;
+
+  if( pfs->flags & ROMFS_FS_FLAG_DIRECT )
+    p = pfs->pbase + addr;
+  else
   {
-    *start = (i >= INTERNAL_FLASH_SIZE)?(INTERNAL_FLASH_SIZE-1):i;
-    return FS_FILE_NOT_FOUND;
+    base = addr & ~3;
+    len = sizeof( buf );
+    if( pfs->max_size && base + len > pfs->max_size )
+      len = ( pfs->max_size - base + 3 ) & ~3;
+    pfs->readf( buf, base, len, pfs );
+    p = ( const uint8_t* )buf + ( addr - base );
   }
+  if( p[ 0 ] == WOFS_END_MARKER_CHAR )
+    return FS_FILE_NOT_FOUND;
   // Read file name
-  len = len>MAX_FNAME_LENGTH?MAX_FNAME_LENGTH:len;
-  for( j = 0; j < len; j ++ )
+  for( j = 0; j < MAX_FNAME_LENGTH; j ++ )
   {
-    fname[ j ] = romfsh_read8( i + j, pfs );
+    fname[ j ] = p[ j ];
     if( fname[ j ] == 0 )
-       break;
+      break;
   }
-  n = j; // save the file name length to n
-  // ' i + j' now points at the '0' byte
-  j = i + j + 1;
+  fname[ j ] = 0;
+  *pnamelen = j;
+  // ' addr + j' now points at the '0' byte
+  j = addr + j + 1;
   // Round to a multiple of ROMFS_ALIGN
   j = ( j + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
   // WOFS has an additional WOFS_DEL_FIELD_SIZE bytes before the size as an indication for "file deleted"
   if( romfsh_is_wofs( pfs ) )
   {
-    is_deleted = romfsh_read8( j, pfs ) == WOFS_FILE_DELETED;
+    *pdeleted = p[ j - addr ] == WOFS_FILE_DELETED;
     j += WOFS_DEL_FIELD_SIZE;
   }
   else
-    is_deleted = 0;
+    *pdeleted = 0;
   // And read the size
-  fsize = romfsh_read8( j, pfs ) + ( romfsh_read8( j + 1, pfs ) << 8 );
-  fsize += ( romfsh_read8( j + 2, pfs ) << 16 ) + ( romfsh_read8( j + 3, pfs ) << 24 );
-  j += ROMFS_SIZE_LEN;
+  *psize = p[ j - addr ] + ( p[ j - addr + 1 ] << 8 );
+  *psize += ( p[ j - addr + 2 ] << 16 ) + ( p[ j - addr + 3 ] << 24 );
+  *pdata = j + ROMFS_SIZE_LEN;
+  return FS_FILE_OK;
+}
+
+// Helper function: address of the file following the one with given data address and size
+static uint32_t romfsh_next_addr( uint32_t data, uint32_t fsize, const FSDATA *pfs )
+{
+  uint32_t i = data + fsize;
+  // On WOFS, all file names must begin at a multiple of ROMFS_ALIGN
+  if( romfsh_is_wofs( pfs ) )
+    i = ( i + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
+  return i;
+}
+
+// Index header and entry sizes, see romfs.h
+#define ROMFS_INDEX_HDR_LEN   12
+#define ROMFS_INDEX_ENTRY_LEN 8
+
+// File names are compared without case, so is the hash
+static uint32_t romfs_name_hash( const char *name )
+{
+  uint32_t h = 2166136261UL;
+  uint8_t c;
+  while( ( c = ( uint8_t )*name ++ ) != 0 )
+  {
+    if( c >= 'A' && c <= 'Z' )
+      c += 'a' - 'A';
+    h ^= c;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+// Read the index header, if the FS has one
+static void romfs_load_index( FSDATA *pfs )
+{
+  uint32_t hdr[ ROMFS_INDEX_HDR_LEN / 4 ];
+  uint8_t *magic = ( uint8_t* )hdr;
+
+  pfs->index_count = pfs->index_end = 0;
+  romfsh_read( hdr, 0, ROMFS_INDEX_HDR_LEN, pfs );
+  if( magic[ 0 ] == 0 && magic[ 1 ] == 'I' && magic[ 2 ] == 'D' && magic[ 3 ] == 'X' )
+  {
+    pfs->index_count = hdr[ 1 ];
+    pfs->index_end = hdr[ 2 ];
+  }
+}
+
+// Address of the first file
+static uint32_t romfs_first_file( const FSDATA *pfs )
+{
+  if( pfs->index_count == 0 && pfs->index_end == 0 )
+    return 0;
+  return ROMFS_INDEX_HDR_LEN + pfs->index_count * ROMFS_INDEX_ENTRY_LEN;
+}
+
+// Look the file up in the name index: a binary search on the hash, then the
+// names of the files with that hash are compared. Returns FS_FILE_OK with
+// the data address and size if found.
+static uint8_t romfs_index_find( const char *fname, uint32_t *pdata, uint32_t *psize, uint32_t *pnameaddr, const FSDATA *pfs )
+{
+  uint32_t h = romfs_name_hash( fname );
+  uint32_t lo = 0, hi = pfs->index_count, mid;
+  uint32_t entry[ 2 ];
+  char fsname[ MAX_FNAME_LENGTH + 1 ];
+  uint32_t namelen;
+  int is_deleted;
+
+  while( lo < hi )
+  {
+    mid = ( lo + hi ) / 2;
+    romfsh_read( entry, ROMFS_INDEX_HDR_LEN + mid * ROMFS_INDEX_ENTRY_LEN, ROMFS_INDEX_ENTRY_LEN, pfs );
+    if( entry[ 0 ] < h )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for( ; lo < pfs->index_count; lo ++ )
+  {
+    romfsh_read( entry, ROMFS_INDEX_HDR_LEN + lo * ROMFS_INDEX_ENTRY_LEN, ROMFS_INDEX_ENTRY_LEN, pfs );
+    if( entry[ 0 ] != h )
+      break;
+    if( romfsh_read_header( entry[ 1 ], fsname, &namelen, pdata, psize, &is_deleted, pfs ) != FS_FILE_OK )
+      break;
+    if( !c_strncasecmp( fname, fsname, MAX_FNAME_LENGTH ) && !is_deleted )
+    {
+      if( pnameaddr )
+        *pnameaddr = entry[ 1 ];
+      return FS_FILE_OK;
+    }
+  }
+  return FS_FILE_NOT_FOUND;
+}
+
+// Find the next file, returning FS_FILE_OK or FS_FILE_NOT_FOUND if there no file left.
+static uint8_t romfs_next_file( uint32_t *start, char* fname, size_t len, size_t *act_len, FSDATA *pfs )
+{
+  uint32_t i, n;
+  uint32_t fsize, data;
+  int is_deleted;
+  char fsname[ MAX_FNAME_LENGTH + 1 ];
+  
+  // Look for the file
+  i = *start;
+  if( i == 0 )
+    i = romfs_first_file( pfs );
+  *act_len = 0;
+  if( (i >= INTERNAL_FLASH_SIZE) || romfsh_read_header( i, fsname, &n, &data, &fsize, &is_deleted, pfs ) != FS_FILE_OK )    // end of file system
+  {
+    *start = (i >= INTERNAL_FLASH_SIZE)?(INTERNAL_FLASH_SIZE-1):i;
+    return FS_FILE_NOT_FOUND;
+  }
+  len = len>MAX_FNAME_LENGTH?MAX_FNAME_LENGTH:len;
+  if( n > len )
+    n = len;
+  c_memcpy( fname, fsname, n );
+  if( n < len )
+    fname[ n ] = 0;
   if( !is_deleted )
   {
     // Found the valid file
     *act_len = n;
   }
   // Move to next file
-  i = j + fsize;
-  // On WOFS, all file names must begin at a multiple of ROMFS_ALIGN
-  if( romfsh_is_wofs( pfs ) )
-    i = ( i + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
-  *start = i;   // modify the start address
+  *start = romfsh_next_addr( data, fsize, pfs );   // modify the start address
   return FS_FILE_OK;
 }
 
@@ -122,52 +247,38 @@ static uint8_t romfs_next_file( uint32_t *start, char* fname, size_t len, size_t
 // or FS_FILE_OK
 static uint8_t romfs_open_file( const char* fname, FD* pfd, FSDATA *pfs, uint32_t *plast, uint32_t *pnameaddr )
 {
-  uint32_t i, j, n;
+  uint32_t i, n;
   char fsname[ MAX_FNAME_LENGTH + 1 ];
-  uint32_t fsize;
+  uint32_t fsize, data, namelen;
   int is_deleted;
   
-  // Look for the file
-  i = 0;
+  // Indexed files are found without walking the FS
+  if( pfs->index_count > 0 &&
+      romfs_index_find( fname, &data, &fsize, pnameaddr, pfs ) == FS_FILE_OK )
+  {
+    pfd->baseaddr = data;
+    pfd->offset = 0;
+    pfd->size = fsize;
+    return FS_FILE_OK;
+  }
+  // Look for the file in the files that are not indexed
+  i = pfs->index_end > 0 ? pfs->index_end : romfs_first_file( pfs );
   while( 1 )
   {
     if( i >= INTERNAL_FLASH_SIZE ){
       *plast = INTERNAL_FLASH_SIZE - 1;   // point to last one
       return FS_FILE_NOT_FOUND;
     }
-    if( romfsh_read8( i, pfs ) == WOFS_END_MARKER_CHAR )
+    n = i;
+    if( romfsh_read_header( i, fsname, &namelen, &data, &fsize, &is_deleted, pfs ) != FS_FILE_OK )
     {
       *plast = i;
       return FS_FILE_NOT_FOUND;
     }
-    // Read file name
-    n = i;
-    for( j = 0; j < MAX_FNAME_LENGTH; j ++ )
-    {
-      fsname[ j ] = romfsh_read8( i + j, pfs );
-      if( fsname[ j ] == 0 )
-         break;
-    }
-    // ' i + j' now points at the '0' byte
-    j = i + j + 1;
-    // Round to a multiple of ROMFS_ALIGN
-    j = ( j + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
-    // WOFS has an additional WOFS_DEL_FIELD_SIZE bytes before the size as an indication for "file deleted"
-    if( romfsh_is_wofs( pfs ) )
-    {
-      is_deleted = romfsh_read8( j, pfs ) == WOFS_FILE_DELETED;
-      j += WOFS_DEL_FIELD_SIZE;
-    }
-    else
-      is_deleted = 0;
-    // And read the size
-    fsize = romfsh_read8( j, pfs ) + ( romfsh_read8( j + 1, pfs ) << 8 );
-    fsize += ( romfsh_read8( j + 2, pfs ) << 16 ) + ( romfsh_read8( j + 3, pfs ) << 24 );
-    j += ROMFS_SIZE_LEN;
     if( !c_strncasecmp( fname, fsname, MAX_FNAME_LENGTH ) && !is_deleted )
     {
       // Found the file
-      pfd->baseaddr = j;
+      pfd->baseaddr = data;
       pfd->offset = 0;
       pfd->size = fsize;
       if( pnameaddr )
@@ -175,10 +286,7 @@ static uint8_t romfs_open_file( const char* fname, FD* pfd, FSDATA *pfs, uint32_
       return FS_FILE_OK;
     }
     // Move to next file
-    i = j + fsize;
-    // On WOFS, all file names must begin at a multiple of ROMFS_ALIGN
-    if( romfsh_is_wofs( pfs ) )
-      i = ( i + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
+    i = romfsh_next_addr( data, fsize, pfs );
   }
   *plast = 0;
   return FS_FILE_NOT_FOUND;
@@ -405,6 +513,48 @@ static int romfs_lseek( int fd, int off, int whence, void *pdata )
   return newpos;
 }
 
+// Helper function: map the file name of PFS, a FS in the memory mapped flash.
+// Returns 1 and the address and size of the file data if found, 0 otherwise.
+static int romfsh_map( const char *name, const uint8_t **paddr, uint32_t *psize, FSDATA *pfs )
+{
+  FD tempfd;
+  uint32_t last;
+
+  if( romfs_open_file( name, &tempfd, pfs, &last, NULL ) != FS_FILE_OK )
+    return 0;
+  // A file that is still being written has no size yet
+  if( tempfd.size == 0xFFFFFFFF )
+    return 0;
+  *paddr = pfs->pbase + tempfd.baseaddr;
+  *psize = tempfd.size;
+  return 1;
+}
+
+// ****************************************************************************
+// ROMFS instance: the image in romfiles.h, stored in the memory mapped flash
+
+#if defined( BUILD_ROMFS )
+static uint32_t romfs_image_read( void *to, uint32_t fromaddr, uint32_t size, const void *pdata )
+{
+  const FSDATA *pfsdata = ( const FSDATA* )pdata;
+  if( fromaddr >= pfsdata->max_size )
+    return 0;
+  return platform_flash_read( to, fromaddr + ( uint32_t )pfsdata->pbase, size );
+}
+
+// Not a const, the index is read at init time
+static FSDATA romfs_fsdata =
+{
+  ( uint8_t* )romfiles_fs,
+  0,
+  romfs_image_read,
+  NULL,
+  sizeof( romfiles_fs ),
+  0,
+  0
+};
+#endif // #if defined( BUILD_ROMFS )
+
 // ****************************************************************************
 // WOFS functions and instance descriptor for real hardware
 
@@ -430,6 +580,9 @@ static uint32_t sim_wofs_read( void *to, uint32_t fromaddr, uint32_t size, const
     return 0;
   }
   fromaddr += ( uint32_t )pfsdata->pbase;
+  // aligned transfers go to the flash directly
+  if( ( ( fromaddr | size | ( uint32_t )to ) & ( INTERNAL_FLASH_READ_UNIT_SIZE - 1 ) ) == 0 )
+    return platform_s_flash_read( to, fromaddr, size );
   return platform_flash_read( to, fromaddr, size );
 }
 
@@ -440,6 +593,8 @@ static FSDATA wofs_fsdata =
   ROMFS_FS_FLAG_WO,
   sim_wofs_read,
   sim_wofs_write,
+  0,
+  0,
   0
 };
 
@@ -457,6 +612,7 @@ int wofs_format( void )
   while( sect_first <= sect_last )
     if( platform_flash_erase_sector( sect_first ++ ) == PLATFORM_ERR )
       return 0;
+  romfs_load_index( &wofs_fsdata );
   return 1;
 }
 
@@ -508,6 +664,23 @@ uint8_t wofs_next( uint32_t *start, char* fname, size_t len, size_t *act_len ){
 
 #endif // #ifdef BUILD_WOFS
 
+// Map a file of ROMFS or WOFS: the data of these files is contiguous in the
+// memory mapped flash, so it can be read in place. Byte reads work through
+// the load exception handler, aligned word reads are fast.
+// Returns 1 and the address and size of the file data if found, 0 otherwise.
+int romfs_map( const char *name, const uint8_t **paddr, uint32_t *psize )
+{
+#if defined( BUILD_ROMFS )
+  if( romfsh_map( name, paddr, psize, &romfs_fsdata ) )
+    return 1;
+#endif
+#if defined( BUILD_WOFS )
+  if( romfsh_map( name, paddr, psize, &wofs_fsdata ) )
+    return 1;
+#endif
+  return 0;
+}
+
 // Initialize both ROMFS and WOFS as needed
 int romfs_init( void )
 {
@@ -523,7 +696,11 @@ int romfs_init( void )
   wofs_fsdata.pbase = ( uint8_t* )platform_flash_get_first_free_block_address( NULL );
   wofs_fsdata.max_size = INTERNAL_FLASH_SIZE - ( ( uint32_t )wofs_fsdata.pbase - INTERNAL_FLASH_START_ADDRESS );
   NODE_DBG("wofs.pbase:%x,max:%x\n",wofs_fsdata.pbase,wofs_fsdata.max_size);
+  romfs_load_index( &wofs_fsdata );
 #endif // ifdef BUILD_WOFS
+#if defined( BUILD_ROMFS )
+  romfs_load_index( &romfs_fsdata );
+#endif
   return 0;
 }
 
@@ -24,6 +24,18 @@ File deleted flag: (WOFS_DEL_FIELD_SIZE bytes), aligned to ROMFS_ALIGN bytes
 File size: (4 bytes), aligned to ROMFS_ALIGN bytes
 File data: (file size bytes)
 
+An image may start with a name index, so that a file can be opened without
+walking all the files before it. A file name is never empty, so a zero byte at
+the start of the FS marks the index:
+
+Index header: 0x00 'I' 'D' 'X', entry count (4 bytes), end of indexed files (4 bytes)
+Index entries: name hash (4 bytes), file address (4 bytes), sorted by hash
+Files: as above, right after the last index entry
+
+All index fields are little endian and 4 byte aligned. The hash is the 32 bit
+FNV-1a hash of the file name in lower case. On WOFS, files created after the image was
+built follow the indexed files and are found by the usual walk.
+
 *******************************************************************************/
 
 // GLOBAL maximum file length (on ALL supported filesystem)
@@ -76,6 +88,8 @@ typedef struct
   p_fs_read readf;                // pointer to read function (for non-direct mode FS)
   p_fs_write writef;              // pointer to write function (only for ROMFS_FS_FLAG_WO)
   uint32_t max_size;                   // maximum size of the FS (in bytes)
+  uint32_t index_count;                // number of entries in the name index, 0 if none
+  uint32_t index_end;                  // address after the last indexed file
 } FSDATA;
 
 #define romfs_fs_set_flag( p, f )     p->flags |= ( f )
@@ -96,6 +110,7 @@ uint8_t wofs_next( uint32_t *start, char* fname, size_t len, size_t *act_len );
 #endif
 // FS functions
 int romfs_init( void );
+int romfs_map( const char *name, const uint8_t **paddr, uint32_t *psize );
 
 #endif
 
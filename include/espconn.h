@@ -72,6 +72,10 @@ typedef struct _remot_info{
 /** A callback prototype to inform about events for a espconn */
 typedef void (* espconn_recv_callback)(void *arg, char *pdata, unsigned short len);
 typedef void (* espconn_sent_callback)(void *arg);
+struct pbuf;
+/** A callback prototype that gets received tcp data as the pbuf chain, which
+    is freed when it returns */
+typedef void (* espconn_recv_pbuf_callback)(void *arg, struct pbuf *p);
 
 /** A espconn descriptor */
 struct espconn {
@@ -88,6 +92,8 @@ struct espconn {
     espconn_sent_callback sent_callback;
     uint8 link_cnt;
     void *reverse;
+    /** Takes the place of recv_callback for tcp, without the flat copy */
+    espconn_recv_pbuf_callback recv_pbuf_callback;
 };
 
 enum espconn_option{
@@ -95,9 +101,17 @@ enum espconn_option{
 	ESPCONN_REUSEADDR = 0x01,
 	ESPCONN_NODELAY = 0x02,
 	ESPCONN_COPY = 0x04,
+	ESPCONN_KEEPALIVE = 0x08,
+	ESPCONN_RSTCLOSE = 0x10,
 	ESPCONN_END
 };
 
+enum espconn_level{
+	ESPCONN_KEEPIDLE,
+	ESPCONN_KEEPINTVL,
+	ESPCONN_KEEPCNT
+};
+
 /******************************************************************************
  * FunctionName : espconn_connect
  * Description  : The function given as the connect
@@ -257,6 +271,19 @@ sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback
 
 sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb);
 
+/******************************************************************************
+ * FunctionName : espconn_regist_recvpbufcb
+ * Description  : used to specify the function that should be called with the
+ *                pbuf chain of data received on a tcp connection, instead of
+ *                the recv callback with a flat copy of it.
+ * Parameters   : espconn -- espconn to set the recv callback
+ *                recv_pbuf_cb -- function to call with the received pbuf chain,
+ *                NULL for the recv callback again
+ * Returns      : none
+*******************************************************************************/
+
+sint8 espconn_regist_recvpbufcb(struct espconn *espconn, espconn_recv_pbuf_callback recv_pbuf_cb);
+
 /******************************************************************************
  * FunctionName : espconn_regist_reconcb
  * Description  : used to specify the function that should be called when connection
@@ -290,14 +317,36 @@ uint32 espconn_port(void);
 
 /******************************************************************************
  * FunctionName : espconn_set_opt
- * Description  : access port value for client so that we don't end up bouncing
- *                all connections at the same time .
- * Parameters   : none
- * Returns      : access port value
+ * Description  : set options of a tcp connection, on top of those it has
+ * Parameters   : espconn -- the espconn used to set the options
+ * 				  opt -- the espconn_option flags to set
+ * Returns      : result
 *******************************************************************************/
 
 sint8 espconn_set_opt(struct espconn *espconn, uint8 opt);
 
+/******************************************************************************
+ * FunctionName : espconn_clear_opt
+ * Description  : clear options of a tcp connection
+ * Parameters   : espconn -- the espconn used to clear the options
+ * 				  opt -- the espconn_option flags to clear
+ * Returns      : result
+*******************************************************************************/
+
+sint8 espconn_clear_opt(struct espconn *espconn, uint8 opt);
+
+/******************************************************************************
+ * FunctionName : espconn_set_keepalive
+ * Description  : set the keepalive timing of a tcp connection
+ * Parameters   : espconn -- the espconn used to set the keepalive timing
+ * 				  level -- ESPCONN_KEEPIDLE and ESPCONN_KEEPINTVL in seconds,
+ * 				           ESPCONN_KEEPCNT the probes sent before giving up
+ * 				  optarg -- points to the uint32 value
+ * Returns      : result
+*******************************************************************************/
+
+sint8 espconn_set_keepalive(struct espconn *espconn, uint8 level, void *optarg);
+
 /******************************************************************************
  * TypedefName : dns_found_callback
  * Description : Callback which is invoked when a hostname is found.
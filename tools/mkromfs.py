@@ -0,0 +1,119 @@
+#!/usr/bin/env python
+#
+# mkromfs.py
+#
+# Packs the files of a directory into an indexed ROMFS/WOFS image, see the
+# format description in app/wofs/romfs.h. The name index lets the firmware
+# open a file with a binary search instead of walking all files before it.
+#
+# usage: mkromfs.py [--wofs] [--header romfiles.h] [-o image] dir
+#
+#   --wofs     WOFS layout (file deleted field, aligned files), for flashing
+#              at the first free block after the firmware
+#   --header   also write the image as a C array, the format of
+#              app/wofs/romfiles.h
+#   -o image   binary image to write
+#
+
+import argparse
+import os
+import struct
+import sys
+
+MAX_FNAME_LENGTH = 30
+ROMFS_ALIGN = 4
+WOFS_DEL_FIELD_SIZE = ROMFS_ALIGN
+INDEX_HDR = b'\x00IDX'
+
+
+def name_hash(name):
+    # 32 bit FNV-1a of the lower case name, as romfs_name_hash()
+    h = 2166136261
+    for c in name.lower().encode('ascii'):
+        h ^= c if isinstance(c, int) else ord(c)
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def align(n):
+    return (n + ROMFS_ALIGN - 1) & ~(ROMFS_ALIGN - 1)
+
+
+def file_record(addr, name, data, wofs):
+    rec = name.encode('ascii') + b'\x00'
+    rec += b'\x00' * (align(addr + len(rec)) - addr - len(rec))
+    if wofs:
+        rec += b'\xFF' * WOFS_DEL_FIELD_SIZE
+    rec += struct.pack('<I', len(data)) + data
+    if wofs:
+        # on WOFS every file name starts at a multiple of ROMFS_ALIGN
+        rec += b'\x00' * (align(addr + len(rec)) - addr - len(rec))
+    return rec
+
+
+def build(files, wofs):
+    count = len(files)
+    addr = 12 + 8 * count
+    body = b''
+    index = []
+    for name, data in files:
+        index.append((name_hash(name), addr))
+        rec = file_record(addr, name, data, wofs)
+        body += rec
+        addr += len(rec)
+    index.sort()
+    image = INDEX_HDR + struct.pack('<II', count, addr)
+    for h, a in index:
+        image += struct.pack('<II', h, a)
+    image += body
+    # end of the file system
+    image += b'\xFF'
+    return image
+
+
+def write_header(path, image):
+    out = open(path, 'w')
+    out.write('// Generated by mkromfs.py\n// DO NOT MODIFY\n\n')
+    out.write('#ifndef __ROMFILES_H__\n#define __ROMFILES_H__\n\n')
+    # in the memory mapped flash, so that file.map() can read it in place
+    out.write('const unsigned char romfiles_fs[] ICACHE_RODATA_ATTR __attribute__((aligned(4))) = \n{\n')
+    data = bytearray(image)
+    for i in range(0, len(data), 16):
+        line = ', '.join('0x%02X' % b for b in data[i:i + 16])
+        out.write('  ' + line + (',\n' if i + 16 < len(data) else '\n'))
+    out.write('};\n\n#endif\n')
+    out.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build an indexed ROMFS/WOFS image')
+    parser.add_argument('--wofs', action='store_true', help='WOFS layout')
+    parser.add_argument('--header', help='C header to write')
+    parser.add_argument('-o', dest='image', help='binary image to write')
+    parser.add_argument('dir', help='directory with the files')
+    args = parser.parse_args()
+    if not args.image and not args.header:
+        parser.error('nothing to write, give -o and/or --header')
+
+    files = []
+    # sorted, so that the same directory always gives the same image
+    for name in sorted(os.listdir(args.dir)):
+        path = os.path.join(args.dir, name)
+        if not os.path.isfile(path):
+            continue
+        if len(name) > MAX_FNAME_LENGTH:
+            sys.exit('%s: name too long, max %d characters' % (name, MAX_FNAME_LENGTH))
+        with open(path, 'rb') as f:
+            files.append((name, f.read()))
+
+    image = build(files, args.wofs)
+    if args.image:
+        with open(args.image, 'wb') as f:
+            f.write(image)
+    if args.header:
+        write_header(args.header, image)
+    print('%d files, image %d bytes' % (len(files), len(image)))
+
+
+if __name__ == '__main__':
+    main()
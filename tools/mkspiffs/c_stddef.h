@@ -0,0 +1,6 @@
+#ifndef _MKSPIFFS_C_STDDEF_H_
+#define _MKSPIFFS_C_STDDEF_H_
+
+#include <stddef.h>
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef _MKSPIFFS_C_STDIO_H_
+#define _MKSPIFFS_C_STDIO_H_
+
+#include <stdio.h>
+
+#define c_printf printf
+#define c_sprintf sprintf
+
+#endif
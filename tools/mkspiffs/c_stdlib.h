@@ -0,0 +1,10 @@
+#ifndef _MKSPIFFS_C_STDLIB_H_
+#define _MKSPIFFS_C_STDLIB_H_
+
+#include <stdlib.h>
+
+#define c_malloc malloc
+#define c_free free
+#define c_zalloc(n) calloc(1, (n))
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _MKSPIFFS_C_STRING_H_
+#define _MKSPIFFS_C_STRING_H_
+
+#include <string.h>
+
+#define c_memcmp memcmp
+#define c_memcpy memcpy
+#define c_memset memset
+#define c_strcmp strcmp
+#define c_strcpy strcpy
+#define c_strlen strlen
+#define c_strncmp strncmp
+#define c_strncpy strncpy
+#define c_strchr strchr
+#define c_strrchr strrchr
+
+#endif
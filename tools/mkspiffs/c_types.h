@@ -0,0 +1,14 @@
+/*
+ * Host replacements for the firmware libc headers, just enough to build
+ * the spiffs core on a pc.
+ */
+#ifndef _MKSPIFFS_C_TYPES_H_
+#define _MKSPIFFS_C_TYPES_H_
+
+#include <stdint.h>
+
+typedef int32_t sint32_t;
+typedef int16_t sint16_t;
+typedef int8_t sint8_t;
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ * mkspiffs.c
+ *
+ * Builds a spiffs image from the files in a directory, for flashing next to
+ * the firmware instead of uploading files one by one over the uart.
+ *
+ * The image is made with the same spiffs core and the same geometry the
+ * firmware mounts with (app/spiffs/spiffs.c), on an empty file system, so
+ * each file is written in one go and ends up in consecutive pages.
+ *
+ * usage: mkspiffs [-s size] [-p page] [-b block] [-c luac] [-z] [-v] -o image dir
+ *
+ *   -s size   file system size in bytes, the firmware uses all flash from
+ *             the first free 16kB aligned address after the firmware to the
+ *             system parameter area (default 512kB)
+ *   -p page   logical page size (default 256, as the firmware), the firmware
+ *             finds the page size of the image when mounting it
+ *   -b block  logical block and erase size (default 4096, as the firmware)
+ *   -c luac   compile .lua files with given cross compiler and store them
+ *             as .lc, init.lua is always kept as source
+ *   -z        store files compressed (app/spiffs/spiffs_lz.c), the firmware
+ *             reads them back uncompressed. Files that do not get smaller
+ *             are stored as they are
+ *   -v        list the files added
+ *
+ * Only regular files directly in dir are added, the file system is flat.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+
+#define DEFAULT_FS_SIZE     (512*1024)
+#define DEFAULT_PAGE_SIZE   256
+#define DEFAULT_BLOCK_SIZE  4096
+
+static u8_t *flash;
+static u32_t flash_size;
+static spiffs fs;
+// with -z files are compressed here first, behind the image in the emulated
+// flash, so that the image gets each file written once in the form it keeps
+static spiffs scratch;
+static int verbose = 0;
+static int compress = 0;
+static u8_t lz_work[SPIFFS_LZ_WRITE_WORK_SIZE];
+
+static s32_t flash_read(u32_t addr, u32_t size, u8_t *dst) {
+  if (addr + size > flash_size) return SPIFFS_ERR_INTERNAL;
+  memcpy(dst, &flash[addr], size);
+  return SPIFFS_OK;
+}
+
+static s32_t flash_write(u32_t addr, u32_t size, u8_t *src) {
+  u32_t i;
+  if (addr + size > flash_size) return SPIFFS_ERR_INTERNAL;
+  // nor flash can only clear bits
+  for (i = 0; i < size; i++) {
+    flash[addr + i] &= src[i];
+  }
+  return SPIFFS_OK;
+}
+
+static s32_t flash_erase(u32_t addr, u32_t size) {
+  if (addr + size > flash_size) return SPIFFS_ERR_INTERNAL;
+  memset(&flash[addr], 0xff, size);
+  return SPIFFS_OK;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+      "usage: mkspiffs [-s size] [-p page] [-b block] [-c luac] [-z] [-v] -o image dir\n");
+  exit(1);
+}
+
+static int name_cmp(const void *a, const void *b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static u8_t *load_file(const char *path, u32_t *len) {
+  FILE *f = fopen(path, "rb");
+  u8_t *buf;
+  long size;
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = malloc(size > 0 ? size : 1);
+  if (buf && fread(buf, 1, size, f) != (size_t)size) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  *len = size;
+  return buf;
+}
+
+// Runs the cross compiler on a lua source, returns the byte code
+static u8_t *compile_file(const char *luac, const char *path, u32_t *len) {
+  char out[] = "/tmp/mkspiffsXXXXXX";
+  char *argv[] = { (char *)luac, "-o", out, (char *)path, NULL };
+  u8_t *buf = NULL;
+  int status;
+  pid_t pid;
+  int fd = mkstemp(out);
+  if (fd < 0) return NULL;
+  close(fd);
+  // no shell, the names go to luac as they are
+  pid = fork();
+  if (pid == 0) {
+    execvp(luac, argv);
+    perror(luac);
+    _exit(127);
+  }
+  if (pid > 0 && waitpid(pid, &status, 0) == pid &&
+      WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+    buf = load_file(out, len);
+  }
+  unlink(out);
+  return buf;
+}
+
+// Mounts a file system on the emulated flash, with buffers of its own
+static s32_t mount_fs(spiffs *f, spiffs_config *cfg) {
+  u32_t cache_size = (cfg->log_page_size + 32) * 4;
+  u8_t *work = malloc(cfg->log_page_size * 2);
+  u8_t *fds = malloc(2 * sizeof(spiffs_fd));
+  u8_t *cache = malloc(cache_size);
+  if (!work || !fds || !cache) return SPIFFS_ERR_INTERNAL;
+  return SPIFFS_mount(f, cfg, work, fds, 2 * sizeof(spiffs_fd), cache, cache_size, 0);
+}
+
+// Compresses a file in the scratch file system, returns the compressed file
+// as it is stored, or NULL if it does not get smaller
+static u8_t *compress_file(const char *name, u8_t *data, u32_t len, u32_t *zlen) {
+  spiffs_file fd;
+  spiffs_lz lz;
+  spiffs_stat s;
+  u8_t *z = NULL;
+  fd = SPIFFS_open(&scratch, "z", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  if (fd < 0 || SPIFFS_lz_write_start(&scratch, &lz, fd, lz_work) < 0 ||
+      SPIFFS_lz_write(&lz, data, len) != (s32_t)len || SPIFFS_lz_close(&lz) < 0 ||
+      SPIFFS_fstat(&scratch, fd, &s) < 0) {
+    fprintf(stderr, "%s: cannot compress, error %i, stored as it is\n", name, SPIFFS_errno(&scratch));
+  } else if (s.size < len && (z = malloc(s.size)) != NULL) {
+    if (SPIFFS_lseek(&scratch, fd, 0, SPIFFS_SEEK_SET) < 0 ||
+        SPIFFS_read(&scratch, fd, z, s.size) != (s32_t)s.size) {
+      free(z);
+      z = NULL;
+    }
+    *zlen = s.size;
+  }
+  if (fd >= 0) {
+    SPIFFS_fremove(&scratch, fd);
+  }
+  return z;
+}
+
+static int add_file(const char *name, u8_t *data, u32_t len) {
+  spiffs_file fd;
+  u8_t *z = NULL;
+  u32_t zlen = 0;
+  if (strlen(name) >= SPIFFS_OBJ_NAME_LEN) {
+    fprintf(stderr, "%s: name too long, max %i characters\n", name, SPIFFS_OBJ_NAME_LEN - 1);
+    return -1;
+  }
+  fd = SPIFFS_open(&fs, (char *)name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  if (fd < 0) {
+    fprintf(stderr, "%s: cannot create, error %i\n", name, SPIFFS_errno(&fs));
+    return -1;
+  }
+  if (compress) {
+    z = compress_file(name, data, len, &zlen);
+  }
+  // one write per file, the data pages of a file are allocated in sequence
+  // and none are left deleted
+  if (z) {
+    if (SPIFFS_write(&fs, fd, z, zlen) != (s32_t)zlen) {
+      fprintf(stderr, "%s: cannot write, error %i\n", name, SPIFFS_errno(&fs));
+      SPIFFS_close(&fs, fd);
+      free(z);
+      return -1;
+    }
+    free(z);
+  } else if (len > 0 && SPIFFS_write(&fs, fd, data, len) != (s32_t)len) {
+    fprintf(stderr, "%s: cannot write, error %i\n", name, SPIFFS_errno(&fs));
+    SPIFFS_close(&fs, fd);
+    return -1;
+  } else {
+    zlen = len;
+  }
+  SPIFFS_close(&fs, fd);
+  if (verbose) {
+    printf("%-32s %8u %8u\n", name, len, zlen);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  u32_t fs_size = DEFAULT_FS_SIZE;
+  u32_t page_size = DEFAULT_PAGE_SIZE;
+  u32_t block_size = DEFAULT_BLOCK_SIZE;
+  const char *luac = NULL;
+  const char *image = NULL;
+  const char *dir;
+  char **names = NULL;
+  int count = 0;
+  int i, c;
+  int res = 0;
+
+  while ((c = getopt(argc, argv, "s:p:b:c:o:zv")) != -1) {
+    switch (c) {
+    case 's': fs_size = strtoul(optarg, NULL, 0); break;
+    case 'p': page_size = strtoul(optarg, NULL, 0); break;
+    case 'b': block_size = strtoul(optarg, NULL, 0); break;
+    case 'c': luac = optarg; break;
+    case 'o': image = optarg; break;
+    case 'z': compress = 1; break;
+    case 'v': verbose = 1; break;
+    default: usage();
+    }
+  }
+  if (!image || optind != argc - 1) usage();
+  dir = argv[optind];
+  if (page_size == 0 || block_size % page_size || fs_size % block_size ||
+      fs_size / block_size < 2) {
+    fprintf(stderr, "bad geometry\n");
+    return 1;
+  }
+
+  // emulated flash, file system at address 0 and the scratch one after it,
+  // erased
+  flash_size = compress ? fs_size * 2 : fs_size;
+  flash = malloc(flash_size);
+  memset(flash, 0xff, flash_size);
+
+  spiffs_config cfg;
+  cfg.phys_addr = 0;
+  cfg.phys_size = fs_size;
+  cfg.phys_erase_block = block_size;
+  cfg.log_block_size = block_size;
+  cfg.log_page_size = page_size;
+  cfg.hal_read_f = flash_read;
+  cfg.hal_write_f = flash_write;
+  cfg.hal_erase_f = flash_erase;
+
+  if (mount_fs(&fs, &cfg) < 0) {
+    fprintf(stderr, "mount failed, error %i\n", SPIFFS_errno(&fs));
+    return 1;
+  }
+  if (compress) {
+    cfg.phys_addr = fs_size;
+    if (mount_fs(&scratch, &cfg) < 0) {
+      fprintf(stderr, "mount failed, error %i\n", SPIFFS_errno(&scratch));
+      return 1;
+    }
+  }
+
+  // sorted, so that the same directory always gives the same image
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  if (!d) {
+    perror(dir);
+    return 1;
+  }
+  while ((e = readdir(d))) {
+    char path[1024];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) continue;
+    names = realloc(names, (count + 1) * sizeof(char *));
+    names[count++] = strdup(e->d_name);
+  }
+  closedir(d);
+  qsort(names, count, sizeof(char *), name_cmp);
+
+  for (i = 0; i < count && res == 0; i++) {
+    char path[1024];
+    char name[SPIFFS_OBJ_NAME_LEN + 8];
+    size_t nlen = strlen(names[i]);
+    u32_t len;
+    u8_t *data;
+    if (nlen >= sizeof(name)) {
+      fprintf(stderr, "%s: name too long, max %i characters\n", names[i], SPIFFS_OBJ_NAME_LEN - 1);
+      res = -1;
+      break;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+    strcpy(name, names[i]);
+    if (luac && nlen > 4 && strcmp(&names[i][nlen - 4], ".lua") == 0 &&
+        strcmp(names[i], "init.lua") != 0) {
+      data = compile_file(luac, path, &len);
+      if (!data) {
+        fprintf(stderr, "%s: compile failed\n", path);
+        res = -1;
+        break;
+      }
+      strcpy(&name[nlen - 4], ".lc");
+    } else {
+      data = load_file(path, &len);
+      if (!data) {
+        perror(path);
+        res = -1;
+        break;
+      }
+    }
+    res = add_file(name, data, len);
+    free(data);
+  }
+
+  u32_t total = 0, used = 0;
+  SPIFFS_info(&fs, &total, &used);
+  SPIFFS_unmount(&fs);
+  if (res < 0) {
+    return 1;
+  }
+
+  FILE *f = fopen(image, "wb");
+  // the image only, not the scratch file system behind it
+  if (!f || fwrite(flash, 1, fs_size, f) != fs_size) {
+    perror(image);
+    return 1;
+  }
+  fclose(f);
+  printf("%i files, %u of %u bytes used, image %u bytes\n", count, used, total, fs_size);
+  return 0;
+}